@@ -0,0 +1,25 @@
+# Writes OUTPUT, a C source defining kSystemBuildId as a hash of the contents of
+# SOURCES and of BINARY, which names the executable, its compiler, its
+# configuration and its flags. Saved states and boot caches hold the arena's
+# structs verbatim and function pointers that are moved by a single offset, so
+# they must only be loaded by the very executable that wrote them.
+# Usage: cmake -DOUTPUT=BuildId.c -DSOURCES="a.c;a.h;..." -DBINARY=... -P BuildId.cmake
+set(hashes "")
+foreach(source IN LISTS SOURCES)
+    file(SHA256 "${source}" hash)
+    string(APPEND hashes "${hash}")
+endforeach()
+string(APPEND hashes "${BINARY}")
+string(SHA256 id "${hashes}")
+string(SUBSTRING "${id}" 0 16 id)
+set(source "// Generated by BuildId.cmake from the emulator sources, do not edit.\n#include <stdint.h>\n\nconst uint64_t kSystemBuildId = 0x${id}ULL;\n")
+
+# The source is only rewritten when the ID changes, so that the executable is not
+# relinked for nothing.
+set(previous "")
+if(EXISTS "${OUTPUT}")
+    file(READ "${OUTPUT}" previous)
+endif()
+if(NOT previous STREQUAL source)
+    file(WRITE "${OUTPUT}" "${source}")
+endif()
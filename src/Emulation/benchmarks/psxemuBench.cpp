@@ -0,0 +1,373 @@
+// Microbenchmarks of the hot paths of the emulator, run by the psxemuBench
+// target. Every benchmark is timed over a fixed number of samples after a few
+// warm-up ones, and the time per item (instruction, read, tick, word, pixel)
+// is reported as JSON with its min, median and p99 over the samples. Inputs
+// come from fixed programs and a fixed seed, so runs are comparable.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+extern "C" {
+
+#include "../src/Gpu.h"
+#include "../src/Host.h"
+}
+#include "../tests/TestSystem.hpp"
+
+static const Address kBenchDmaGpuChannel = 0x20;
+static const uint32_t kBenchScreenWidth = 640;
+static const uint32_t kBenchScreenHeight = 480;
+
+// Results of reads go here, so that the reads are not optimized away.
+static volatile uint32_t benchSink;
+
+typedef struct __BenchOptions {
+  uint32_t samples;
+  uint32_t warmup;
+  const char *filter;
+} BenchOptions;
+
+// A sample runs the benchmarked code once and returns the number of items it
+// processed.
+typedef std::function<uint64_t()> BenchSample;
+
+typedef struct __BenchResult {
+  std::string name;
+  std::string unit;
+  std::vector<double> nanoseconds;
+} BenchResult;
+
+static std::vector<BenchResult> results;
+
+static bool BenchSelected(const BenchOptions &options, const char *name) {
+  return options.filter == NULL || strstr(name, options.filter) != NULL;
+}
+
+static void Bench(const BenchOptions &options, const char *name, const char *unit, BenchSample sample) {
+  if (!BenchSelected(options, name)) {
+    return;
+  }
+  uint32_t i;
+  for (i = 0; i < options.warmup; i++) {
+    sample();
+  }
+  BenchResult result = {name, unit, {}};
+  for (i = 0; i < options.samples; i++) {
+    uint64_t start = HostTicks();
+    uint64_t items = sample();
+    uint64_t ticks = HostTicks() - start;
+    double nanoseconds = (double)ticks * 1e9 / (double)HostTicksPerSecond();
+    result.nanoseconds.push_back(nanoseconds / (double)(items > 0 ? items : 1));
+  }
+  std::sort(result.nanoseconds.begin(), result.nanoseconds.end());
+  results.push_back(result);
+}
+
+// Nearest-rank percentile of sorted values.
+static double Percentile(const std::vector<double> &sorted, double percentile) {
+  size_t rank = (size_t)(percentile / 100.0 * sorted.size() + 0.999999);
+  return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+}
+
+static void PrintResults() {
+  printf("{\"benchmarks\":[\n");
+  size_t i;
+  for (i = 0; i < results.size(); i++) {
+    const BenchResult &result = results[i];
+    double median = Percentile(result.nanoseconds, 50);
+    printf("  {\"name\":\"%s\",\"unit\":\"ns/%s\",\"samples\":%zu,\"min\":%.4f,\"median\":%.4f,\"p99\":%.4f,"
+           "\"%ss_per_second\":%.0f}%s\n",
+           result.name.c_str(), result.unit.c_str(), result.nanoseconds.size(), result.nanoseconds.front(), median,
+           Percentile(result.nanoseconds, 99), result.unit.c_str(), median > 0 ? 1e9 / median : 0.0,
+           i + 1 < results.size() ? "," : "");
+  }
+  printf("]}\n");
+}
+
+// Each mix is an endless loop that counts its iterations in $30, so that the
+// instructions run in a sample follow from how far the counter moved.
+typedef struct __BenchInstructionMix {
+  const char *name;
+  std::vector<uint32_t> program;
+  uint32_t instructionsPerIteration;
+} BenchInstructionMix;
+
+static std::vector<BenchInstructionMix> BenchInstructionMixes() {
+  return {
+      {"alu",
+       {
+           0x241E0000, // addiu $30, $0, 0
+           0x24010001, // addiu $1, $0, 1
+           0x24020003, // addiu $2, $0, 3
+           0x00221821, // addu $3, $1, $2
+           0x00622023, // subu $4, $3, $2
+           0x00832824, // and $5, $4, $3
+           0x00A43025, // or $6, $5, $4
+           0x00C53826, // xor $7, $6, $5
+           0x00074080, // sll $8, $7, 2
+           0x00084842, // srl $9, $8, 1
+           0x0128502A, // slt $10, $9, $8
+           0x3C0B1234, // lui $11, 0x1234
+           0x356B5678, // ori $11, $11, 0x5678
+           0x01625821, // addu $11, $11, $2
+           0x1000FFF2, // beq $0, $0, -14
+           0x27DE0001, // addiu $30, $30, 1
+       },
+       15},
+      {"memory",
+       {
+           0x241E0000, // addiu $30, $0, 0
+           0x3C038000, // lui $3, 0x8000
+           0xAC7E0100, // sw $30, 0x100($3)
+           0x8C640100, // lw $4, 0x100($3)
+           0xA0640104, // sb $4, 0x104($3)
+           0x90650104, // lbu $5, 0x104($3)
+           0xA4650108, // sh $5, 0x108($3)
+           0x84660108, // lh $6, 0x108($3)
+           0x00C53021, // addu $6, $6, $5
+           0xAC66010C, // sw $6, 0x10C($3)
+           0x1000FFF7, // beq $0, $0, -9
+           0x27DE0001, // addiu $30, $30, 1
+       },
+       10},
+      {"branch",
+       {
+           0x241E0000, // addiu $30, $0, 0
+           0x24010004, // addiu $1, $0, 4
+           0x2421FFFF, // addiu $1, $1, -1
+           0x1420FFFE, // bne $1, $0, -2
+           0x00000000, // nop
+           0x27DE0001, // addiu $30, $30, 1
+           0x1000FFFB, // beq $0, $0, -5
+           0x24010004, // addiu $1, $0, 4
+       },
+       // Four times around the inner loop plus the three outer instructions.
+       15},
+  };
+}
+
+static void BenchCpu(const BenchOptions &options) {
+  const CpuExecutionMode modes[] = {CpuModeInterpreter, CpuModeCachedInterpreter, CpuModeRecompiler};
+  const char *const modeNames[] = {"interpreter", "cached-interpreter", "recompiler"};
+  const uint32_t cyclesPerSample = 1000000;
+  for (BenchInstructionMix &mix : BenchInstructionMixes()) {
+    size_t m;
+    for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+      std::string name = std::string("cpu/") + mix.name + "/" + modeNames[m];
+      if (!BenchSelected(options, name.c_str())) {
+        continue;
+      }
+      auto sys = TestSystemNew();
+      TestProgram program = {
+          .cyclesToRun = 0, .size = mix.program.size() * sizeof(uint32_t), .program = (uint8_t *)mix.program.data()};
+      LoadTestProgram(sys, program);
+      CpuSetExecutionMode(sys->cpu, modes[m]);
+      Cpu *cpu = sys->cpu;
+      uint32_t perIteration = mix.instructionsPerIteration;
+      Bench(options, name.c_str(), "instruction", [cpu, perIteration, cyclesPerSample]() {
+        uint32_t start = cpu->reg[30];
+        CpuRun(cpu, cyclesPerSample);
+        return (uint64_t)(cpu->reg[30] - start) * perIteration;
+      });
+    }
+  }
+}
+
+// Reads spread over RAM, the BIOS and the registers of two devices, in an
+// order fixed by the seed.
+static void BenchBus(const BenchOptions &options) {
+  auto sys = TestSystemNew();
+  std::vector<uint32_t> bios(0x1000);
+  TestProgram program = {.cyclesToRun = 0, .size = bios.size() * sizeof(uint32_t), .program = (uint8_t *)bios.data()};
+  LoadTestProgram(sys, program);
+  const Address bases[] = {0x80000000, 0xA0100000, 0xBFC00000, 0x1F801070, 0x1F8010F0};
+  const uint32_t ranges[] = {0x00100000, 0x00100000, 0x00004000, 0x8, 0x8};
+  std::vector<Address> addresses(4096);
+  uint32_t seed = 1;
+  for (Address &address : addresses) {
+    seed = seed * 1103515245 + 12345;
+    size_t region = (seed >> 16) % 5;
+    seed = seed * 1103515245 + 12345;
+    address = bases[region] + (((seed >> 8) % ranges[region]) & ~3u);
+  }
+  Bus *bus = sys->bus;
+  Bench(options, "bus/read32", "read", [bus, &addresses]() {
+    uint32_t sum = 0;
+    for (Address address : addresses) {
+      uint32_t value = 0;
+      uint32_t cycles = 0;
+      SystemException exception;
+      BusRead32(bus, address, &value, &exception, &cycles);
+      sum += value + cycles;
+    }
+    benchSink = sum;
+    return (uint64_t)addresses.size();
+  });
+}
+
+static void BenchClockUpdate(void *context, uint32_t cycles) { (*(uint64_t *)context) += cycles; }
+
+// Ticks a clock with sixteen devices in the small steps the CPU takes, so that
+// most ticks fire nothing and some fire several devices. The slice variant
+// also asks for the next update before every tick, like CpuRun does.
+static void BenchClock(const BenchOptions &options) {
+  auto sys = TestSystemNew();
+  Clock *clock = sys->clock;
+  static uint64_t counters[16];
+  uint32_t i;
+  for (i = 0; i < 16; i++) {
+    ClockDevice device = NewClockDevice(&counters[i], BenchClockUpdate, 33868800 / (1 + i % 4));
+    ClockDeviceHandle handle = ClockAddDevice(clock, &device);
+    ClockDeviceSetDefaultUpdateFrequency(handle, 100 + i * 397);
+  }
+  const uint32_t ticksPerSample = 100000;
+  Bench(options, "clock/tick", "tick", [clock, ticksPerSample]() {
+    uint32_t i;
+    for (i = 0; i < ticksPerSample; i++) {
+      ClockTick(clock, 1 + (i & 31));
+    }
+    return (uint64_t)ticksPerSample;
+  });
+  Bench(options, "clock/slice", "tick", [clock, ticksPerSample]() {
+    uint32_t i;
+    for (i = 0; i < ticksPerSample; i++) {
+      ClockTick(clock, ClockStartSlice(clock, 1 + (i & 31)));
+    }
+    return (uint64_t)ticksPerSample;
+  });
+}
+
+static void BenchDmaWrite32(void *context, Address ramAddress, uint32_t value) { (*(uint32_t *)context) += value; }
+
+static void BenchDmaWriteBlock(void *context, Address ramAddress, uint32_t step, const uint32_t *values, size_t count) {
+  size_t i;
+  for (i = 0; i < count; i++) {
+    (*(uint32_t *)context) += values[i];
+  }
+}
+
+static uint32_t BenchDmaRead32(void *context, Address ramAddress) { return ramAddress; }
+
+static bool BenchDmaIsReady(void *context) { return true; }
+
+// Moves RAM to a device that takes every word at once, through the GPU
+// channel, in blocks and as a linked list of 16-word nodes.
+static void BenchDma(const BenchOptions &options) {
+  auto sys = TestSystemNew();
+  Dma *dma = sys->dma;
+  Memory *memory = sys->memory;
+  static uint32_t sink;
+  DmaChannelPort *port = DmaGetChannel(dma, DmaChannelGpu);
+  DmaChannelSetHandlers(port, &sink, BenchDmaWrite32, BenchDmaRead32, BenchDmaIsReady);
+  DmaChannelSetBlockHandlers(port, BenchDmaWriteBlock, NULL);
+  DmaChannelSetClocksPerWord(port, 1);
+  const uint32_t blockWords = 16;
+  const uint32_t numBlocks = 4096;
+  Bench(options, "dma/block", "word", [dma, blockWords, numBlocks]() {
+    DmaWrite32(dma, UserSegment, kBenchDmaGpuChannel + 0, 0x00010000);
+    DmaWrite32(dma, UserSegment, kBenchDmaGpuChannel + 4, (numBlocks << 16) | blockWords);
+    DmaWrite32(dma, UserSegment, kBenchDmaGpuChannel + 8, 0x01000201);
+    while (DmaIsActive(dma)) {
+      DmaRun(dma);
+    }
+    return (uint64_t)blockWords * numBlocks;
+  });
+
+  const uint32_t numNodes = 4096;
+  const uint32_t nodeWords = 16;
+  const Address listStart = 0x00100000;
+  uint32_t i;
+  for (i = 0; i < numNodes; i++) {
+    Address node = listStart + i * (nodeWords + 1) * 4;
+    Address next = i + 1 < numNodes ? node + (nodeWords + 1) * 4 : 0x00FFFFFF;
+    MemoryWrite32(memory, UserSegment, node, (nodeWords << 24) | next);
+  }
+  Bench(options, "dma/linked-list", "word", [dma, listStart, numNodes, nodeWords]() {
+    DmaWrite32(dma, UserSegment, kBenchDmaGpuChannel + 0, listStart);
+    DmaWrite32(dma, UserSegment, kBenchDmaGpuChannel + 8, 0x01000401);
+    while (DmaIsActive(dma)) {
+      DmaRun(dma);
+    }
+    return (uint64_t)numNodes * nodeWords;
+  });
+}
+
+static void GpuRunCommands(Gpu *gpu, const uint32_t *packets, size_t count) {
+  size_t i;
+  for (i = 0; i < count; i++) {
+    GpuSendCommand(gpu, packets[i]);
+  }
+  GpuRun(gpu, 64);
+}
+
+// Fills Gouraud-shaded right triangles with 128 pixel legs, and converts the
+// 640x480 display area to host pixels.
+static void BenchGpu(const BenchOptions &options) {
+  auto sys = TestSystemNew();
+  Gpu *gpu = GpuNew((System *)sys.get(), sys->bus);
+  sys->gpu = gpu;
+  const uint32_t setup[] = {0xE1000200, 0xE3000000, 0xE407FFFF, 0xE5000000};
+  GpuRunCommands(gpu, setup, sizeof(setup) / sizeof(setup[0]));
+  GpuSendControl(gpu, 0x03000000);
+  const uint32_t legLength = 128;
+  const uint32_t trianglesPerSample = 64;
+  Bench(options, "gpu/shaded-triangle", "pixel", [gpu, legLength, trianglesPerSample]() {
+    uint32_t i;
+    for (i = 0; i < trianglesPerSample; i++) {
+      uint32_t x = (i % 8) * legLength;
+      uint32_t y = (i / 8 % 4) * legLength;
+      const uint32_t triangle[] = {
+          0x300000FF, (y << 16) | x, 0x0000FF00, (y << 16) | (x + legLength), 0x00FF0000,
+          ((y + legLength) << 16) | x,
+      };
+      GpuRunCommands(gpu, triangle, sizeof(triangle) / sizeof(triangle[0]));
+    }
+    return (uint64_t)trianglesPerSample * legLength * legLength / 2;
+  });
+
+  std::vector<uint32_t> pixels(kBenchScreenWidth * kBenchScreenHeight);
+  Bench(options, "gpu/blit", "pixel", [gpu, &pixels]() {
+    GpuUpdateScreen(gpu, NewGpuScreen(kBenchScreenWidth, kBenchScreenHeight, pixels.data()));
+    return (uint64_t)pixels.size();
+  });
+}
+
+static void PrintUsage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [--samples N] [--filter TEXT]\n"
+          "  --samples N    timed samples per benchmark (default 50)\n"
+          "  --filter TEXT  only run benchmarks whose name contains TEXT\n",
+          program);
+}
+
+int main(int argc, char *args[]) {
+  BenchOptions options = {.samples = 50, .warmup = 3, .filter = NULL};
+  int i;
+  for (i = 1; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if (strcmp(args[i], "--samples") == 0 && hasValue) {
+      char *end;
+      unsigned long samples = strtoul(args[++i], &end, 10);
+      if (*end != '\0' || samples == 0 || samples > 100000) {
+        PrintUsage(args[0]);
+        return 1;
+      }
+      options.samples = (uint32_t)samples;
+    } else if (strcmp(args[i], "--filter") == 0 && hasValue) {
+      options.filter = args[++i];
+    } else {
+      PrintUsage(args[0]);
+      return 1;
+    }
+  }
+  BenchCpu(options);
+  BenchBus(options);
+  BenchClock(options);
+  BenchDma(options);
+  BenchGpu(options);
+  PrintResults();
+  return 0;
+}
@@ -1,15 +1,23 @@
 #include "Bios.h"
 #include "Bus.h"
+#include "Host.h"
 #include "System.h"
+#include <PsxCoreFoundation/String.h>
 
 ASSUME_NONNULL_BEGIN
 
 static const size_t kBiosSize = 512 * 1024;
 static const size_t kBiosMask = 0x0007FFFF;
 
+// image is a read-only mapping of the BIOS file that every System using the
+// same file shares, so it is not part of the arena or of saved states. hash
+// tells apart state that was derived from the image, it is kept with the
+// mapping so that only the first System using a file reads all of it.
 struct __Bios {
   System *sys;
-  uint8_t bios[kBiosSize];
+  Bus *bus;
+  const uint8_t *image;
+  uint64_t hash;
 };
 
 static inline BusDevice BiosBusDevice(Bios *bios) {
@@ -20,36 +28,67 @@ static inline BusDevice BiosBusDevice(Bios *bios) {
                       .read8 = (Read8)BiosRead8,
                       .write32 = (Write32)BiosWrite32,
                       .write16 = (Write16)BiosWrite16,
-                      .write8 = (Write8)BiosWrite8};
+                      .write8 = (Write8)BiosWrite8,
+                      .host = (uint8_t *)bios->image,
+                      .hostMask = kBiosMask,
+                      .hostReadOnly = true};
   return device;
 }
 
+// Checks that the file at biosPath maps and is a whole BIOS, so that callers
+// which must not panic can reject a file before BiosNew would.
+PCFResult BiosCheck(PCFStringRef biosPath) {
+  size_t size = 0;
+  if (HostMapFile(PCFStringToCString(biosPath), &size) == NULL) {
+    return PCFResultError(PCFFORMAT("Unable to map the Bios %s!", biosPath));
+  }
+  if (size != kBiosSize) {
+    return PCFResultError(
+        PCFFORMAT("Bios size is incorrect! Bios is %d bytes. Expected %d", (int)size, (int)kBiosSize));
+  }
+  return PCFResultSuccess();
+}
+
 Bios *BiosNew(System *sys, Bus *bus, PCFStringRef biosPath) {
   Bios *bios = (Bios *)SystemArenaAllocate(sys, sizeof(Bios));
-  PCFDataRef biosData = PCFDataResultOrPanic(PCFDataNewFromFile(biosPath));
-  if (PCFDataCopyInto(biosData, bios->bios, kBiosSize) != kBiosSize) {
-    PCF_PANIC("Bios size is incorrect! Bios is %d bytes. Expected %d", PCFDataCapacity(biosData), kBiosSize);
-  }
-  PCFRelease(biosData);
+  PCFResultOrPanic(BiosCheck(biosPath));
+  size_t size = 0;
+  const uint8_t *image = HostMapFile(PCFStringToCString(biosPath), &size);
   bios->sys = sys;
+  bios->bus = bus;
+  bios->image = image;
+  bios->hash = HostMappedFileHash(image);
   BusDevice device = BiosBusDevice(bios);
   PCFResultOrPanic(BusRegisterDevice(bus, &device, NewAddressRange(0x1FC00000, 0x20000000, kMainSegments)));
   return bios;
 }
 
+// The image of the Bios a saved state replaces, which BiosRelocate maps back in.
+const uint8_t *BiosImage(Bios *bios) { return bios->image; }
+
+// Has to run after BusRelocate.
+void BiosRelocate(Bios *bios, const SystemRelocation *relocation, const uint8_t *image) {
+  bios->sys = (System *)RelocateArenaPointer(relocation, bios->sys);
+  bios->bus = (Bus *)RelocateArenaPointer(relocation, bios->bus);
+  bios->image = image;
+  BusSetHost(bios->bus, bios, (uint8_t *)image);
+}
+
+uint64_t BiosHash(Bios *bios) { return bios->hash; }
+
 uint32_t BiosRead32(Bios *bios, MemorySegment segment, Address address) {
   Address addr = (address & kBiosMask) >> 2;
-  return ((uint32_t *)bios->bios)[addr];
+  return ((const uint32_t *)bios->image)[addr];
 }
 
 uint16_t BiosRead16(Bios *bios, MemorySegment segment, Address address) {
   Address addr = (address & kBiosMask) >> 1;
-  return ((uint16_t *)bios->bios)[addr];
+  return ((const uint16_t *)bios->image)[addr];
 }
 
 uint8_t BiosRead8(Bios *bios, MemorySegment segment, Address address) {
   Address addr = (address & kBiosMask);
-  return bios->bios[addr];
+  return bios->image[addr];
 }
 
 void BiosWrite32(Bios *bios, MemorySegment segment, Address address, uint32_t data) {}
@@ -4,7 +4,11 @@
 
 ASSUME_NONNULL_BEGIN
 
+PCFResult BiosCheck(PCFStringRef biosPath);
 Bios *BiosNew(System *sys, Bus *bus, PCFStringRef biosPath);
+const uint8_t *BiosImage(Bios *bios);
+void BiosRelocate(Bios *bios, const SystemRelocation *relocation, const uint8_t *image);
+uint64_t BiosHash(Bios *bios);
 BUS_DEVICE_FUNCS(Bios)
 
 ASSUME_NONNULL_END
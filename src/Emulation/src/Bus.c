@@ -4,84 +4,168 @@
 #include <string.h>
 ASSUME_NONNULL_BEGIN
 
+#define kBusPhysicalSize 0x20000000
+#define kBusPageShift 12
+#define kBusNumPages (kBusPhysicalSize >> kBusPageShift)
+#define kBusPageShared 0xFF
+#define kBusFastNumPages (kBusPhysicalSize >> kBusFastPageShift)
+#define kBusPagesPerFastPage (1 << (kBusFastPageShift - kBusPageShift))
+
 typedef struct __BusDeviceEntry {
   BusDevice device;
   AddressRange addressRange;
-  struct __BusDeviceEntry *_Nullable left;
-  struct __BusDeviceEntry *_Nullable right;
+  Address size;
+#if SYSTEM_STATS
+  uint64_t reads;
+  uint64_t writes;
+  uint64_t cycles;
+#endif
 } BusDeviceEntry;
 
+// pages holds one entry per 4 KiB physical page: 0 when no device is mapped
+// there, the index + 1 of the only device overlapping it, or kBusPageShared
+// when several do (the I/O port page) and the sorted device list is searched.
+// fastPages is derived from it for the CPU, see _BusUpdateFastPages.
 struct __Bus {
   System *sys;
   uint8_t maxDevices;
   uint8_t numDevices;
+  uint8_t sorted[UINT8_MAX];
+  uint8_t pages[kBusNumPages];
+  BusFastPage fastPages[kBusFastNumPages];
   BusDeviceEntry devices[];
 };
 
-static BusDevice *_Nullable _FindDeviceHelper(BusDeviceEntry *_Nullable entry, Address addr, Address *deviceAddress) {
-  if (entry == NULL) {
-    return NULL;
-  }
-  if (InRange(&entry->addressRange, addr)) {
-    *deviceAddress = PHYSICAL(addr) - entry->addressRange.start;
-    return &entry->device;
+static inline bool _EntryContains(const BusDeviceEntry *entry, Address addr, Address *deviceAddress) {
+  Address offset = PHYSICAL(addr) - entry->addressRange.start;
+  if (offset >= entry->size || !MemorySegmentsContain(entry->addressRange.segments, SEGMENT(addr))) {
+    return false;
   }
+  *deviceAddress = offset;
+  return true;
+}
+
+// Ranges registered for different segments may overlap (the cache control port
+// sits inside the BIOS range in KSEG2), so after finding the last device that
+// starts at or before addr keep walking back until one actually contains it.
+static BusDeviceEntry *_Nullable _FindSharedPageDevice(Bus *bus, Address addr, Address *deviceAddress) {
   Address addrPhysical = PHYSICAL(addr);
-  if (addrPhysical < entry->addressRange.start) {
-    return _FindDeviceHelper(entry->left, addr, deviceAddress);
+  size_t low = 0;
+  size_t high = bus->numDevices;
+  while (low < high) {
+    size_t mid = (low + high) / 2;
+    if (bus->devices[bus->sorted[mid]].addressRange.start <= addrPhysical) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  while (low > 0) {
+    BusDeviceEntry *entry = &bus->devices[bus->sorted[--low]];
+    if (_EntryContains(entry, addr, deviceAddress)) {
+      return entry;
+    }
   }
-  return _FindDeviceHelper(entry->right, addr, deviceAddress);
+  return NULL;
 }
 
-inline BusDevice *_Nullable _FindDevice(Bus *bus, Address addr, Address *deviceAddress) {
-  assert(bus->numDevices != 0);
-  return _FindDeviceHelper(bus->devices, addr, deviceAddress);
+static inline void _CountAccesses(BusDeviceEntry *entry, bool write, uint64_t count) {
+  STATS_ADD(entry->reads, write ? 0 : count);
+  STATS_ADD(entry->writes, write ? count : 0);
+  STATS_ADD(entry->cycles, entry->device.cpuCycles * count);
 }
 
-static PCFResult _BusRegisterDeviceHelper(BusDeviceEntry *parent, BusDeviceEntry *target) {
-  int32_t result = RangeCompare(target->addressRange, parent->addressRange);
-  if (result == 0) {
-    return PCFResultError(PCFFORMAT("Duplicate Address Range attached to Bus: " ADDR_FORMAT " - " ADDR_FORMAT,
-                                    target->addressRange.start, target->addressRange.end));
-  }
-  if (result < 0) {
-    if (parent->left == NULL) {
-      parent->left = target;
-      return PCFResultSuccess();
-    }
-    return _BusRegisterDeviceHelper(parent->left, target);
+static inline void _CountAccess(BusDeviceEntry *entry, bool write) { _CountAccesses(entry, write, 1); }
+
+static inline BusDeviceEntry *_Nullable _FindDevice(Bus *bus, Address addr, Address *deviceAddress) {
+  uint8_t page = bus->pages[PHYSICAL(addr) >> kBusPageShift];
+  if (page == kBusPageShared) {
+    return _FindSharedPageDevice(bus, addr, deviceAddress);
   }
-  if (parent->right == NULL) {
-    parent->right = target;
-    return PCFResultSuccess();
+  if (page == 0) {
+    return NULL;
   }
-  return _BusRegisterDeviceHelper(parent->right, target);
+  BusDeviceEntry *entry = &bus->devices[page - 1];
+  return _EntryContains(entry, addr, deviceAddress) ? entry : NULL;
 }
 
 Bus *BusNew(System *sys, size_t maxDevices) {
   Bus *bus = (Bus *)SystemArenaAllocate(sys, maxDevices * sizeof(BusDeviceEntry) + sizeof(Bus));
   bus->maxDevices = maxDevices;
+  bus->numDevices = 0;
   bus->sys = sys;
+  memset(bus->pages, 0, sizeof(bus->pages));
+  memset(bus->fastPages, 0, sizeof(bus->fastPages));
   return bus;
 }
 
+// A fast page is one fully covered by a single memory-backed device that is
+// visible in all of USEG, KSEG0 and KSEG1, and whose mirrors (if any) repeat
+// on a multiple of the fast page size.
+static void _BusUpdateFastPages(Bus *bus, const BusDeviceEntry *entry) {
+  Address start = entry->addressRange.start;
+  size_t fastPage;
+  size_t lastFastPage = (start + entry->size - 1) >> kBusFastPageShift;
+  for (fastPage = start >> kBusFastPageShift; fastPage <= lastFastPage; fastPage++) {
+    BusFastPage *fast = &bus->fastPages[fastPage];
+    fast->host = NULL;
+    uint8_t page = bus->pages[fastPage * kBusPagesPerFastPage];
+    if (page == 0 || page == kBusPageShared) {
+      continue;
+    }
+    size_t i = 1;
+    while (i < kBusPagesPerFastPage && bus->pages[fastPage * kBusPagesPerFastPage + i] == page) {
+      i++;
+    }
+    const BusDeviceEntry *owner = &bus->devices[page - 1];
+    const BusDevice *device = &owner->device;
+    Address pageStart = (Address)fastPage << kBusFastPageShift;
+    Address offset = pageStart - owner->addressRange.start;
+    if (i != kBusPagesPerFastPage || device->host == NULL ||
+        (owner->addressRange.segments & kMainSegments) != kMainSegments ||
+        (device->hostMask & kBusFastPageMask) != kBusFastPageMask || pageStart < owner->addressRange.start ||
+        owner->size < kBusFastPageMask + 1 || offset > owner->size - (kBusFastPageMask + 1)) {
+      continue;
+    }
+    fast->host = device->host + (offset & device->hostMask);
+    fast->cycles = device->cpuCycles;
+    fast->readOnly = device->hostReadOnly;
+    fast->device = page - 1;
+  }
+}
+
 PCFResult BusRegisterDevice(Bus *bus, BusDevice *device, AddressRange addressRange) {
   if (bus->numDevices + 1 == bus->maxDevices) {
     return PCFResultError(PCFCSTR("Too many bus devices registered!"));
   }
-  size_t entryNum = bus->numDevices;
-  bus->devices[entryNum].device = *device;
-  bus->devices[entryNum].addressRange = addressRange;
-  bus->devices[entryNum].left = NULL;
-  bus->devices[entryNum].right = NULL;
-  PCFResult result = PCFResultSuccess();
-  if (entryNum != 0) {
-    result = _BusRegisterDeviceHelper(bus->devices, &bus->devices[entryNum]);
+  size_t i;
+  size_t position = bus->numDevices;
+  for (i = 0; i < bus->numDevices; i++) {
+    int32_t result = RangeCompare(addressRange, bus->devices[bus->sorted[i]].addressRange);
+    if (result == 0) {
+      return PCFResultError(PCFFORMAT("Duplicate Address Range attached to Bus: " ADDR_FORMAT " - " ADDR_FORMAT,
+                                      addressRange.start, addressRange.end));
+    }
+    if (result < 0 && position == bus->numDevices) {
+      position = i;
+    }
   }
-  if (result.successful) {
-    bus->numDevices++;
+  uint8_t entryNum = bus->numDevices;
+  BusDeviceEntry *entry = &bus->devices[entryNum];
+  entry->device = *device;
+  entry->addressRange = addressRange;
+  entry->size = (addressRange.end == 0 ? kBusPhysicalSize : addressRange.end) - addressRange.start;
+  memmove(&bus->sorted[position + 1], &bus->sorted[position], bus->numDevices - position);
+  bus->sorted[position] = entryNum;
+
+  size_t page;
+  size_t lastPage = (addressRange.start + entry->size - 1) >> kBusPageShift;
+  for (page = addressRange.start >> kBusPageShift; page <= lastPage; page++) {
+    bus->pages[page] = bus->pages[page] == 0 ? entryNum + 1 : kBusPageShared;
   }
-  return result;
+  _BusUpdateFastPages(bus, entry);
+  bus->numDevices++;
+  return PCFResultSuccess();
 }
 
 inline bool IsAddressMisaligned(uint32_t size, Address address) {
@@ -100,8 +184,8 @@ inline bool IsAddressMisaligned(uint32_t size, Address address) {
 
 bool BusRead32(Bus *bus, Address address, uint32_t *result, SystemException *exception, uint32_t *cycles) {
   Address offset;
-  BusDevice *_Nullable device = _FindDevice(bus, address, &offset);
-  if (device == NULL) {
+  BusDeviceEntry *_Nullable entry = _FindDevice(bus, address, &offset);
+  if (entry == NULL) {
     *exception = NewSystemException(kExceptionBusErrorFetch, address);
     return false;
   }
@@ -109,15 +193,21 @@ bool BusRead32(Bus *bus, Address address, uint32_t *result, SystemException *exc
     *exception = NewSystemException(kExceptionAddressErrorFetch, address);
     return false;
   }
-  *result = device->read32(device->context, MemorySegmentForAddress(address), offset);
+  BusDevice *device = &entry->device;
+  if (device->host != NULL) {
+    *result = *(uint32_t *)(device->host + (offset & device->hostMask));
+  } else {
+    *result = device->read32(device->context, SEGMENT(address), offset);
+  }
+  _CountAccess(entry, false);
   *cycles = device->cpuCycles;
   return true;
 }
 
 bool BusRead16(Bus *bus, Address address, uint16_t *result, SystemException *exception, uint32_t *cycles) {
   Address offset;
-  BusDevice *_Nullable device = _FindDevice(bus, address, &offset);
-  if (device == NULL) {
+  BusDeviceEntry *_Nullable entry = _FindDevice(bus, address, &offset);
+  if (entry == NULL) {
     *exception = NewSystemException(kExceptionBusErrorFetch, address);
     return false;
   }
@@ -125,15 +215,21 @@ bool BusRead16(Bus *bus, Address address, uint16_t *result, SystemException *exc
     *exception = NewSystemException(kExceptionAddressErrorFetch, address);
     return false;
   }
-  *result = device->read16(device->context, MemorySegmentForAddress(address), offset);
+  BusDevice *device = &entry->device;
+  if (device->host != NULL) {
+    *result = *(uint16_t *)(device->host + (offset & device->hostMask));
+  } else {
+    *result = device->read16(device->context, SEGMENT(address), offset);
+  }
+  _CountAccess(entry, false);
   *cycles = device->cpuCycles;
   return true;
 }
 
 bool BusRead8(Bus *bus, Address address, uint8_t *result, SystemException *exception, uint32_t *cycles) {
   Address offset;
-  BusDevice *_Nullable device = _FindDevice(bus, address, &offset);
-  if (device == NULL) {
+  BusDeviceEntry *_Nullable entry = _FindDevice(bus, address, &offset);
+  if (entry == NULL) {
     *exception = NewSystemException(kExceptionBusErrorFetch, address);
     return false;
   }
@@ -141,15 +237,27 @@ bool BusRead8(Bus *bus, Address address, uint8_t *result, SystemException *excep
     *exception = NewSystemException(kExceptionAddressErrorFetch, address);
     return false;
   }
-  *result = device->read8(device->context, MemorySegmentForAddress(address), offset);
+  BusDevice *device = &entry->device;
+  if (device->host != NULL) {
+    *result = *(uint8_t *)(device->host + (offset & device->hostMask));
+  } else {
+    *result = device->read8(device->context, SEGMENT(address), offset);
+  }
+  _CountAccess(entry, false);
   *cycles = device->cpuCycles;
   return true;
 }
 
+static inline void _HostWritten(const BusDevice *device, Address offset, size_t size) {
+  if (device->hostWritten != NULL) {
+    device->hostWritten(device->context, offset, size);
+  }
+}
+
 bool BusWrite32(Bus *bus, Address address, uint32_t value, SystemException *exception, uint32_t *cycles) {
   Address offset;
-  BusDevice *_Nullable device = _FindDevice(bus, address, &offset);
-  if (device == NULL) {
+  BusDeviceEntry *_Nullable entry = _FindDevice(bus, address, &offset);
+  if (entry == NULL) {
     *exception = NewSystemException(kExceptionBusErrorFetch, address);
     return false;
   }
@@ -157,15 +265,22 @@ bool BusWrite32(Bus *bus, Address address, uint32_t value, SystemException *exce
     *exception = NewSystemException(kExceptionAddressErrorFetch, address);
     return false;
   }
-  device->write32(device->context, MemorySegmentForAddress(address), offset, value);
+  BusDevice *device = &entry->device;
+  if (device->host != NULL && !device->hostReadOnly) {
+    *(uint32_t *)(device->host + (offset & device->hostMask)) = value;
+    _HostWritten(device, offset, sizeof(value));
+  } else {
+    device->write32(device->context, SEGMENT(address), offset, value);
+  }
+  _CountAccess(entry, true);
   *cycles = device->cpuCycles;
   return true;
 }
 
 bool BusWrite16(Bus *bus, Address address, uint16_t value, SystemException *exception, uint32_t *cycles) {
   Address offset;
-  BusDevice *_Nullable device = _FindDevice(bus, address, &offset);
-  if (device == NULL) {
+  BusDeviceEntry *_Nullable entry = _FindDevice(bus, address, &offset);
+  if (entry == NULL) {
     *exception = NewSystemException(kExceptionBusErrorFetch, address);
     return false;
   }
@@ -173,15 +288,22 @@ bool BusWrite16(Bus *bus, Address address, uint16_t value, SystemException *exce
     *exception = NewSystemException(kExceptionAddressErrorFetch, address);
     return false;
   }
-  device->write16(device->context, MemorySegmentForAddress(address), offset, value);
+  BusDevice *device = &entry->device;
+  if (device->host != NULL && !device->hostReadOnly) {
+    *(uint16_t *)(device->host + (offset & device->hostMask)) = value;
+    _HostWritten(device, offset, sizeof(value));
+  } else {
+    device->write16(device->context, SEGMENT(address), offset, value);
+  }
+  _CountAccess(entry, true);
   *cycles = device->cpuCycles;
   return true;
 }
 
 bool BusWrite8(Bus *bus, Address address, uint8_t value, SystemException *exception, uint32_t *cycles) {
   Address offset;
-  BusDevice *_Nullable device = _FindDevice(bus, address, &offset);
-  if (device == NULL) {
+  BusDeviceEntry *_Nullable entry = _FindDevice(bus, address, &offset);
+  if (entry == NULL) {
     *exception = NewSystemException(kExceptionBusErrorFetch, address);
     return false;
   }
@@ -189,30 +311,184 @@ bool BusWrite8(Bus *bus, Address address, uint8_t value, SystemException *except
     *exception = NewSystemException(kExceptionAddressErrorFetch, address);
     return false;
   }
+  BusDevice *device = &entry->device;
   if (address == 0x1F802041) {
     PCFDEBUG("PSX BIOS: TraceStep - %d", value);
   }
-  device->write8(device->context, MemorySegmentForAddress(address), offset, value);
+  if (device->host != NULL && !device->hostReadOnly) {
+    *(uint8_t *)(device->host + (offset & device->hostMask)) = value;
+    _HostWritten(device, offset, sizeof(value));
+  } else {
+    device->write8(device->context, SEGMENT(address), offset, value);
+  }
+  _CountAccess(entry, true);
   *cycles = device->cpuCycles;
   return true;
 }
 
+// Finds the device a block transfer starting at address goes to and how many
+// of its count words it takes before the device (or its host backing store,
+// for mirrored memory) ends.
+static BusDeviceEntry *_Nullable _FindBlockDevice(Bus *bus, Address address, size_t count, Address *offset,
+                                                  size_t *run, SystemException *exception) {
+  BusDeviceEntry *_Nullable entry = _FindDevice(bus, address, offset);
+  if (entry == NULL) {
+    *exception = NewSystemException(kExceptionBusErrorFetch, address);
+    return NULL;
+  }
+  if (IsAddressMisaligned(32, address)) {
+    *exception = NewSystemException(kExceptionAddressErrorFetch, address);
+    return NULL;
+  }
+  size_t words = (entry->size - *offset + 3) >> 2;
+  const BusDevice *device = &entry->device;
+  if (device->host != NULL) {
+    size_t hostWords = ((size_t)device->hostMask + 1 - (*offset & device->hostMask)) >> 2;
+    words = hostWords < words ? hostWords : words;
+  }
+  *run = count < words ? count : words;
+  return entry;
+}
+
+// Reads count consecutive words starting at address, looking the device up
+// once per device crossed instead of once per word. cycles is the sum over
+// all words. When an exception is raised the words before the faulting one
+// have been read.
+bool BusReadBlock(Bus *bus, Address address, uint32_t *values, size_t count, SystemException *exception,
+                  uint32_t *cycles) {
+  *cycles = 0;
+  while (count > 0) {
+    Address offset;
+    size_t run;
+    BusDeviceEntry *_Nullable entry = _FindBlockDevice(bus, address, count, &offset, &run, exception);
+    if (entry == NULL) {
+      return false;
+    }
+    BusDevice *device = &entry->device;
+    if (device->host != NULL) {
+      memcpy(values, device->host + (offset & device->hostMask), run * sizeof(uint32_t));
+    } else {
+      size_t i;
+      for (i = 0; i < run; i++) {
+        values[i] = device->read32(device->context, SEGMENT(address), offset + (Address)(i << 2));
+      }
+    }
+    _CountAccesses(entry, false, run);
+    *cycles += device->cpuCycles * run;
+    address += (Address)(run << 2);
+    values += run;
+    count -= run;
+  }
+  return true;
+}
+
+// The counterpart of BusReadBlock.
+bool BusWriteBlock(Bus *bus, Address address, const uint32_t *values, size_t count, SystemException *exception,
+                   uint32_t *cycles) {
+  *cycles = 0;
+  while (count > 0) {
+    Address offset;
+    size_t run;
+    BusDeviceEntry *_Nullable entry = _FindBlockDevice(bus, address, count, &offset, &run, exception);
+    if (entry == NULL) {
+      return false;
+    }
+    BusDevice *device = &entry->device;
+    if (device->host != NULL && !device->hostReadOnly) {
+      memcpy(device->host + (offset & device->hostMask), values, run * sizeof(uint32_t));
+      _HostWritten(device, offset, run * sizeof(uint32_t));
+    } else {
+      size_t i;
+      for (i = 0; i < run; i++) {
+        device->write32(device->context, SEGMENT(address), offset + (Address)(i << 2), values[i]);
+      }
+    }
+    _CountAccesses(entry, true, run);
+    *cycles += device->cpuCycles * run;
+    address += (Address)(run << 2);
+    values += run;
+    count -= run;
+  }
+  return true;
+}
+
+const BusFastPage *BusFastPages(Bus *bus) { return bus->fastPages; }
+
+#if SYSTEM_STATS
+void BusCountFastAccess(Bus *bus, const BusFastPage *page, bool write) {
+  _CountAccess(&bus->devices[page->device], write);
+}
+
+void BusGetStats(Bus *bus, SystemStats *stats) {
+  stats->numBusDevices = bus->numDevices < kStatsMaxBusDevices ? bus->numDevices : kStatsMaxBusDevices;
+  size_t i;
+  for (i = 0; i < stats->numBusDevices; i++) {
+    const BusDeviceEntry *entry = &bus->devices[i];
+    BusDeviceStats *device = &stats->busDevices[i];
+    device->addressRange = entry->addressRange;
+    device->reads = entry->reads;
+    device->writes = entry->writes;
+    device->cycles = entry->cycles;
+  }
+}
+#endif
+
+// Points the devices registered with context at a new backing store, for
+// devices whose store lives outside the arena.
+void BusSetHost(Bus *bus, const void *context, uint8_t *host) {
+  uint8_t i;
+  for (i = 0; i < bus->numDevices; i++) {
+    BusDeviceEntry *entry = &bus->devices[i];
+    if (entry->device.context == context) {
+      entry->device.host = host;
+      _BusUpdateFastPages(bus, entry);
+    }
+  }
+}
+
+// Host pointers are taken to point into the arena, devices backed by memory
+// outside of it call BusSetHost once the Bus is relocated.
+void BusRelocate(Bus *bus, const SystemRelocation *relocation) {
+  bus->sys = (System *)RelocateArenaPointer(relocation, bus->sys);
+  uint8_t i;
+  for (i = 0; i < bus->numDevices; i++) {
+    BusDevice *device = &bus->devices[i].device;
+    device->context = RelocateArenaPointer(relocation, device->context);
+    device->read32 = (Read32)RelocateImagePointer(relocation, (void *)device->read32);
+    device->read16 = (Read16)RelocateImagePointer(relocation, (void *)device->read16);
+    device->read8 = (Read8)RelocateImagePointer(relocation, (void *)device->read8);
+    device->write32 = (Write32)RelocateImagePointer(relocation, (void *)device->write32);
+    device->write16 = (Write16)RelocateImagePointer(relocation, (void *)device->write16);
+    device->write8 = (Write8)RelocateImagePointer(relocation, (void *)device->write8);
+    device->hostWritten = (HostWritten)RelocateImagePointer(relocation, (void *)device->hostWritten);
+    device->host = (uint8_t *)RelocateArenaPointer(relocation, device->host);
+  }
+  size_t fastPage;
+  for (fastPage = 0; fastPage < kBusFastNumPages; fastPage++) {
+    bus->fastPages[fastPage].host = (uint8_t *)RelocateArenaPointer(relocation, bus->fastPages[fastPage].host);
+  }
+}
+
 void BusDump(Bus *bus, Address start, Address end, PCFStringRef fileName) {
   FILE *file;
   errno_t error = fopen_s(&file, PCFStringToCString(fileName), "w");
   if (error != 0) {
     PCF_PANIC("%s", PCFStringToCString(PCFStringNewFromError(error)));
   }
-  Address current;
-
-  for (current = start; current < end; current += 4) {
+  Address current = start;
+  while (current < end) {
+    uint32_t words[256];
+    size_t count = ((size_t)(end - current) + 3) >> 2;
+    count = count < 256 ? count : 256;
     SystemException exception;
     uint32_t cycles = 0;
-    uint32_t instruction = 0;
-    if (!BusRead32(bus, current, &instruction, &exception, &cycles)) {
+    if (!BusReadBlock(bus, current, words, count, &exception, &cycles)) {
       PCF_PANIC("Exception dumping bus. Are addresses aligned?");
     }
-    fprintf(file, "%08x: %08x\n", current, instruction);
+    size_t i;
+    for (i = 0; i < count; i++, current += 4) {
+      fprintf(file, "%08x: %08x\n", current, words[i]);
+    }
   }
   fclose(file);
 }
@@ -1,4 +1,5 @@
 #pragma once
+#include "Stats.h"
 #include "Types.h"
 #include <PsxCoreFoundation/Data.h>
 #include <stdbool.h>
@@ -6,6 +7,27 @@
 
 ASSUME_NONNULL_BEGIN
 
+#define kBusFastPageShift 16
+#define kBusFastPageMask 0xFFFF
+
+// A 64 KiB page of plain memory mapped into USEG, KSEG0 and KSEG1 that the CPU
+// can access without going through the bus. host is NULL for every other page,
+// device is the index of the device that owns the page.
+struct __BusFastPage {
+  uint8_t *_Nullable host;
+  uint32_t cycles;
+  bool readOnly;
+  uint8_t device;
+};
+
+static inline const BusFastPage *_Nullable BusFastPageForAddress(const BusFastPage *pages, Address address) {
+  if (!MemorySegmentsContain(kMainSegments, SEGMENT(address))) {
+    return NULL;
+  }
+  const BusFastPage *page = &pages[PHYSICAL(address) >> kBusFastPageShift];
+  return page->host != NULL ? page : NULL;
+}
+
 Bus *BusNew(System *sys, size_t maxDevices);
 PCFResult BusRegisterDevice(Bus *bus, BusDevice *device, AddressRange addressRange);
 bool BusRead8(Bus *bus, Address address, uint8_t *result, SystemException *exception, uint32_t *cycles);
@@ -14,6 +36,15 @@ bool BusRead32(Bus *bus, Address address, uint32_t *result, SystemException *exc
 bool BusWrite8(Bus *bus, Address address, uint8_t value, SystemException *exception, uint32_t *cycles);
 bool BusWrite16(Bus *bus, Address address, uint16_t value, SystemException *exception, uint32_t *cycles);
 bool BusWrite32(Bus *bus, Address address, uint32_t value, SystemException *exception, uint32_t *cycles);
+bool BusReadBlock(Bus *bus, Address address, uint32_t *values, size_t count, SystemException *exception,
+                  uint32_t *cycles);
+bool BusWriteBlock(Bus *bus, Address address, const uint32_t *values, size_t count, SystemException *exception,
+                   uint32_t *cycles);
+const BusFastPage *BusFastPages(Bus *bus);
+void BusCountFastAccess(Bus *bus, const BusFastPage *page, bool write);
+void BusGetStats(Bus *bus, SystemStats *stats);
+void BusSetHost(Bus *bus, const void *context, uint8_t *host);
+void BusRelocate(Bus *bus, const SystemRelocation *relocation);
 void BusDump(Bus *bus, Address start, Address end, PCFStringRef fileName);
 
 ASSUME_NONNULL_END
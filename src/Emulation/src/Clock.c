@@ -1,209 +1,321 @@
 #include "Clock.h"
+#include "Host.h"
 #include "System.h"
-#include <SDL.h>
-#include <math.h>
+#include <string.h>
 
 ASSUME_NONNULL_BEGIN
 
-// Time in Nanos
-#define kMaxNumOfDevices 10
-#define kMasterClockTickFrequency (1000.0 / 33.868800)
-#define kDefaultUpdateFrequency (1000000000.0 / 60.0)
+#define kInitialDeviceCapacity 16
+#define kDefaultUpdateFrequency (kMasterClockRate / 60)
+#define kNotScheduled SIZE_MAX
 
+// Device cycles are derived from master ticks exactly: cycleRemainder holds
+// the fraction of a device cycle (in 1/kMasterClockRate units) that was not
+// handed to the device at its last update. heapIndex is the entry's slot in
+// the update heap, or kNotScheduled after ClockDeviceCancel.
 typedef struct __ClockDeviceEntry {
   ClockDevice device;
-  double nextUpdate;
-  double updateFrequency;
-  double lastUpdateTime;
+  uint64_t nextUpdate;
+  uint64_t updateFrequency;
+  uint64_t lastUpdateTime;
+  uint64_t cycleRemainder;
+  size_t heapIndex;
+#if SYSTEM_STATS
+  uint64_t updates;
+#endif
 } ClockDeviceEntry;
 
+// heap is a binary min-heap of device indices ordered by nextUpdate. Both it
+// and devices grow in the arena as devices are added; handles hold indices so
+// they stay valid. sliceCycles is how far the CPU may run before ClockTick has
+// to be called, see ClockStartSlice. Anything that moves an update earlier
+// zeroes it.
 struct __Clock {
+  System *sys;
   double realTimePerTick;
   uint64_t realLastSync;
-  double systemTime;
-  double lastSync;
+  uint64_t systemTime;
+  uint64_t lastSync;
+  uint32_t sliceCycles;
   size_t numOfDevices;
-  ClockDeviceEntry devices[kMaxNumOfDevices];
-  ClockDeviceEntry *_Nullable heap[kMaxNumOfDevices];
+  size_t heapSize;
+  size_t capacity;
+  ClockDeviceEntry *devices;
+  size_t *heap;
 };
 
 static inline ClockDeviceEntry *ClockDeviceHandleGetEntry(ClockDeviceHandle handle) {
+  if (handle.index >= handle.clock->numOfDevices) {
+    PCF_PANIC("Received an invalid ClockDeviceHandle! Index in Handle: %d. Devices attached to clock: %d",
+              handle.index, handle.clock->numOfDevices);
+  }
   return &handle.clock->devices[handle.index];
 }
 
-static void HeapSwap(ClockDeviceEntry **a, ClockDeviceEntry **b) {
-  ClockDeviceEntry *t;
-  t = *a;
-  *a = *b;
-  *b = t;
-}
-
-// function to get right child of a node of a tree
-static int HeapGetRightChild(Clock *clock, size_t index) {
-  index++;
-  if ((((2 * index) + 1) <= clock->numOfDevices))
-    return (2 * index);
-  return -1;
+static inline uint64_t HeapNextUpdate(Clock *clock, size_t position) {
+  return clock->devices[clock->heap[position]].nextUpdate;
 }
 
-// function to get left child of a node of a tree
-static int HeapGetLeftChild(Clock *clock, size_t index) {
-  index++;
-  if (((2 * index) <= clock->numOfDevices))
-    return 2 * index - 1;
-  return -1;
+static inline void HeapPlace(Clock *clock, size_t position, size_t device) {
+  clock->heap[position] = device;
+  clock->devices[device].heapIndex = position;
 }
 
-// function to get the parent of a node of a tree
-static int HeapGetParent(Clock *clock, size_t index) {
-  index++;
-  if ((index <= clock->numOfDevices)) {
-    return (index / 2) - 1;
+static void HeapSiftUp(Clock *clock, size_t position) {
+  size_t device = clock->heap[position];
+  uint64_t nextUpdate = clock->devices[device].nextUpdate;
+  while (position > 0) {
+    size_t parent = (position - 1) / 2;
+    if (HeapNextUpdate(clock, parent) <= nextUpdate) {
+      break;
+    }
+    HeapPlace(clock, position, clock->heap[parent]);
+    position = parent;
   }
-  return -1;
+  HeapPlace(clock, position, device);
 }
 
-static void HeapMinHeapify(Clock *clock, size_t index) {
-  ClockDeviceEntry **heap = clock->heap;
-  int left_child_index = HeapGetLeftChild(clock, index);
-  int right_child_index = HeapGetRightChild(clock, index);
-
-  // finding smallest among index, left child and right child
-  int smallest = index;
-
-  if ((left_child_index <= clock->numOfDevices) && (left_child_index > 0)) {
-    if (heap[left_child_index]->nextUpdate < heap[smallest]->nextUpdate) {
-      smallest = left_child_index;
+static void HeapSiftDown(Clock *clock, size_t position) {
+  size_t device = clock->heap[position];
+  uint64_t nextUpdate = clock->devices[device].nextUpdate;
+  while (2 * position + 1 < clock->heapSize) {
+    size_t child = 2 * position + 1;
+    if (child + 1 < clock->heapSize && HeapNextUpdate(clock, child + 1) < HeapNextUpdate(clock, child)) {
+      child++;
     }
-  }
-
-  if ((right_child_index <= clock->numOfDevices && (right_child_index > 0))) {
-    if (heap[right_child_index]->nextUpdate < heap[smallest]->nextUpdate) {
-      smallest = right_child_index;
+    if (HeapNextUpdate(clock, child) >= nextUpdate) {
+      break;
     }
+    HeapPlace(clock, position, clock->heap[child]);
+    position = child;
   }
+  HeapPlace(clock, position, device);
+}
 
-  // smallest is not the node, node is not a heap
-  if (smallest != index) {
-    HeapSwap(&heap[index], &heap[smallest]);
-    HeapMinHeapify(clock, smallest);
+static void HeapInsert(Clock *clock, size_t device) {
+  size_t position = clock->heapSize++;
+  HeapPlace(clock, position, device);
+  HeapSiftUp(clock, position);
+}
+
+static void HeapRemove(Clock *clock, ClockDeviceEntry *entry) {
+  size_t position = entry->heapIndex;
+  size_t last = clock->heap[--clock->heapSize];
+  entry->heapIndex = kNotScheduled;
+  if (position == clock->heapSize) {
+    return;
   }
+  HeapPlace(clock, position, last);
+  HeapSiftUp(clock, position);
+  HeapSiftDown(clock, clock->devices[last].heapIndex);
 }
 
-static ClockDeviceEntry *HeapMinimum(Clock *clock) { return clock->heap[0]; }
+static inline ClockDeviceEntry *_Nullable HeapMinimum(Clock *clock) {
+  return clock->heapSize > 0 ? &clock->devices[clock->heap[0]] : NULL;
+}
 
-static void HeapDecreaseNextUpdate(Clock *clock, size_t index) {
-  ClockDeviceEntry **heap = clock->heap;
-  while ((index > 0) && (heap[HeapGetParent(clock, index)]->nextUpdate > heap[index]->nextUpdate)) {
-    HeapSwap(&heap[index], &heap[HeapGetParent(clock, index)]);
-    index = HeapGetParent(clock, index);
+// Moves the entry's update to nextUpdate, putting it back in the heap if it
+// was cancelled.
+static void ScheduleEntry(Clock *clock, ClockDeviceEntry *entry, uint64_t nextUpdate) {
+  uint64_t previous = entry->nextUpdate;
+  entry->nextUpdate = nextUpdate;
+  if (entry->heapIndex == kNotScheduled) {
+    HeapInsert(clock, (size_t)(entry - clock->devices));
+    ClockEndSlice(clock);
+  } else if (nextUpdate < previous) {
+    HeapSiftUp(clock, entry->heapIndex);
+    ClockEndSlice(clock);
+  } else if (nextUpdate > previous) {
+    HeapSiftDown(clock, entry->heapIndex);
   }
 }
 
-static void HeapIncreaseNextUpdate(Clock *clock, size_t index) { HeapMinHeapify(clock, index); }
-
-static inline ClockDeviceEntry NewClockDeviceEntry(ClockDevice *device) {
-  ClockDeviceEntry entry = {
-      .device = *device, .nextUpdate = kDefaultUpdateFrequency, .updateFrequency = kDefaultUpdateFrequency};
+static inline ClockDeviceEntry NewClockDeviceEntry(ClockDevice *device, uint64_t systemTime) {
+  ClockDeviceEntry entry = {.device = *device,
+                            .nextUpdate = systemTime + kDefaultUpdateFrequency,
+                            .updateFrequency = kDefaultUpdateFrequency,
+                            .lastUpdateTime = systemTime,
+                            .cycleRemainder = 0,
+                            .heapIndex = kNotScheduled};
   return entry;
 }
 
+// Master ticks it takes the device to run at least the given number of cycles.
+static inline uint64_t DeviceCyclesToTicks(const ClockDeviceEntry *entry, uint32_t cycles) {
+  uint64_t rate = entry->device.clockRate;
+  return ((uint64_t)cycles * kMasterClockRate + rate - 1) / rate;
+}
+
 static inline ClockDeviceHandle NewClockDeviceHandle(Clock *clock, size_t index) {
   ClockDeviceHandle handle = {.clock = clock, .index = index};
   return handle;
 }
 
-static size_t FindHeapIndexForHandle(ClockDeviceHandle handle) {
-  Clock *clock = handle.clock;
-  ClockDeviceEntry **heap = clock->heap;
-  ClockDeviceEntry *target = ClockDeviceHandleGetEntry(handle);
-  size_t i;
-  for (i = 0; i < clock->numOfDevices; i++) {
-    if (heap[i] == target) {
-      return i;
-    }
+static void ClockReserveDevices(Clock *clock, size_t capacity) {
+  ClockDeviceEntry *devices = (ClockDeviceEntry *)SystemArenaAllocate(clock->sys, capacity * sizeof(*devices));
+  size_t *heap = (size_t *)SystemArenaAllocate(clock->sys, capacity * sizeof(*heap));
+  if (clock->numOfDevices > 0) {
+    memcpy(devices, clock->devices, clock->numOfDevices * sizeof(*devices));
+    memcpy(heap, clock->heap, clock->heapSize * sizeof(*heap));
   }
-  PCF_PANIC("Received an invalid ClockDeviceHandle! Index in Handle: %d. Devices attached to clock: %d", handle.index,
-            clock->numOfDevices);
-  return -1;
+  clock->devices = devices;
+  clock->heap = heap;
+  clock->capacity = capacity;
 }
 
 Clock *ClockNew(System *sys) {
   Clock *clock = (Clock *)SystemArenaAllocate(sys, sizeof(*clock));
+  clock->sys = sys;
   clock->numOfDevices = 0;
-  clock->systemTime = 0.0;
-  clock->lastSync = 0.0;
+  clock->heapSize = 0;
+  clock->systemTime = 0;
+  clock->lastSync = 0;
+  clock->sliceCycles = 0;
+  ClockReserveDevices(clock, kInitialDeviceCapacity);
   return clock;
 }
 
+// Starts pacing over from the current system time, as if a sync just
+// happened.
 void ClockResetRealtime(Clock *clock) {
-  clock->realTimePerTick = 1000000000.0 / (double)SDL_GetPerformanceFrequency();
-  clock->realLastSync = SDL_GetPerformanceCounter();
+  clock->realTimePerTick = 1000000000.0 / (double)HostTicksPerSecond();
+  clock->realLastSync = HostTicks();
+  clock->lastSync = clock->systemTime;
+}
+
+ClockRealtime ClockGetRealtime(Clock *clock) {
+  ClockRealtime realtime = {.realTimePerTick = clock->realTimePerTick, .realLastSync = clock->realLastSync};
+  return realtime;
+}
+
+void ClockSetRealtime(Clock *clock, ClockRealtime realtime) {
+  clock->realTimePerTick = realtime.realTimePerTick;
+  clock->realLastSync = realtime.realLastSync;
+}
+
+void ClockRelocate(Clock *clock, const SystemRelocation *relocation) {
+  clock->sys = (System *)RelocateArenaPointer(relocation, clock->sys);
+  clock->devices = (ClockDeviceEntry *)RelocateArenaPointer(relocation, clock->devices);
+  clock->heap = (size_t *)RelocateArenaPointer(relocation, clock->heap);
+  size_t i;
+  for (i = 0; i < clock->numOfDevices; i++) {
+    ClockDevice *device = &clock->devices[i].device;
+    device->context = RelocateArenaPointer(relocation, device->context);
+    device->update = (UpdateHandler)RelocateImagePointer(relocation, (void *)device->update);
+  }
 }
 
 ClockDeviceHandle ClockAddDevice(Clock *clock, ClockDevice *device) {
-  if (clock->numOfDevices == kMaxNumOfDevices) {
-    PCF_PANIC("Too many devices registered with clock!");
+  if (clock->numOfDevices == clock->capacity) {
+    ClockReserveDevices(clock, clock->capacity * 2);
   }
   size_t index = clock->numOfDevices;
   clock->numOfDevices++;
-  clock->devices[index] = NewClockDeviceEntry(device);
-  clock->heap[index] = &clock->devices[index];
+  clock->devices[index] = NewClockDeviceEntry(device, clock->systemTime);
+  HeapInsert(clock, index);
+  ClockEndSlice(clock);
   return NewClockDeviceHandle(clock, index);
 }
 
+// Sets the period of the device's regular updates, starting from now if that
+// is earlier than its pending update.
 void ClockDeviceSetDefaultUpdateFrequency(ClockDeviceHandle handle, uint32_t cycles) {
   ClockDeviceEntry *entry = ClockDeviceHandleGetEntry(handle);
-  double newUpdateFrequency = entry->device.nanoSecsPerCycle * cycles;
-  double systemTime = handle.clock->systemTime;
+  uint64_t newUpdateFrequency = DeviceCyclesToTicks(entry, cycles);
+  uint64_t systemTime = handle.clock->systemTime;
   entry->updateFrequency = newUpdateFrequency;
-  if (entry->nextUpdate > (systemTime + newUpdateFrequency)) {
-    entry->nextUpdate = (systemTime + newUpdateFrequency);
-    HeapDecreaseNextUpdate(handle.clock, FindHeapIndexForHandle(handle));
+  if (entry->heapIndex == kNotScheduled || entry->nextUpdate > (systemTime + newUpdateFrequency)) {
+    ScheduleEntry(handle.clock, entry, systemTime + newUpdateFrequency);
   }
 }
 
+// Makes sure the device is updated within the given number of its cycles.
 void ClockDeviceRequestUpdate(ClockDeviceHandle handle, uint32_t cycles) {
   ClockDeviceEntry *entry = ClockDeviceHandleGetEntry(handle);
-  double nextUpdate = entry->device.nanoSecsPerCycle * cycles;
-  if (entry->nextUpdate > nextUpdate) {
-    entry->nextUpdate = nextUpdate;
-    HeapDecreaseNextUpdate(handle.clock, FindHeapIndexForHandle(handle));
+  uint64_t nextUpdate = handle.clock->systemTime + DeviceCyclesToTicks(entry, cycles);
+  if (entry->heapIndex == kNotScheduled || entry->nextUpdate > nextUpdate) {
+    ScheduleEntry(handle.clock, entry, nextUpdate);
+  }
+}
+
+// Moves the pending update to the given number of device cycles from now,
+// whether that is earlier or later than it was.
+void ClockDeviceReschedule(ClockDeviceHandle handle, uint32_t cycles) {
+  ClockDeviceEntry *entry = ClockDeviceHandleGetEntry(handle);
+  ScheduleEntry(handle.clock, entry, handle.clock->systemTime + DeviceCyclesToTicks(entry, cycles));
+}
+
+// Drops the pending update. The device is not updated again until it asks
+// for an update or reschedules.
+void ClockDeviceCancel(ClockDeviceHandle handle) {
+  ClockDeviceEntry *entry = ClockDeviceHandleGetEntry(handle);
+  if (entry->heapIndex != kNotScheduled) {
+    HeapRemove(handle.clock, entry);
   }
 }
 
-static void UpdateDeviceEntry(ClockDeviceEntry *entry, double systemTime) {
-  uint32_t cycles = (systemTime - entry->lastUpdateTime) / entry->device.nanoSecsPerCycle;
+static void UpdateDeviceEntry(ClockDeviceEntry *entry, uint64_t systemTime) {
+  uint64_t scaled = (systemTime - entry->lastUpdateTime) * entry->device.clockRate + entry->cycleRemainder;
   entry->lastUpdateTime = systemTime;
-  entry->device.update(entry->device.context, cycles);
+  entry->cycleRemainder = scaled % kMasterClockRate;
+  STATS_ADD(entry->updates, 1);
+  entry->device.update(entry->device.context, (uint32_t)(scaled / kMasterClockRate));
 }
 
 void ClockTick(Clock *clock, uint32_t cycles) {
-  double timeTick = cycles * kMasterClockTickFrequency;
-  double systemTime = clock->systemTime + timeTick;
+  uint64_t systemTime = clock->systemTime + cycles;
   clock->systemTime = systemTime;
-  if (clock->numOfDevices > 0) {
-    ClockDeviceEntry *entry = HeapMinimum(clock);
-    while (entry->nextUpdate < systemTime) {
-      UpdateDeviceEntry(entry, systemTime);
-      entry->nextUpdate = systemTime + entry->updateFrequency;
-      HeapIncreaseNextUpdate(clock, 0);
-      entry = HeapMinimum(clock);
+  ClockDeviceEntry *_Nullable entry = HeapMinimum(clock);
+  while (entry != NULL && entry->nextUpdate <= systemTime) {
+    // The update handler may reschedule or cancel its own entry, in which case
+    // that wins over the default period.
+    entry->nextUpdate = systemTime + entry->updateFrequency;
+    HeapSiftDown(clock, 0);
+    UpdateDeviceEntry(entry, systemTime);
+    entry = HeapMinimum(clock);
+  }
+}
+
+uint32_t ClockStartSlice(Clock *clock, uint32_t maxCycles) {
+  uint32_t cycles = maxCycles;
+  ClockDeviceEntry *_Nullable entry = HeapMinimum(clock);
+  if (entry != NULL) {
+    uint64_t cyclesToUpdate = entry->nextUpdate > clock->systemTime ? entry->nextUpdate - clock->systemTime : 1;
+    if (cyclesToUpdate < cycles) {
+      cycles = (uint32_t)cyclesToUpdate;
     }
   }
+  clock->sliceCycles = cycles;
+  return cycles;
 }
 
+const uint32_t *ClockSliceCycles(Clock *clock) { return &clock->sliceCycles; }
+
+void ClockEndSlice(Clock *clock) { clock->sliceCycles = 0; }
+
+// Device cycles left until the device's next update.
 uint32_t ClockDeviceCyclesToNextUpdate(ClockDeviceHandle handle) {
   ClockDeviceEntry *entry = ClockDeviceHandleGetEntry(handle);
-  return (uint32_t)ceil(entry->nextUpdate / entry->device.nanoSecsPerCycle);
+  uint64_t systemTime = handle.clock->systemTime;
+  if (entry->heapIndex == kNotScheduled) {
+    return UINT32_MAX;
+  }
+  if (entry->nextUpdate <= systemTime) {
+    return 0;
+  }
+  uint64_t ticks = entry->nextUpdate - systemTime;
+  if (ticks > UINT32_MAX) {
+    return UINT32_MAX;
+  }
+  return (uint32_t)((ticks * entry->device.clockRate + kMasterClockRate - 1) / kMasterClockRate);
 }
 
 void ClockSyncToRealtime(Clock *clock) {
-  double systemTime = clock->systemTime - clock->lastSync;
-  double realTime = (SDL_GetPerformanceCounter() - clock->realLastSync) * clock->realTimePerTick;
+  double systemTime = (double)(clock->systemTime - clock->lastSync) * (1000000000.0 / kMasterClockRate);
+  double realTime = (HostTicks() - clock->realLastSync) * clock->realTimePerTick;
   int32_t delayAmount = (systemTime - realTime) / 1000000.0;
   if (delayAmount > 0) {
-    SDL_Delay(delayAmount);
+    HostSleep(delayAmount);
   }
   // Uncomment this to provide a rough indicator of the
   // performance of the emulator. As long as delayAmount
@@ -211,11 +323,20 @@ void ClockSyncToRealtime(Clock *clock) {
   // Playstation in realtime.
   // printf("Delay = %d\n", delayAmount);
   clock->lastSync = clock->systemTime;
-  clock->realLastSync = SDL_GetPerformanceCounter();
+  clock->realLastSync = HostTicks();
 }
 
-double ClockSystemTime(Clock *clock) { return clock->systemTime; }
+#if SYSTEM_STATS
+void ClockGetStats(Clock *clock, SystemStats *stats) {
+  stats->numClockDevices = clock->numOfDevices < kStatsMaxClockDevices ? clock->numOfDevices : kStatsMaxClockDevices;
+  size_t i;
+  for (i = 0; i < stats->numClockDevices; i++) {
+    stats->clockDevices[i].clockRate = clock->devices[i].device.clockRate;
+    stats->clockDevices[i].updates = clock->devices[i].updates;
+  }
+}
+#endif
 
-double ClockCyclesOfMasterClock(uint32_t cycles) { return cycles * kMasterClockTickFrequency; }
+uint64_t ClockSystemTime(Clock *clock) { return clock->systemTime; }
 
 ASSUME_NONNULL_END
@@ -1,16 +1,28 @@
+#include "Stats.h"
 #include "Types.h"
 
 ASSUME_NONNULL_BEGIN
 
+// System time is counted in master clock ticks, which are also CPU cycles.
+#define kMasterClockRate 33868800
+
 Clock *ClockNew(System *sys);
 ClockDeviceHandle ClockAddDevice(Clock *clock, ClockDevice *device);
 void ClockDeviceSetDefaultUpdateFrequency(ClockDeviceHandle handle, uint32_t cycles);
 void ClockDeviceRequestUpdate(ClockDeviceHandle handle, uint32_t cycles);
+void ClockDeviceReschedule(ClockDeviceHandle handle, uint32_t cycles);
+void ClockDeviceCancel(ClockDeviceHandle handle);
 uint32_t ClockDeviceCyclesToNextUpdate(ClockDeviceHandle handle);
 void ClockResetRealtime(Clock *clock);
+ClockRealtime ClockGetRealtime(Clock *clock);
+void ClockSetRealtime(Clock *clock, ClockRealtime realtime);
+void ClockRelocate(Clock *clock, const SystemRelocation *relocation);
 void ClockTick(Clock *clock, uint32_t cycles);
+uint32_t ClockStartSlice(Clock *clock, uint32_t maxCycles);
+const uint32_t *ClockSliceCycles(Clock *clock);
+void ClockEndSlice(Clock *clock);
 void ClockSyncToRealtime(Clock *clock);
-double ClockSystemTime(Clock *clock);
-double ClockCyclesOfMasterClock(uint32_t cycles);
+uint64_t ClockSystemTime(Clock *clock);
+void ClockGetStats(Clock *clock, SystemStats *stats);
 
 ASSUME_NONNULL_END
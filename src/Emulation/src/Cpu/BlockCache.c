@@ -0,0 +1,139 @@
+#include "BlockCache.h"
+#include "../Memory.h"
+#include "../System.h"
+#include <string.h>
+
+ASSUME_NONNULL_BEGIN
+
+#define kBlockCacheTableSize 4096
+#define kBlockCacheMaxBlocks 4096
+#define kBlockCacheMaxOps (kBlockCacheMaxBlocks * 16)
+#define kBlockCacheRamMirrorEnd 0x00800000
+#define kBlockCacheRamMask 0x001FFFFF
+// The code pages of RAM, see kMemoryCodePageShift.
+#define kBlockCacheNumPages 512
+
+// The pages of RAM that blocks were decoded from are marked as code in memory,
+// which reports writes to them through BlockCacheCodeWritten. pageBlocks heads
+// a list per page of the blocks that start or end on it, linked through
+// nextOnPage. Entries are 1 + twice the block's index, plus 1 for the page it
+// ends on, so 0 ends a list. Blocks only leave a list when its page is written.
+struct __BlockCache {
+  bool flushPending;
+  uint32_t generation;
+  size_t numBlocks;
+  size_t numOps;
+  Memory *_Nullable memory;
+  CpuBlock *_Nullable table[kBlockCacheTableSize];
+  uint16_t pageBlocks[kBlockCacheNumPages];
+  uint16_t nextOnPage[kBlockCacheMaxBlocks * 2];
+  CpuBlock blocks[kBlockCacheMaxBlocks];
+  CpuDecodedOp ops[kBlockCacheMaxOps];
+};
+
+static inline size_t TableIndex(Address address) { return (address >> 2) & (kBlockCacheTableSize - 1); }
+
+static inline bool IsRamAddress(Address address) { return PHYSICAL(address) < kBlockCacheRamMirrorEnd; }
+
+static inline size_t RamPage(Address address) { return (PHYSICAL(address) & kBlockCacheRamMask) >> kMemoryCodePageShift; }
+
+static void BlockCacheFlush(BlockCache *cache) {
+  memset(cache->table, 0, sizeof(cache->table));
+  memset(cache->pageBlocks, 0, sizeof(cache->pageBlocks));
+  if (cache->memory != NULL) {
+    MemoryClearCode(cache->memory);
+  }
+  cache->numBlocks = 0;
+  cache->numOps = 0;
+  cache->flushPending = false;
+  cache->generation++;
+}
+
+BlockCache *BlockCacheNew(System *sys) {
+  BlockCache *cache = (BlockCache *)SystemArenaAllocateTransient(sys, sizeof(BlockCache));
+  cache->generation = 0;
+  cache->memory = NULL;
+  BlockCacheFlush(cache);
+  return cache;
+}
+
+// memory is the main RAM, the one whose code pages are tracked. Whoever sets
+// it also has to hand BlockCacheCodeWritten to MemorySetCodeWriteHandler.
+void BlockCacheSetMemory(BlockCache *cache, Memory *memory) { cache->memory = memory; }
+
+CpuBlock *_Nullable BlockCacheLookup(BlockCache *cache, Address address) {
+  if (cache->flushPending) {
+    BlockCacheFlush(cache);
+    return NULL;
+  }
+  CpuBlock *_Nullable block = cache->table[TableIndex(address)];
+  if (block != NULL && block->start == address) {
+    return block;
+  }
+  return NULL;
+}
+
+CpuBlock *BlockCacheBeginBlock(BlockCache *cache, Address address) {
+  if (cache->flushPending || cache->numBlocks == kBlockCacheMaxBlocks ||
+      cache->numOps + kBlockCacheMaxOpsPerBlock > kBlockCacheMaxOps) {
+    BlockCacheFlush(cache);
+  }
+  CpuBlock *block = &cache->blocks[cache->numBlocks];
+  block->start = address;
+  block->numOps = 0;
+  block->ops = &cache->ops[cache->numOps];
+  block->hits = 0;
+  block->code = NULL;
+  block->idleLoop = false;
+  block->idleWrites = 0;
+  return block;
+}
+
+static void BlockCacheAddToPage(BlockCache *cache, size_t page, size_t entry) {
+  cache->nextOnPage[entry - 1] = cache->pageBlocks[page];
+  cache->pageBlocks[page] = (uint16_t)entry;
+}
+
+void BlockCacheCommitBlock(BlockCache *cache, CpuBlock *block) {
+  cache->numBlocks++;
+  cache->numOps += block->numOps;
+  cache->table[TableIndex(block->start)] = block;
+  if (IsRamAddress(block->start)) {
+    size_t entry = 1 + ((size_t)(block - cache->blocks) << 1);
+    size_t firstPage = RamPage(block->start);
+    size_t lastPage = RamPage(block->start + ((block->numOps - 1) << 2));
+    BlockCacheAddToPage(cache, firstPage, entry);
+    if (lastPage != firstPage) {
+      BlockCacheAddToPage(cache, lastPage, entry + 1);
+    }
+  }
+  if (cache->memory != NULL) {
+    MemoryMarkCode(cache->memory, block->start);
+    MemoryMarkCode(cache->memory, block->start + ((block->numOps - 1) << 2));
+  }
+}
+
+// Drops the blocks that start or end on the code page at the RAM offset page,
+// which the main RAM no longer has marked. Blocks on its list that the table
+// has already replaced stay where they are.
+void BlockCacheCodeWritten(BlockCache *cache, Address page) {
+  size_t ramPage = RamPage(page);
+  size_t entry = cache->pageBlocks[ramPage];
+  cache->pageBlocks[ramPage] = 0;
+  while (entry != 0) {
+    CpuBlock *block = &cache->blocks[(entry - 1) >> 1];
+    size_t index = TableIndex(block->start);
+    if (cache->table[index] == block) {
+      cache->table[index] = NULL;
+    }
+    entry = cache->nextOnPage[entry - 1];
+  }
+}
+
+void BlockCacheRequestFlush(BlockCache *cache) { cache->flushPending = true; }
+
+// Incremented on every flush, anything holding on to blocks (or code generated
+// for them) from an older generation must drop it.
+uint32_t BlockCacheGeneration(BlockCache *cache) { return cache->generation; }
+
+ASSUME_NONNULL_END
@@ -0,0 +1,57 @@
+#pragma once
+#include "../Types.h"
+#include "Types.h"
+
+ASSUME_NONNULL_BEGIN
+
+#define kBlockCacheMaxOpsPerBlock 32
+
+// A guest instruction decoded once into the handler that will execute it. The
+// handler is the leaf handler (R-type functs are resolved through
+// kRegisterFunctTable at decode time), and cycles includes the fetch cost.
+typedef struct __CpuDecodedOp {
+  OpcodeHandler handler;
+  Instruction instruction;
+  uint32_t cycles;
+} CpuDecodedOp;
+
+// code is the native translation of the block once it has run often enough
+// for the recompiler to pick it up, hits counts the runs until then. idleLoop
+// is set for blocks that branch back to their own start without side effects,
+// idleWrites holds the registers such a loop writes.
+typedef struct __CpuBlock {
+  Address start;
+  uint32_t numOps;
+  CpuDecodedOp *ops;
+  uint32_t hits;
+  void *_Nullable code;
+  bool idleLoop;
+  uint32_t idleWrites;
+} CpuBlock;
+
+static inline bool InstructionIsBranch(Instruction instruction) {
+  if (instruction.imm.op == 0) {
+    return instruction.reg.funct == 0x08 || instruction.reg.funct == 0x09;
+  }
+  return instruction.imm.op >= 0x01 && instruction.imm.op <= 0x07;
+}
+
+// Instructions that raise exceptions or touch COP0 end a block so that the
+// state they change is observed before the next block is looked up.
+static inline bool InstructionEndsBlock(Instruction instruction) {
+  if (instruction.imm.op == 0) {
+    return instruction.reg.funct == 0x0C || instruction.reg.funct == 0x0D;
+  }
+  return instruction.imm.op == 0x10;
+}
+
+BlockCache *BlockCacheNew(System *sys);
+void BlockCacheSetMemory(BlockCache *cache, Memory *memory);
+CpuBlock *_Nullable BlockCacheLookup(BlockCache *cache, Address address);
+CpuBlock *BlockCacheBeginBlock(BlockCache *cache, Address address);
+void BlockCacheCommitBlock(BlockCache *cache, CpuBlock *block);
+void BlockCacheCodeWritten(BlockCache *cache, Address page);
+void BlockCacheRequestFlush(BlockCache *cache);
+uint32_t BlockCacheGeneration(BlockCache *cache);
+
+ASSUME_NONNULL_END
@@ -1,24 +1,30 @@
 #include "Cpu.h"
+#include "../Bus.h"
 #include "../Clock.h"
+#include "../Memory.h"
 #include "../System.h"
 #include "../Types.h"
+#include "BlockCache.h"
 #include "Instructions.h"
+#include "Recompiler.h"
 
 ASSUME_NONNULL_BEGIN
 
-static OpcodeHandler kOpcodeTable[64] = {
+static const OpcodeHandler kOpcodeTable[64] = {
     Rtype, Bcond,  J,    Jal,    Beq, Bne, Blez, Bgtz, Addi, Addiu,  Slti, Sltiu,  Andi, Ori, Xori, Lui,
     Cop0,  UnkCop, Cop2, UnkCop, Unk, Unk, Unk,  Unk,  Unk,  Unk,    Unk,  Unk,    Unk,  Unk, Unk,  Unk,
     Lb,    Lh,     Lwl,  Lw,     Lbu, Lhu, Lwr,  Unk,  Sb,   Sh,     Swl,  Sw,     Unk,  Unk, Swr,  Unk,
     Lwc0,  UnkCop, Lwc2, UnkCop, Unk, Unk, Unk,  Unk,  Swc0, UnkCop, Swc2, UnkCop, Unk,  Unk, Unk,  Unk};
 
-static OpcodeHandler kRegisterFunctTable[64] = {
+static const OpcodeHandler kRegisterFunctTable[64] = {
     Sll,  Unk,  Srl,  Sra,  Sllv, Unk, Srlv, Srav, Jr,   Jalr,  Unk, Unk,  Syscall, Break, Unk, Unk,
     Mfhi, Mthi, Mflo, Mtlo, Unk,  Unk, Unk,  Unk,  Mult, Multu, Div, Divu, Unk,     Unk,   Unk, Unk,
     Add,  Addu, Sub,  Subu, And,  Or,  Xor,  Nor,  Unk,  Unk,   Slt, Sltu, Unk,     Unk,   Unk, Unk,
     Unk,  Unk,  Unk,  Unk,  Unk,  Unk, Unk,  Unk,  Unk,  Unk,   Unk, Unk,  Unk,     Unk,   Unk, Unk};
 
 static void RunNextInstruction(Cpu *cpu);
+static void RunNextBlock(Cpu *cpu);
+static void RunNextRecompiledBlock(Cpu *cpu);
 static void Store32(Cpu *cpu, Address address, uint32_t value);
 static void Store16(Cpu *cpu, Address address, uint16_t value);
 static void Store8(Cpu *cpu, Address address, uint8_t value);
@@ -28,6 +34,8 @@ static bool Load16(Cpu *cpu, Address address, uint16_t *result);
 static bool Load8(Cpu *cpu, Address address, uint8_t *result);
 static bool LoadNextInstruction(Cpu *cpu, Instruction *result);
 static void Exception(Cpu *cpu, SystemException exception);
+static void Interrupt(Cpu *cpu);
+static void UpdateInterruptPending(Cpu *cpu);
 static void CacheControlWrite32(Cpu *cpu, Address address, MemorySegment segment, uint32_t value);
 static void CacheControlWrite16(Cpu *cpu, Address address, MemorySegment segment, uint16_t value);
 static void CacheControlWrite8(Cpu *cpu, Address address, MemorySegment segment, uint8_t value);
@@ -44,6 +52,9 @@ static void CpuLink(Cpu *cpu, uint8_t linkReg);
 Cpu *CpuNew(System *sys, Bus *bus, Clock *clock) {
   Cpu *cpu = (Cpu *)SystemArenaAllocate(sys, sizeof(Cpu));
   cpu->bus = bus;
+  cpu->fastPages = BusFastPages(bus);
+  cpu->scratchpad = NULL;
+  cpu->memory = NULL;
   cpu->sys = sys;
   int i;
   for (i = 1; i < 32; i++) {
@@ -56,6 +67,12 @@ Cpu *CpuNew(System *sys, Bus *bus, Clock *clock) {
   cpu->loadReg = 0;
   cpu->loadValue = 0;
   cpu->clock = clock;
+  cpu->mode = CpuModeInterpreter;
+  cpu->blockCache = BlockCacheNew(sys);
+  cpu->recompiler = NULL;
+  cpu->idleLoop.active = false;
+  cpu->idleLoop.numStats = 0;
+  cpu->interruptPending = false;
 
   cpu->cop0.badVaddr = 0;
   cpu->cop0.cause.value = 0;
@@ -63,10 +80,19 @@ Cpu *CpuNew(System *sys, Bus *bus, Clock *clock) {
   cpu->cop0.sr.value = 0;
   cpu->cop0.sr.parsed.bootExceptionVectors = 1;
   cpu->cop0.sr.parsed.tlbShutdown = 1;
+  GteReset(&cpu->gte);
 
   return cpu;
 }
 
+// Releases what the Cpu holds outside of the arena, which is the recompiler's
+// code buffer.
+void CpuFree(Cpu *cpu) {
+  if (cpu->recompiler != NULL) {
+    RecompilerFree(cpu->recompiler);
+  }
+}
+
 void CpuRegisterCacheControl(Cpu *cpu) {
   BusDevice device = {.context = cpu,
                       .cpuCycles = 0,
@@ -79,14 +105,49 @@ void CpuRegisterCacheControl(Cpu *cpu) {
   PCFResultOrPanic(BusRegisterDevice(cpu->bus, &device, NewAddressRange(0xFFFE0130, 0xFFFE0134, KernelSegment2)));
 }
 
-void CpuRun(Cpu *cpu, uint32_t cycles) {
+// scratchpad is the 1 KiB the data cache device registered on the bus, which
+// loads and stores then reach without going through it.
+void CpuSetScratchpad(Cpu *cpu, uint8_t *scratchpad) { cpu->scratchpad = scratchpad; }
+
+// memory is the main RAM. It keeps track of the pages the block cache decoded
+// code from and tells the cache when one of them is written to, by stores,
+// DMA or anything else.
+void CpuSetMemory(Cpu *cpu, Memory *memory) {
+  cpu->memory = memory;
+  BlockCacheSetMemory(cpu->blockCache, memory);
+  MemorySetCodeWriteHandler(memory, (MemoryCodeWriteHandler)BlockCacheCodeWritten, cpu->blockCache);
+}
 
+// Runs the CPU up to the next device update (or until a register write moves
+// one earlier, starts a DMA or lets an interrupt through, which zero the slice)
+// before ticking the clock. Interrupts are only taken between slices.
+void CpuRun(Cpu *cpu, uint32_t cycles) {
+  const uint32_t *sliceCycles = ClockSliceCycles(cpu->clock);
   uint32_t numCycles = 0;
   while (cycles > numCycles) {
     if (SystemIsDmaActive(cpu->sys)) {
       numCycles += SystemDmaRun(cpu->sys);
     } else {
-      RunNextInstruction(cpu);
+      if (cpu->interruptPending) {
+        Interrupt(cpu);
+      }
+      ClockStartSlice(cpu->clock, cycles - numCycles);
+      switch (cpu->mode) {
+      case CpuModeRecompiler:
+        while (cpu->cycles < *sliceCycles) {
+          RunNextRecompiledBlock(cpu);
+        }
+        break;
+      case CpuModeCachedInterpreter:
+        while (cpu->cycles < *sliceCycles) {
+          RunNextBlock(cpu);
+        }
+        break;
+      default:
+        while (cpu->cycles < *sliceCycles) {
+          RunNextInstruction(cpu);
+        }
+      }
       ClockTick(cpu->clock, cpu->cycles);
       numCycles += cpu->cycles;
       cpu->cycles = 0;
@@ -94,6 +155,122 @@ void CpuRun(Cpu *cpu, uint32_t cycles) {
   }
 }
 
+// Steps the interpreter until pc reaches address, ticking devices and taking
+// interrupts like CpuRun. Returns false if that does not happen within
+// maxCycles.
+bool CpuRunUntil(Cpu *cpu, Address address, uint64_t maxCycles) {
+  const uint32_t *sliceCycles = ClockSliceCycles(cpu->clock);
+  uint64_t numCycles = 0;
+  while (cpu->pc != address) {
+    if (numCycles >= maxCycles) {
+      return false;
+    }
+    if (SystemIsDmaActive(cpu->sys)) {
+      numCycles += SystemDmaRun(cpu->sys);
+      continue;
+    }
+    if (cpu->interruptPending) {
+      Interrupt(cpu);
+    }
+    uint64_t remaining = maxCycles - numCycles;
+    ClockStartSlice(cpu->clock, remaining > UINT32_MAX ? UINT32_MAX : (uint32_t)remaining);
+    while (cpu->cycles < *sliceCycles && cpu->pc != address) {
+      RunNextInstruction(cpu);
+    }
+    ClockTick(cpu->clock, cpu->cycles);
+    numCycles += cpu->cycles;
+    cpu->cycles = 0;
+  }
+  return true;
+}
+
+// Enters an executable that was copied into RAM behind the CPU's back, an sp
+// of 0 keeps the stack the BIOS set up.
+void CpuStartExecutable(Cpu *cpu, Address pc, uint32_t gp, uint32_t sp) {
+  CpuDelayedLoad(cpu);
+  cpu->pc = pc;
+  cpu->nextPc = pc + 4;
+  cpu->branch = false;
+  cpu->delaySlot = false;
+  cpu->reg[28] = gp;
+  if (sp != 0) {
+    cpu->reg[29] = sp;
+    cpu->reg[30] = sp;
+  }
+  BlockCacheRequestFlush(cpu->blockCache);
+}
+
+Address CpuGetPc(Cpu *cpu) { return cpu->pc; }
+
+void CpuSetExecutionMode(Cpu *cpu, CpuExecutionMode mode) {
+  if (mode == CpuModeRecompiler && !RECOMPILER_SUPPORTED) {
+    PCFWARN("The recompiler does not support this host, using the cached interpreter.");
+    mode = CpuModeCachedInterpreter;
+  }
+  if (mode == CpuModeRecompiler && cpu->recompiler == NULL) {
+    cpu->recompiler = RecompilerNew(cpu->sys);
+  }
+  cpu->mode = mode;
+  BlockCacheRequestFlush(cpu->blockCache);
+}
+
+CpuCaches CpuGetCaches(Cpu *cpu) {
+  CpuCaches caches = {.blockCache = cpu->blockCache, .recompiler = cpu->recompiler, .mode = cpu->mode};
+  return caches;
+}
+
+// Called before the guest RAM is replaced by loaded, so that the blocks the
+// load makes stale can be told apart from the ones that stay valid.
+void CpuInvalidateChangedCode(Cpu *cpu, const uint8_t *loaded) {
+  if (cpu->memory != NULL) {
+    MemoryInvalidateChangedCode(cpu->memory, loaded);
+  }
+}
+
+// caches are what CpuGetCaches returned for the Cpu this one replaces. Its
+// blocks are kept if keepBlocks is set, which the caller may only do when
+// the guest memory stayed where it was and CpuInvalidateChangedCode ran.
+void CpuRelocate(Cpu *cpu, const SystemRelocation *relocation, CpuCaches caches, bool keepBlocks) {
+  cpu->bus = (Bus *)RelocateArenaPointer(relocation, cpu->bus);
+  cpu->fastPages = (const BusFastPage *)RelocateArenaPointer(relocation, cpu->fastPages);
+  cpu->scratchpad = (uint8_t *)RelocateArenaPointer(relocation, cpu->scratchpad);
+  cpu->memory = (Memory *)RelocateArenaPointer(relocation, cpu->memory);
+  cpu->sys = (System *)RelocateArenaPointer(relocation, cpu->sys);
+  cpu->clock = (Clock *)RelocateArenaPointer(relocation, cpu->clock);
+  cpu->blockCache = caches.blockCache;
+  cpu->recompiler = caches.recompiler;
+  if (cpu->memory != NULL) {
+    BlockCacheSetMemory(cpu->blockCache, cpu->memory);
+  }
+  if (cpu->mode == CpuModeRecompiler && cpu->recompiler == NULL) {
+    cpu->recompiler = RecompilerNew(cpu->sys);
+  }
+  if (!keepBlocks || cpu->mode != caches.mode) {
+    BlockCacheRequestFlush(cpu->blockCache);
+  }
+}
+
+// Drives the external interrupt input, cause bit 10, from the interrupt
+// controller.
+void CpuSetInterruptLine(Cpu *cpu, bool asserted) {
+  if (asserted) {
+    cpu->cop0.cause.parsed.interruptPending |= 0x04;
+  } else {
+    cpu->cop0.cause.parsed.interruptPending &= ~0x04;
+  }
+  UpdateInterruptPending(cpu);
+}
+
+// The pending flag is only recomputed when cause, sr or the line change, and
+// ends the current slice so CpuRun takes the interrupt at the next boundary.
+static void UpdateInterruptPending(Cpu *cpu) {
+  cpu->interruptPending = cpu->cop0.sr.parsed.currentInteruptEnable &&
+                          (cpu->cop0.cause.parsed.interruptPending & cpu->cop0.sr.parsed.interruptMasks) != 0;
+  if (cpu->interruptPending) {
+    ClockEndSlice(cpu->clock);
+  }
+}
+
 static void RunNextInstruction(Cpu *cpu) {
   cpu->currentPc = cpu->pc;
   if (cpu->currentPc == 0x800415d4) {
@@ -107,12 +284,269 @@ static void RunNextInstruction(Cpu *cpu) {
   cpu->nextPc = cpu->pc + 4;
   cpu->delaySlot = cpu->branch;
   cpu->branch = false;
-  // TODO: Check for interrupts
-
   DecodeAndExecute(cpu, instruction);
   cpu->reg[0] = 0;
 }
 
+static OpcodeHandler ResolveHandler(Instruction instruction) {
+  if (instruction.imm.op == 0) {
+    return kRegisterFunctTable[instruction.reg.funct];
+  }
+  return kOpcodeTable[instruction.imm.op];
+}
+
+// Marks blocks that are a polling loop: a branch back to the block start whose
+// body only loads, does ALU work and compares. Such a loop can only exit once
+// something outside the CPU changes the memory it reads.
+static void DetectIdleLoop(CpuBlock *block) {
+  if (block->numOps < 2) {
+    return;
+  }
+  Address branchPc = block->start + ((block->numOps - 2) << 2);
+  Instruction branch = block->ops[block->numOps - 2].instruction;
+  Address target;
+  switch (branch.imm.op) {
+  case 0x01: // Bltz and bgez, the linking forms are not loops
+    if (branch.imm.rt > 0x01) {
+      return;
+    }
+    target = branchPc + 4 + (SIGN_EXTEND(branch.imm.immediate) << 2);
+    break;
+  case 0x04:
+  case 0x05:
+  case 0x06:
+  case 0x07:
+    target = branchPc + 4 + (SIGN_EXTEND(branch.imm.immediate) << 2);
+    break;
+  case 0x02:
+    target = ((branchPc + 4) & 0xF0000000) | (branch.jump.target << 2);
+    break;
+  default:
+    return;
+  }
+  if (target != block->start) {
+    return;
+  }
+  uint32_t writes = 0;
+  uint32_t i;
+  for (i = 0; i < block->numOps; i++) {
+    Instruction instruction = block->ops[i].instruction;
+    if (i == block->numOps - 2) {
+      continue;
+    }
+    switch (instruction.imm.op) {
+    case 0x00:
+      switch (instruction.reg.funct) {
+      case 0x00: // Sll
+      case 0x02: // Srl
+      case 0x03: // Sra
+      case 0x04: // Sllv
+      case 0x06: // Srlv
+      case 0x07: // Srav
+      case 0x21: // Addu
+      case 0x23: // Subu
+      case 0x24: // And
+      case 0x25: // Or
+      case 0x26: // Xor
+      case 0x27: // Nor
+      case 0x2A: // Slt
+      case 0x2B: // Sltu
+        writes |= 1 << instruction.reg.rd;
+        break;
+      default:
+        return;
+      }
+      break;
+    case 0x09: // Addiu
+    case 0x0A: // Slti
+    case 0x0B: // Sltiu
+    case 0x0C: // Andi
+    case 0x0D: // Ori
+    case 0x0E: // Xori
+    case 0x0F: // Lui
+    case 0x20: // Lb
+    case 0x21: // Lh
+    case 0x23: // Lw
+    case 0x24: // Lbu
+    case 0x25: // Lhu
+      writes |= 1 << instruction.imm.rt;
+      break;
+    default:
+      return;
+    }
+  }
+  block->idleLoop = true;
+  block->idleWrites = writes & ~1u;
+}
+
+static CpuIdleLoopStats *IdleLoopStatsForAddress(Cpu *cpu, Address address) {
+  CpuIdleLoop *loop = &cpu->idleLoop;
+  size_t i;
+  size_t leastHit = 0;
+  for (i = 0; i < loop->numStats; i++) {
+    if (loop->stats[i].address == address) {
+      return &loop->stats[i];
+    }
+    if (loop->stats[i].hits < loop->stats[leastHit].hits) {
+      leastHit = i;
+    }
+  }
+  if (loop->numStats < kCpuMaxIdleLoopStats) {
+    leastHit = loop->numStats++;
+  }
+  CpuIdleLoopStats *stats = &loop->stats[leastHit];
+  stats->address = address;
+  stats->hits = 0;
+  stats->skippedCycles = 0;
+  return stats;
+}
+
+// Called after an idle loop candidate went around once. If the iteration left
+// every register it writes as it found them, the next one will do the same
+// until a device update, DMA or interrupt changes the memory it polls, all of
+// which end the clock slice. So the rest of the slice can be skipped.
+static void CheckIdleLoop(Cpu *cpu, CpuBlock *block) {
+  CpuIdleLoop *loop = &cpu->idleLoop;
+  bool unchanged = loop->active && loop->address == block->start && loop->loadReg == cpu->loadReg &&
+                   loop->loadValue == cpu->loadValue;
+  uint32_t writes = block->idleWrites;
+  while (writes != 0) {
+    uint32_t reg = __builtin_ctz(writes);
+    writes &= writes - 1;
+    unchanged = unchanged && loop->reg[reg] == cpu->reg[reg];
+    loop->reg[reg] = cpu->reg[reg];
+  }
+  loop->active = true;
+  loop->address = block->start;
+  loop->loadReg = cpu->loadReg;
+  loop->loadValue = cpu->loadValue;
+  uint32_t sliceCycles = *ClockSliceCycles(cpu->clock);
+  if (unchanged && cpu->cycles < sliceCycles) {
+    CpuIdleLoopStats *stats = IdleLoopStatsForAddress(cpu, block->start);
+    stats->hits++;
+    stats->skippedCycles += sliceCycles - cpu->cycles;
+    cpu->cycles = sliceCycles;
+  }
+}
+
+static inline void AfterBlock(Cpu *cpu, CpuBlock *block) {
+  if (block->idleLoop && cpu->pc == block->start) {
+    CheckIdleLoop(cpu, block);
+  } else {
+    cpu->idleLoop.active = false;
+  }
+}
+
+const CpuIdleLoopStats *CpuGetIdleLoopStats(Cpu *cpu, size_t *count) {
+  *count = cpu->idleLoop.numStats;
+  return cpu->idleLoop.stats;
+}
+
+#if SYSTEM_STATS
+void CpuGetStats(Cpu *cpu, SystemStats *stats) { stats->cpu = cpu->stats; }
+#endif
+
+static CpuBlock *_Nullable CompileBlock(Cpu *cpu, Address address) {
+  MemorySegment segment = MemorySegmentForAddress(address);
+  bool cached = (segment == UserSegment || segment == KernelSegment0) && cpu->cacheControlReg.parsed.codeCacheEnabled;
+  CpuBlock *block = BlockCacheBeginBlock(cpu->blockCache, address);
+  bool delaySlot = false;
+  while (block->numOps < kBlockCacheMaxOpsPerBlock) {
+    SystemException exception;
+    uint32_t cycles;
+    uint32_t value;
+    if (!BusRead32(cpu->bus, address + (block->numOps << 2), &value, &exception, &cycles)) {
+      break;
+    }
+    Instruction instruction = NewInstruction(value);
+    CpuDecodedOp *op = &block->ops[block->numOps++];
+    op->handler = ResolveHandler(instruction);
+    op->instruction = instruction;
+    op->cycles = 1 + (cached ? 0 : cycles);
+    if (delaySlot || InstructionEndsBlock(instruction)) {
+      break;
+    }
+    delaySlot = InstructionIsBranch(instruction);
+  }
+  if (block->numOps == 0) {
+    return NULL;
+  }
+  DetectIdleLoop(block);
+  BlockCacheCommitBlock(cpu->blockCache, block);
+  return block;
+}
+
+static inline void CountInstruction(Cpu *cpu, Instruction instruction) {
+  STATS_ADD(cpu->stats.opcodes[instruction.imm.op], 1);
+  STATS_ADD(cpu->stats.registerFuncts[instruction.reg.funct], instruction.imm.op == 0);
+}
+
+static void ExecuteBlock(Cpu *cpu, CpuBlock *block) {
+  Address expectedPc = block->start;
+  CpuDecodedOp *op = block->ops;
+  CpuDecodedOp *end = block->ops + block->numOps;
+  // A taken branch or an exception moves pc away from the straight-line path,
+  // which is where the block stops.
+  while (op != end && cpu->pc == expectedPc) {
+    cpu->currentPc = expectedPc;
+    cpu->pc = cpu->nextPc;
+    cpu->nextPc = cpu->pc + 4;
+    cpu->delaySlot = cpu->branch;
+    cpu->branch = false;
+    CountInstruction(cpu, op->instruction);
+    op->handler(cpu, op->instruction);
+    cpu->reg[0] = 0;
+    cpu->cycles += op->cycles;
+    expectedPc += 4;
+    op++;
+  }
+}
+
+static void RunNextBlock(Cpu *cpu) {
+  CpuBlock *_Nullable block = BlockCacheLookup(cpu->blockCache, cpu->pc);
+  if (block == NULL) {
+    block = CompileBlock(cpu, cpu->pc);
+  }
+  if (block == NULL) {
+    // The fetch itself faults, let the interpreter raise the exception.
+    RunNextInstruction(cpu);
+    return;
+  }
+  ExecuteBlock(cpu, block);
+  AfterBlock(cpu, block);
+}
+
+static void RunNextRecompiledBlock(Cpu *cpu) {
+  if (cpu->branch || cpu->loadReg != 0) {
+    // Translations assume they are entered outside of any delay slot.
+    RunNextInstruction(cpu);
+    return;
+  }
+  CpuBlock *_Nullable block = BlockCacheLookup(cpu->blockCache, cpu->pc);
+  if (block == NULL) {
+    block = CompileBlock(cpu, cpu->pc);
+  }
+  if (block == NULL) {
+    RunNextInstruction(cpu);
+    return;
+  }
+  if (block->code == NULL && ++block->hits >= kRecompilerHotThreshold) {
+    RecompilerTranslate(cpu->recompiler, cpu, block);
+  }
+  if (block->code != NULL) {
+#if SYSTEM_STATS
+    uint32_t i;
+    for (i = 0; i < block->numOps; i++) {
+      CountInstruction(cpu, block->ops[i].instruction);
+    }
+#endif
+    ((RecompiledBlock)block->code)(cpu);
+  } else {
+    ExecuteBlock(cpu, block);
+  }
+  AfterBlock(cpu, block);
+}
+
 static void Exception(Cpu *cpu, SystemException exception) {
   cpu->pc = cpu->cop0.sr.parsed.bootExceptionVectors ? kGeneralExceptionVectorBoot : kGeneralExceptionVector;
   if (cpu->delaySlot) {
@@ -129,6 +563,19 @@ static void Exception(Cpu *cpu, SystemException exception) {
   cpu->cop0.sr.parsed.prevUserMode = cpu->cop0.sr.parsed.currentUserMode;
   cpu->cop0.sr.parsed.currentInteruptEnable = 0;
   cpu->cop0.sr.parsed.currentUserMode = 0;
+  UpdateInterruptPending(cpu);
+}
+
+// Interrupts are taken between instructions, so unlike Exception the pending
+// load lands first and pc is the instruction that has not run yet.
+static void Interrupt(Cpu *cpu) {
+  CpuDelayedLoad(cpu);
+  cpu->currentPc = cpu->pc;
+  cpu->delaySlot = cpu->branch;
+  Exception(cpu, NewSystemException(kExceptionExternalInterrupt, cpu->pc));
+  cpu->nextPc = cpu->pc + 4;
+  cpu->branch = false;
+  cpu->delaySlot = false;
 }
 
 static bool LoadNextInstruction(Cpu *cpu, Instruction *result) {
@@ -142,9 +589,11 @@ static bool LoadNextInstruction(Cpu *cpu, Instruction *result) {
     size_t index = (address & 0x000000F) >> 2;
     if (!line->tagValid.parsed.isInvalid && line->tagValid.parsed.tag == tag &&
         line->tagValid.parsed.validIndex <= index) {
+      STATS_ADD(cpu->stats.iCacheHits, 1);
       *result = line->entries[index];
       return true;
     } else {
+      STATS_ADD(cpu->stats.iCacheMisses, 1);
       line->tagValid.parsed.tag = tag;
       line->tagValid.parsed.isInvalid = false;
       line->tagValid.parsed.validIndex = index;
@@ -174,6 +623,7 @@ static bool LoadNextInstruction(Cpu *cpu, Instruction *result) {
 }
 
 static void DecodeAndExecute(Cpu *cpu, Instruction instruction) {
+  CountInstruction(cpu, instruction);
   kOpcodeTable[instruction.imm.op](cpu, instruction);
   cpu->cycles++;
 }
@@ -365,9 +815,12 @@ static void Mtc0(Cpu *cpu, Instruction instruction) {
     return;
   case 12:
     cpu->cop0.sr.value = rt;
+    UpdateInterruptPending(cpu);
     return;
   case 13:
-    cpu->cop0.cause.value = rt;
+    // Only the two software interrupt bits are writable.
+    cpu->cop0.cause.value = (cpu->cop0.cause.value & ~0x300) | (rt & 0x300);
+    UpdateInterruptPending(cpu);
     return;
   }
   PCF_PANIC("Write to Unsupported COP0 reg: %d", instruction.copReg.rdCop);
@@ -396,8 +849,29 @@ static void Mfc0(Cpu *cpu, Instruction instruction) {
 }
 
 static void Cop2(Cpu *cpu, Instruction instruction) {
-  PCFWARN("GTE (COP2) instructions are unimplemented!");
-  CpuDelayedLoad(cpu);
+  if (instruction.copCommand.unused25) {
+    CpuDelayedLoad(cpu);
+    cpu->cycles += GteExecute(&cpu->gte, instruction.copCommand.command);
+    return;
+  }
+  uint32_t rt = cpu->reg[instruction.copReg.rt];
+  switch (instruction.copReg.subOpcode) {
+  case 0:
+    CpuDelayedLoadAndSetLoad(cpu, instruction.copReg.rt, GteReadData(&cpu->gte, instruction.copReg.rdCop));
+    return;
+  case 2:
+    CpuDelayedLoadAndSetLoad(cpu, instruction.copReg.rt, GteReadControl(&cpu->gte, instruction.copReg.rdCop));
+    return;
+  case 4:
+    CpuDelayedLoad(cpu);
+    GteWriteData(&cpu->gte, instruction.copReg.rdCop, rt);
+    return;
+  case 6:
+    CpuDelayedLoad(cpu);
+    GteWriteControl(&cpu->gte, instruction.copReg.rdCop, rt);
+    return;
+  }
+  Unk(cpu, instruction);
 }
 
 static void Lb(Cpu *cpu, Instruction instruction) {
@@ -601,14 +1075,21 @@ static void Swr(Cpu *cpu, Instruction instruction) {
 static void Lwc0(Cpu *cpu, Instruction instruction) { Unk(cpu, instruction); }
 
 static void Lwc2(Cpu *cpu, Instruction instruction) {
-  PCFWARN("GTE (COP2) instructions are unimplemented!");
+  uint32_t rs = cpu->reg[instruction.copLoadStore.rs];
+  uint32_t offset = SIGN_EXTEND((uint16_t)instruction.copLoadStore.immediate);
+  uint32_t result;
   CpuDelayedLoad(cpu);
+  if (Load32(cpu, rs + offset, &result)) {
+    GteWriteData(&cpu->gte, instruction.copLoadStore.rtDat, result);
+  }
 }
 
 static void Swc0(Cpu *cpu, Instruction instruction) { Unk(cpu, instruction); }
 
 static void Swc2(Cpu *cpu, Instruction instruction) {
-  PCFWARN("GTE (COP2) instructions are unimplemented!");
+  uint32_t rs = cpu->reg[instruction.copLoadStore.rs];
+  uint32_t offset = SIGN_EXTEND((uint16_t)instruction.copLoadStore.immediate);
+  Store32(cpu, rs + offset, GteReadData(&cpu->gte, instruction.copLoadStore.rtDat));
   CpuDelayedLoad(cpu);
 }
 
@@ -805,7 +1286,7 @@ static void Nor(Cpu *cpu, Instruction instruction) {
   int32_t rs = cpu->reg[instruction.reg.rs];
   int32_t rt = cpu->reg[instruction.reg.rt];
   CpuDelayedLoad(cpu);
-  cpu->reg[instruction.reg.rd] = !(rs | rt);
+  cpu->reg[instruction.reg.rd] = ~(rs | rt);
 }
 
 static void Slt(Cpu *cpu, Instruction instruction) {
@@ -872,6 +1353,7 @@ static void Rfe(Cpu *cpu, Instruction instruction) {
   cpu->cop0.sr.parsed.currentInteruptEnable = cpu->cop0.sr.parsed.prevInteruptEnable;
   cpu->cop0.sr.parsed.currentUserMode = cpu->cop0.sr.parsed.prevUserMode;
   CpuDelayedLoad(cpu);
+  UpdateInterruptPending(cpu);
 }
 
 static void CpuDelayedLoad(Cpu *cpu) {
@@ -898,6 +1380,39 @@ static void CpuLink(Cpu *cpu, uint8_t linkReg) {
   CpuDelayedLoadAndSetLoad(cpu, linkReg, returnAddress);
 }
 
+// The scratchpad answers at 0x1F800000 in KUSEG and KSEG0 only, KSEG1 has no
+// view of it.
+static inline bool IsScratchpadAddress(Address address) { return (address & 0x7FFFFC00) == 0x1F800000; }
+
+// Host pointer for an access to plain memory that can skip the bus, NULL for
+// MMIO, unmapped and misaligned addresses, which the bus turns into exceptions.
+// The scratchpad is checked first: it has no wait states and is never code.
+// Stats builds send its accesses through the bus so that they are counted.
+static inline uint8_t *_Nullable FastmemPointer(Cpu *cpu, Address address, Address alignMask, bool write,
+                                                uint32_t *cycles) {
+  if (!SYSTEM_STATS && IsScratchpadAddress(address) && cpu->scratchpad != NULL && (address & alignMask) == 0) {
+    *cycles = 0;
+    return cpu->scratchpad + (address & 0x3FF);
+  }
+  const BusFastPage *_Nullable page = BusFastPageForAddress(cpu->fastPages, address);
+  if (page == NULL || (address & alignMask) != 0 || (write && page->readOnly)) {
+    return NULL;
+  }
+  *cycles = page->cycles;
+#if SYSTEM_STATS
+  BusCountFastAccess(cpu->bus, page, write);
+#endif
+  return page->host + (address & kBusFastPageMask);
+}
+
+// Stores through the fast pages bypass the Memory functions, which report
+// writes to code on their own.
+static inline void NotifyFastWrite(Cpu *cpu, Address address) {
+  if (cpu->memory != NULL) {
+    MemoryNotifyWrite(cpu->memory, address);
+  }
+}
+
 static void Store32(Cpu *cpu, Address address, uint32_t value) {
   if (cpu->cop0.sr.parsed.cacheIsolated) {
     CacheMaintenance(cpu, address, value);
@@ -905,9 +1420,12 @@ static void Store32(Cpu *cpu, Address address, uint32_t value) {
   }
   SystemException exception;
   uint32_t cycles;
-  if (!BusWrite32(cpu->bus, address, value, &exception, &cycles)) {
+  uint8_t *_Nullable host = FastmemPointer(cpu, address, 0x3, true, &cycles);
+  if (host != NULL) {
+    *(uint32_t *)host = value;
+    NotifyFastWrite(cpu, address);
+  } else if (!BusWrite32(cpu->bus, address, value, &exception, &cycles)) {
     Exception(cpu, exception);
-    return;
   }
 }
 
@@ -921,9 +1439,12 @@ static void Store16(Cpu *cpu, Address address, uint16_t value) {
   }
   SystemException exception;
   uint32_t cycles;
-  if (!BusWrite16(cpu->bus, address, value, &exception, &cycles)) {
+  uint8_t *_Nullable host = FastmemPointer(cpu, address, 0x1, true, &cycles);
+  if (host != NULL) {
+    *(uint16_t *)host = value;
+    NotifyFastWrite(cpu, address);
+  } else if (!BusWrite16(cpu->bus, address, value, &exception, &cycles)) {
     Exception(cpu, exception);
-    return;
   }
 }
 
@@ -934,17 +1455,22 @@ static void Store8(Cpu *cpu, Address address, uint8_t value) {
   }
   SystemException exception;
   uint32_t cycles;
-  if (!BusWrite8(cpu->bus, address, value, &exception, &cycles)) {
+  uint8_t *_Nullable host = FastmemPointer(cpu, address, 0x0, true, &cycles);
+  if (host != NULL) {
+    *host = value;
+    NotifyFastWrite(cpu, address);
+  } else if (!BusWrite8(cpu->bus, address, value, &exception, &cycles)) {
     Exception(cpu, exception);
-    return;
   }
 }
 
 static bool Load32(Cpu *cpu, Address address, uint32_t *result) {
   SystemException exception;
   uint32_t cycles;
-  BusRead32(cpu->bus, address, result, &exception, &cycles);
-  if (!BusRead32(cpu->bus, address, result, &exception, &cycles)) {
+  uint8_t *_Nullable host = FastmemPointer(cpu, address, 0x3, false, &cycles);
+  if (host != NULL) {
+    *result = *(uint32_t *)host;
+  } else if (!BusRead32(cpu->bus, address, result, &exception, &cycles)) {
     Exception(cpu, exception);
     return false;
   }
@@ -955,8 +1481,10 @@ static bool Load32(Cpu *cpu, Address address, uint32_t *result) {
 static bool Load32WithoutCycleCount(Cpu *cpu, Address address, uint32_t *result) {
   SystemException exception;
   uint32_t cycles;
-  BusRead32(cpu->bus, address, result, &exception, &cycles);
-  if (!BusRead32(cpu->bus, address, result, &exception, &cycles)) {
+  uint8_t *_Nullable host = FastmemPointer(cpu, address, 0x3, false, &cycles);
+  if (host != NULL) {
+    *result = *(uint32_t *)host;
+  } else if (!BusRead32(cpu->bus, address, result, &exception, &cycles)) {
     Exception(cpu, exception);
     return false;
   }
@@ -966,8 +1494,10 @@ static bool Load32WithoutCycleCount(Cpu *cpu, Address address, uint32_t *result)
 static bool Load16(Cpu *cpu, Address address, uint16_t *result) {
   SystemException exception;
   uint32_t cycles;
-  BusRead16(cpu->bus, address, result, &exception, &cycles);
-  if (!BusRead16(cpu->bus, address, result, &exception, &cycles)) {
+  uint8_t *_Nullable host = FastmemPointer(cpu, address, 0x1, false, &cycles);
+  if (host != NULL) {
+    *result = *(uint16_t *)host;
+  } else if (!BusRead16(cpu->bus, address, result, &exception, &cycles)) {
     Exception(cpu, exception);
     return false;
   }
@@ -978,8 +1508,10 @@ static bool Load16(Cpu *cpu, Address address, uint16_t *result) {
 static bool Load8(Cpu *cpu, Address address, uint8_t *result) {
   SystemException exception;
   uint32_t cycles;
-  BusRead8(cpu->bus, address, result, &exception, &cycles);
-  if (!BusRead8(cpu->bus, address, result, &exception, &cycles)) {
+  uint8_t *_Nullable host = FastmemPointer(cpu, address, 0x0, false, &cycles);
+  if (host != NULL) {
+    *result = *host;
+  } else if (!BusRead8(cpu->bus, address, result, &exception, &cycles)) {
     Exception(cpu, exception);
     return false;
   }
@@ -1020,6 +1552,7 @@ static void CacheMaintenance(Cpu *cpu, Address address, uint32_t value) {
   }
   size_t lineNumber = (address >> 4) & 0xFF;
   CacheLine *line = &cpu->iCache[lineNumber];
+  BlockCacheRequestFlush(cpu->blockCache);
   if (cpu->cacheControlReg.parsed.tagTestMode) {
     line->tagValid.parsed.isInvalid = true;
   } else {
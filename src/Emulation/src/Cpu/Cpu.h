@@ -5,8 +5,21 @@
 ASSUME_NONNULL_BEGIN
 
 Cpu *CpuNew(System *sys, Bus *bus, Clock *clock);
+void CpuFree(Cpu *cpu);
 void CpuRegisterCacheControl(Cpu *cpu);
+void CpuSetScratchpad(Cpu *cpu, uint8_t *scratchpad);
+void CpuSetMemory(Cpu *cpu, Memory *memory);
 void CpuRun(Cpu *cpu, uint32_t cycles);
+bool CpuRunUntil(Cpu *cpu, Address address, uint64_t maxCycles);
+void CpuStartExecutable(Cpu *cpu, Address pc, uint32_t gp, uint32_t sp);
+Address CpuGetPc(Cpu *cpu);
+void CpuSetExecutionMode(Cpu *cpu, CpuExecutionMode mode);
+void CpuSetInterruptLine(Cpu *cpu, bool asserted);
+CpuCaches CpuGetCaches(Cpu *cpu);
+void CpuInvalidateChangedCode(Cpu *cpu, const uint8_t *loaded);
+void CpuRelocate(Cpu *cpu, const SystemRelocation *relocation, CpuCaches caches, bool keepBlocks);
 void CpuPrintRegs(Cpu *cpu);
 void CpuPrintStack(Cpu *cpu);
+const CpuIdleLoopStats *CpuGetIdleLoopStats(Cpu *cpu, size_t *count);
+void CpuGetStats(Cpu *cpu, SystemStats *stats);
 ASSUME_NONNULL_END
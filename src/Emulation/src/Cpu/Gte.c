@@ -0,0 +1,822 @@
+#include "Gte.h"
+#include <immintrin.h>
+#include <string.h>
+
+ASSUME_NONNULL_BEGIN
+
+#define kGteFlagError 0x80000000
+#define kGteFlagErrorMask 0x7F87E000
+#define kGteFlagMacPositive(index) (0x80000000 >> (index))
+#define kGteFlagMacNegative(index) (0x10000000 >> (index))
+#define kGteFlagIrSaturated(index) (0x02000000 >> (index))
+#define kGteFlagColorSaturated(index) (0x00400000 >> (index))
+#define kGteFlagSzSaturated 0x00040000
+#define kGteFlagDivideOverflow 0x00020000
+#define kGteFlagMac0Positive 0x00010000
+#define kGteFlagMac0Negative 0x00008000
+#define kGteFlagSxSaturated 0x00004000
+#define kGteFlagSySaturated 0x00002000
+#define kGteFlagIr0Saturated 0x00001000
+
+static const int64_t kGteMacMax = (1LL << 43) - 1;
+static const int64_t kGteMacMin = -(1LL << 43);
+static const int32_t kGteIrMax = 0x7FFF;
+static const int32_t kGteIrMin = -0x8000;
+static const int32_t kGteZero[3] = {0, 0, 0};
+
+// Reciprocal seeds for the UNR division, indexed by the normalized divisor.
+static const uint8_t kUnrTable[257] = {
+    0xFF, 0xFD, 0xFB, 0xF9, 0xF7, 0xF5, 0xF3, 0xF1, 0xEF, 0xEE, 0xEC, 0xEA, 0xE8, 0xE6, 0xE4, 0xE3, 0xE1, 0xDF, 0xDD,
+    0xDC, 0xDA, 0xD8, 0xD6, 0xD5, 0xD3, 0xD1, 0xD0, 0xCE, 0xCD, 0xCB, 0xC9, 0xC8, 0xC6, 0xC5, 0xC3, 0xC1, 0xC0, 0xBE,
+    0xBD, 0xBB, 0xBA, 0xB8, 0xB7, 0xB5, 0xB4, 0xB2, 0xB1, 0xB0, 0xAE, 0xAD, 0xAB, 0xAA, 0xA9, 0xA7, 0xA6, 0xA4, 0xA3,
+    0xA2, 0xA0, 0x9F, 0x9E, 0x9C, 0x9B, 0x9A, 0x99, 0x97, 0x96, 0x95, 0x94, 0x92, 0x91, 0x90, 0x8F, 0x8D, 0x8C, 0x8B,
+    0x8A, 0x89, 0x87, 0x86, 0x85, 0x84, 0x83, 0x82, 0x81, 0x7F, 0x7E, 0x7D, 0x7C, 0x7B, 0x7A, 0x79, 0x78, 0x77, 0x75,
+    0x74, 0x73, 0x72, 0x71, 0x70, 0x6F, 0x6E, 0x6D, 0x6C, 0x6B, 0x6A, 0x69, 0x68, 0x67, 0x66, 0x65, 0x64, 0x63, 0x62,
+    0x61, 0x60, 0x5F, 0x5E, 0x5D, 0x5D, 0x5C, 0x5B, 0x5A, 0x59, 0x58, 0x57, 0x56, 0x55, 0x54, 0x53, 0x53, 0x52, 0x51,
+    0x50, 0x4F, 0x4E, 0x4D, 0x4D, 0x4C, 0x4B, 0x4A, 0x49, 0x48, 0x48, 0x47, 0x46, 0x45, 0x44, 0x43, 0x43, 0x42, 0x41,
+    0x40, 0x3F, 0x3F, 0x3E, 0x3D, 0x3C, 0x3C, 0x3B, 0x3A, 0x39, 0x39, 0x38, 0x37, 0x36, 0x36, 0x35, 0x34, 0x33, 0x33,
+    0x32, 0x31, 0x31, 0x30, 0x2F, 0x2E, 0x2E, 0x2D, 0x2C, 0x2C, 0x2B, 0x2A, 0x2A, 0x29, 0x28, 0x28, 0x27, 0x26, 0x26,
+    0x25, 0x24, 0x24, 0x23, 0x22, 0x22, 0x21, 0x20, 0x20, 0x1F, 0x1E, 0x1E, 0x1D, 0x1D, 0x1C, 0x1B, 0x1B, 0x1A, 0x19,
+    0x19, 0x18, 0x18, 0x17, 0x16, 0x16, 0x15, 0x15, 0x14, 0x14, 0x13, 0x12, 0x12, 0x11, 0x11, 0x10, 0x0F, 0x0F, 0x0E,
+    0x0E, 0x0D, 0x0D, 0x0C, 0x0C, 0x0B, 0x0A, 0x0A, 0x09, 0x09, 0x08, 0x08, 0x07, 0x07, 0x06, 0x06, 0x05, 0x05, 0x04,
+    0x04, 0x03, 0x03, 0x02, 0x02, 0x01, 0x01, 0x00, 0x00, 0x00};
+
+static const uint8_t kGteCycles[64] = {
+    [0x01] = 15, [0x06] = 8,  [0x0C] = 6, [0x10] = 8,  [0x11] = 8,  [0x12] = 8, [0x13] = 19, [0x14] = 13,
+    [0x16] = 44, [0x1B] = 17, [0x1C] = 11, [0x1E] = 14, [0x20] = 30, [0x28] = 5, [0x29] = 8,  [0x2A] = 17,
+    [0x2D] = 5,  [0x2E] = 6,  [0x30] = 23, [0x3D] = 5,  [0x3E] = 5,  [0x3F] = 39};
+
+typedef union packed __GteCommand {
+  uint32_t value;
+  struct packed __GteCommandParsed {
+    uint32_t opcode : 6;
+    uint32_t unused6_9 : 4;
+    uint32_t lm : 1;
+    uint32_t unused11_12 : 2;
+    uint32_t translation : 2;
+    uint32_t vector : 2;
+    uint32_t matrix : 2;
+    uint32_t sf : 1;
+    uint32_t unused20_31 : 12;
+  } parsed;
+} GteCommand;
+
+void GteReset(Gte *gte) { memset(gte, 0, sizeof(Gte)); }
+
+static inline int32_t Clamp(int32_t value, int32_t min, int32_t max) {
+  return value < min ? min : (value > max ? max : value);
+}
+
+static inline uint32_t PackHalves(int16_t low, int16_t high) { return (uint16_t)low | ((uint32_t)(uint16_t)high << 16); }
+
+static inline int16_t LowHalf(uint32_t value) { return (int16_t)(value & 0xFFFF); }
+
+static inline int16_t HighHalf(uint32_t value) { return (int16_t)(value >> 16); }
+
+static inline uint32_t PackBytes(const uint8_t bytes[4]) {
+  return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+static inline void UnpackBytes(uint8_t bytes[4], uint32_t value) {
+  bytes[0] = value & 0xFF;
+  bytes[1] = (value >> 8) & 0xFF;
+  bytes[2] = (value >> 16) & 0xFF;
+  bytes[3] = value >> 24;
+}
+
+static uint32_t ReadOrgb(Gte *gte) {
+  uint32_t r = Clamp(gte->ir[1] >> 7, 0, 0x1F);
+  uint32_t g = Clamp(gte->ir[2] >> 7, 0, 0x1F);
+  uint32_t b = Clamp(gte->ir[3] >> 7, 0, 0x1F);
+  return r | (g << 5) | (b << 10);
+}
+
+uint32_t GteReadData(Gte *gte, uint32_t reg) {
+  switch (reg) {
+  case 0:
+  case 2:
+  case 4:
+    return PackHalves(gte->v[reg >> 1][0], gte->v[reg >> 1][1]);
+  case 1:
+  case 3:
+  case 5:
+    return (uint32_t)(int32_t)gte->v[reg >> 1][2];
+  case 6:
+    return PackBytes(gte->rgbc);
+  case 7:
+    return gte->otz;
+  case 8:
+  case 9:
+  case 10:
+  case 11:
+    return (uint32_t)(int32_t)gte->ir[reg - 8];
+  case 12:
+  case 13:
+  case 14:
+    return PackHalves(gte->sxy[reg - 12][0], gte->sxy[reg - 12][1]);
+  case 15:
+    return PackHalves(gte->sxy[2][0], gte->sxy[2][1]);
+  case 16:
+  case 17:
+  case 18:
+  case 19:
+    return gte->sz[reg - 16];
+  case 20:
+  case 21:
+  case 22:
+    return PackBytes(gte->rgb[reg - 20]);
+  case 23:
+    return gte->res1;
+  case 24:
+  case 25:
+  case 26:
+  case 27:
+    return (uint32_t)gte->mac[reg - 24];
+  case 28:
+  case 29:
+    return ReadOrgb(gte);
+  case 30:
+    return (uint32_t)gte->lzcs;
+  default:
+    return gte->lzcr;
+  }
+}
+
+static void PushSxy(Gte *gte, int16_t x, int16_t y) {
+  memmove(gte->sxy[0], gte->sxy[1], sizeof(gte->sxy[0]) * 2);
+  gte->sxy[2][0] = x;
+  gte->sxy[2][1] = y;
+}
+
+void GteWriteData(Gte *gte, uint32_t reg, uint32_t value) {
+  switch (reg) {
+  case 0:
+  case 2:
+  case 4:
+    gte->v[reg >> 1][0] = LowHalf(value);
+    gte->v[reg >> 1][1] = HighHalf(value);
+    return;
+  case 1:
+  case 3:
+  case 5:
+    gte->v[reg >> 1][2] = LowHalf(value);
+    return;
+  case 6:
+    UnpackBytes(gte->rgbc, value);
+    return;
+  case 7:
+    gte->otz = value & 0xFFFF;
+    return;
+  case 8:
+  case 9:
+  case 10:
+  case 11:
+    gte->ir[reg - 8] = LowHalf(value);
+    return;
+  case 12:
+  case 13:
+  case 14:
+    gte->sxy[reg - 12][0] = LowHalf(value);
+    gte->sxy[reg - 12][1] = HighHalf(value);
+    return;
+  case 15:
+    PushSxy(gte, LowHalf(value), HighHalf(value));
+    return;
+  case 16:
+  case 17:
+  case 18:
+  case 19:
+    gte->sz[reg - 16] = value & 0xFFFF;
+    return;
+  case 20:
+  case 21:
+  case 22:
+    UnpackBytes(gte->rgb[reg - 20], value);
+    return;
+  case 23:
+    gte->res1 = value;
+    return;
+  case 24:
+  case 25:
+  case 26:
+  case 27:
+    gte->mac[reg - 24] = (int32_t)value;
+    return;
+  case 28:
+    gte->ir[1] = (value & 0x1F) << 7;
+    gte->ir[2] = ((value >> 5) & 0x1F) << 7;
+    gte->ir[3] = ((value >> 10) & 0x1F) << 7;
+    return;
+  case 30: {
+    gte->lzcs = (int32_t)value;
+    uint32_t bits = gte->lzcs < 0 ? ~value : value;
+    gte->lzcr = bits == 0 ? 32 : __builtin_clz(bits);
+    return;
+  }
+  default:
+    // ORGB and LZCR are read-only.
+    return;
+  }
+}
+
+// Control registers are laid out as three blocks of eight: a 3x3 matrix in
+// five registers followed by a vector, then the screen and depth parameters.
+uint32_t GteReadControl(Gte *gte, uint32_t reg) {
+  if (reg < 24) {
+    uint32_t block = reg >> 3;
+    uint32_t index = reg & 0x7;
+    if (index >= 5) {
+      return (uint32_t)gte->vectors[block][index - 5];
+    }
+    const int16_t *matrix = &gte->matrices[block][0][0];
+    if (index == 4) {
+      return (uint32_t)(int32_t)matrix[8];
+    }
+    return PackHalves(matrix[index * 2], matrix[index * 2 + 1]);
+  }
+  switch (reg) {
+  case 24:
+    return (uint32_t)gte->ofx;
+  case 25:
+    return (uint32_t)gte->ofy;
+  case 26:
+    // H is unsigned but reads back sign extended.
+    return (uint32_t)(int32_t)(int16_t)gte->h;
+  case 27:
+    return (uint32_t)(int32_t)gte->dqa;
+  case 28:
+    return (uint32_t)gte->dqb;
+  case 29:
+    return (uint32_t)(int32_t)gte->zsf3;
+  case 30:
+    return (uint32_t)(int32_t)gte->zsf4;
+  default:
+    return gte->flag;
+  }
+}
+
+void GteWriteControl(Gte *gte, uint32_t reg, uint32_t value) {
+  if (reg < 24) {
+    uint32_t block = reg >> 3;
+    uint32_t index = reg & 0x7;
+    if (index >= 5) {
+      gte->vectors[block][index - 5] = (int32_t)value;
+      return;
+    }
+    int16_t *matrix = &gte->matrices[block][0][0];
+    matrix[index * 2] = LowHalf(value);
+    if (index < 4) {
+      matrix[index * 2 + 1] = HighHalf(value);
+    }
+    return;
+  }
+  switch (reg) {
+  case 24:
+    gte->ofx = (int32_t)value;
+    return;
+  case 25:
+    gte->ofy = (int32_t)value;
+    return;
+  case 26:
+    gte->h = value & 0xFFFF;
+    return;
+  case 27:
+    gte->dqa = LowHalf(value);
+    return;
+  case 28:
+    gte->dqb = (int32_t)value;
+    return;
+  case 29:
+    gte->zsf3 = LowHalf(value);
+    return;
+  case 30:
+    gte->zsf4 = LowHalf(value);
+    return;
+  default:
+    gte->flag = value & 0x7FFFF000;
+    if (gte->flag & kGteFlagErrorMask) {
+      gte->flag |= kGteFlagError;
+    }
+  }
+}
+
+// Scalar accumulator steps. MAC1-3 are 44-bit accumulators that flag an
+// overflow after every addition and wrap, the value stored in the register
+// is the low 32 bits after the sf shift.
+
+static inline int64_t CheckMac(Gte *gte, uint32_t index, int64_t value) {
+  if (value > kGteMacMax) {
+    gte->flag |= kGteFlagMacPositive(index);
+  } else if (value < kGteMacMin) {
+    gte->flag |= kGteFlagMacNegative(index);
+  }
+  return value;
+}
+
+static inline int64_t WrapMac(Gte *gte, uint32_t index, int64_t value) {
+  CheckMac(gte, index, value);
+  return (int64_t)((uint64_t)value << 20) >> 20;
+}
+
+static inline void SetMac(Gte *gte, uint32_t index, int64_t value, uint32_t shift) {
+  CheckMac(gte, index, value);
+  gte->mac[index] = (int32_t)(value >> shift);
+}
+
+static inline void SetIr(Gte *gte, uint32_t index, int32_t value, bool lm) {
+  int32_t ir = Clamp(value, lm ? 0 : kGteIrMin, kGteIrMax);
+  if (ir != value) {
+    gte->flag |= kGteFlagIrSaturated(index);
+  }
+  gte->ir[index] = (int16_t)ir;
+}
+
+static inline void SetMacAndIr(Gte *gte, uint32_t index, int64_t value, uint32_t shift, bool lm) {
+  SetMac(gte, index, value, shift);
+  SetIr(gte, index, gte->mac[index], lm);
+}
+
+static inline void SetMac0(Gte *gte, int64_t value) {
+  if (value > INT32_MAX) {
+    gte->flag |= kGteFlagMac0Positive;
+  } else if (value < INT32_MIN) {
+    gte->flag |= kGteFlagMac0Negative;
+  }
+  gte->mac[0] = (int32_t)value;
+}
+
+static inline void SetIr0(Gte *gte, int64_t value) {
+  int64_t ir = value < 0 ? 0 : (value > 0x1000 ? 0x1000 : value);
+  if (ir != value) {
+    gte->flag |= kGteFlagIr0Saturated;
+  }
+  gte->ir[0] = (int16_t)ir;
+}
+
+static inline uint16_t SaturateSz(Gte *gte, int64_t value) {
+  if (value < 0 || value > 0xFFFF) {
+    gte->flag |= kGteFlagSzSaturated;
+    return value < 0 ? 0 : 0xFFFF;
+  }
+  return (uint16_t)value;
+}
+
+static inline void PushSz(Gte *gte, int64_t value) {
+  gte->sz[0] = gte->sz[1];
+  gte->sz[1] = gte->sz[2];
+  gte->sz[2] = gte->sz[3];
+  gte->sz[3] = SaturateSz(gte, value);
+}
+
+static inline int16_t SaturateScreen(Gte *gte, int64_t value, uint32_t flag) {
+  if (value < -0x400 || value > 0x3FF) {
+    gte->flag |= flag;
+    return value < 0 ? -0x400 : 0x3FF;
+  }
+  return (int16_t)value;
+}
+
+static inline uint8_t SaturateColor(Gte *gte, int32_t value, uint32_t index) {
+  if (value < 0 || value > 0xFF) {
+    gte->flag |= kGteFlagColorSaturated(index);
+    return value < 0 ? 0 : 0xFF;
+  }
+  return (uint8_t)value;
+}
+
+static void PushColor(Gte *gte) {
+  memmove(gte->rgb[0], gte->rgb[1], sizeof(gte->rgb[0]) * 2);
+  gte->rgb[2][0] = SaturateColor(gte, gte->mac[1] >> 4, 1);
+  gte->rgb[2][1] = SaturateColor(gte, gte->mac[2] >> 4, 2);
+  gte->rgb[2][2] = SaturateColor(gte, gte->mac[3] >> 4, 3);
+  gte->rgb[2][3] = gte->rgbc[3];
+}
+
+// Perspective division H / SZ3 by Newton-Raphson from a table seed, the same
+// unsigned reciprocal (UNR) algorithm the hardware uses.
+static uint32_t Divide(Gte *gte) {
+  uint32_t sz3 = gte->sz[3];
+  if (gte->h >= sz3 * 2) {
+    gte->flag |= kGteFlagDivideOverflow;
+    return 0x1FFFF;
+  }
+  uint32_t shift = __builtin_clz(sz3) - 16;
+  uint32_t n = (uint32_t)gte->h << shift;
+  uint32_t d = sz3 << shift;
+  uint32_t u = kUnrTable[(d - 0x7FC0) >> 7] + 0x101;
+  d = (0x2000080 - d * u) >> 8;
+  d = (0x0000080 + d * u) >> 8;
+  uint64_t result = ((uint64_t)n * d + 0x8000) >> 16;
+  return result > 0x1FFFF ? 0x1FFFF : (uint32_t)result;
+}
+
+// SIMD kernels. Four independent 44-bit accumulations run in the 64-bit lanes
+// of an AVX2 register, their 16-bit operands sign extended to 32-bit SSE4.1
+// lanes where a product can not overflow. Lane 3 is padding.
+
+// AVX2 has no 64-bit arithmetic shift, so sign extension from bit 43 is done
+// by flipping and subtracting the sign bit.
+static inline __m256i Wrap44(__m256i value) {
+  const __m256i mask = _mm256_set1_epi64x((1LL << 44) - 1);
+  const __m256i sign = _mm256_set1_epi64x(1LL << 43);
+  return _mm256_sub_epi64(_mm256_xor_si256(_mm256_and_si256(value, mask), sign), sign);
+}
+
+static inline void CheckMacLanes(__m256i value, __m256i *positive, __m256i *negative) {
+  *positive = _mm256_or_si256(*positive, _mm256_cmpgt_epi64(value, _mm256_set1_epi64x(kGteMacMax)));
+  *negative = _mm256_or_si256(*negative, _mm256_cmpgt_epi64(_mm256_set1_epi64x(kGteMacMin), value));
+}
+
+// (t << 12) + a0 * b0 + a1 * b1 + a2 * b2 per lane with the hardware's
+// overflow check and wrap after every addition.
+static inline __m256i MacLanes(__m256i t, __m128i a0, __m128i b0, __m128i a1, __m128i b1, __m128i a2, __m128i b2,
+                               __m256i *positive, __m256i *negative) {
+  __m256i sum = _mm256_add_epi64(_mm256_slli_epi64(t, 12), _mm256_cvtepi32_epi64(_mm_mullo_epi32(a0, b0)));
+  CheckMacLanes(sum, positive, negative);
+  sum = _mm256_add_epi64(Wrap44(sum), _mm256_cvtepi32_epi64(_mm_mullo_epi32(a1, b1)));
+  CheckMacLanes(sum, positive, negative);
+  sum = _mm256_add_epi64(Wrap44(sum), _mm256_cvtepi32_epi64(_mm_mullo_epi32(a2, b2)));
+  CheckMacLanes(sum, positive, negative);
+  return sum;
+}
+
+// The low 32 bits of a logical and an arithmetic shift agree for shifts of 32
+// or less, which is all the MAC registers keep.
+static inline __m128i ShiftLanes(__m256i sum, uint32_t shift) {
+  __m256i shifted = _mm256_srl_epi64(sum, _mm_cvtsi32_si128(shift));
+  return _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(shifted, _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6)));
+}
+
+static inline uint32_t LaneMask(__m256i lanes) { return _mm256_movemask_pd(_mm256_castsi256_pd(lanes)) & 0x7; }
+
+// Computes MAC1-3 = ((t << 12) + m * v) >> shift and saturates IR1-3 from
+// them, the three rows in parallel lanes.
+static void MultiplyMatrixByVector(Gte *gte, int16_t m[3][3], const int16_t v[3], const int32_t t[3],
+                                   uint32_t shift, bool lm) {
+  __m256i positive = _mm256_setzero_si256();
+  __m256i negative = _mm256_setzero_si256();
+  __m256i sum = MacLanes(_mm256_setr_epi64x(t[0], t[1], t[2], 0), _mm_setr_epi32(m[0][0], m[1][0], m[2][0], 0),
+                         _mm_set1_epi32(v[0]), _mm_setr_epi32(m[0][1], m[1][1], m[2][1], 0), _mm_set1_epi32(v[1]),
+                         _mm_setr_epi32(m[0][2], m[1][2], m[2][2], 0), _mm_set1_epi32(v[2]), &positive, &negative);
+  __m128i mac = ShiftLanes(sum, shift);
+  __m128i ir = _mm_min_epi32(_mm_max_epi32(mac, _mm_set1_epi32(lm ? 0 : kGteIrMin)), _mm_set1_epi32(kGteIrMax));
+  uint32_t saturated = ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(ir, mac))) & 0x7;
+  uint32_t overflowPositive = LaneMask(positive);
+  uint32_t overflowNegative = LaneMask(negative);
+  int32_t values[4];
+  _mm_storeu_si128((__m128i *)values, mac);
+  uint32_t i;
+  for (i = 0; i < 3; i++) {
+    if (overflowPositive & (1 << i)) {
+      gte->flag |= kGteFlagMacPositive(i + 1);
+    }
+    if (overflowNegative & (1 << i)) {
+      gte->flag |= kGteFlagMacNegative(i + 1);
+    }
+    if (saturated & (1 << i)) {
+      gte->flag |= kGteFlagIrSaturated(i + 1);
+    }
+    gte->mac[i + 1] = values[i];
+  }
+  _mm_storeu_si128((__m128i *)values, ir);
+  gte->ir[1] = (int16_t)values[0];
+  gte->ir[2] = (int16_t)values[1];
+  gte->ir[3] = (int16_t)values[2];
+}
+
+// The MVMVA far color translation is broken on hardware: the first column is
+// only used to set flags, the result comes from the other two.
+static void MultiplyMatrixByVectorFarColorBug(Gte *gte, int16_t m[3][3], const int16_t v[3], uint32_t shift,
+                                              bool lm) {
+  const int32_t *t = gte->vectors[GteVectorFarColor];
+  uint32_t i;
+  for (i = 0; i < 3; i++) {
+    int64_t first = WrapMac(gte, i + 1, ((int64_t)t[i] << 12) + (int64_t)m[i][0] * v[0]);
+    SetIr(gte, i + 1, (int32_t)(first >> shift), false);
+    int64_t sum = WrapMac(gte, i + 1, (int64_t)m[i][1] * v[1]) + (int64_t)m[i][2] * v[2];
+    SetMacAndIr(gte, i + 1, sum, shift, lm);
+  }
+}
+
+// Finishes a perspective transformation from the raw MAC1-3 sums: IR1-3, the
+// SZ and SXY FIFOs and, for the last vertex, depth cueing into MAC0/IR0.
+static void Project(Gte *gte, int64_t x, int64_t y, int64_t z, uint32_t shift, bool lm, bool last) {
+  gte->mac[1] = (int32_t)(x >> shift);
+  gte->mac[2] = (int32_t)(y >> shift);
+  gte->mac[3] = (int32_t)(z >> shift);
+  SetIr(gte, 1, gte->mac[1], lm);
+  SetIr(gte, 2, gte->mac[2], lm);
+  // IR3 saturates from MAC3 but flags from the unshifted depth, whatever sf is.
+  int32_t depth = (int32_t)(z >> 12);
+  if (depth < kGteIrMin || depth > kGteIrMax) {
+    gte->flag |= kGteFlagIrSaturated(3);
+  }
+  gte->ir[3] = (int16_t)Clamp(gte->mac[3], lm ? 0 : kGteIrMin, kGteIrMax);
+  PushSz(gte, depth);
+  int64_t divisor = Divide(gte);
+  int64_t sx = divisor * gte->ir[1] + gte->ofx;
+  int64_t sy = divisor * gte->ir[2] + gte->ofy;
+  SetMac0(gte, sx);
+  SetMac0(gte, sy);
+  PushSxy(gte, SaturateScreen(gte, sx >> 16, kGteFlagSxSaturated), SaturateScreen(gte, sy >> 16, kGteFlagSySaturated));
+  if (last) {
+    int64_t sz = divisor * gte->dqa + gte->dqb;
+    SetMac0(gte, sz);
+    SetIr0(gte, sz >> 12);
+  }
+}
+
+static void Rtps(Gte *gte, uint32_t shift, bool lm) {
+  int16_t(*m)[3] = gte->matrices[GteMatrixRotation];
+  const int32_t *t = gte->vectors[GteVectorTranslation];
+  const int16_t *v = gte->v[0];
+  __m256i positive = _mm256_setzero_si256();
+  __m256i negative = _mm256_setzero_si256();
+  __m256i sum = MacLanes(_mm256_setr_epi64x(t[0], t[1], t[2], 0), _mm_setr_epi32(m[0][0], m[1][0], m[2][0], 0),
+                         _mm_set1_epi32(v[0]), _mm_setr_epi32(m[0][1], m[1][1], m[2][1], 0), _mm_set1_epi32(v[1]),
+                         _mm_setr_epi32(m[0][2], m[1][2], m[2][2], 0), _mm_set1_epi32(v[2]), &positive, &negative);
+  uint32_t overflowPositive = LaneMask(positive);
+  uint32_t overflowNegative = LaneMask(negative);
+  uint32_t i;
+  for (i = 0; i < 3; i++) {
+    if (overflowPositive & (1 << i)) {
+      gte->flag |= kGteFlagMacPositive(i + 1);
+    }
+    if (overflowNegative & (1 << i)) {
+      gte->flag |= kGteFlagMacNegative(i + 1);
+    }
+  }
+  int64_t values[4];
+  _mm256_storeu_si256((__m256i *)values, sum);
+  Project(gte, values[0], values[1], values[2], shift, lm, true);
+}
+
+// RTPT transforms V0-V2 at once: each row of the rotation matrix is one MAC
+// with the three vertices in its lanes, the projections then run in order.
+static void Rtpt(Gte *gte, uint32_t shift, bool lm) {
+  int16_t(*m)[3] = gte->matrices[GteMatrixRotation];
+  const int32_t *t = gte->vectors[GteVectorTranslation];
+  int16_t(*v)[3] = gte->v;
+  __m128i x = _mm_setr_epi32(v[0][0], v[1][0], v[2][0], 0);
+  __m128i y = _mm_setr_epi32(v[0][1], v[1][1], v[2][1], 0);
+  __m128i z = _mm_setr_epi32(v[0][2], v[1][2], v[2][2], 0);
+  int64_t rows[3][4];
+  uint32_t i;
+  for (i = 0; i < 3; i++) {
+    __m256i positive = _mm256_setzero_si256();
+    __m256i negative = _mm256_setzero_si256();
+    __m256i sum = MacLanes(_mm256_set1_epi64x(t[i]), _mm_set1_epi32(m[i][0]), x, _mm_set1_epi32(m[i][1]), y,
+                           _mm_set1_epi32(m[i][2]), z, &positive, &negative);
+    if (LaneMask(positive)) {
+      gte->flag |= kGteFlagMacPositive(i + 1);
+    }
+    if (LaneMask(negative)) {
+      gte->flag |= kGteFlagMacNegative(i + 1);
+    }
+    _mm256_storeu_si256((__m256i *)rows[i], sum);
+  }
+  for (i = 0; i < 3; i++) {
+    Project(gte, rows[0][i], rows[1][i], rows[2][i], shift, lm, i == 2);
+  }
+}
+
+// [MAC1-3] = MAC + (FC - MAC) * IR0, starting from the given MAC values.
+static void InterpolateColor(Gte *gte, const int64_t mac[3], uint32_t shift, bool lm) {
+  uint32_t i;
+  for (i = 0; i < 3; i++) {
+    SetMacAndIr(gte, i + 1, ((int64_t)gte->vectors[GteVectorFarColor][i] << 12) - mac[i], shift, false);
+  }
+  for (i = 0; i < 3; i++) {
+    SetMacAndIr(gte, i + 1, (int64_t)gte->ir[i + 1] * gte->ir[0] + mac[i], shift, lm);
+  }
+}
+
+static void ColorTimesIr(const Gte *gte, int64_t mac[3]) {
+  uint32_t i;
+  for (i = 0; i < 3; i++) {
+    mac[i] = ((int64_t)gte->rgbc[i] * gte->ir[i + 1]) << 4;
+  }
+}
+
+static void CurrentIr(const Gte *gte, int16_t ir[3]) {
+  ir[0] = gte->ir[1];
+  ir[1] = gte->ir[2];
+  ir[2] = gte->ir[3];
+}
+
+// [IR1-3] = BK + LCM * IR, the color of the light falling on a vertex.
+static void LightColor(Gte *gte, uint32_t shift, bool lm) {
+  int16_t ir[3];
+  CurrentIr(gte, ir);
+  MultiplyMatrixByVector(gte, gte->matrices[GteMatrixLightColor], ir, gte->vectors[GteVectorBackgroundColor], shift,
+                         lm);
+}
+
+static void Nc(Gte *gte, const int16_t v[3], uint32_t shift, bool lm) {
+  MultiplyMatrixByVector(gte, gte->matrices[GteMatrixLight], v, kGteZero, shift, lm);
+  LightColor(gte, shift, lm);
+  PushColor(gte);
+}
+
+static void Ncc(Gte *gte, const int16_t v[3], uint32_t shift, bool lm) {
+  MultiplyMatrixByVector(gte, gte->matrices[GteMatrixLight], v, kGteZero, shift, lm);
+  LightColor(gte, shift, lm);
+  int64_t mac[3];
+  ColorTimesIr(gte, mac);
+  uint32_t i;
+  for (i = 0; i < 3; i++) {
+    SetMacAndIr(gte, i + 1, mac[i], shift, lm);
+  }
+  PushColor(gte);
+}
+
+static void Ncd(Gte *gte, const int16_t v[3], uint32_t shift, bool lm) {
+  MultiplyMatrixByVector(gte, gte->matrices[GteMatrixLight], v, kGteZero, shift, lm);
+  LightColor(gte, shift, lm);
+  int64_t mac[3];
+  ColorTimesIr(gte, mac);
+  InterpolateColor(gte, mac, shift, lm);
+  PushColor(gte);
+}
+
+static void Dpc(Gte *gte, const uint8_t color[3], uint32_t shift, bool lm) {
+  int64_t mac[3] = {(int64_t)color[0] << 16, (int64_t)color[1] << 16, (int64_t)color[2] << 16};
+  InterpolateColor(gte, mac, shift, lm);
+  PushColor(gte);
+}
+
+static void Mvmva(Gte *gte, GteCommand command, uint32_t shift, bool lm) {
+  int16_t garbage[3][3];
+  int16_t(*m)[3];
+  if (command.parsed.matrix == 3) {
+    int16_t r = gte->rgbc[0] << 4;
+    int16_t rt13 = gte->matrices[GteMatrixRotation][0][2];
+    int16_t rt22 = gte->matrices[GteMatrixRotation][1][1];
+    int16_t rows[3][3] = {{-r, r, gte->ir[0]}, {rt13, rt13, rt13}, {rt22, rt22, rt22}};
+    memcpy(garbage, rows, sizeof(garbage));
+    m = garbage;
+  } else {
+    m = gte->matrices[command.parsed.matrix];
+  }
+  int16_t ir[3];
+  const int16_t *v;
+  if (command.parsed.vector == 3) {
+    CurrentIr(gte, ir);
+    v = ir;
+  } else {
+    v = gte->v[command.parsed.vector];
+  }
+  switch (command.parsed.translation) {
+  case 2:
+    MultiplyMatrixByVectorFarColorBug(gte, m, v, shift, lm);
+    return;
+  case 3:
+    MultiplyMatrixByVector(gte, m, v, kGteZero, shift, lm);
+    return;
+  default:
+    MultiplyMatrixByVector(gte, m, v, gte->vectors[command.parsed.translation], shift, lm);
+  }
+}
+
+uint32_t GteExecute(Gte *gte, uint32_t value) {
+  GteCommand command = {.value = value};
+  uint32_t shift = command.parsed.sf ? 12 : 0;
+  bool lm = command.parsed.lm;
+  gte->flag = 0;
+  switch (command.parsed.opcode) {
+  case 0x01:
+    Rtps(gte, shift, lm);
+    break;
+  case 0x06: {
+    int64_t x0 = gte->sxy[0][0], y0 = gte->sxy[0][1];
+    int64_t x1 = gte->sxy[1][0], y1 = gte->sxy[1][1];
+    int64_t x2 = gte->sxy[2][0], y2 = gte->sxy[2][1];
+    SetMac0(gte, x0 * y1 + x1 * y2 + x2 * y0 - x0 * y2 - x1 * y0 - x2 * y1);
+    break;
+  }
+  case 0x0C: {
+    int16_t(*rt)[3] = gte->matrices[GteMatrixRotation];
+    int64_t ir1 = gte->ir[1], ir2 = gte->ir[2], ir3 = gte->ir[3];
+    SetMacAndIr(gte, 1, ir3 * rt[1][1] - ir2 * rt[2][2], shift, lm);
+    SetMacAndIr(gte, 2, ir1 * rt[2][2] - ir3 * rt[0][0], shift, lm);
+    SetMacAndIr(gte, 3, ir2 * rt[0][0] - ir1 * rt[1][1], shift, lm);
+    break;
+  }
+  case 0x10:
+    Dpc(gte, gte->rgbc, shift, lm);
+    break;
+  case 0x11: {
+    int64_t mac[3] = {(int64_t)gte->ir[1] << 12, (int64_t)gte->ir[2] << 12, (int64_t)gte->ir[3] << 12};
+    InterpolateColor(gte, mac, shift, lm);
+    PushColor(gte);
+    break;
+  }
+  case 0x12:
+    Mvmva(gte, command, shift, lm);
+    break;
+  case 0x13:
+    Ncd(gte, gte->v[0], shift, lm);
+    break;
+  case 0x14: {
+    LightColor(gte, shift, lm);
+    int64_t mac[3];
+    ColorTimesIr(gte, mac);
+    InterpolateColor(gte, mac, shift, lm);
+    PushColor(gte);
+    break;
+  }
+  case 0x16:
+    Ncd(gte, gte->v[0], shift, lm);
+    Ncd(gte, gte->v[1], shift, lm);
+    Ncd(gte, gte->v[2], shift, lm);
+    break;
+  case 0x1B:
+    Ncc(gte, gte->v[0], shift, lm);
+    break;
+  case 0x1C: {
+    LightColor(gte, shift, lm);
+    int64_t mac[3];
+    ColorTimesIr(gte, mac);
+    uint32_t i;
+    for (i = 0; i < 3; i++) {
+      SetMacAndIr(gte, i + 1, mac[i], shift, lm);
+    }
+    PushColor(gte);
+    break;
+  }
+  case 0x1E:
+    Nc(gte, gte->v[0], shift, lm);
+    break;
+  case 0x20:
+    Nc(gte, gte->v[0], shift, lm);
+    Nc(gte, gte->v[1], shift, lm);
+    Nc(gte, gte->v[2], shift, lm);
+    break;
+  case 0x28: {
+    uint32_t i;
+    for (i = 1; i < 4; i++) {
+      SetMacAndIr(gte, i, (int64_t)gte->ir[i] * gte->ir[i], shift, lm);
+    }
+    break;
+  }
+  case 0x29: {
+    int64_t mac[3];
+    ColorTimesIr(gte, mac);
+    InterpolateColor(gte, mac, shift, lm);
+    PushColor(gte);
+    break;
+  }
+  case 0x2A:
+    // Each pass consumes the oldest entry of the color FIFO.
+    Dpc(gte, gte->rgb[0], shift, lm);
+    Dpc(gte, gte->rgb[0], shift, lm);
+    Dpc(gte, gte->rgb[0], shift, lm);
+    break;
+  case 0x2D: {
+    int64_t sum = (int64_t)gte->zsf3 * (gte->sz[1] + gte->sz[2] + gte->sz[3]);
+    SetMac0(gte, sum);
+    gte->otz = SaturateSz(gte, sum >> 12);
+    break;
+  }
+  case 0x2E: {
+    int64_t sum = (int64_t)gte->zsf4 * (gte->sz[0] + gte->sz[1] + gte->sz[2] + gte->sz[3]);
+    SetMac0(gte, sum);
+    gte->otz = SaturateSz(gte, sum >> 12);
+    break;
+  }
+  case 0x30:
+    Rtpt(gte, shift, lm);
+    break;
+  case 0x3D: {
+    uint32_t i;
+    for (i = 1; i < 4; i++) {
+      SetMacAndIr(gte, i, (int64_t)gte->ir[i] * gte->ir[0], shift, lm);
+    }
+    PushColor(gte);
+    break;
+  }
+  case 0x3E: {
+    uint32_t i;
+    for (i = 1; i < 4; i++) {
+      int64_t mac = WrapMac(gte, i, (int64_t)gte->mac[i] << shift);
+      SetMacAndIr(gte, i, (int64_t)gte->ir[i] * gte->ir[0] + mac, shift, lm);
+    }
+    PushColor(gte);
+    break;
+  }
+  case 0x3F:
+    Ncc(gte, gte->v[0], shift, lm);
+    Ncc(gte, gte->v[1], shift, lm);
+    Ncc(gte, gte->v[2], shift, lm);
+    break;
+  default:
+    PCFDEBUG("Unknown GTE command: 0x%08x", value);
+    break;
+  }
+  if (gte->flag & kGteFlagErrorMask) {
+    gte->flag |= kGteFlagError;
+  }
+  return kGteCycles[command.parsed.opcode];
+}
+
+ASSUME_NONNULL_END
@@ -0,0 +1,45 @@
+#pragma once
+#include "../Types.h"
+
+ASSUME_NONNULL_BEGIN
+
+typedef enum __GteMatrix { GteMatrixRotation = 0, GteMatrixLight, GteMatrixLightColor } GteMatrix;
+
+typedef enum __GteVector { GteVectorTranslation = 0, GteVectorBackgroundColor, GteVectorFarColor } GteVector;
+
+// The geometry transformation engine (COP2). Registers are kept unpacked in
+// the widths the commands operate on, GteRead/GteWrite convert them from and
+// to the 32-bit values seen through mfc2/cfc2/lwc2.
+typedef struct __Gte {
+  int16_t v[3][3];
+  uint8_t rgbc[4];
+  uint16_t otz;
+  int16_t ir[4];
+  int16_t sxy[3][2];
+  uint16_t sz[4];
+  uint8_t rgb[3][4];
+  uint32_t res1;
+  int32_t mac[4];
+  int32_t lzcs;
+  uint32_t lzcr;
+  int16_t matrices[3][3][3];
+  int32_t vectors[3][3];
+  int32_t ofx;
+  int32_t ofy;
+  uint16_t h;
+  int16_t dqa;
+  int32_t dqb;
+  int16_t zsf3;
+  int16_t zsf4;
+  uint32_t flag;
+} Gte;
+
+void GteReset(Gte *gte);
+uint32_t GteReadData(Gte *gte, uint32_t reg);
+void GteWriteData(Gte *gte, uint32_t reg, uint32_t value);
+uint32_t GteReadControl(Gte *gte, uint32_t reg);
+void GteWriteControl(Gte *gte, uint32_t reg, uint32_t value);
+// Runs a cop2 command and returns the cycles it takes.
+uint32_t GteExecute(Gte *gte, uint32_t command);
+
+ASSUME_NONNULL_END
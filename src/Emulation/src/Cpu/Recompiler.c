@@ -0,0 +1,985 @@
+#include "Recompiler.h"
+#include "../Memory.h"
+#include "../System.h"
+#include <stddef.h>
+#include <string.h>
+
+#if RECOMPILER_SUPPORTED
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+ASSUME_NONNULL_BEGIN
+
+#define kRecompilerCodeSize (8 * 1024 * 1024)
+#define kRecompilerMaxBlockSize (kBlockCacheMaxOpsPerBlock * 512)
+#define kRecompilerMaxExits (kBlockCacheMaxOpsPerBlock * 2 + 1)
+#define kRecompilerNumGuestHostRegs 4
+#define kRecompilerPendingUnknown 0xFF
+#define kRecompilerFrameSize 40
+
+struct __Recompiler {
+  uint8_t *_Nullable code;
+  size_t position;
+  uint32_t generation;
+};
+
+#if RECOMPILER_SUPPORTED
+
+typedef enum {
+  HostRax = 0,
+  HostRcx,
+  HostRdx,
+  HostRbx,
+  HostRsp,
+  HostRbp,
+  HostRsi,
+  HostRdi,
+  HostR8,
+  HostR9,
+  HostR10,
+  HostR11,
+  HostR12,
+  HostR13,
+  HostR14,
+  HostR15
+} HostRegister;
+
+typedef enum {
+  ConditionNoOverflow = 0x1,
+  ConditionBelow = 0x2,
+  ConditionAboveEqual = 0x3,
+  ConditionEqual = 0x4,
+  ConditionNotEqual = 0x5,
+  ConditionLess = 0xC,
+  ConditionGreaterEqual = 0xD,
+  ConditionLessEqual = 0xE,
+  ConditionGreater = 0xF
+} HostCondition;
+
+// rbx holds the Cpu for the whole block and r15 the base of main RAM. eax, ecx
+// and edx carry guest operands, r8-r11 are scratch for address checks.
+static const HostRegister kCpuReg = HostRbx;
+static const HostRegister kRamReg = HostR15;
+static const HostRegister kGuestHostRegs[kRecompilerNumGuestHostRegs] = {HostR12, HostR13, HostR14, HostRbp};
+#if defined(_WIN32)
+static const HostRegister kArgReg0 = HostRcx;
+static const HostRegister kArgReg1 = HostRdx;
+static const HostRegister kArgReg2 = HostR8;
+#else
+static const HostRegister kArgReg0 = HostRdi;
+static const HostRegister kArgReg1 = HostRsi;
+static const HostRegister kArgReg2 = HostRdx;
+#endif
+
+typedef struct __Emitter {
+  uint8_t *cursor;
+} Emitter;
+
+typedef struct __Translation {
+  Emitter emitter;
+  Cpu *cpu;
+  uint8_t *ram;
+  // Strips the segment from a RAM address. Mirrored RAM is indexed across all
+  // 8 MB, a single copy wraps at 2 MB.
+  uint32_t ramMask;
+  int8_t hostReg[32];
+  // The guest register with a load still in its delay slot. The value itself
+  // always lives in cpu->loadValue, only which register it belongs to is
+  // resolved while translating.
+  uint8_t pending;
+  uint32_t cycles;
+  size_t numExits;
+  uint8_t *exits[kRecompilerMaxExits];
+} Translation;
+
+static inline int32_t RegOffset(uint8_t reg) { return (int32_t)(offsetof(Cpu, reg) + reg * sizeof(uint32_t)); }
+
+#define CPU_OFFSET(field) ((int32_t)offsetof(Cpu, field))
+
+static inline void Emit8(Emitter *e, uint8_t value) { *e->cursor++ = value; }
+
+static inline void Emit32(Emitter *e, uint32_t value) {
+  memcpy(e->cursor, &value, sizeof(value));
+  e->cursor += sizeof(value);
+}
+
+static inline void Emit64(Emitter *e, uint64_t value) {
+  memcpy(e->cursor, &value, sizeof(value));
+  e->cursor += sizeof(value);
+}
+
+static void EmitRex(Emitter *e, bool wide, uint8_t reg, uint8_t index, uint8_t base) {
+  uint8_t rex = 0x40 | (wide << 3) | (((reg >> 3) & 1) << 2) | (((index >> 3) & 1) << 1) | ((base >> 3) & 1);
+  if (rex != 0x40) {
+    Emit8(e, rex);
+  }
+}
+
+static void EmitOpcode(Emitter *e, uint16_t opcode) {
+  if (opcode > 0xFF) {
+    Emit8(e, 0x0F);
+  }
+  Emit8(e, opcode & 0xFF);
+}
+
+// op reg, rm (register direct)
+static void EmitRegReg(Emitter *e, bool wide, uint16_t opcode, uint8_t reg, uint8_t rm) {
+  EmitRex(e, wide, reg, 0, rm);
+  EmitOpcode(e, opcode);
+  Emit8(e, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// op reg, [base + disp32]
+static void EmitRegMem(Emitter *e, bool wide, uint16_t opcode, uint8_t reg, HostRegister base, int32_t disp) {
+  EmitRex(e, wide, reg, 0, base);
+  EmitOpcode(e, opcode);
+  Emit8(e, 0x80 | ((reg & 7) << 3) | (base & 7));
+  if ((base & 7) == HostRsp) {
+    Emit8(e, 0x24);
+  }
+  Emit32(e, (uint32_t)disp);
+}
+
+// op reg, [base + index]
+static void EmitRegIndexed(Emitter *e, bool wide, uint16_t opcode, uint8_t reg, HostRegister base,
+                           HostRegister index) {
+  EmitRex(e, wide, reg, index, base);
+  EmitOpcode(e, opcode);
+  Emit8(e, ((reg & 7) << 3) | 0x04);
+  Emit8(e, ((index & 7) << 3) | (base & 7));
+}
+
+static void EmitMovRegReg(Emitter *e, HostRegister dst, HostRegister src) {
+  if (dst != src) {
+    EmitRegReg(e, false, 0x89, src, dst);
+  }
+}
+
+static void EmitMovRegImm(Emitter *e, HostRegister dst, uint32_t imm) {
+  if (imm == 0) {
+    EmitRegReg(e, false, 0x31, dst, dst);
+    return;
+  }
+  EmitRex(e, false, 0, 0, dst);
+  Emit8(e, 0xB8 | (dst & 7));
+  Emit32(e, imm);
+}
+
+static void EmitMovRegImm64(Emitter *e, HostRegister dst, const void *_Nullable imm) {
+  EmitRex(e, true, 0, 0, dst);
+  Emit8(e, 0xB8 | (dst & 7));
+  Emit64(e, (uint64_t)(uintptr_t)imm);
+}
+
+static void EmitLoadCpu(Emitter *e, HostRegister dst, int32_t offset) { EmitRegMem(e, false, 0x8B, dst, kCpuReg, offset); }
+
+static void EmitStoreCpu(Emitter *e, int32_t offset, HostRegister src) {
+  EmitRegMem(e, false, 0x89, src, kCpuReg, offset);
+}
+
+static void EmitStoreCpuImm(Emitter *e, int32_t offset, uint32_t imm) {
+  EmitRegMem(e, false, 0xC7, 0, kCpuReg, offset);
+  Emit32(e, imm);
+}
+
+static void EmitStoreCpuImm8(Emitter *e, int32_t offset, uint8_t imm) {
+  EmitRegMem(e, false, 0xC6, 0, kCpuReg, offset);
+  Emit8(e, imm);
+}
+
+static void EmitAddCpuCycles(Emitter *e, int32_t cycles) {
+  if (cycles == 0) {
+    return;
+  }
+  EmitRegMem(e, true, 0x81, cycles > 0 ? 0 : 5, kCpuReg, CPU_OFFSET(cycles));
+  Emit32(e, (uint32_t)(cycles > 0 ? cycles : -cycles));
+}
+
+// Two operand ALU op with the destination in rm, e.g. 0x01 is add, 0x39 is cmp.
+static void EmitAlu(Emitter *e, uint8_t opcode, HostRegister dst, HostRegister src) {
+  EmitRegReg(e, false, opcode, src, dst);
+}
+
+// digit selects the operation of the 0x81 group: 0 add, 1 or, 4 and, 5 sub, 6 xor, 7 cmp.
+static void EmitAluImm(Emitter *e, uint8_t digit, HostRegister dst, uint32_t imm) {
+  EmitRegReg(e, false, 0x81, digit, dst);
+  Emit32(e, imm);
+}
+
+// digit selects the shift: 4 shl, 5 shr, 7 sar.
+static void EmitShiftImm(Emitter *e, uint8_t digit, HostRegister dst, uint8_t amount) {
+  EmitRegReg(e, false, 0xC1, digit, dst);
+  Emit8(e, amount);
+}
+
+static void EmitShiftCl(Emitter *e, uint8_t digit, HostRegister dst) { EmitRegReg(e, false, 0xD3, digit, dst); }
+
+static void EmitSetCondition(Emitter *e, HostCondition condition, HostRegister dst) {
+  EmitRegReg(e, false, 0x190 | condition, 0, dst);
+  EmitRegReg(e, false, 0x1B6, dst, dst);
+}
+
+static uint8_t *EmitJump(Emitter *e) {
+  Emit8(e, 0xE9);
+  uint8_t *patch = e->cursor;
+  Emit32(e, 0);
+  return patch;
+}
+
+static uint8_t *EmitJumpIf(Emitter *e, HostCondition condition) {
+  Emit8(e, 0x0F);
+  Emit8(e, 0x80 | condition);
+  uint8_t *patch = e->cursor;
+  Emit32(e, 0);
+  return patch;
+}
+
+static void PatchJump(uint8_t *patch, const uint8_t *target) {
+  int32_t rel = (int32_t)(target - (patch + 4));
+  memcpy(patch, &rel, sizeof(rel));
+}
+
+static void EmitCall(Emitter *e, const void *function) {
+  EmitMovRegImm64(e, HostRax, function);
+  EmitRegReg(e, false, 0xFF, 2, HostRax);
+}
+
+// Interpreter handlers take the Instruction union by value, calling them
+// through a plain C function keeps the generated code free of ABI details for
+// aggregates.
+static void RecompilerCallHandler(Cpu *cpu, OpcodeHandler handler, uint32_t instruction) {
+  handler(cpu, NewInstruction(instruction));
+}
+
+static void LoadGuest(Translation *t, HostRegister dst, uint8_t reg) {
+  if (reg == 0) {
+    EmitMovRegImm(&t->emitter, dst, 0);
+  } else if (t->hostReg[reg] >= 0) {
+    EmitMovRegReg(&t->emitter, dst, (HostRegister)t->hostReg[reg]);
+  } else {
+    EmitLoadCpu(&t->emitter, dst, RegOffset(reg));
+  }
+}
+
+static void StoreGuest(Translation *t, uint8_t reg, HostRegister src) {
+  if (reg == 0) {
+    return;
+  }
+  if (t->hostReg[reg] >= 0) {
+    EmitMovRegReg(&t->emitter, (HostRegister)t->hostReg[reg], src);
+  } else {
+    EmitStoreCpu(&t->emitter, RegOffset(reg), src);
+  }
+}
+
+static void FlushGuests(Translation *t) {
+  uint8_t reg;
+  for (reg = 1; reg < 32; reg++) {
+    if (t->hostReg[reg] >= 0) {
+      EmitStoreCpu(&t->emitter, RegOffset(reg), (HostRegister)t->hostReg[reg]);
+    }
+  }
+}
+
+static void ReloadGuests(Translation *t) {
+  uint8_t reg;
+  for (reg = 1; reg < 32; reg++) {
+    if (t->hostReg[reg] >= 0) {
+      EmitLoadCpu(&t->emitter, (HostRegister)t->hostReg[reg], RegOffset(reg));
+    }
+  }
+}
+
+// Retires the load in the delay slot, unless the current instruction replaces
+// it with a load to the same register.
+static void CommitPending(Translation *t, uint8_t replacedBy) {
+  uint8_t reg = t->pending;
+  if (reg != 0 && reg != replacedBy) {
+    if (t->hostReg[reg] >= 0) {
+      EmitLoadCpu(&t->emitter, (HostRegister)t->hostReg[reg], CPU_OFFSET(loadValue));
+    } else {
+      EmitLoadCpu(&t->emitter, HostR11, CPU_OFFSET(loadValue));
+      EmitStoreCpu(&t->emitter, RegOffset(reg), HostR11);
+    }
+  }
+  t->pending = 0;
+}
+
+static void EmitJumpToEpilogue(Translation *t) {
+  assert(t->numExits < kRecompilerMaxExits);
+  t->exits[t->numExits++] = EmitJump(&t->emitter);
+}
+
+// Leaves a block whose guest state is still partly held in host registers.
+static void EmitNativeExit(Translation *t, Address pc, bool delaySlot) {
+  Emitter *e = &t->emitter;
+  FlushGuests(t);
+  EmitStoreCpuImm8(e, CPU_OFFSET(loadReg), t->pending);
+  EmitStoreCpuImm(e, CPU_OFFSET(currentPc), pc);
+  if (delaySlot) {
+    EmitLoadCpu(e, HostRax, CPU_OFFSET(nextPc));
+    EmitStoreCpu(e, CPU_OFFSET(pc), HostRax);
+    EmitAluImm(e, 0, HostRax, 4);
+    EmitStoreCpu(e, CPU_OFFSET(nextPc), HostRax);
+  } else {
+    EmitStoreCpuImm(e, CPU_OFFSET(pc), pc + 4);
+    EmitStoreCpuImm(e, CPU_OFFSET(nextPc), pc + 8);
+  }
+  EmitAddCpuCycles(e, t->cycles);
+  EmitJumpToEpilogue(t);
+}
+
+// Leaves a block right after an interpreter handler ran, the handler already
+// left pc, the delayed load and all guest registers in the Cpu.
+static void EmitInterpreterExit(Translation *t, CpuDecodedOp *op) {
+  EmitAddCpuCycles(&t->emitter, t->cycles + op->cycles);
+  EmitJumpToEpilogue(t);
+}
+
+static uint8_t PendingAfterInterpreter(Instruction instruction) {
+  switch (instruction.imm.op) {
+  case 0x00:
+    return instruction.reg.funct == 0x09 ? instruction.reg.rd : 0;
+  case 0x01:
+    return kRecompilerPendingUnknown;
+  case 0x03:
+    return 31;
+  case 0x12:
+    // mfc2 and cfc2 load through the delay slot like the loads below.
+    if (!instruction.copReg.unused25 && (instruction.copReg.subOpcode == 0 || instruction.copReg.subOpcode == 2)) {
+      return instruction.copReg.rt;
+    }
+    return 0;
+  case 0x20:
+  case 0x21:
+  case 0x22:
+  case 0x23:
+  case 0x24:
+  case 0x25:
+  case 0x26:
+    return instruction.imm.rt;
+  }
+  return 0;
+}
+
+// Runs one instruction through its interpreter handler with the guest state
+// synced exactly as the cached interpreter would leave it. Returns true if the
+// block has to end right after the call.
+static bool EmitInterpreterCall(Translation *t, CpuDecodedOp *op, Address pc, bool delaySlot, bool last) {
+  Emitter *e = &t->emitter;
+  FlushGuests(t);
+  if (t->pending != kRecompilerPendingUnknown) {
+    EmitStoreCpuImm8(e, CPU_OFFSET(loadReg), t->pending);
+  }
+  EmitStoreCpuImm(e, CPU_OFFSET(currentPc), pc);
+  if (delaySlot) {
+    EmitLoadCpu(e, HostRax, CPU_OFFSET(nextPc));
+    EmitStoreCpu(e, CPU_OFFSET(pc), HostRax);
+    EmitAluImm(e, 0, HostRax, 4);
+    EmitStoreCpu(e, CPU_OFFSET(nextPc), HostRax);
+  } else {
+    EmitStoreCpuImm(e, CPU_OFFSET(pc), pc + 4);
+    EmitStoreCpuImm(e, CPU_OFFSET(nextPc), pc + 8);
+  }
+  EmitStoreCpuImm8(e, CPU_OFFSET(delaySlot), delaySlot);
+  EmitStoreCpuImm8(e, CPU_OFFSET(branch), 0);
+  EmitRegReg(e, true, 0x89, kCpuReg, kArgReg0);
+  EmitMovRegImm64(e, kArgReg1, (const void *)op->handler);
+  EmitMovRegImm(e, kArgReg2, op->instruction.value);
+  EmitCall(e, (const void *)RecompilerCallHandler);
+  EmitStoreCpuImm(e, RegOffset(0), 0);
+  if (delaySlot || last || InstructionEndsBlock(op->instruction)) {
+    EmitInterpreterExit(t, op);
+    return true;
+  }
+  // Exceptions move pc to the handler vector.
+  EmitRegMem(e, false, 0x81, 7, kCpuReg, CPU_OFFSET(pc));
+  Emit32(e, pc + 4);
+  uint8_t *noException = EmitJumpIf(e, ConditionEqual);
+  EmitInterpreterExit(t, op);
+  PatchJump(noException, e->cursor);
+  ReloadGuests(t);
+  t->pending = PendingAfterInterpreter(op->instruction);
+  return false;
+}
+
+// Leaves r10 holding the offset into RAM of the address in ecx, or jumps to the
+// returned patch when the access has to go through the bus.
+static void EmitRamCheck(Translation *t, uint32_t alignMask, uint8_t **slowPaths) {
+  Emitter *e = &t->emitter;
+  EmitMovRegReg(e, HostR10, HostRcx);
+  // RAM and its mirrors sit below 8MB physical in KUSEG, KSEG0 and KSEG1.
+  EmitRegReg(e, false, 0xF7, 0, HostR10);
+  Emit32(e, 0x1F800000 | alignMask);
+  slowPaths[0] = EmitJumpIf(e, ConditionNotEqual);
+  EmitShiftImm(e, 5, HostR10, 29);
+  EmitMovRegImm(e, HostR11, 0x31);
+  EmitRegReg(e, false, 0x1A3, HostR10, HostR11);
+  slowPaths[1] = EmitJumpIf(e, ConditionAboveEqual);
+  EmitMovRegReg(e, HostR10, HostRcx);
+  EmitAluImm(e, 4, HostR10, t->ramMask);
+}
+
+static void EmitAddressInEcx(Translation *t, Instruction instruction) {
+  LoadGuest(t, HostRcx, instruction.imm.rs);
+  int32_t offset = SIGN_EXTEND(instruction.imm.immediate);
+  if (offset != 0) {
+    EmitAluImm(&t->emitter, 0, HostRcx, (uint32_t)offset);
+  }
+}
+
+static void TranslateLoad(Translation *t, CpuDecodedOp *op, Address pc, bool delaySlot, bool last) {
+  Emitter *e = &t->emitter;
+  Instruction instruction = op->instruction;
+  uint16_t opcode;
+  uint32_t alignMask;
+  switch (instruction.imm.op) {
+  case 0x20: // lb
+    opcode = 0x1BE;
+    alignMask = 0;
+    break;
+  case 0x21: // lh
+    opcode = 0x1BF;
+    alignMask = 1;
+    break;
+  case 0x24: // lbu
+    opcode = 0x1B6;
+    alignMask = 0;
+    break;
+  case 0x25: // lhu
+    opcode = 0x1B7;
+    alignMask = 1;
+    break;
+  default: // lw
+    opcode = 0x8B;
+    alignMask = 3;
+  }
+  uint8_t *slowPaths[2];
+  EmitAddressInEcx(t, instruction);
+  EmitRamCheck(t, alignMask, slowPaths);
+  EmitRegIndexed(e, false, opcode, HostRax, kRamReg, HostR10);
+  uint8_t pending = t->pending;
+  CommitPending(t, instruction.imm.rt);
+  if (instruction.imm.rt != 0) {
+    EmitStoreCpu(e, CPU_OFFSET(loadValue), HostRax);
+    t->pending = instruction.imm.rt;
+  }
+  uint8_t *done = EmitJump(e);
+
+  PatchJump(slowPaths[0], e->cursor);
+  PatchJump(slowPaths[1], e->cursor);
+  uint8_t fastPending = t->pending;
+  t->pending = pending;
+  if (!EmitInterpreterCall(t, op, pc, delaySlot, last)) {
+    // The handler charged the real bus cycles itself.
+    EmitAddCpuCycles(e, -(int32_t)kMemoryCpuCycles);
+  }
+  t->pending = fastPending;
+  PatchJump(done, e->cursor);
+  t->cycles += kMemoryCpuCycles;
+}
+
+static void TranslateStore(Translation *t, CpuDecodedOp *op, Address pc, bool delaySlot, bool last) {
+  Emitter *e = &t->emitter;
+  Instruction instruction = op->instruction;
+  uint32_t alignMask = instruction.imm.op == 0x28 ? 0 : instruction.imm.op == 0x29 ? 1 : 3;
+  uint8_t *slowPaths[3];
+  EmitAddressInEcx(t, instruction);
+  LoadGuest(t, HostRax, instruction.imm.rt);
+  // Isolated cache stores are cache maintenance.
+  EmitRegMem(e, false, 0xF7, 0, kCpuReg, CPU_OFFSET(cop0.sr));
+  Emit32(e, 0x00010000);
+  slowPaths[2] = EmitJumpIf(e, ConditionNotEqual);
+  EmitRamCheck(t, alignMask, slowPaths);
+  uint8_t pending = t->pending;
+  CommitPending(t, 0);
+  switch (instruction.imm.op) {
+  case 0x28: // sb
+    EmitRegIndexed(e, false, 0x88, HostRax, kRamReg, HostR10);
+    break;
+  case 0x29: // sh
+    Emit8(e, 0x66);
+    EmitRegIndexed(e, false, 0x89, HostRax, kRamReg, HostR10);
+    break;
+  default: // sw
+    EmitRegIndexed(e, false, 0x89, HostRax, kRamReg, HostR10);
+  }
+  // Only stores to pages holding decoded code need to reach the main RAM's
+  // code write handler.
+  Memory *memory = SystemMemory(t->cpu->sys);
+  EmitMovRegReg(e, HostR11, HostR10);
+  EmitShiftImm(e, 5, HostR11, kMemoryCodePageShift);
+  if (t->ramMask >= kMemoryRamSize) {
+    EmitAluImm(e, 4, HostR11, (uint32_t)(kMemoryRamSize >> kMemoryCodePageShift) - 1);
+  }
+  EmitMovRegImm64(e, HostRdx, MemoryCodePages(memory));
+  EmitRegIndexed(e, false, 0x80, 7, HostRdx, HostR11);
+  Emit8(e, 0);
+  uint8_t *noCode = EmitJumpIf(e, ConditionEqual);
+  EmitMovRegReg(e, kArgReg1, HostRcx);
+  EmitMovRegImm64(e, kArgReg0, memory);
+  EmitCall(e, (const void *)MemoryNotifyWrite);
+  PatchJump(noCode, e->cursor);
+  uint8_t *done = EmitJump(e);
+
+  PatchJump(slowPaths[0], e->cursor);
+  PatchJump(slowPaths[1], e->cursor);
+  PatchJump(slowPaths[2], e->cursor);
+  t->pending = pending;
+  EmitInterpreterCall(t, op, pc, delaySlot, last);
+  t->pending = 0;
+  PatchJump(done, e->cursor);
+}
+
+// add, addi and sub trap on overflow, the interpreter raises the exception.
+static void EmitOverflowCheck(Translation *t, CpuDecodedOp *op, Address pc, bool delaySlot, bool last,
+                              uint8_t **done) {
+  uint8_t *noOverflow = EmitJumpIf(&t->emitter, ConditionNoOverflow);
+  uint8_t pending = t->pending;
+  EmitInterpreterCall(t, op, pc, delaySlot, last);
+  t->pending = pending;
+  *done = EmitJump(&t->emitter);
+  PatchJump(noOverflow, t->emitter.cursor);
+}
+
+static void EmitBranch(Translation *t, HostCondition condition, Address pc, Instruction instruction) {
+  Emitter *e = &t->emitter;
+  Address target = pc + 4 + (SIGN_EXTEND(instruction.imm.immediate) << 2);
+  CommitPending(t, 0);
+  EmitMovRegImm(e, HostRdx, pc + 8);
+  EmitMovRegImm(e, HostR8, target);
+  EmitAlu(e, 0x39, HostRax, HostRcx);
+  EmitRegReg(e, false, 0x140 | condition, HostRdx, HostR8);
+  EmitStoreCpu(e, CPU_OFFSET(nextPc), HostRdx);
+}
+
+static void TranslateRegister(Translation *t, CpuDecodedOp *op, Address pc, bool delaySlot, bool last) {
+  Emitter *e = &t->emitter;
+  Instruction instruction = op->instruction;
+  RegisterInstruction reg = instruction.reg;
+  uint8_t *done = NULL;
+  switch (reg.funct) {
+  case 0x00: // sll
+  case 0x02: // srl
+  case 0x03: // sra
+    LoadGuest(t, HostRax, reg.rt);
+    CommitPending(t, 0);
+    if (reg.shamt != 0) {
+      EmitShiftImm(e, reg.funct == 0x00 ? 4 : reg.funct == 0x02 ? 5 : 7, HostRax, reg.shamt);
+    }
+    break;
+  case 0x04: // sllv
+  case 0x06: // srlv
+  case 0x07: // srav
+    LoadGuest(t, HostRax, reg.rt);
+    LoadGuest(t, HostRcx, reg.rs);
+    CommitPending(t, 0);
+    EmitShiftCl(e, reg.funct == 0x04 ? 4 : reg.funct == 0x06 ? 5 : 7, HostRax);
+    break;
+  case 0x08: // jr
+    LoadGuest(t, HostRax, reg.rs);
+    CommitPending(t, 0);
+    EmitStoreCpu(e, CPU_OFFSET(nextPc), HostRax);
+    return;
+  case 0x09: // jalr
+    LoadGuest(t, HostRax, reg.rs);
+    CommitPending(t, reg.rd);
+    if (reg.rd != 0) {
+      EmitStoreCpuImm(e, CPU_OFFSET(loadValue), pc + 8);
+      t->pending = reg.rd;
+    }
+    EmitStoreCpu(e, CPU_OFFSET(nextPc), HostRax);
+    return;
+  case 0x10: // mfhi
+  case 0x12: // mflo
+    CommitPending(t, 0);
+    EmitLoadCpu(e, HostRax, reg.funct == 0x10 ? CPU_OFFSET(hilo.distinct.hi) : CPU_OFFSET(hilo.distinct.lo));
+    break;
+  case 0x11: // mthi
+  case 0x13: // mtlo
+    LoadGuest(t, HostRax, reg.rs);
+    EmitStoreCpu(e, reg.funct == 0x11 ? CPU_OFFSET(hilo.distinct.hi) : CPU_OFFSET(hilo.distinct.lo), HostRax);
+    CommitPending(t, 0);
+    return;
+  case 0x18: // mult
+  case 0x19: // multu
+    LoadGuest(t, HostRax, reg.rs);
+    LoadGuest(t, HostRcx, reg.rt);
+    CommitPending(t, 0);
+    if (reg.funct == 0x18) {
+      EmitRegReg(e, true, 0x63, HostRax, HostRax);
+      EmitRegReg(e, true, 0x63, HostRcx, HostRcx);
+    }
+    EmitRegReg(e, true, 0x1AF, HostRax, HostRcx);
+    EmitRegMem(e, true, 0x89, HostRax, kCpuReg, CPU_OFFSET(hilo.combined));
+    return;
+  case 0x20: // add
+  case 0x21: // addu
+  case 0x22: // sub
+  case 0x23: // subu
+  case 0x24: // and
+  case 0x25: // or
+  case 0x26: // xor
+  case 0x27: // nor
+  case 0x2A: // slt
+  case 0x2B: // sltu
+    LoadGuest(t, HostRax, reg.rs);
+    LoadGuest(t, HostRcx, reg.rt);
+    switch (reg.funct) {
+    case 0x20:
+    case 0x21:
+      EmitAlu(e, 0x01, HostRax, HostRcx);
+      break;
+    case 0x22:
+    case 0x23:
+      EmitAlu(e, 0x29, HostRax, HostRcx);
+      break;
+    case 0x24:
+      EmitAlu(e, 0x21, HostRax, HostRcx);
+      break;
+    case 0x25:
+      EmitAlu(e, 0x09, HostRax, HostRcx);
+      break;
+    case 0x26:
+      EmitAlu(e, 0x31, HostRax, HostRcx);
+      break;
+    case 0x27:
+      EmitAlu(e, 0x09, HostRax, HostRcx);
+      EmitRegReg(e, false, 0xF7, 2, HostRax);
+      break;
+    case 0x2A:
+    case 0x2B:
+      EmitAlu(e, 0x39, HostRax, HostRcx);
+      EmitSetCondition(e, reg.funct == 0x2A ? ConditionLess : ConditionBelow, HostRax);
+      break;
+    }
+    if (reg.funct == 0x20 || reg.funct == 0x22) {
+      EmitOverflowCheck(t, op, pc, delaySlot, last, &done);
+    }
+    CommitPending(t, 0);
+    break;
+  default:
+    EmitInterpreterCall(t, op, pc, delaySlot, last);
+    return;
+  }
+  StoreGuest(t, reg.rd, HostRax);
+  if (done != NULL) {
+    PatchJump(done, e->cursor);
+  }
+}
+
+static void TranslateImmediate(Translation *t, CpuDecodedOp *op, Address pc, bool delaySlot, bool last) {
+  Emitter *e = &t->emitter;
+  Instruction instruction = op->instruction;
+  ImmediateInstruction imm = instruction.imm;
+  uint32_t signExtended = (uint32_t)SIGN_EXTEND(imm.immediate);
+  uint8_t *done = NULL;
+  switch (imm.op) {
+  case 0x08: // addi
+  case 0x09: // addiu
+    LoadGuest(t, HostRax, imm.rs);
+    EmitAluImm(e, 0, HostRax, signExtended);
+    if (imm.op == 0x08) {
+      EmitOverflowCheck(t, op, pc, delaySlot, last, &done);
+    }
+    break;
+  case 0x0A: // slti
+  case 0x0B: // sltiu
+    LoadGuest(t, HostRax, imm.rs);
+    EmitAluImm(e, 7, HostRax, signExtended);
+    EmitSetCondition(e, imm.op == 0x0A ? ConditionLess : ConditionBelow, HostRax);
+    break;
+  case 0x0C: // andi
+  case 0x0D: // ori
+  case 0x0E: // xori
+    LoadGuest(t, HostRax, imm.rs);
+    EmitAluImm(e, imm.op == 0x0C ? 4 : imm.op == 0x0D ? 1 : 6, HostRax, imm.immediate);
+    break;
+  case 0x0F: // lui
+    EmitMovRegImm(e, HostRax, (uint32_t)imm.immediate << 16);
+    break;
+  }
+  CommitPending(t, 0);
+  StoreGuest(t, imm.rt, HostRax);
+  if (done != NULL) {
+    PatchJump(done, e->cursor);
+  }
+}
+
+static void TranslateBranch(Translation *t, CpuDecodedOp *op, Address pc) {
+  Emitter *e = &t->emitter;
+  Instruction instruction = op->instruction;
+  switch (instruction.imm.op) {
+  case 0x01: // bltz, bgez
+    LoadGuest(t, HostRax, instruction.imm.rs);
+    EmitMovRegImm(e, HostRcx, 0);
+    EmitBranch(t, instruction.imm.rt == 0 ? ConditionLess : ConditionGreaterEqual, pc, instruction);
+    return;
+  case 0x02: // j
+  case 0x03: // jal
+    CommitPending(t, instruction.imm.op == 0x03 ? 31 : 0);
+    if (instruction.imm.op == 0x03) {
+      EmitStoreCpuImm(e, CPU_OFFSET(loadValue), pc + 8);
+      t->pending = 31;
+    }
+    EmitStoreCpuImm(e, CPU_OFFSET(nextPc), (instruction.jump.target << 2) | ((pc + 4) & 0xF0000000));
+    return;
+  case 0x04: // beq
+  case 0x05: // bne
+    LoadGuest(t, HostRax, instruction.imm.rs);
+    LoadGuest(t, HostRcx, instruction.imm.rt);
+    EmitBranch(t, instruction.imm.op == 0x04 ? ConditionEqual : ConditionNotEqual, pc, instruction);
+    return;
+  case 0x06: // blez
+  case 0x07: // bgtz
+    LoadGuest(t, HostRax, instruction.imm.rs);
+    EmitMovRegImm(e, HostRcx, 0);
+    EmitBranch(t, instruction.imm.op == 0x06 ? ConditionLessEqual : ConditionGreater, pc, instruction);
+    return;
+  }
+}
+
+// Only the common integer instructions are translated, everything else (COP0,
+// GTE, unaligned and linking branches, divisions, ...) calls the interpreter.
+static bool IsNative(Instruction instruction) {
+  switch (instruction.imm.op) {
+  case 0x00:
+    switch (instruction.reg.funct) {
+    case 0x01:
+    case 0x05:
+    case 0x0A:
+    case 0x0B:
+    case 0x0C:
+    case 0x0D:
+    case 0x0E:
+    case 0x0F:
+    case 0x14:
+    case 0x15:
+    case 0x16:
+    case 0x17:
+    case 0x1A:
+    case 0x1B:
+    case 0x1C:
+    case 0x1D:
+    case 0x1E:
+    case 0x1F:
+    case 0x28:
+    case 0x29:
+      return false;
+    }
+    return instruction.reg.funct < 0x2C;
+  case 0x01:
+    return instruction.imm.rt == 0x00 || instruction.imm.rt == 0x01;
+  case 0x20:
+  case 0x21:
+  case 0x23:
+  case 0x24:
+  case 0x25:
+  case 0x28:
+  case 0x29:
+  case 0x2B:
+    // The native RAM path would skip the bus counters.
+    return !SYSTEM_STATS;
+  }
+  return instruction.imm.op >= 0x02 && instruction.imm.op <= 0x0F;
+}
+
+// Returns true if the block continues with the next instruction.
+static bool TranslateOp(Translation *t, CpuDecodedOp *op, Address pc, bool delaySlot, bool last) {
+  Instruction instruction = op->instruction;
+  bool branch = InstructionIsBranch(instruction);
+  if (t->pending == kRecompilerPendingUnknown || !IsNative(instruction) || (branch && (delaySlot || last))) {
+    bool exited = EmitInterpreterCall(t, op, pc, delaySlot, last);
+    t->cycles += op->cycles;
+    return !exited;
+  }
+  switch (instruction.imm.op) {
+  case 0x00:
+    TranslateRegister(t, op, pc, delaySlot, last);
+    break;
+  case 0x01:
+  case 0x02:
+  case 0x03:
+  case 0x04:
+  case 0x05:
+  case 0x06:
+  case 0x07:
+    TranslateBranch(t, op, pc);
+    break;
+  case 0x20:
+  case 0x21:
+  case 0x23:
+  case 0x24:
+  case 0x25:
+    TranslateLoad(t, op, pc, delaySlot, last);
+    break;
+  case 0x28:
+  case 0x29:
+  case 0x2B:
+    TranslateStore(t, op, pc, delaySlot, last);
+    break;
+  default:
+    TranslateImmediate(t, op, pc, delaySlot, last);
+  }
+  t->cycles += op->cycles;
+  if (delaySlot || last) {
+    EmitNativeExit(t, pc, delaySlot);
+    return false;
+  }
+  return true;
+}
+
+// Keeps the most used guest registers of the block in callee saved host
+// registers for its whole duration.
+static void AllocateGuestRegisters(Translation *t, CpuBlock *block) {
+  uint32_t uses[32] = {0};
+  uint32_t i;
+  for (i = 0; i < block->numOps; i++) {
+    Instruction instruction = block->ops[i].instruction;
+    uses[instruction.reg.rs]++;
+    uses[instruction.reg.rt]++;
+    if (instruction.imm.op == 0x00) {
+      uses[instruction.reg.rd]++;
+    }
+  }
+  memset(t->hostReg, -1, sizeof(t->hostReg));
+  size_t host;
+  for (host = 0; host < kRecompilerNumGuestHostRegs; host++) {
+    uint8_t best = 0;
+    uint8_t reg;
+    for (reg = 1; reg < 32; reg++) {
+      if (t->hostReg[reg] < 0 && uses[reg] > uses[best]) {
+        best = reg;
+      }
+    }
+    if (best == 0 || uses[best] < 2) {
+      break;
+    }
+    t->hostReg[best] = (int8_t)kGuestHostRegs[host];
+  }
+}
+
+static const HostRegister kSavedRegs[] = {HostRbx, HostRbp, HostR12, HostR13, HostR14, HostR15};
+
+static void EmitPrologue(Translation *t) {
+  Emitter *e = &t->emitter;
+  size_t i;
+  for (i = 0; i < sizeof(kSavedRegs) / sizeof(kSavedRegs[0]); i++) {
+    EmitRex(e, false, 0, 0, kSavedRegs[i]);
+    Emit8(e, 0x50 | (kSavedRegs[i] & 7));
+  }
+  // Six pushes leave the stack 16 byte aligned after this, with room for the
+  // Win64 shadow space.
+  EmitRegReg(e, true, 0x83, 5, HostRsp);
+  Emit8(e, kRecompilerFrameSize);
+  EmitRegReg(e, true, 0x89, kArgReg0, kCpuReg);
+  EmitMovRegImm64(e, kRamReg, t->ram);
+  ReloadGuests(t);
+}
+
+static void EmitEpilogue(Translation *t) {
+  Emitter *e = &t->emitter;
+  EmitRegReg(e, true, 0x83, 0, HostRsp);
+  Emit8(e, kRecompilerFrameSize);
+  size_t i;
+  for (i = sizeof(kSavedRegs) / sizeof(kSavedRegs[0]); i > 0; i--) {
+    EmitRex(e, false, 0, 0, kSavedRegs[i - 1]);
+    Emit8(e, 0x58 | (kSavedRegs[i - 1] & 7));
+  }
+  Emit8(e, 0xC3);
+}
+
+Recompiler *RecompilerNew(System *sys) {
+  Recompiler *rec = (Recompiler *)SystemArenaAllocateTransient(sys, sizeof(Recompiler));
+#if defined(_WIN32)
+  rec->code = (uint8_t *)VirtualAlloc(NULL, kRecompilerCodeSize, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+  void *code = mmap(NULL, kRecompilerCodeSize, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  rec->code = code == MAP_FAILED ? NULL : (uint8_t *)code;
+#endif
+  if (rec->code == NULL) {
+    PCF_PANIC("Unable to allocate executable memory for the recompiler!");
+  }
+  rec->position = 0;
+  rec->generation = 0;
+  return rec;
+}
+
+// Releases the code buffer, rec itself goes with the arena.
+void RecompilerFree(Recompiler *rec) {
+  if (rec->code == NULL) {
+    return;
+  }
+#if defined(_WIN32)
+  VirtualFree(rec->code, 0, MEM_RELEASE);
+#else
+  munmap(rec->code, kRecompilerCodeSize);
+#endif
+  rec->code = NULL;
+}
+
+bool RecompilerTranslate(Recompiler *rec, Cpu *cpu, CpuBlock *block) {
+  uint32_t generation = BlockCacheGeneration(cpu->blockCache);
+  if (rec->generation != generation) {
+    // Every block that pointed into the buffer is gone.
+    rec->generation = generation;
+    rec->position = 0;
+  }
+  if (rec->position + kRecompilerMaxBlockSize > kRecompilerCodeSize) {
+    BlockCacheRequestFlush(cpu->blockCache);
+    return false;
+  }
+  Translation t;
+  t.emitter.cursor = rec->code + rec->position;
+  t.cpu = cpu;
+  t.ram = MemoryData(SystemMemory(cpu->sys));
+  t.ramMask = (uint32_t)(kMemoryRamSize * MemoryGetRam(SystemMemory(cpu->sys)).mirrors - 1);
+  t.pending = 0;
+  t.cycles = 0;
+  t.numExits = 0;
+  AllocateGuestRegisters(&t, block);
+
+  uint8_t *start = t.emitter.cursor;
+  EmitPrologue(&t);
+  bool delaySlot = false;
+  uint32_t i;
+  for (i = 0; i < block->numOps; i++) {
+    CpuDecodedOp *op = &block->ops[i];
+    bool last = i + 1 == block->numOps;
+    if (!TranslateOp(&t, op, block->start + (i << 2), delaySlot, last)) {
+      break;
+    }
+    delaySlot = InstructionIsBranch(op->instruction);
+  }
+  uint8_t *epilogue = t.emitter.cursor;
+  EmitEpilogue(&t);
+  size_t exit;
+  for (exit = 0; exit < t.numExits; exit++) {
+    PatchJump(t.exits[exit], epilogue);
+  }
+  rec->position += t.emitter.cursor - start;
+  block->code = start;
+  return true;
+}
+
+#else
+
+Recompiler *RecompilerNew(System *sys) {
+  Recompiler *rec = (Recompiler *)SystemArenaAllocateTransient(sys, sizeof(Recompiler));
+  rec->code = NULL;
+  rec->position = 0;
+  rec->generation = 0;
+  return rec;
+}
+
+void RecompilerFree(Recompiler *rec) {}
+
+bool RecompilerTranslate(Recompiler *rec, Cpu *cpu, CpuBlock *block) { return false; }
+
+#endif
+
+ASSUME_NONNULL_END
@@ -0,0 +1,24 @@
+#pragma once
+#include "../Types.h"
+#include "BlockCache.h"
+#include "Types.h"
+
+ASSUME_NONNULL_BEGIN
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define RECOMPILER_SUPPORTED 1
+#else
+#define RECOMPILER_SUPPORTED 0
+#endif
+
+// Number of times a block runs through the cached interpreter before it is
+// translated to native code.
+#define kRecompilerHotThreshold 4
+
+typedef void (*RecompiledBlock)(Cpu *cpu);
+
+Recompiler *RecompilerNew(System *sys);
+void RecompilerFree(Recompiler *rec);
+bool RecompilerTranslate(Recompiler *rec, Cpu *cpu, CpuBlock *block);
+
+ASSUME_NONNULL_END
@@ -1,5 +1,7 @@
 #pragma once
+#include "..\Stats.h"
 #include "..\Types.h"
+#include "Gte.h"
 
 ASSUME_NONNULL_BEGIN
 
@@ -17,6 +19,45 @@ static const Address kGeneralExceptionVector = 0x80000080;
 static const Address kGeneralExceptionVectorBoot = 0xBFC00180;
 static const uint32_t kProcessorId = 0x00000002;
 
+typedef enum { CpuModeInterpreter = 0, CpuModeCachedInterpreter, CpuModeRecompiler } CpuExecutionMode;
+
+struct __BlockCache;
+typedef struct __BlockCache BlockCache;
+
+struct __Recompiler;
+typedef struct __Recompiler Recompiler;
+
+// The block cache and the recompiler live at the transient end of the arena,
+// out of saved states. A Cpu loaded from a state takes them over from the one
+// it replaces, together with the mode its blocks were made for.
+typedef struct __CpuCaches {
+  BlockCache *blockCache;
+  Recompiler *_Nullable recompiler;
+  CpuExecutionMode mode;
+} CpuCaches;
+
+#define kCpuMaxIdleLoopStats 16
+
+// hits counts how often the loop at address was fast-forwarded to the end of
+// a clock slice, skippedCycles the cycles that saved interpreting.
+typedef struct __CpuIdleLoopStats {
+  Address address;
+  uint64_t hits;
+  uint64_t skippedCycles;
+} CpuIdleLoopStats;
+
+// The idle loop candidate that ran last (when active), with the registers it
+// writes and its pending load as they were at the end of its last iteration.
+typedef struct __CpuIdleLoop {
+  bool active;
+  Address address;
+  uint8_t loadReg;
+  uint32_t loadValue;
+  uint32_t reg[32];
+  size_t numStats;
+  CpuIdleLoopStats stats[kCpuMaxIdleLoopStats];
+} CpuIdleLoop;
+
 typedef struct packed __ImmediateInstruction {
   uint16_t immediate : 16;
   uint16_t rt : 5;
@@ -144,9 +185,12 @@ typedef struct packed __CpuCop0 {
 
 struct __Cpu {
   Bus *bus;
+  const BusFastPage *fastPages;
+  uint8_t *_Nullable scratchpad;
+  Memory *_Nullable memory;
   System *sys;
   uint32_t reg[32];
-  uint8_t loadReg : 5;
+  uint8_t loadReg;
   uint32_t loadValue;
   Address pc;
   Address nextPc;
@@ -175,8 +219,17 @@ struct __Cpu {
     } parsed;
   } cacheControlReg;
   CpuCop0 cop0;
+  Gte gte;
   Clock *clock;
   uint64_t cycles;
+  CpuExecutionMode mode;
+  BlockCache *blockCache;
+  Recompiler *_Nullable recompiler;
+  CpuIdleLoop idleLoop;
+  bool interruptPending;
+#if SYSTEM_STATS
+  CpuStats stats;
+#endif
 };
 
 typedef void (*_Nullable OpcodeHandler)(Cpu *cpu, Instruction instruction);
@@ -12,8 +12,6 @@ SIMPLE_BUS_DEVICE_DEFINITION(Peripherals, NewAddressRange(0x1F801040, 0x1F801060
                              { return 0x00000000; })
 SIMPLE_BUS_DEVICE_DEFINITION(MemoryControl2, NewAddressRange(0x1F801060, 0x1F801064, kMainSegments),
                              { return 0x00000B88; })
-SIMPLE_BUS_DEVICE_DEFINITION(InterruptControl, NewAddressRange(0x1F801070, 0x1F801078, kMainSegments),
-                             { return 0x00000000; })
 SIMPLE_BUS_DEVICE_DEFINITION(Timers, NewAddressRange(0x1F801100, 0x1F801130, kMainSegments), { return 0x00000000; })
 SIMPLE_BUS_DEVICE_DEFINITION(Cdrom, NewAddressRange(0x1F801800, 0x1F801804, kMainSegments), { return 0x00000000; })
 SIMPLE_BUS_DEVICE_DEFINITION(Mdec, NewAddressRange(0x1F801820, 0x1F801828, kMainSegments), { return 0x00000000; })
@@ -7,7 +7,6 @@ SIMPLE_BUS_DEVICE_DECLARE(Expansion2)
 SIMPLE_BUS_DEVICE_DECLARE(MemoryControl1)
 SIMPLE_BUS_DEVICE_DECLARE(Peripherals)
 SIMPLE_BUS_DEVICE_DECLARE(MemoryControl2)
-SIMPLE_BUS_DEVICE_DECLARE(InterruptControl)
 SIMPLE_BUS_DEVICE_DECLARE(Timers)
 SIMPLE_BUS_DEVICE_DECLARE(Cdrom)
 SIMPLE_BUS_DEVICE_DECLARE(Mdec)
@@ -3,14 +3,19 @@
 #include "Clock.h"
 #include "Memory.h"
 #include "System.h"
+#include <string.h>
 
 ASSUME_NONNULL_BEGIN
 
 static const uint32_t kDmaInterruptRegisterWriteMask = 0x7FFF801F;
+static const uint32_t kDmaInterruptRegisterFlagsMask = 0x7F000000;
 static const uint32_t kDmaChannelControlRegisterWriteMask = 0x71770703;
 static const uint32_t kDmaChannelOtcControlRegisterWriteMask = 0x51000000;
 static const uint32_t kDmaBaseAddressRegisterWriteMask = 0x00FFFFFF;
 static const uint32_t kDmaBaseAddressRegisterRamMask = 0x001FFFFC;
+// Words moved between RAM and a port per span, linked list packets (at most
+// 255 words) always fit in one.
+#define kDmaSpanWords 256
 
 typedef enum __DmaChannelSyncMode {
   DmaChannelSyncManual = 0,
@@ -115,6 +120,8 @@ struct __DmaChannelPort {
   DmaChannelIsReady isReady;
   DmaChannelWrite32 write32;
   DmaChannelRead32 read32;
+  DmaChannelWriteBlock _Nullable writeBlock;
+  DmaChannelReadBlock _Nullable readBlock;
 };
 
 struct __Dma {
@@ -126,11 +133,15 @@ struct __Dma {
   uint32_t blocksLeft;
   bool ignoreReady;
   bool isLinkedListTransfer;
+  System *sys;
   Memory *memory;
   Clock *clock;
   DmaChannelRegs channelRegs[7];
   DmaControlReg controlReg;
   DmaInterruptReg interruptReg;
+#if SYSTEM_STATS
+  uint64_t words[kStatsNumDmaChannels];
+#endif
 };
 
 static inline DmaChannelName GetChannelName(Address address) { return (DmaChannelName)((address & 0x70) >> 4); }
@@ -151,6 +162,53 @@ static inline uint32_t GetRamStepFromControlReg(DmaChannelControlReg reg) {
   return reg.parsed.stepBackward ? (uint32_t)-4 : 4;
 }
 
+// The master flag is set while forceIrq is set or an enabled channel has its
+// flag raised. The interrupt controller only sees it going from 0 to 1.
+static void DmaUpdateInterrupt(Dma *dma) {
+  DmaInterruptReg *reg = &dma->interruptReg;
+  uint32_t enabled = (reg->value >> 16) & 0x7F;
+  uint32_t flags = (reg->value >> 24) & 0x7F;
+  bool masterFlag = reg->parsed.forceIrq || (reg->parsed.irqMasterEnable && (enabled & flags) != 0);
+  if (masterFlag && !reg->parsed.irqMasterFlag) {
+    SystemInterrupt(dma->sys, kInterruptDma);
+  }
+  reg->parsed.irqMasterFlag = masterFlag;
+}
+
+static void DmaFinishTransfer(Dma *dma, DmaChannelRegs *regs) {
+  dma->isActive = false;
+  regs->channelControl.parsed.startBusy = false;
+  if (dma->interruptReg.value & (1 << (16 + dma->activeChannel))) {
+    dma->interruptReg.value |= 1 << (24 + dma->activeChannel);
+    DmaUpdateInterrupt(dma);
+  }
+}
+
+static void DmaPortWriteSpan(DmaChannelPort *port, Address address, uint32_t step, const uint32_t *values,
+                             size_t count) {
+  if (port->writeBlock != NULL) {
+    port->writeBlock(port->context, address, step, values, count);
+    return;
+  }
+  size_t i;
+  for (i = 0; i < count; i++) {
+    port->write32(port->context, address, values[i]);
+    address = (address + step) & kDmaBaseAddressRegisterRamMask;
+  }
+}
+
+static void DmaPortReadSpan(DmaChannelPort *port, Address address, uint32_t step, uint32_t *values, size_t count) {
+  if (port->readBlock != NULL) {
+    port->readBlock(port->context, address, step, values, count);
+    return;
+  }
+  size_t i;
+  for (i = 0; i < count; i++) {
+    values[i] = port->read32(port->context, address);
+    address = (address + step) & kDmaBaseAddressRegisterRamMask;
+  }
+}
+
 static uint32_t DmaResumeLinkedList(Dma *dma) {
   DmaChannelRegs *regs = &dma->channelRegs[dma->activeChannel];
   DmaChannelPort *port = &dma->channelPorts[dma->activeChannel];
@@ -158,15 +216,14 @@ static uint32_t DmaResumeLinkedList(Dma *dma) {
   uint32_t cycles = 0;
 
   while (port->isReady(port->context) && address != 0x00FFFFFF) {
-    uint32_t header = MemoryRead32(dma->memory, UserSegment, address);
+    uint32_t header = MemoryRead32(dma->memory, UserSegment, address & kDmaBaseAddressRegisterRamMask);
     uint32_t size = (header & 0xFF000000) >> 24;
-    int i;
-    for (i = 0; i < size; i++) {
-      address = (address + 4) & kDmaBaseAddressRegisterRamMask;
-      uint32_t value = MemoryRead32(dma->memory, UserSegment, address);
-      port->write32(port->context, address, value);
-    }
+    uint32_t values[kDmaSpanWords];
+    address = (address + 4) & kDmaBaseAddressRegisterRamMask;
+    MemoryReadSpan(dma->memory, address, false, values, size);
+    DmaPortWriteSpan(port, address, 4, values, size);
     address = header & 0x00FFFFFF;
+    STATS_ADD(dma->words[dma->activeChannel], size);
     ClockTick(dma->clock, port->clocksPerWord * size);
     cycles += port->clocksPerWord * size;
     while (!port->isReady(port->context)) {
@@ -176,8 +233,7 @@ static uint32_t DmaResumeLinkedList(Dma *dma) {
   }
   dma->ramAddress = address;
   if (address == 0x00FFFFFF) {
-    dma->isActive = false;
-    regs->channelControl.parsed.startBusy = false;
+    DmaFinishTransfer(dma, regs);
   }
   return cycles;
 }
@@ -191,6 +247,7 @@ static uint32_t DmaResumeBlockTransfer(Dma *dma) {
   DmaChannelPort *port = &dma->channelPorts[dma->activeChannel];
   DmaChannelRegs *regs = &dma->channelRegs[dma->activeChannel];
   bool fromRam = regs->channelControl.parsed.fromRam;
+  bool stepBackward = regs->channelControl.parsed.stepBackward;
   uint32_t step = GetRamStepFromControlReg(regs->channelControl);
 
   Address address = dma->ramAddress;
@@ -200,25 +257,28 @@ static uint32_t DmaResumeBlockTransfer(Dma *dma) {
   uint32_t cycles = 0;
 
   while (*blocks > 0 && (ignoreReady || port->isReady(port->context))) {
-    int i;
-    for (i = 0; i < blockSize; i++) {
+    uint32_t done = 0;
+    while (done < blockSize) {
+      uint32_t values[kDmaSpanWords];
+      uint32_t count = blockSize - done < kDmaSpanWords ? blockSize - done : kDmaSpanWords;
       if (fromRam) {
-        uint32_t value = MemoryRead32(dma->memory, UserSegment, address);
-        port->write32(port->context, address, value);
+        MemoryReadSpan(dma->memory, address, stepBackward, values, count);
+        DmaPortWriteSpan(port, address, step, values, count);
       } else {
-        uint32_t value = port->read32(port->context, address);
-        MemoryWrite32(dma->memory, UserSegment, address, value);
+        DmaPortReadSpan(port, address, step, values, count);
+        MemoryWriteSpan(dma->memory, address, stepBackward, values, count);
       }
-      address = (address + step) & kDmaBaseAddressRegisterRamMask;
+      address = (address + step * count) & kDmaBaseAddressRegisterRamMask;
+      done += count;
     }
+    STATS_ADD(dma->words[dma->activeChannel], blockSize);
     ClockTick(dma->clock, port->clocksPerWord * blockSize);
     cycles += port->clocksPerWord * blockSize;
     (*blocks)--;
   }
   dma->ramAddress = address;
   if (*blocks == 0) {
-    dma->isActive = false;
-    regs->channelControl.parsed.startBusy = false;
+    DmaFinishTransfer(dma, regs);
   }
   return cycles;
 }
@@ -252,6 +312,7 @@ static void DmaBlockTransfer(Dma *dma, DmaChannelName channel) {
 static void DmaStartDma(Dma *dma, DmaChannelName channel) {
   DmaChannelRegs *regs = &dma->channelRegs[channel];
   dma->isActive = true;
+  ClockEndSlice(dma->clock);
   dma->activeChannel = channel;
   dma->ramAddress = regs->baseAddress & kDmaBaseAddressRegisterRamMask;
   regs->channelControl.parsed.startTrigger = 0;
@@ -275,6 +336,18 @@ void OtcDmaChannelWrite32(void *context, Address address, uint32_t value) {
   PCF_PANIC("Dma Channel 6 (OTC) does not support writes!");
 }
 
+// Fills values the way count calls to OtcDmaChannelRead32 would, the table is
+// always cleared stepping backwards.
+void OtcDmaChannelReadBlock(void *context, Address address, uint32_t step, uint32_t *values, size_t count) {
+  uint32_t *remaining = (uint32_t *)context;
+  size_t i;
+  for (i = 0; i < count; i++) {
+    (*remaining)--;
+    values[i] = *remaining == 0 ? 0xFFFFFF : (address - 4) & kDmaBaseAddressRegisterRamMask;
+    address = (address + step) & kDmaBaseAddressRegisterRamMask;
+  }
+}
+
 bool OtcDmaChannelIsReady(void *context) { return true; }
 
 Dma *DmaNew(System *sys, Bus *bus) {
@@ -282,12 +355,14 @@ Dma *DmaNew(System *sys, Bus *bus) {
   uint32_t *otcCounter = (uint32_t *)SystemArenaAllocate(sys, sizeof(uint32_t));
   dma->controlReg.value = 0x07654321;
   dma->channelRegs[DmaChannelOtc].channelControl.parsed.stepBackward = true;
+  dma->sys = sys;
   dma->clock = SystemClock(sys);
   dma->memory = SystemMemory(sys);
   BusDevice device = DmaBusDevice(dma);
   BusRegisterDevice(bus, &device, NewAddressRange(0x1F801080, 0x1F801100, kMainSegments));
   DmaChannelPort *port = DmaGetChannel(dma, DmaChannelOtc);
   DmaChannelSetHandlers(port, otcCounter, OtcDmaChannelWrite32, OtcDmaChannelRead32, OtcDmaChannelIsReady);
+  DmaChannelSetBlockHandlers(port, NULL, OtcDmaChannelReadBlock);
   DmaChannelSetClocksPerWord(port, 1);
   return dma;
 }
@@ -312,12 +387,40 @@ void DmaChannelSetHandlers(DmaChannelPort *channel, void *context, DmaChannelWri
   channel->read32 = read32;
   channel->isReady = isReady;
 }
+
+// Optional, a port without block handlers gets a write32 or read32 call per word.
+void DmaChannelSetBlockHandlers(DmaChannelPort *channel, DmaChannelWriteBlock _Nullable writeBlock,
+                                DmaChannelReadBlock _Nullable readBlock) {
+  channel->writeBlock = writeBlock;
+  channel->readBlock = readBlock;
+}
+
 void DmaChannelSetClocksPerWord(DmaChannelPort *channel, uint32_t clocksPerWord) {
   channel->clocksPerWord = clocksPerWord;
 }
 
 bool DmaIsActive(Dma *dma) { return dma->isActive; }
 
+#if SYSTEM_STATS
+void DmaGetStats(Dma *dma, SystemStats *stats) { memcpy(stats->dmaWords, dma->words, sizeof(stats->dmaWords)); }
+#endif
+
+void DmaRelocate(Dma *dma, const SystemRelocation *relocation) {
+  dma->sys = (System *)RelocateArenaPointer(relocation, dma->sys);
+  dma->memory = (Memory *)RelocateArenaPointer(relocation, dma->memory);
+  dma->clock = (Clock *)RelocateArenaPointer(relocation, dma->clock);
+  size_t i;
+  for (i = 0; i < sizeof(dma->channelPorts) / sizeof(dma->channelPorts[0]); i++) {
+    DmaChannelPort *port = &dma->channelPorts[i];
+    port->context = RelocateArenaPointer(relocation, port->context);
+    port->isReady = (DmaChannelIsReady)RelocateImagePointer(relocation, (void *)port->isReady);
+    port->write32 = (DmaChannelWrite32)RelocateImagePointer(relocation, (void *)port->write32);
+    port->read32 = (DmaChannelRead32)RelocateImagePointer(relocation, (void *)port->read32);
+    port->writeBlock = (DmaChannelWriteBlock)RelocateImagePointer(relocation, (void *)port->writeBlock);
+    port->readBlock = (DmaChannelReadBlock)RelocateImagePointer(relocation, (void *)port->readBlock);
+  }
+}
+
 uint32_t DmaRead32(Dma *dma, MemorySegment segment, Address address) {
   uint32_t reg = GetRegisterOffset(address);
   if (address < 0x70) {
@@ -389,11 +492,17 @@ void DmaWrite32(Dma *dma, MemorySegment segment, Address address, uint32_t data)
   case 0:
     dma->controlReg.value = data;
     return;
-  case 1:
-    dma->interruptReg.value = data;
-    // TODO: Handle DMA interrupts correctly
+  case 1: {
+    // Channel flags are acknowledged by writing 1 to them, the master flag is
+    // read-only and only recomputed.
+    bool masterFlag = dma->interruptReg.parsed.irqMasterFlag;
+    uint32_t flags = dma->interruptReg.value & kDmaInterruptRegisterFlagsMask & ~data;
+    dma->interruptReg.value = (data & kDmaInterruptRegisterWriteMask & ~kDmaInterruptRegisterFlagsMask) | flags;
+    dma->interruptReg.parsed.irqMasterFlag = masterFlag;
+    DmaUpdateInterrupt(dma);
     return;
   }
+  }
 }
 
 void DmaWrite16(Dma *dma, MemorySegment segment, Address address, uint16_t data) {
@@ -1,5 +1,6 @@
 #pragma once
 #include "Clock.h"
+#include "Stats.h"
 #include "Types.h"
 
 ASSUME_NONNULL_BEGIN
@@ -7,6 +8,11 @@ ASSUME_NONNULL_BEGIN
 typedef void (*DmaChannelWrite32)(void *context, Address ramAddress, uint32_t value);
 typedef uint32_t (*DmaChannelRead32)(void *context, Address ramAddress);
 typedef bool (*DmaChannelIsReady)(void *context);
+// Block forms of write32 and read32 for ports that can take a span of words at
+// once. values[i] belongs to ramAddress + i * step (wrapped to RAM).
+typedef void (*DmaChannelWriteBlock)(void *context, Address ramAddress, uint32_t step, const uint32_t *values,
+                                     size_t count);
+typedef void (*DmaChannelReadBlock)(void *context, Address ramAddress, uint32_t step, uint32_t *values, size_t count);
 
 typedef enum __DmaChannelName {
   DmaChannelMdecIn = 0,
@@ -23,8 +29,12 @@ uint32_t DmaRun(Dma *dma);
 DmaChannelPort *DmaGetChannel(Dma *dma, DmaChannelName channelName);
 void DmaChannelSetHandlers(DmaChannelPort *channel, void *context, DmaChannelWrite32 write32, DmaChannelRead32 read32,
                            DmaChannelIsReady isReady);
+void DmaChannelSetBlockHandlers(DmaChannelPort *channel, DmaChannelWriteBlock _Nullable writeBlock,
+                                DmaChannelReadBlock _Nullable readBlock);
 void DmaChannelSetClocksPerWord(DmaChannelPort *channel, uint32_t clocksPerWord);
 bool DmaIsActive(Dma *dma);
+void DmaGetStats(Dma *dma, SystemStats *stats);
+void DmaRelocate(Dma *dma, const SystemRelocation *relocation);
 BUS_DEVICE_FUNCS(Dma)
 
 ASSUME_NONNULL_END
@@ -17,7 +17,7 @@ static const uint32_t kCyclesPerDisplay = 480 * kCyclesPerScanline;
 static const uint32_t kCyclesPerVBlank = kCyclesPerFrame - kCyclesPerDisplay;
 static const int8_t kDitherTable[] = {-4, 0, -3, 1, 2, -1, 3, -1, -3, 1, -4, 0, 3, -1, 2, -2};
 
-static GpuControlCommandHandler kControlCommandTable[64] = {
+static const GpuControlCommandHandler kControlCommandTable[64] = {
     GpuReset,
     GpuClearCommandBuffer,
     GpuResetIrq,
@@ -84,8 +84,9 @@ static GpuControlCommandHandler kControlCommandTable[64] = {
     GpuInvalidControlCommand,
 };
 
-static uint32_t kColorRampLookup[32] = {0,   16,  32,  48,  64,  80,  96,  112, 128, 133, 139, 144, 150, 155, 161, 166,
-                                        172, 177, 183, 188, 194, 199, 205, 210, 216, 221, 227, 232, 238, 243, 249, 255};
+static const uint32_t kColorRampLookup[32] = {0,   16,  32,  48,  64,  80,  96,  112, 128, 133, 139, 144, 150, 155,
+                                              161, 166, 172, 177, 183, 188, 194, 199, 205, 210, 216, 221, 227, 232,
+                                              238, 243, 249, 255};
 
 static void FastFill(GpuScreen screen, uint32_t value) {
   uint32_t *dest = screen.pixels;
@@ -252,6 +253,10 @@ struct __Gpu {
   uint8_t texWindowMaskY;
   uint8_t texWindowOffsetX;
   uint8_t texWindowOffsetY;
+#if SYSTEM_STATS
+  uint8_t statsCommand;
+  GpuStats stats;
+#endif
   uint16_t vram[kVramSize];
 };
 
@@ -294,6 +299,7 @@ static void GpuSetPixel(Gpu *gpu, uint16_t x, uint16_t y, uint32_t color, bool d
   screenPixel |= ((color & 0xF80000) >> 9);
   screenPixel |= (gpu->status.parsed.maskSet << 15);
   gpu->vram[x + (y * 1024)] = screenPixel;
+  STATS_ADD(gpu->stats.pixels[gpu->statsCommand], 1);
 }
 
 static void GpuMonochromeTriangle(Gpu *gpu, GpuPackedVertex v1, GpuPackedVertex v2, GpuPackedVertex v3,
@@ -414,6 +420,14 @@ void GpuDmaChannelWrite32(void *context, Address address, uint32_t value) {
   GpuSendCommand(gpu, value);
 }
 
+void GpuDmaChannelWriteBlock(void *context, Address address, uint32_t step, const uint32_t *values, size_t count) {
+  Gpu *gpu = (Gpu *)context;
+  size_t i;
+  for (i = 0; i < count; i++) {
+    GpuSendCommand(gpu, values[i]);
+  }
+}
+
 bool GpuDmaChannelIsReady(void *context) {
   Gpu *gpu = (Gpu *)context;
   return gpu->status.parsed.dmaReady;
@@ -436,6 +450,7 @@ Gpu *GpuNew(System *sys, Bus *bus) {
   DmaChannelPort *port = DmaGetChannel(SystemDma(sys), DmaChannelGpu);
   DmaChannelSetClocksPerWord(port, 1);
   DmaChannelSetHandlers(port, gpu, GpuDmaChannelWrite32, GpuDmaChannelRead32, GpuDmaChannelIsReady);
+  DmaChannelSetBlockHandlers(port, GpuDmaChannelWriteBlock, NULL);
   return gpu;
 }
 
@@ -465,6 +480,10 @@ static void GpuBeginCommand(Gpu *gpu) {
 
 static void GpuCommandDispatch(Gpu *gpu, GpuPacket packet) {
   uint32_t command = (packet & 0xFF000000);
+#if SYSTEM_STATS
+  gpu->statsCommand = command >> 24;
+  gpu->stats.primitives[gpu->statsCommand]++;
+#endif
   switch (command) {
   case 0x28000000:
     GpuRenderMonochromeQuad(gpu, packet);
@@ -485,6 +504,11 @@ static void GpuCommandDispatch(Gpu *gpu, GpuPacket packet) {
   case 0x38000000:
     GpuRenderShadedQuad(gpu, packet);
     break;
+  case 0x1F000000:
+    GpuGetPacket(gpu);
+    gpu->status.parsed.interrupt = 1;
+    SystemInterrupt(gpu->sys, kInterruptGpu);
+    break;
   default:
     GpuGetPacket(gpu);
   }
@@ -532,6 +556,7 @@ static void GpuWriteToVram(Gpu *gpu, GpuPacket packet) {
   y = indexY + gpu->continuation.writeToVramY;
   gpu->vram[x + (y * 1024)] = values.coords.y;
   gpu->continuation.writeToVramIndex++;
+  STATS_ADD(gpu->stats.pixels[0xA0], 2);
   if (gpu->continuation.writeToVramIndex >= max) {
     gpu->continuation.writeToVram = false;
   }
@@ -573,6 +598,7 @@ void GpuRun(Gpu *gpu, uint32_t cycles) {
   if (gpu->continuation.cyclesSinceLastFrame >= kCyclesPerDisplay) {
     gpu->continuation.cyclesSinceLastFrame -= kCyclesPerDisplay;
     gpu->continuation.oddFrame = !gpu->continuation.oddFrame;
+    SystemInterrupt(gpu->sys, kInterruptVBlank);
   }
   uint32_t line = gpu->continuation.cyclesSinceLastFrame / kCyclesPerScanline;
   if (gpu->status.parsed.isinter) {
@@ -598,6 +624,29 @@ uint32_t GpuScreenWidth(Gpu *gpu) { return gpu->screenWidth; }
 
 uint32_t GpuScreenHeight(Gpu *gpu) { return gpu->screenHeight; }
 
+#if SYSTEM_STATS
+void GpuGetStats(Gpu *gpu, SystemStats *stats) { stats->gpu = gpu->stats; }
+#endif
+
+// FNV-1a over the pixels of a screen, so that frames of separate runs can be
+// compared without keeping them around.
+uint64_t GpuScreenHash(GpuScreen screen) {
+  const uint8_t *bytes = (const uint8_t *)screen.pixels;
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  size_t i;
+  for (i = 0; i < (size_t)screen.width * screen.height * sizeof(uint32_t); i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+void GpuRelocate(Gpu *gpu, const SystemRelocation *relocation) {
+  gpu->sys = (System *)RelocateArenaPointer(relocation, gpu->sys);
+  gpu->clockHandle.clock = (Clock *)RelocateArenaPointer(relocation, gpu->clockHandle.clock);
+  gpu->continuation.runningCommand =
+      (GpuCommandImpl)RelocateImagePointer(relocation, (void *)gpu->continuation.runningCommand);
+}
+
 void GpuInvalidControlCommand(Gpu *gpu, GpuCommand command) {
   PCF_PANIC("Received invalid control command 0x%08x", command.value);
 }
@@ -618,7 +667,7 @@ void GpuClearCommandBuffer(Gpu *gpu, GpuCommand command) {
   gpu->continuation.runningCommand = NULL;
 }
 
-void GpuResetIrq(Gpu *gpu, GpuCommand command) { PCFDEBUG("Gpu -> Reset IRQ"); }
+void GpuResetIrq(Gpu *gpu, GpuCommand command) { gpu->status.parsed.interrupt = 0; }
 
 void GpuDisplayEnable(Gpu *gpu, GpuCommand command) { // I need this on the next line
   gpu->status.parsed.displayDisabled = command.parsed.parameters;
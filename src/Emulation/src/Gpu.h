@@ -1,4 +1,5 @@
 #pragma once
+#include "Stats.h"
 #include "Types.h"
 
 ASSUME_NONNULL_BEGIN
@@ -12,6 +13,9 @@ void GpuRun(Gpu *gpu, uint32_t cycles);
 void GpuUpdateScreen(Gpu *gpu, GpuScreen screen);
 uint32_t GpuScreenWidth(Gpu *gpu);
 uint32_t GpuScreenHeight(Gpu *gpu);
+uint64_t GpuScreenHash(GpuScreen screen);
+void GpuGetStats(Gpu *gpu, SystemStats *stats);
+void GpuRelocate(Gpu *gpu, const SystemRelocation *relocation);
 
 BUS_DEVICE_FUNCS(Gpu)
 
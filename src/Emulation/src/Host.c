@@ -0,0 +1,311 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include "Host.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+
+struct __HostThread {
+  HANDLE handle;
+  HostThreadFunction function;
+  void *argument;
+};
+
+struct __HostMutex {
+  SRWLOCK lock;
+};
+
+uint64_t HostTicks(void) {
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  return (uint64_t)counter.QuadPart;
+}
+
+uint64_t HostTicksPerSecond(void) {
+  LARGE_INTEGER frequency;
+  QueryPerformanceFrequency(&frequency);
+  return (uint64_t)frequency.QuadPart;
+}
+
+void HostSleep(uint32_t milliseconds) { Sleep(milliseconds); }
+
+// Counts the cores of every processor group, hosts with more than 64 of them
+// have more than one.
+uint32_t HostNumCores(void) {
+  DWORD cores = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+  return cores > 0 ? (uint32_t)cores : 1;
+}
+
+static DWORD WINAPI HostThreadMain(LPVOID parameter) {
+  HostThread *thread = (HostThread *)parameter;
+  thread->function(thread->argument);
+  return 0;
+}
+
+HostThread *HostThreadStart(HostThreadFunction function, void *argument) {
+  HostThread *thread = (HostThread *)calloc(1, sizeof(HostThread));
+  thread->function = function;
+  thread->argument = argument;
+  thread->handle = CreateThread(NULL, 0, HostThreadMain, thread, 0, NULL);
+  if (thread->handle == NULL) {
+    abort();
+  }
+  return thread;
+}
+
+void HostThreadJoin(HostThread *thread) {
+  WaitForSingleObject(thread->handle, INFINITE);
+  CloseHandle(thread->handle);
+  free(thread);
+}
+
+HostMutex *HostMutexNew(void) {
+  HostMutex *mutex = (HostMutex *)calloc(1, sizeof(HostMutex));
+  InitializeSRWLock(&mutex->lock);
+  return mutex;
+}
+
+void HostMutexLock(HostMutex *mutex) { AcquireSRWLockExclusive(&mutex->lock); }
+
+void HostMutexUnlock(HostMutex *mutex) { ReleaseSRWLockExclusive(&mutex->lock); }
+
+void HostMutexFree(HostMutex *mutex) { free(mutex); }
+
+// Mapping views at chosen addresses needs the placeholder API of newer Windows
+// versions, RAM falls back to masking its mirrors.
+uint8_t *HostMirroredMemoryNew(size_t size, uint32_t mirrors) { return NULL; }
+
+void HostMirroredMemoryFree(uint8_t *memory, size_t size, uint32_t mirrors) {}
+
+static SRWLOCK HostMappedFilesLock = SRWLOCK_INIT;
+
+static void HostLockMappedFiles(void) { AcquireSRWLockExclusive(&HostMappedFilesLock); }
+
+static void HostUnlockMappedFiles(void) { ReleaseSRWLockExclusive(&HostMappedFilesLock); }
+
+static const uint8_t *HostMapFileUncached(const char *path, size_t *size) {
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return NULL;
+  }
+  LARGE_INTEGER fileSize;
+  HANDLE mapping = NULL;
+  if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  }
+  CloseHandle(file);
+  if (mapping == NULL) {
+    return NULL;
+  }
+  const uint8_t *data = (const uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+  *size = (size_t)fileSize.QuadPart;
+  return data;
+}
+
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+struct __HostThread {
+  pthread_t thread;
+  HostThreadFunction function;
+  void *argument;
+};
+
+struct __HostMutex {
+  pthread_mutex_t lock;
+};
+
+uint64_t HostTicks(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+uint64_t HostTicksPerSecond(void) { return 1000000000ULL; }
+
+void HostSleep(uint32_t milliseconds) {
+  struct timespec duration = {.tv_sec = milliseconds / 1000, .tv_nsec = (long)(milliseconds % 1000) * 1000000L};
+  while (nanosleep(&duration, &duration) != 0 && errno == EINTR) {
+  }
+}
+
+uint32_t HostNumCores(void) {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  return cores > 0 ? (uint32_t)cores : 1;
+}
+
+static void *HostThreadMain(void *parameter) {
+  HostThread *thread = (HostThread *)parameter;
+  thread->function(thread->argument);
+  return NULL;
+}
+
+HostThread *HostThreadStart(HostThreadFunction function, void *argument) {
+  HostThread *thread = (HostThread *)calloc(1, sizeof(HostThread));
+  thread->function = function;
+  thread->argument = argument;
+  if (pthread_create(&thread->thread, NULL, HostThreadMain, thread) != 0) {
+    abort();
+  }
+  return thread;
+}
+
+void HostThreadJoin(HostThread *thread) {
+  pthread_join(thread->thread, NULL);
+  free(thread);
+}
+
+HostMutex *HostMutexNew(void) {
+  HostMutex *mutex = (HostMutex *)calloc(1, sizeof(HostMutex));
+  pthread_mutex_init(&mutex->lock, NULL);
+  return mutex;
+}
+
+void HostMutexLock(HostMutex *mutex) { pthread_mutex_lock(&mutex->lock); }
+
+void HostMutexUnlock(HostMutex *mutex) { pthread_mutex_unlock(&mutex->lock); }
+
+void HostMutexFree(HostMutex *mutex) {
+  pthread_mutex_destroy(&mutex->lock);
+  free(mutex);
+}
+
+// Reserves the whole range first so that nothing else can be mapped between
+// the copies, then maps a memfd over each part of it. Returns NULL where there
+// is no memfd, size has to be a multiple of the page size.
+uint8_t *HostMirroredMemoryNew(size_t size, uint32_t mirrors) {
+#if defined(__linux__)
+  int file = memfd_create("psxemu-mirrored", MFD_CLOEXEC);
+  if (file < 0) {
+    return NULL;
+  }
+  uint8_t *memory = NULL;
+  if (ftruncate(file, (off_t)size) == 0) {
+    void *reserved = mmap(NULL, size * mirrors, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reserved != MAP_FAILED) {
+      memory = (uint8_t *)reserved;
+    }
+  }
+  uint32_t i;
+  for (i = 0; memory != NULL && i < mirrors; i++) {
+    if (mmap(memory + i * size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, file, 0) == MAP_FAILED) {
+      munmap(memory, size * mirrors);
+      memory = NULL;
+    }
+  }
+  close(file);
+  return memory;
+#else
+  return NULL;
+#endif
+}
+
+void HostMirroredMemoryFree(uint8_t *memory, size_t size, uint32_t mirrors) { munmap(memory, size * mirrors); }
+
+static pthread_mutex_t HostMappedFilesLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void HostLockMappedFiles(void) { pthread_mutex_lock(&HostMappedFilesLock); }
+
+static void HostUnlockMappedFiles(void) { pthread_mutex_unlock(&HostMappedFilesLock); }
+
+static const uint8_t *HostMapFileUncached(const char *path, size_t *size) {
+  int file = open(path, O_RDONLY);
+  if (file < 0) {
+    return NULL;
+  }
+  struct stat status;
+  void *data = MAP_FAILED;
+  if (fstat(file, &status) == 0 && status.st_size > 0) {
+    data = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_SHARED, file, 0);
+  }
+  close(file);
+  if (data == MAP_FAILED) {
+    return NULL;
+  }
+  *size = (size_t)status.st_size;
+  return (const uint8_t *)data;
+}
+
+#endif
+
+typedef struct __HostMappedFile {
+  struct __HostMappedFile *next;
+  const uint8_t *data;
+  size_t size;
+  bool hashed;
+  uint64_t hash;
+  char path[];
+} HostMappedFile;
+
+static HostMappedFile *HostMappedFiles = NULL;
+
+// Maps the whole file at path read-only and returns NULL if it cannot be
+// opened or is empty. size comes from the file system, the data is only read
+// as it is touched. Every call with the same path in the process gets the same
+// mapping, and the pages are shared with other processes mapping the file
+// through the page cache. Mappings stay until the process exits.
+const uint8_t *HostMapFile(const char *path, size_t *size) {
+  HostLockMappedFiles();
+  HostMappedFile *mapped;
+  for (mapped = HostMappedFiles; mapped != NULL; mapped = mapped->next) {
+    if (strcmp(mapped->path, path) == 0) {
+      break;
+    }
+  }
+  if (mapped == NULL) {
+    size_t fileSize = 0;
+    const uint8_t *data = HostMapFileUncached(path, &fileSize);
+    if (data != NULL) {
+      size_t pathLength = strlen(path);
+      mapped = (HostMappedFile *)calloc(1, sizeof(HostMappedFile) + pathLength + 1);
+      mapped->data = data;
+      mapped->size = fileSize;
+      memcpy(mapped->path, path, pathLength + 1);
+      mapped->next = HostMappedFiles;
+      HostMappedFiles = mapped;
+    }
+  }
+  HostUnlockMappedFiles();
+  if (mapped == NULL) {
+    return NULL;
+  }
+  *size = mapped->size;
+  return mapped->data;
+}
+
+// FNV-1a over all of a mapping that HostMapFile returned, taken the first time
+// it is asked for and kept with the mapping.
+uint64_t HostMappedFileHash(const uint8_t *data) {
+  HostLockMappedFiles();
+  HostMappedFile *mapped;
+  for (mapped = HostMappedFiles; mapped != NULL; mapped = mapped->next) {
+    if (mapped->data == data) {
+      break;
+    }
+  }
+  uint64_t hash = 0;
+  if (mapped != NULL) {
+    if (!mapped->hashed) {
+      mapped->hash = 0xCBF29CE484222325ULL;
+      size_t i;
+      for (i = 0; i < mapped->size; i++) {
+        mapped->hash = (mapped->hash ^ mapped->data[i]) * 0x100000001B3ULL;
+      }
+      mapped->hashed = true;
+    }
+    hash = mapped->hash;
+  }
+  HostUnlockMappedFiles();
+  return hash;
+}
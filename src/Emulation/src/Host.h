@@ -0,0 +1,31 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// The little the core needs from the host operating system, so that it builds
+// without SDL. Ticks come from a monotonic counter.
+uint64_t HostTicks(void);
+uint64_t HostTicksPerSecond(void);
+void HostSleep(uint32_t milliseconds);
+
+// Threads and locks for the frontends that run several Systems at once.
+typedef struct __HostThread HostThread;
+typedef struct __HostMutex HostMutex;
+typedef void (*HostThreadFunction)(void *argument);
+
+uint32_t HostNumCores(void);
+HostThread *HostThreadStart(HostThreadFunction function, void *argument);
+void HostThreadJoin(HostThread *thread);
+HostMutex *HostMutexNew(void);
+void HostMutexLock(HostMutex *mutex);
+void HostMutexUnlock(HostMutex *mutex);
+void HostMutexFree(HostMutex *mutex);
+
+// Read-only mappings of whole files, for images that many Systems share.
+const uint8_t *HostMapFile(const char *path, size_t *size);
+uint64_t HostMappedFileHash(const uint8_t *data);
+
+// Memory whose size bytes repeat mirrors times back to back, the host MMU maps
+// every copy to the same pages.
+uint8_t *HostMirroredMemoryNew(size_t size, uint32_t mirrors);
+void HostMirroredMemoryFree(uint8_t *memory, size_t size, uint32_t mirrors);
@@ -0,0 +1,94 @@
+#include "InterruptControl.h"
+#include "Bus.h"
+#include "Cpu/Cpu.h"
+#include "System.h"
+
+ASSUME_NONNULL_BEGIN
+
+static const uint32_t kInterruptControlWriteMask = 0x000007FF;
+
+// I_STAT at offset 0 latches raised interrupts until they are acknowledged by
+// writing 0 to their bit, I_MASK at offset 4 selects which of them drive the
+// CPU's interrupt line.
+struct __InterruptControl {
+  Cpu *cpu;
+  uint32_t status;
+  uint32_t mask;
+};
+
+static inline BusDevice InterruptControlBusDevice(InterruptControl *control) {
+  BusDevice device = {.context = control,
+                      .cpuCycles = 0,
+                      .read32 = (Read32)InterruptControlRead32,
+                      .read16 = (Read16)InterruptControlRead16,
+                      .read8 = (Read8)InterruptControlRead8,
+                      .write32 = (Write32)InterruptControlWrite32,
+                      .write16 = (Write16)InterruptControlWrite16,
+                      .write8 = (Write8)InterruptControlWrite8};
+  return device;
+}
+
+static void InterruptControlUpdate(InterruptControl *control) {
+  CpuSetInterruptLine(control->cpu, (control->status & control->mask) != 0);
+}
+
+InterruptControl *InterruptControlNew(System *sys, Bus *bus, Cpu *cpu) {
+  InterruptControl *control = (InterruptControl *)SystemArenaAllocate(sys, sizeof(InterruptControl));
+  control->cpu = cpu;
+  control->status = 0;
+  control->mask = 0;
+  BusDevice device = InterruptControlBusDevice(control);
+  PCFResultOrPanic(BusRegisterDevice(bus, &device, NewAddressRange(0x1F801070, 0x1F801078, kMainSegments)));
+  return control;
+}
+
+void InterruptControlRaise(InterruptControl *control, InterruptCode code) {
+  control->status |= (1 << code) & kInterruptControlWriteMask;
+  InterruptControlUpdate(control);
+}
+
+void InterruptControlRelocate(InterruptControl *control, const SystemRelocation *relocation) {
+  control->cpu = (Cpu *)RelocateArenaPointer(relocation, control->cpu);
+}
+
+uint32_t InterruptControlRead32(InterruptControl *control, MemorySegment segment, Address address) {
+  uint32_t value = (address & 0x4) ? control->mask : control->status;
+  return value >> ((address & 0x3) << 3);
+}
+
+uint16_t InterruptControlRead16(InterruptControl *control, MemorySegment segment, Address address) {
+  return (uint16_t)InterruptControlRead32(control, segment, address);
+}
+
+uint8_t InterruptControlRead8(InterruptControl *control, MemorySegment segment, Address address) {
+  return (uint8_t)InterruptControlRead32(control, segment, address);
+}
+
+void InterruptControlWrite32(InterruptControl *control, MemorySegment segment, Address address, uint32_t data) {
+  if (address & 0x4) {
+    control->mask = data & kInterruptControlWriteMask;
+  } else {
+    control->status &= data;
+  }
+  InterruptControlUpdate(control);
+}
+
+// Narrow writes only change their own byte lanes. I_MASK keeps the bytes
+// around them, and I_STAT gets 1s there so that the acknowledge leaves them.
+static void InterruptControlWriteLanes(InterruptControl *control, MemorySegment segment, Address address,
+                                       uint32_t data, uint32_t lanes) {
+  uint32_t shift = (address & 0x3) << 3;
+  uint32_t keep = ~(lanes << shift);
+  uint32_t value = (data << shift) | ((address & 0x4) ? control->mask & keep : keep);
+  InterruptControlWrite32(control, segment, address & ~0x3, value);
+}
+
+void InterruptControlWrite16(InterruptControl *control, MemorySegment segment, Address address, uint16_t data) {
+  InterruptControlWriteLanes(control, segment, address, data, 0xFFFF);
+}
+
+void InterruptControlWrite8(InterruptControl *control, MemorySegment segment, Address address, uint8_t data) {
+  InterruptControlWriteLanes(control, segment, address, data, 0xFF);
+}
+
+ASSUME_NONNULL_END
@@ -0,0 +1,11 @@
+#pragma once
+#include "Types.h"
+
+ASSUME_NONNULL_BEGIN
+
+InterruptControl *InterruptControlNew(System *sys, Bus *bus, Cpu *cpu);
+void InterruptControlRaise(InterruptControl *control, InterruptCode code);
+void InterruptControlRelocate(InterruptControl *control, const SystemRelocation *relocation);
+BUS_DEVICE_FUNCS(InterruptControl)
+
+ASSUME_NONNULL_END
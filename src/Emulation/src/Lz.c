@@ -0,0 +1,155 @@
+#include "Lz.h"
+#include <string.h>
+
+ASSUME_NONNULL_BEGIN
+
+#define kLzMinMatch 4
+#define kLzMaxOffset 0xFFFF
+#define kLzHashBits 12
+#define kLzNibbleMax 15
+
+// Each sequence is a token byte holding the literal count in its high nibble
+// and the match length minus kLzMinMatch in its low one, either extended by
+// bytes that are added on while they are 255. The literals follow, then the
+// 16-bit offset of the match and its length extension. The last sequence
+// stops after its literals.
+
+static inline uint32_t LzRead32(const uint8_t *p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static inline uint32_t LzHash(uint32_t value) { return (value * 2654435761U) >> (32 - kLzHashBits); }
+
+static inline uint8_t *_Nullable LzWriteLength(uint8_t *dst, const uint8_t *end, size_t length) {
+  while (length >= 255) {
+    if (dst == end) {
+      return NULL;
+    }
+    *dst++ = 255;
+    length -= 255;
+  }
+  if (dst == end) {
+    return NULL;
+  }
+  *dst++ = (uint8_t)length;
+  return dst;
+}
+
+static uint8_t *_Nullable LzWriteSequence(uint8_t *dst, const uint8_t *end, const uint8_t *literals,
+                                          size_t numLiterals, size_t offset, size_t matchLength) {
+  if (dst == end) {
+    return NULL;
+  }
+  uint8_t *token = dst++;
+  size_t matchCode = matchLength > 0 ? matchLength - kLzMinMatch : 0;
+  *token = (uint8_t)(((numLiterals < kLzNibbleMax ? numLiterals : kLzNibbleMax) << 4) |
+                     (matchCode < kLzNibbleMax ? matchCode : kLzNibbleMax));
+  if (numLiterals >= kLzNibbleMax && (dst = LzWriteLength(dst, end, numLiterals - kLzNibbleMax)) == NULL) {
+    return NULL;
+  }
+  if ((size_t)(end - dst) < numLiterals) {
+    return NULL;
+  }
+  memcpy(dst, literals, numLiterals);
+  dst += numLiterals;
+  if (matchLength == 0) {
+    return dst;
+  }
+  if (end - dst < 2) {
+    return NULL;
+  }
+  *dst++ = (uint8_t)offset;
+  *dst++ = (uint8_t)(offset >> 8);
+  if (matchCode >= kLzNibbleMax) {
+    return LzWriteLength(dst, end, matchCode - kLzNibbleMax);
+  }
+  return dst;
+}
+
+size_t LzCompress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity) {
+  uint32_t table[1 << kLzHashBits];
+  memset(table, 0xFF, sizeof(table));
+  const uint8_t *end = dst + capacity;
+  uint8_t *out = dst;
+  size_t anchor = 0;
+  size_t position = 0;
+  while (position + kLzMinMatch <= size) {
+    uint32_t value = LzRead32(src + position);
+    uint32_t *slot = &table[LzHash(value)];
+    size_t candidate = *slot;
+    *slot = (uint32_t)position;
+    if (candidate == UINT32_MAX || position - candidate > kLzMaxOffset || LzRead32(src + candidate) != value) {
+      position++;
+      continue;
+    }
+    size_t length = kLzMinMatch;
+    while (position + length < size && src[candidate + length] == src[position + length]) {
+      length++;
+    }
+    out = LzWriteSequence(out, end, src + anchor, position - anchor, position - candidate, length);
+    if (out == NULL) {
+      return 0;
+    }
+    position += length;
+    anchor = position;
+  }
+  out = LzWriteSequence(out, end, src + anchor, size - anchor, 0, 0);
+  return out == NULL ? 0 : (size_t)(out - dst);
+}
+
+static inline const uint8_t *_Nullable LzReadLength(const uint8_t *src, const uint8_t *end, size_t *length) {
+  uint8_t byte;
+  do {
+    if (src == end) {
+      return NULL;
+    }
+    byte = *src++;
+    *length += byte;
+  } while (byte == 255);
+  return src;
+}
+
+size_t LzDecompress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity) {
+  const uint8_t *end = src + size;
+  size_t position = 0;
+  while (src < end) {
+    uint8_t token = *src++;
+    size_t numLiterals = token >> 4;
+    if (numLiterals == kLzNibbleMax && (src = LzReadLength(src, end, &numLiterals)) == NULL) {
+      return 0;
+    }
+    if ((size_t)(end - src) < numLiterals || capacity - position < numLiterals) {
+      return 0;
+    }
+    memcpy(dst + position, src, numLiterals);
+    src += numLiterals;
+    position += numLiterals;
+    if (src == end) {
+      break;
+    }
+    if (end - src < 2) {
+      return 0;
+    }
+    size_t offset = src[0] | ((size_t)src[1] << 8);
+    src += 2;
+    size_t length = (token & kLzNibbleMax) + kLzMinMatch;
+    if ((token & kLzNibbleMax) == kLzNibbleMax && (src = LzReadLength(src, end, &length)) == NULL) {
+      return 0;
+    }
+    if (offset == 0 || offset > position || capacity - position < length) {
+      return 0;
+    }
+    // Matches may overlap the bytes they produce, which is how runs are coded.
+    const uint8_t *match = dst + position - offset;
+    size_t i;
+    for (i = 0; i < length; i++) {
+      dst[position + i] = match[i];
+    }
+    position += length;
+  }
+  return position;
+}
+
+ASSUME_NONNULL_END
@@ -0,0 +1,15 @@
+#pragma once
+#include "Types.h"
+
+ASSUME_NONNULL_BEGIN
+
+// Compressed data never grows past this, so a buffer of this size always fits.
+#define LZ_MAX_COMPRESSED_SIZE(size) ((size) + (size) / 255 + 16)
+
+// A byte-oriented LZ77 codec in the style of LZ4, fast enough to run on every
+// frame. Both return the number of bytes written to dst, or 0 when it is too
+// small (or, for LzDecompress, when src is malformed).
+size_t LzCompress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity);
+size_t LzDecompress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity);
+
+ASSUME_NONNULL_END
@@ -1,17 +1,59 @@
 #include "Memory.h"
+#include "Bus.h"
+#include "Host.h"
 #include "System.h"
+#include <stdlib.h>
 #include <string.h>
 
 ASSUME_NONNULL_BEGIN
 
-const static size_t kMemorySize = 2 * 1024 * 1024;
 const static size_t kMemoryMask = 0x001FFFFF;
 const static size_t kDataCacheSize = 1024;
+// RAM repeats four times in the first 8 MB of the physical address space.
+const static uint32_t kMemoryRamMirrors = 4;
+const static Address kMemoryRamMirrorEnd = 0x00800000;
+#define kMemoryNumCodePages (kMemoryRamSize >> kMemoryCodePageShift)
 
+// Memory kept in the arena holds its bytes in memory. Main RAM lives outside
+// of it in ram, mapped ramMirrors times back to back where the host can (see
+// MemoryNew). Saved states carry it through SystemStateSpans.
+// codePages marks the pages of main RAM that instructions were fetched from
+// into a host cache, codeWriteHandler is told when one is written to. Like the
+// caches they are kept in the transient end of the arena.
 struct __Memory {
+  uint8_t *_Nullable ram;
+  uint32_t ramMirrors;
+  bool *_Nullable codePages;
+  MemoryCodeWriteHandler _Nullable codeWriteHandler;
+  void *_Nullable codeWriteContext;
   uint8_t memory[];
 };
 
+static inline uint8_t *MemoryBytes(Memory *mem) { return mem->ram != NULL ? mem->ram : mem->memory; }
+
+// Mirrored RAM covers all 8 MB, a single copy wraps at its end.
+static inline uint32_t MemoryHostMask(Memory *mem) {
+  return mem->ram != NULL ? (uint32_t)(kMemoryRamSize * mem->ramMirrors - 1) : kMemoryMask;
+}
+
+// Reports every marked page among the size bytes from offset on, offsets past
+// the end of RAM fall into its mirrors. The bus calls it for the writes it makes
+// to the RAM directly.
+static void MemoryCodeWritten(Memory *mem, Address offset, size_t size) {
+  if (mem->codeWriteHandler == NULL) {
+    return;
+  }
+  size_t last = (offset + size - 1) >> kMemoryCodePageShift;
+  size_t page;
+  for (page = offset >> kMemoryCodePageShift; page <= last; page++) {
+    size_t codePage = page & (kMemoryNumCodePages - 1);
+    if (mem->codePages[codePage]) {
+      mem->codePages[codePage] = false;
+      mem->codeWriteHandler(mem->codeWriteContext, (Address)(codePage << kMemoryCodePageShift));
+    }
+  }
+}
+
 static inline BusDevice MemoryBusDevice(Memory *mem, uint32_t cpuCycles) {
   BusDevice device = {.context = mem,
                       .cpuCycles = cpuCycles,
@@ -20,21 +62,59 @@ static inline BusDevice MemoryBusDevice(Memory *mem, uint32_t cpuCycles) {
                       .read8 = (Read8)MemoryRead8,
                       .write32 = (Write32)MemoryWrite32,
                       .write16 = (Write16)MemoryWrite16,
-                      .write8 = (Write8)MemoryWrite8};
+                      .write8 = (Write8)MemoryWrite8,
+                      .host = MemoryBytes(mem),
+                      .hostMask = MemoryHostMask(mem),
+                      .hostWritten = (HostWritten)MemoryCodeWritten};
   return device;
 }
 
 Memory *MemoryNewCustom(System *sys, Bus *bus, size_t size, AddressRange range, uint32_t cycles) {
-  Memory *mem = (Memory *)SystemArenaAllocate(sys, size);
+  Memory *mem = (Memory *)SystemArenaAllocate(sys, sizeof(Memory) + size);
+  mem->ram = NULL;
+  mem->ramMirrors = 0;
+  mem->codePages = NULL;
+  mem->codeWriteHandler = NULL;
+  mem->codeWriteContext = NULL;
   memset(mem->memory, 0xAA, size);
   BusDevice device = MemoryBusDevice(mem, cycles);
   PCFResultOrPanic(BusRegisterDevice(bus, &device, range));
   return mem;
 }
 
+// The hardware mirrors come from the host MMU when it can map the RAM four
+// times over, so the bus and the fast pages see 8 MB of plain memory. Other
+// hosts get a single copy whose mirrors are masked. Either way the RAM is
+// released with MemoryFree.
 Memory *MemoryNew(System *sys, Bus *bus) {
+  Memory *mem = (Memory *)SystemArenaAllocate(sys, sizeof(Memory));
+  mem->ram = HostMirroredMemoryNew(kMemoryRamSize, kMemoryRamMirrors);
+  mem->ramMirrors = kMemoryRamMirrors;
+  if (mem->ram == NULL) {
+    mem->ram = (uint8_t *)PCFMalloc(kMemoryRamSize);
+    mem->ramMirrors = 1;
+  }
+  memset(mem->ram, 0xAA, kMemoryRamSize);
+  mem->codePages = (bool *)SystemArenaAllocateTransient(sys, kMemoryNumCodePages * sizeof(bool));
+  mem->codeWriteHandler = NULL;
+  mem->codeWriteContext = NULL;
+  MemoryClearCode(mem);
   AddressRange range = NewAddressRange(0x00000000, 0x00800000, kMainSegments);
-  return MemoryNewCustom(sys, bus, kMemorySize, range, 3);
+  BusDevice device = MemoryBusDevice(mem, kMemoryCpuCycles);
+  PCFResultOrPanic(BusRegisterDevice(bus, &device, range));
+  return mem;
+}
+
+void MemoryFree(Memory *mem) {
+  if (mem->ram == NULL) {
+    return;
+  }
+  if (mem->ramMirrors > 1) {
+    HostMirroredMemoryFree(mem->ram, kMemoryRamSize, mem->ramMirrors);
+  } else {
+    free(mem->ram);
+  }
+  mem->ram = NULL;
 }
 
 Memory *DataCacheNew(System *sys, Bus *bus) {
@@ -42,32 +122,186 @@ Memory *DataCacheNew(System *sys, Bus *bus) {
   return MemoryNewCustom(sys, bus, kDataCacheSize, range, 0);
 }
 
+uint8_t *MemoryData(Memory *mem) { return MemoryBytes(mem); }
+
+MemoryRam MemoryGetRam(Memory *mem) {
+  MemoryRam ram = {.ram = mem->ram,
+                   .mirrors = mem->ramMirrors,
+                   .codePages = mem->codePages,
+                   .codeWriteHandler = mem->codeWriteHandler,
+                   .codeWriteContext = mem->codeWriteContext};
+  return ram;
+}
+
+// ram is what MemoryGetRam returned for the Memory this one replaces, the RAM
+// itself stays where it is, and so does the tracking of the code the host
+// caches hold. Has to run after BusRelocate.
+void MemoryRelocate(Memory *mem, Bus *bus, MemoryRam ram) {
+  mem->ram = ram.ram;
+  mem->ramMirrors = ram.mirrors;
+  mem->codePages = ram.codePages;
+  mem->codeWriteHandler = ram.codeWriteHandler;
+  mem->codeWriteContext = ram.codeWriteContext;
+  BusSetHost(bus, mem, MemoryBytes(mem));
+}
+
+// mem has to be the main RAM. Only one handler is supported, it replaces any
+// earlier one.
+void MemorySetCodeWriteHandler(Memory *mem, MemoryCodeWriteHandler handler, void *context) {
+  mem->codeWriteHandler = handler;
+  mem->codeWriteContext = context;
+}
+
+// Marks the page holding address as code. Addresses outside of main RAM and
+// its mirrors are ignored.
+void MemoryMarkCode(Memory *mem, Address address) {
+  if (mem->codePages != NULL && PHYSICAL(address) < kMemoryRamMirrorEnd) {
+    mem->codePages[(address & kMemoryMask) >> kMemoryCodePageShift] = true;
+  }
+}
+
+void MemoryClearCode(Memory *mem) {
+  if (mem->codePages != NULL) {
+    memset(mem->codePages, 0, kMemoryNumCodePages * sizeof(bool));
+  }
+}
+
+// For writes to RAM that bypass the Memory functions, like the CPU's through
+// its fast pages. Addresses outside of main RAM and its mirrors are ignored.
+void MemoryNotifyWrite(Memory *mem, Address address) {
+  if (PHYSICAL(address) < kMemoryRamMirrorEnd) {
+    MemoryCodeWritten(mem, address & kMemoryMask, 1);
+  }
+}
+
+// Called before the main RAM is replaced by loaded, reports the code pages
+// whose contents change.
+void MemoryInvalidateChangedCode(Memory *mem, const uint8_t *loaded) {
+  const size_t pageSize = (size_t)1 << kMemoryCodePageShift;
+  const uint8_t *ram = MemoryBytes(mem);
+  size_t page;
+  if (mem->codePages == NULL) {
+    return;
+  }
+  for (page = 0; page < kMemoryNumCodePages; page++) {
+    if (mem->codePages[page] && memcmp(ram + page * pageSize, loaded + page * pageSize, pageSize) != 0) {
+      MemoryCodeWritten(mem, (Address)(page * pageSize), pageSize);
+    }
+  }
+}
+
+// Marked pages are non-zero, the recompiler tests them inline.
+const bool *MemoryCodePages(Memory *mem) { return mem->codePages; }
+
+// The number of words from word to the end of RAM in the direction of the
+// transfer, at most count. Forward runs carry on into the mirrors.
+static inline size_t MemorySpanRun(Memory *mem, size_t word, bool stepBackward, size_t count) {
+  size_t mirrors = mem->ram != NULL ? mem->ramMirrors : 1;
+  size_t run = stepBackward ? word + 1 : ((kMemoryRamSize * mirrors) >> 2) - word;
+  return run < count ? run : count;
+}
+
+// Copies count words starting at address into values, moving to the previous
+// word after each one when stepBackward is set. Addresses wrap at the end of
+// RAM, every run up to the wrap is copied in one go.
+void MemoryReadSpan(Memory *mem, Address address, bool stepBackward, uint32_t *values, size_t count) {
+  const uint32_t *words = (const uint32_t *)MemoryBytes(mem);
+  size_t word = (address & kMemoryMask) >> 2;
+  while (count > 0) {
+    size_t run = MemorySpanRun(mem, word, stepBackward, count);
+    if (stepBackward) {
+      size_t i;
+      for (i = 0; i < run; i++) {
+        values[i] = words[word - i];
+      }
+      word -= run;
+    } else {
+      memcpy(values, words + word, run * sizeof(uint32_t));
+      word += run;
+    }
+    word &= kMemoryMask >> 2;
+    values += run;
+    count -= run;
+  }
+}
+
+// The counterpart of MemoryReadSpan, values[0] is written to address. Code
+// pages the span covers are reported like any other write.
+void MemoryWriteSpan(Memory *mem, Address address, bool stepBackward, const uint32_t *values, size_t count) {
+  uint32_t *words = (uint32_t *)MemoryBytes(mem);
+  size_t word = (address & kMemoryMask) >> 2;
+  while (count > 0) {
+    size_t run = MemorySpanRun(mem, word, stepBackward, count);
+    if (stepBackward) {
+      size_t i;
+      for (i = 0; i < run; i++) {
+        words[word - i] = values[i];
+      }
+      MemoryCodeWritten(mem, (Address)((word + 1 - run) << 2), run << 2);
+      word -= run;
+    } else {
+      memcpy(words + word, values, run * sizeof(uint32_t));
+      MemoryCodeWritten(mem, (Address)(word << 2), run << 2);
+      word += run;
+    }
+    word &= kMemoryMask >> 2;
+    values += run;
+    count -= run;
+  }
+}
+
+// Copies size bytes from bytes to address, or zeroes them when bytes is NULL.
+// Addresses wrap at the end of RAM, and like in MemoryWriteSpan every run up to
+// the wrap is copied and reported in one go.
+void MemoryWriteBytes(Memory *mem, Address address, const uint8_t *_Nullable bytes, size_t size) {
+  uint8_t *ram = MemoryBytes(mem);
+  size_t offset = address & kMemoryMask;
+  while (size > 0) {
+    size_t run = kMemoryRamSize - offset;
+    run = run < size ? run : size;
+    if (bytes != NULL) {
+      memcpy(ram + offset, bytes, run);
+      bytes += run;
+    } else {
+      memset(ram + offset, 0, run);
+    }
+    MemoryCodeWritten(mem, (Address)offset, run);
+    offset = 0;
+    size -= run;
+  }
+}
+
+// address is an offset into mem, wrapped with the same mask the bus applies to
+// host, so these agree with the bus whether it or a caller like the DMA uses
+// them. Smaller memories rely on their address range to stay below their size.
 uint32_t MemoryRead32(Memory *mem, MemorySegment segment, Address address) {
-  Address addr = (address & kMemoryMask) >> 2;
-  return ((uint32_t *)mem->memory)[addr];
+  return ((uint32_t *)MemoryBytes(mem))[(address & MemoryHostMask(mem)) >> 2];
 }
 
 uint16_t MemoryRead16(Memory *mem, MemorySegment segment, Address address) {
-  Address addr = (address & kMemoryMask) >> 1;
-  return ((uint16_t *)mem->memory)[addr];
+  return ((uint16_t *)MemoryBytes(mem))[(address & MemoryHostMask(mem)) >> 1];
 }
 
 uint8_t MemoryRead8(Memory *mem, MemorySegment segment, Address address) {
-  return ((uint8_t *)mem->memory)[(address & kMemoryMask)];
+  return MemoryBytes(mem)[address & MemoryHostMask(mem)];
 }
 
 void MemoryWrite32(Memory *mem, MemorySegment segment, Address address, uint32_t data) {
-  Address addr = (address & kMemoryMask) >> 2;
-  ((uint32_t *)mem->memory)[addr] = data;
+  address &= MemoryHostMask(mem);
+  ((uint32_t *)MemoryBytes(mem))[address >> 2] = data;
+  MemoryCodeWritten(mem, address, sizeof(data));
 }
 
 void MemoryWrite16(Memory *mem, MemorySegment segment, Address address, uint16_t data) {
-  Address addr = (address & kMemoryMask) >> 1;
-  ((uint16_t *)mem->memory)[addr] = data;
+  address &= MemoryHostMask(mem);
+  ((uint16_t *)MemoryBytes(mem))[address >> 1] = data;
+  MemoryCodeWritten(mem, address, sizeof(data));
 }
 
 void MemoryWrite8(Memory *mem, MemorySegment segment, Address address, uint8_t data) {
-  ((uint8_t *)mem->memory)[(address & kMemoryMask)] = data;
+  address &= MemoryHostMask(mem);
+  MemoryBytes(mem)[address] = data;
+  MemoryCodeWritten(mem, address, sizeof(data));
 }
 
 ASSUME_NONNULL_END
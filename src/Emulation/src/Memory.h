@@ -4,8 +4,42 @@
 
 ASSUME_NONNULL_BEGIN
 
+// CPU cycles charged for every access to main RAM.
+static const uint32_t kMemoryCpuCycles = 3;
+static const size_t kMemoryRamSize = 2 * 1024 * 1024;
+// Code in main RAM is tracked in pages of 4 KiB.
+static const uint32_t kMemoryCodePageShift = 12;
+
+// Called with the RAM offset of a code page that was just written to, after
+// which the page is no longer marked as code.
+typedef void (*MemoryCodeWriteHandler)(void *context, Address page);
+
+// Where the main RAM lives outside the arena, and the host side tracking of
+// the code in it, see MemoryRelocate.
+typedef struct __MemoryRam {
+  uint8_t *_Nullable ram;
+  uint32_t mirrors;
+  bool *_Nullable codePages;
+  MemoryCodeWriteHandler _Nullable codeWriteHandler;
+  void *_Nullable codeWriteContext;
+} MemoryRam;
+
 Memory *MemoryNewCustom(System *sys, Bus *bus, size_t size, AddressRange range, uint32_t cycles);
 Memory *MemoryNew(System *sys, Bus *bus);
+Memory *DataCacheNew(System *sys, Bus *bus);
+void MemoryFree(Memory *mem);
+uint8_t *MemoryData(Memory *mem);
+MemoryRam MemoryGetRam(Memory *mem);
+void MemoryRelocate(Memory *mem, Bus *bus, MemoryRam ram);
+void MemoryReadSpan(Memory *mem, Address address, bool stepBackward, uint32_t *values, size_t count);
+void MemoryWriteSpan(Memory *mem, Address address, bool stepBackward, const uint32_t *values, size_t count);
+void MemoryWriteBytes(Memory *mem, Address address, const uint8_t *_Nullable bytes, size_t size);
+void MemorySetCodeWriteHandler(Memory *mem, MemoryCodeWriteHandler handler, void *context);
+void MemoryMarkCode(Memory *mem, Address address);
+void MemoryClearCode(Memory *mem);
+void MemoryNotifyWrite(Memory *mem, Address address);
+void MemoryInvalidateChangedCode(Memory *mem, const uint8_t *loaded);
+const bool *MemoryCodePages(Memory *mem);
 BUS_DEVICE_FUNCS(Memory)
 
 ASSUME_NONNULL_END
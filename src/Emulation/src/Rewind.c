@@ -0,0 +1,216 @@
+#include "Rewind.h"
+#include "Lz.h"
+#include "System.h"
+#include <stdlib.h>
+#include <string.h>
+
+ASSUME_NONNULL_BEGIN
+
+#define kRewindPageSize 4096
+#define kRewindMaxEntries 4096
+#define kRewindPageHeaderSize 12
+
+// A snapshot is stored as the pages that differ from the snapshot after it,
+// each as the LZ compressed XOR of the two versions. Applying the newest
+// entry to the newest snapshot (reference, a saved state) therefore yields
+// the one before it. Every page record is the page's offset in the state,
+// its size and its compressed size, 32 bits each, followed by the compressed
+// bytes.
+typedef struct __RewindEntry {
+  size_t offset;
+  size_t size;
+  uint32_t numPages;
+} RewindEntry;
+
+// Entries are laid out in data one after another, wrapping around to the
+// start when they do not fit at the end; the oldest ones are dropped to make
+// room. sys is the system the reference was captured from, NULL when there
+// is none.
+struct __Rewind {
+  System *_Nullable sys;
+  size_t stateSize;
+  uint8_t *_Nullable reference;
+  uint8_t *_Nullable staging;
+  uint8_t *data;
+  size_t capacity;
+  size_t head;
+  size_t first;
+  size_t count;
+  RewindEntry entries[kRewindMaxEntries];
+};
+
+// capacity is how many bytes of compressed history are kept, the newest
+// snapshot comes on top of that.
+Rewind *RewindNew(size_t capacity) {
+  Rewind *rewind = (Rewind *)PCFMalloc(sizeof(Rewind));
+  rewind->data = (uint8_t *)PCFMalloc(capacity);
+  rewind->capacity = capacity;
+  rewind->sys = NULL;
+  rewind->stateSize = 0;
+  rewind->reference = NULL;
+  rewind->staging = NULL;
+  rewind->head = 0;
+  rewind->first = 0;
+  rewind->count = 0;
+  return rewind;
+}
+
+void RewindFree(Rewind *rewind) {
+  free(rewind->reference);
+  free(rewind->staging);
+  free(rewind->data);
+  free(rewind);
+}
+
+static void RewindDropOldest(Rewind *rewind) {
+  rewind->first = (rewind->first + 1) % kRewindMaxEntries;
+  rewind->count--;
+}
+
+static void RewindClearHistory(Rewind *rewind) {
+  rewind->head = 0;
+  rewind->first = 0;
+  rewind->count = 0;
+}
+
+// Starts the history over from the state of sys.
+static void RewindReset(Rewind *rewind, System *sys, size_t stateSize) {
+  if (stateSize != rewind->stateSize) {
+    free(rewind->reference);
+    free(rewind->staging);
+    size_t maxPages = stateSize / kRewindPageSize + kSystemStateNumSpans;
+    rewind->reference = (uint8_t *)PCFMalloc(stateSize);
+    rewind->staging = (uint8_t *)PCFMalloc(maxPages * (kRewindPageHeaderSize + LZ_MAX_COMPRESSED_SIZE(kRewindPageSize)));
+    rewind->stateSize = stateSize;
+  }
+  PCFResultOrPanic(SystemSaveState(sys, rewind->reference, stateSize));
+  rewind->sys = sys;
+  RewindClearHistory(rewind);
+}
+
+// Finds room for size bytes after the newest entry, dropping the oldest
+// entries that are in the way.
+static size_t RewindReserve(Rewind *rewind, size_t size) {
+  if (rewind->count == kRewindMaxEntries) {
+    RewindDropOldest(rewind);
+  }
+  if (rewind->head + size > rewind->capacity) {
+    // Everything from head to the end is older than what is at the start.
+    while (rewind->count > 0 && rewind->entries[rewind->first].offset >= rewind->head) {
+      RewindDropOldest(rewind);
+    }
+    rewind->head = 0;
+  }
+  while (rewind->count > 0 && rewind->entries[rewind->first].offset >= rewind->head &&
+         rewind->entries[rewind->first].offset < rewind->head + size) {
+    RewindDropOldest(rewind);
+  }
+  size_t offset = rewind->head;
+  rewind->head += size;
+  return offset;
+}
+
+static uint8_t *RewindWritePage(uint8_t *out, const uint8_t *live, uint8_t *reference, size_t offset, size_t size) {
+  uint8_t delta[kRewindPageSize];
+  size_t i;
+  for (i = 0; i < size; i++) {
+    delta[i] = live[i] ^ reference[i];
+  }
+  memcpy(reference, live, size);
+  uint32_t record[3] = {(uint32_t)offset, (uint32_t)size, 0};
+  record[2] = (uint32_t)LzCompress(delta, size, out + kRewindPageHeaderSize, LZ_MAX_COMPRESSED_SIZE(kRewindPageSize));
+  memcpy(out, record, sizeof(record));
+  return out + kRewindPageHeaderSize + record[2];
+}
+
+// Makes the state of sys the newest snapshot. Meant to be called once per
+// frame: the live arena is compared against the previous snapshot directly,
+// only the pages that changed are copied and compressed.
+void RewindCapture(Rewind *rewind, System *sys) {
+  size_t stateSize = SystemStateSize(sys);
+  if (sys != rewind->sys || stateSize != rewind->stateSize) {
+    RewindReset(rewind, sys, stateSize);
+    return;
+  }
+  SystemStateSpan spans[kSystemStateNumSpans];
+  size_t offset;
+  SystemStateSpans(sys, spans, &offset);
+  uint8_t *out = rewind->staging;
+  uint32_t numPages = 0;
+  size_t span;
+  for (span = 0; span < kSystemStateNumSpans; span++) {
+    size_t position;
+    for (position = 0; position < spans[span].size; position += kRewindPageSize) {
+      size_t remaining = spans[span].size - position;
+      size_t size = remaining < kRewindPageSize ? remaining : kRewindPageSize;
+      const uint8_t *live = spans[span].data + position;
+      uint8_t *reference = rewind->reference + offset + position;
+      if (memcmp(live, reference, size) != 0) {
+        out = RewindWritePage(out, live, reference, offset + position, size);
+        numPages++;
+      }
+    }
+    offset += spans[span].size;
+  }
+  size_t size = (size_t)(out - rewind->staging);
+  if (size > rewind->capacity) {
+    // Too different to keep, the history starts over from here.
+    RewindClearHistory(rewind);
+    return;
+  }
+  size_t entryOffset = RewindReserve(rewind, size);
+  memcpy(rewind->data + entryOffset, rewind->staging, size);
+  RewindEntry *entry = &rewind->entries[(rewind->first + rewind->count) % kRewindMaxEntries];
+  entry->offset = entryOffset;
+  entry->size = size;
+  entry->numPages = numPages;
+  rewind->count++;
+}
+
+// Loads the newest snapshot into sys and forgets it, so that repeated calls
+// step further back. Returns false once the history is exhausted.
+bool RewindPop(Rewind *rewind, System *sys) {
+  if (rewind->sys == NULL) {
+    return false;
+  }
+  PCFResultOrPanic(SystemLoadState(sys, rewind->reference, rewind->stateSize));
+  if (rewind->count == 0) {
+    rewind->sys = NULL;
+    return true;
+  }
+  rewind->count--;
+  RewindEntry *entry = &rewind->entries[(rewind->first + rewind->count) % kRewindMaxEntries];
+  const uint8_t *in = rewind->data + entry->offset;
+  uint8_t delta[kRewindPageSize];
+  uint32_t i;
+  for (i = 0; i < entry->numPages; i++) {
+    uint32_t record[3];
+    memcpy(record, in, sizeof(record));
+    in += kRewindPageHeaderSize;
+    if (LzDecompress(in, record[2], delta, sizeof(delta)) != record[1]) {
+      PCF_PANIC("Rewind history is corrupted!");
+    }
+    uint8_t *reference = rewind->reference + record[0];
+    size_t j;
+    for (j = 0; j < record[1]; j++) {
+      reference[j] ^= delta[j];
+    }
+    in += record[2];
+  }
+  rewind->head = entry->offset;
+  return true;
+}
+
+// Counts the snapshots RewindPop can still go back to.
+size_t RewindNumSnapshots(Rewind *rewind) { return rewind->sys == NULL ? 0 : rewind->count + 1; }
+
+size_t RewindUsedBytes(Rewind *rewind) {
+  size_t used = 0;
+  size_t i;
+  for (i = 0; i < rewind->count; i++) {
+    used += rewind->entries[(rewind->first + i) % kRewindMaxEntries].size;
+  }
+  return used;
+}
+
+ASSUME_NONNULL_END
@@ -0,0 +1,13 @@
+#pragma once
+#include "Types.h"
+
+ASSUME_NONNULL_BEGIN
+
+Rewind *RewindNew(size_t capacity);
+void RewindFree(Rewind *rewind);
+void RewindCapture(Rewind *rewind, System *sys);
+bool RewindPop(Rewind *rewind, System *sys);
+size_t RewindNumSnapshots(Rewind *rewind);
+size_t RewindUsedBytes(Rewind *rewind);
+
+ASSUME_NONNULL_END
@@ -0,0 +1,66 @@
+#pragma once
+#include "Types.h"
+
+ASSUME_NONNULL_BEGIN
+
+// Builds with SYSTEM_STATS set count what each subsystem does, per System and
+// without atomics, see SystemGetStats. Without it the counters are left out of
+// the structs and STATS_ADD expands to nothing.
+#ifndef SYSTEM_STATS
+#define SYSTEM_STATS 0
+#endif
+
+#if SYSTEM_STATS
+#define STATS_ADD(counter, amount) ((counter) += (amount))
+#else
+#define STATS_ADD(counter, amount) ((void)0)
+#endif
+
+#define kStatsMaxBusDevices 32
+#define kStatsMaxClockDevices 32
+#define kStatsNumDmaChannels 7
+#define kStatsNumGpuCommands 256
+
+// opcodes is indexed by the primary opcode, registerFuncts by the funct of
+// opcode 0. Instructions in recompiled blocks are counted a block at a time.
+typedef struct __CpuStats {
+  uint64_t opcodes[64];
+  uint64_t registerFuncts[64];
+  uint64_t iCacheHits;
+  uint64_t iCacheMisses;
+} CpuStats;
+
+// Accesses to a device, including the ones the CPU makes to plain memory
+// without going through the bus.
+typedef struct __BusDeviceStats {
+  AddressRange addressRange;
+  uint64_t reads;
+  uint64_t writes;
+  uint64_t cycles;
+} BusDeviceStats;
+
+// Indexed by the GP0 command byte. Pixels are the ones that passed clipping and
+// the mask test.
+typedef struct __GpuStats {
+  uint64_t primitives[kStatsNumGpuCommands];
+  uint64_t pixels[kStatsNumGpuCommands];
+} GpuStats;
+
+// Devices are listed in the order they were added to the clock.
+typedef struct __ClockDeviceStats {
+  uint32_t clockRate;
+  uint64_t updates;
+} ClockDeviceStats;
+
+typedef struct __SystemStats {
+  bool enabled;
+  CpuStats cpu;
+  size_t numBusDevices;
+  BusDeviceStats busDevices[kStatsMaxBusDevices];
+  uint64_t dmaWords[kStatsNumDmaChannels];
+  GpuStats gpu;
+  size_t numClockDevices;
+  ClockDeviceStats clockDevices[kStatsMaxClockDevices];
+} SystemStats;
+
+ASSUME_NONNULL_END
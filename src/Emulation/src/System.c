@@ -2,22 +2,42 @@
 #include "Bios.h"
 #include "Bus.h"
 #include "Clock.h"
+#include "Cpu/BlockCache.h"
 #include "Cpu/Cpu.h"
+#include "Cpu/Recompiler.h"
 #include "Devices.h"
 #include "Dma.h"
 #include "Gpu.h"
+#include "Host.h"
+#include "InterruptControl.h"
 #include "Memory.h"
 #include "System.h"
-#include <SDL_surface.h>
+#include <PsxCoreFoundation/String.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 ASSUME_NONNULL_BEGIN
 
 static const size_t kNumOfBusDevices = 29;
 static const size_t kSystemArenaSize = 1024 * 1024 * 10;
+// The BIOS jumps here once the kernel is initialized, before the shell runs.
+static const Address kSystemShellEntry = 0x80030000;
+// The kernel keeps to the first 64 KB of RAM, the shell and the programs it
+// starts run above them.
+static const Address kSystemUserRamStart = 0x00010000;
+static const uint64_t kSystemMaxBootCycles = 33868800ULL * 30;
+static const size_t kExeHeaderSize = 0x800;
+static const uint32_t kSystemStateMagic = 0x53585350; // "PSXS"
+// Bumped whenever the state gains something that is not part of the arena.
+static const uint32_t kSystemStateVersion = 4;
 
+// The arena is allocated from the bottom up to arenaPosition, and from the
+// top down to transientPosition for host caches that saved states leave out.
 struct __System {
   size_t arenaPosition;
+  size_t transientPosition;
   Clock *clock;
   Cpu *cpu;
   Bus *bus;
@@ -25,24 +45,45 @@ struct __System {
   Memory *memory;
   Bios *bios;
   Dma *dma;
+  InterruptControl *interruptControl;
 };
 
+// Precedes the arena and the main RAM, which lives outside of it, in a saved
+// state. The arena holds the structs of the build that saved it verbatim, so
+// build has to match to load it. arenaBase and imageBase are where the arena
+// and SystemNew were in the process that saved it, see SystemRelocation. The
+// BIOS image is not part of the state either, a state only loads into a
+// System running the BIOS with hash biosHash.
+typedef struct __SystemStateHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t build;
+  uint64_t arenaBase;
+  uint64_t imageBase;
+  uint64_t arenaSize;
+  uint64_t biosHash;
+} SystemStateHeader;
+
 System *SystemNew(PCFStringRef biosPath, PCFStringRef _Nullable cdromPath, PCFStringRef _Nullable memoryCardPath) {
-  void *arena = PCFMalloc(kSystemArenaSize);
-  System *sys = (System *)SystemArenaAllocate((System *)arena, sizeof(System));
+  System *sys = (System *)PCFMalloc(kSystemArenaSize);
+  sys->transientPosition = kSystemArenaSize;
+  SystemArenaAllocate(sys, sizeof(System));
   sys->clock = ClockNew(sys);
   Bus *bus = BusNew(sys, kNumOfBusDevices);
   sys->bus = bus;
   sys->cpu = CpuNew(sys, bus, sys->clock);
+  CpuSetExecutionMode(sys->cpu, RECOMPILER_SUPPORTED ? CpuModeRecompiler : CpuModeCachedInterpreter);
   sys->memory = MemoryNew(sys, bus);
+  CpuSetMemory(sys->cpu, sys->memory);
   sys->bios = BiosNew(sys, bus, biosPath);
   CpuRegisterCacheControl(sys->cpu);
+  CpuSetScratchpad(sys->cpu, MemoryData(DataCacheNew(sys, bus)));
   sys->dma = DmaNew(sys, bus);
   sys->gpu = GpuNew(sys, bus);
   TimersNew(sys, bus);
   CdromNew(sys, bus);
   PeripheralsNew(sys, bus);
-  InterruptControlNew(sys, bus);
+  sys->interruptControl = InterruptControlNew(sys, bus, sys->cpu);
   MemoryControl2New(sys, bus);
   MemoryControl1New(sys, bus);
   Expansion1New(sys, bus);
@@ -56,13 +97,323 @@ System *SystemNew(PCFStringRef biosPath, PCFStringRef _Nullable cdromPath, PCFSt
   return sys;
 }
 
+// Releases the main RAM along with the arena.
+void SystemFree(System *sys) {
+  CpuFree(sys->cpu);
+  MemoryFree(sys->memory);
+  free(sys);
+}
+
 Clock *SystemClock(System *sys) { return sys->clock; }
 
 Memory *SystemMemory(System *sys) { return sys->memory; }
 
 Dma *SystemDma(System *sys) { return sys->dma; }
 
-void SystemInterrupt(System *sys, InterruptCode code) {}
+// Once the shell or a program it started runs, the CPU never comes back to
+// the entry point on its own. Until then it runs the BIOS from ROM, or the
+// kernel.
+static bool SystemIsPastShellEntry(System *sys) {
+  Address pc = PHYSICAL(CpuGetPc(sys->cpu));
+  return pc >= kSystemUserRamStart && pc < kMemoryRamSize;
+}
+
+static PCFResult SystemBootToShell(System *sys) {
+  if (!CpuRunUntil(sys->cpu, kSystemShellEntry, kSystemMaxBootCycles)) {
+    return PCFResultError(PCFCSTR("The BIOS never reached the shell entry point!"));
+  }
+  ClockResetRealtime(sys->clock);
+  return PCFResultSuccess();
+}
+
+// Systems built for tests leave out the GPU and BIOS. biosImage and ram belong
+// to the Bios and Memory the loaded ones replace.
+static void SystemRelocate(System *sys, const SystemRelocation *relocation, CpuCaches caches,
+                           const uint8_t *_Nullable biosImage, MemoryRam ram, bool keepBlocks) {
+  sys->clock = (Clock *)RelocateArenaPointer(relocation, sys->clock);
+  sys->cpu = (Cpu *)RelocateArenaPointer(relocation, sys->cpu);
+  sys->bus = (Bus *)RelocateArenaPointer(relocation, sys->bus);
+  sys->gpu = (Gpu *)RelocateArenaPointer(relocation, sys->gpu);
+  sys->memory = (Memory *)RelocateArenaPointer(relocation, sys->memory);
+  sys->bios = (Bios *)RelocateArenaPointer(relocation, sys->bios);
+  sys->dma = (Dma *)RelocateArenaPointer(relocation, sys->dma);
+  sys->interruptControl = (InterruptControl *)RelocateArenaPointer(relocation, sys->interruptControl);
+  ClockRelocate(sys->clock, relocation);
+  BusRelocate(sys->bus, relocation);
+  MemoryRelocate(sys->memory, sys->bus, ram);
+  CpuRelocate(sys->cpu, relocation, caches, keepBlocks);
+  if (sys->gpu != NULL) {
+    GpuRelocate(sys->gpu, relocation);
+  }
+  DmaRelocate(sys->dma, relocation);
+  if (sys->bios != NULL) {
+    BiosRelocate(sys->bios, relocation, biosImage);
+  }
+  InterruptControlRelocate(sys->interruptControl, relocation);
+}
+
+static uint64_t HashBytes(uint64_t hash, const void *bytes, size_t size) {
+  size_t i;
+  for (i = 0; i < size; i++) {
+    hash = (hash ^ ((const uint8_t *)bytes)[i]) * 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+// Hashes where a function of every file the arena points into sits relative to
+// SystemNew. Loading moves all of those pointers by the offset of SystemNew, so
+// this identifies the executable even where it was built without BuildId.c
+// tracking its layout.
+static uint64_t SystemImageHash(void) {
+  const void *functions[] = {(void *)BiosRead32, (void *)BlockCacheCodeWritten, (void *)DmaRead32,
+                             (void *)Expansion1Read32, (void *)GpuRun, (void *)GpuRead32,
+                             (void *)InterruptControlRead32, (void *)MemoryRead32};
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  size_t i;
+  for (i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+    int64_t offset = (int64_t)((intptr_t)functions[i] - (intptr_t)(void *)SystemNew);
+    hash = HashBytes(hash, &offset, sizeof(offset));
+  }
+  return hash;
+}
+
+// Defined by the BuildId.c each executable links, see BuildId.cmake. It hashes
+// every source of the emulator and what decides how the executable is laid
+// out, so it changes along with the layout of any struct in the arena and with
+// the offsets between the functions the arena points to. What changes the
+// layouts without touching a source is mixed in here, along with the offsets
+// themselves.
+extern const uint64_t kSystemBuildId;
+
+static uint64_t SystemBuildHash(void) {
+  const uint64_t build[] = {kSystemBuildId, SYSTEM_STATS, sizeof(void *), SystemImageHash()};
+  return HashBytes(0xCBF29CE484222325ULL, build, sizeof(build));
+}
+
+static SystemStateHeader NewSystemStateHeader(System *sys) {
+  SystemStateHeader header = {.magic = kSystemStateMagic,
+                              .version = kSystemStateVersion,
+                              .build = SystemBuildHash(),
+                              .arenaBase = (uintptr_t)sys,
+                              .imageBase = (uintptr_t)(void *)SystemNew,
+                              .arenaSize = sys->arenaPosition,
+                              .biosHash = sys->bios != NULL ? BiosHash(sys->bios) : 0};
+  return header;
+}
+
+size_t SystemStateSize(System *sys) { return sizeof(SystemStateHeader) + sys->arenaPosition + kMemoryRamSize; }
+
+// The parts of the live System that follow the header in a saved state, in
+// order. The header stays the same for as long as the arena does not grow.
+void SystemStateSpans(System *sys, SystemStateSpan spans[kSystemStateNumSpans], size_t *headerSize) {
+  spans[0].data = (const uint8_t *)sys;
+  spans[0].size = sys->arenaPosition;
+  spans[1].data = MemoryData(sys->memory);
+  spans[1].size = kMemoryRamSize;
+  *headerSize = sizeof(SystemStateHeader);
+}
+
+// A saved state is the header followed by the used part of the arena and the
+// main RAM. The transient end of the arena is left out.
+PCFResult SystemSaveState(System *sys, void *buffer, size_t capacity) {
+  SystemStateHeader header = NewSystemStateHeader(sys);
+  size_t size = sizeof(header) + header.arenaSize + kMemoryRamSize;
+  if (capacity < size) {
+    return PCFResultError(PCFFORMAT("A saved state needs %d bytes, the buffer only has %d!", (int)size, (int)capacity));
+  }
+  uint8_t *out = (uint8_t *)buffer;
+  memcpy(out, &header, sizeof(header));
+  memcpy(out + sizeof(header), sys, header.arenaSize);
+  memcpy(out + sizeof(header) + header.arenaSize, MemoryData(sys->memory), kMemoryRamSize);
+  return PCFResultSuccess();
+}
+
+// Whether the state was saved from this very layout, with the guest memory and
+// the Cpu where they are now. Blocks decoded from its RAM can then be kept.
+static bool SystemStateHasSameLayout(System *sys, const SystemStateHeader *header, const System *saved) {
+  return header->arenaBase == (uintptr_t)sys && header->imageBase == (uintptr_t)(void *)SystemNew &&
+         saved->memory == sys->memory && saved->cpu == sys->cpu;
+}
+
+// Replaces the whole state of sys, which may live in a different arena or
+// process than the one that was saved. What belongs to the host, the
+// transient end of the arena, where the RAM and the BIOS are mapped and the
+// real time of the last sync, is kept.
+// sys is left untouched when the state is rejected.
+PCFResult SystemLoadState(System *sys, const void *state, size_t size) {
+  SystemStateHeader header;
+  if (size < sizeof(header)) {
+    return PCFResultError(PCFCSTR("The saved state is truncated!"));
+  }
+  memcpy(&header, state, sizeof(header));
+  if (header.magic != kSystemStateMagic) {
+    return PCFResultError(PCFCSTR("Not a saved state!"));
+  }
+  if (header.version != kSystemStateVersion || header.build != SystemBuildHash()) {
+    return PCFResultError(PCFCSTR("The saved state is from a different build of the emulator!"));
+  }
+  if (header.arenaSize < sizeof(System) || size - sizeof(header) < kMemoryRamSize ||
+      header.arenaSize > size - sizeof(header) - kMemoryRamSize) {
+    return PCFResultError(PCFCSTR("The saved state is truncated!"));
+  }
+  if (header.arenaSize > sys->transientPosition) {
+    return PCFResultError(PCFCSTR("The saved state does not fit into the arena!"));
+  }
+  if (header.biosHash != (sys->bios != NULL ? BiosHash(sys->bios) : 0)) {
+    return PCFResultError(PCFCSTR("The saved state is from a different BIOS!"));
+  }
+  const uint8_t *data = (const uint8_t *)state + sizeof(header);
+  const uint8_t *loadedRam = data + header.arenaSize;
+  bool keepBlocks = SystemStateHasSameLayout(sys, &header, (const System *)data);
+  if (keepBlocks) {
+    CpuInvalidateChangedCode(sys->cpu, loadedRam);
+  }
+  size_t transientPosition = sys->transientPosition;
+  CpuCaches caches = CpuGetCaches(sys->cpu);
+  const uint8_t *_Nullable biosImage = sys->bios != NULL ? BiosImage(sys->bios) : NULL;
+  MemoryRam ram = MemoryGetRam(sys->memory);
+  ClockRealtime realtime = ClockGetRealtime(sys->clock);
+  memcpy(sys, data, header.arenaSize);
+  sys->transientPosition = transientPosition;
+  SystemRelocation relocation = {.arena = (intptr_t)((uintptr_t)sys - header.arenaBase),
+                                 .image = (intptr_t)((uintptr_t)(void *)SystemNew - header.imageBase)};
+  SystemRelocate(sys, &relocation, caches, biosImage, ram, keepBlocks);
+  memcpy(MemoryData(sys->memory), loadedRam, kMemoryRamSize);
+  ClockSetRealtime(sys->clock, realtime);
+  return PCFResultSuccess();
+}
+
+// The boot is deterministic given the BIOS image, the code running it and the
+// layout of the arena it runs in, which is fixed once SystemNew returns. The
+// cache directory is shared by every executable, so the key also names the one
+// whose function pointers the cached arena holds.
+static uint64_t SystemBootCacheKey(System *sys) {
+  uint64_t build = SystemBuildHash();
+  uint64_t hash = HashBytes(BiosHash(sys->bios), &build, sizeof(build));
+  return HashBytes(hash, &sys->arenaPosition, sizeof(sys->arenaPosition));
+}
+
+static bool SystemRestoreBootCache(System *sys, PCFStringRef path) {
+  FILE *file;
+  if (fopen_s(&file, PCFStringToCString(path), "rb") != 0) {
+    return false;
+  }
+  fseek(file, 0L, SEEK_END);
+  long size = ftell(file);
+  rewind(file);
+  PCFResult result = PCFResultError(PCFCSTR("Unable to read the file!"));
+  if (size > 0) {
+    void *state = PCFMalloc((size_t)size);
+    if (fread(state, (size_t)size, 1, file) == 1) {
+      result = SystemLoadState(sys, state, (size_t)size);
+    }
+    free(state);
+  }
+  fclose(file);
+  if (!result.successful) {
+    PCFWARN("Ignoring boot cache %s: %s", path, result.error);
+    PCFResultReleaseError(result);
+  }
+  return result.successful;
+}
+
+// Other systems, in this process or another, may be booting with the same key.
+// The cache is written under a name of its own and then renamed, so that they
+// never see it half written; if one of them got there first, its file stays.
+static void SystemSaveBootCache(System *sys, PCFStringRef path) {
+  uint64_t writer = HostTicks() ^ (uintptr_t)sys;
+  PCFStringRef partialPath = PCFFORMAT("%s.%016llx.partial", path, (unsigned long long)writer);
+  FILE *file;
+  if (fopen_s(&file, PCFStringToCString(partialPath), "wb") != 0) {
+    PCFWARN("Unable to create boot cache %s.", path);
+    PCFRelease(partialPath);
+    return;
+  }
+  size_t size = SystemStateSize(sys);
+  void *state = PCFMalloc(size);
+  PCFResultOrPanic(SystemSaveState(sys, state, size));
+  bool written = fwrite(state, size, 1, file) == 1;
+  free(state);
+  if (fclose(file) != 0 || !written) {
+    PCFWARN("Unable to write boot cache %s.", path);
+    remove(PCFStringToCString(partialPath));
+  } else if (rename(PCFStringToCString(partialPath), PCFStringToCString(path)) != 0) {
+    remove(PCFStringToCString(partialPath));
+  }
+  PCFRelease(partialPath);
+}
+
+// Boots the BIOS as far as the shell entry point. When cacheDirectory is given
+// the state at that point is kept there, and restored instead of booting again
+// on later runs with the same BIOS and build. sys has to be fresh from
+// SystemNew.
+PCFResult SystemBoot(System *sys, PCFStringRef _Nullable cacheDirectory) {
+  if (cacheDirectory == NULL) {
+    return SystemBootToShell(sys);
+  }
+  uint64_t key = SystemBootCacheKey(sys);
+  PCFStringRef path = PCFFORMAT("%s/psxemu-boot-%016llx.state", cacheDirectory, (unsigned long long)key);
+  if (SystemRestoreBootCache(sys, path)) {
+    PCFRelease(path);
+    return PCFResultSuccess();
+  }
+  PCFResult result = SystemBootToShell(sys);
+  if (result.successful) {
+    SystemSaveBootCache(sys, path);
+  }
+  PCFRelease(path);
+  return result;
+}
+
+// Boots the BIOS only as far as the shell entry point (unless SystemBoot or an
+// earlier run already got there), then copies a PS-X EXE into RAM, clears its
+// BSS and jumps to it instead.
+PCFResult SystemLoadExecutable(System *sys, PCFStringRef exePath) {
+  PCFDataResult dataResult = PCFDataNewFromFile(exePath);
+  if (!dataResult.successful) {
+    return PCFResultError(dataResult.resultOrError.error);
+  }
+  PCFDataRef exe = dataResult.resultOrError.result;
+  size_t size = PCFDataCapacity(exe);
+  char magic[8];
+  size_t i;
+  for (i = 0; i < sizeof(magic) && i < size; i++) {
+    magic[i] = (char)PCFDataGetByte(exe, i);
+  }
+  if (size < kExeHeaderSize || memcmp(magic, "PS-X EXE", sizeof(magic)) != 0) {
+    PCFRelease(exe);
+    return PCFResultError(PCFCSTR("Not a PS-X EXE file!"));
+  }
+  Address pc = PCFDataGetInt(exe, 0x10);
+  uint32_t gp = PCFDataGetInt(exe, 0x14);
+  Address textAddress = PCFDataGetInt(exe, 0x18);
+  uint32_t textSize = PCFDataGetInt(exe, 0x1C);
+  Address bssAddress = PCFDataGetInt(exe, 0x28);
+  uint32_t bssSize = PCFDataGetInt(exe, 0x2C);
+  uint32_t stackAddress = PCFDataGetInt(exe, 0x30);
+  uint32_t stackSize = PCFDataGetInt(exe, 0x34);
+  if (textSize > size - kExeHeaderSize) {
+    PCFRelease(exe);
+    return PCFResultError(PCFFORMAT("PS-X EXE text section is truncated, expected %d bytes", textSize));
+  }
+  if (!SystemIsPastShellEntry(sys)) {
+    PCFResult boot = SystemBootToShell(sys);
+    if (!boot.successful) {
+      PCFRelease(exe);
+      return boot;
+    }
+  }
+  uint8_t *bytes = (uint8_t *)PCFMalloc(size);
+  PCFDataCopyInto(exe, bytes, size);
+  PCFRelease(exe);
+  MemoryWriteBytes(sys->memory, textAddress, bytes + kExeHeaderSize, textSize);
+  free(bytes);
+  MemoryWriteBytes(sys->memory, bssAddress, NULL, bssSize);
+  CpuStartExecutable(sys->cpu, pc, gp, stackAddress != 0 ? stackAddress + stackSize : 0);
+  return PCFResultSuccess();
+}
+
+void SystemInterrupt(System *sys, InterruptCode code) { InterruptControlRaise(sys->interruptControl, code); }
 
 void SystemRun(System *sys) { CpuRun(sys->cpu, 571240); }
 
@@ -70,8 +421,24 @@ uint32_t SystemDmaRun(System *sys) { return DmaRun(sys->dma); }
 
 bool SystemIsDmaActive(System *sys) { return DmaIsActive(sys->dma); }
 
+// All zero, with enabled false, unless the emulator was built with
+// SYSTEM_STATS.
+SystemStats SystemGetStats(System *sys) {
+  SystemStats stats;
+  memset(&stats, 0, sizeof(stats));
+#if SYSTEM_STATS
+  stats.enabled = true;
+  CpuGetStats(sys->cpu, &stats);
+  BusGetStats(sys->bus, &stats);
+  DmaGetStats(sys->dma, &stats);
+  GpuGetStats(sys->gpu, &stats);
+  ClockGetStats(sys->clock, &stats);
+#endif
+  return stats;
+}
+
 void *SystemArenaAllocate(System *sys, size_t size) {
-  if (sys->arenaPosition + size >= kSystemArenaSize) {
+  if (sys->arenaPosition + size >= sys->transientPosition) {
     PCF_PANIC("Exceeded System Arena Size!");
     return (void *)4; // Should never happen since PCF_PANIC crashes the application.
   }
@@ -80,10 +447,19 @@ void *SystemArenaAllocate(System *sys, size_t size) {
   return position;
 }
 
-void SystemUpdateSurface(System *sys, SDL_Surface *surface) {
-  GpuUpdateScreen(sys->gpu, NewGpuScreen(surface->w, surface->h, surface->pixels));
+// Allocates from the top of the arena, which saved states leave out. Meant for
+// host caches, which are kept when a state is loaded.
+void *SystemArenaAllocateTransient(System *sys, size_t size) {
+  if (sys->arenaPosition + size >= sys->transientPosition) {
+    PCF_PANIC("Exceeded System Arena Size!");
+    return (void *)4; // Should never happen since PCF_PANIC crashes the application.
+  }
+  sys->transientPosition -= size;
+  return ((uint8_t *)sys) + sys->transientPosition;
 }
 
+void SystemUpdateScreen(System *sys, GpuScreen screen) { GpuUpdateScreen(sys->gpu, screen); }
+
 void SystemSync(System *sys) { ClockSyncToRealtime(sys->clock); }
 
 static void SystemDebugMemory(System *sys, const char *str) {
@@ -1,24 +1,40 @@
 #pragma once
 #include "Bus.h"
 #include "Cpu/Cpu.h"
+#include "Stats.h"
 #include "Types.h"
 #include <PsxCoreFoundation/Data.h>
-#include <SDL_surface.h>
 
 ASSUME_NONNULL_BEGIN
 
+#define kSystemStateNumSpans 2
+
+typedef struct __SystemStateSpan {
+  const uint8_t *data;
+  size_t size;
+} SystemStateSpan;
+
 System *SystemNew(PCFStringRef biosPath, PCFStringRef _Nullable cdromPath, PCFStringRef _Nullable memoryCardPath);
+void SystemFree(System *sys);
+PCFResult SystemBoot(System *sys, PCFStringRef _Nullable cacheDirectory);
+PCFResult SystemLoadExecutable(System *sys, PCFStringRef exePath);
+size_t SystemStateSize(System *sys);
+PCFResult SystemSaveState(System *sys, void *buffer, size_t capacity);
+PCFResult SystemLoadState(System *sys, const void *state, size_t size);
+void SystemStateSpans(System *sys, SystemStateSpan spans[kSystemStateNumSpans], size_t *headerSize);
 void SystemInterrupt(System *sys, InterruptCode code);
 void SystemRun(System *sys);
-void SystemUpdateSurface(System *sys, SDL_Surface *surface);
+void SystemUpdateScreen(System *sys, GpuScreen screen);
 void SystemSync(System *sys);
 Clock *SystemClock(System *sys);
 Memory *SystemMemory(System *sys);
 Dma *SystemDma(System *sys);
 bool SystemIsDmaActive(System *sys);
 uint32_t SystemDmaRun(System *sys);
+SystemStats SystemGetStats(System *sys);
 void SystemBreakpoint(System *sys);
 
 void *SystemArenaAllocate(System *sys, size_t size);
+void *SystemArenaAllocateTransient(System *sys, size_t size);
 
 ASSUME_NONNULL_END
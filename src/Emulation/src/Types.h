@@ -90,6 +90,7 @@ typedef uint8_t (*Read8)(void *_Nullable, MemorySegment, Address);
 typedef void (*Write32)(void *_Nullable, MemorySegment, Address, uint32_t);
 typedef void (*Write16)(void *_Nullable, MemorySegment, Address, uint16_t);
 typedef void (*Write8)(void *_Nullable, MemorySegment, Address, uint8_t);
+typedef void (*HostWritten)(void *_Nullable, Address, size_t);
 typedef void (*UpdateHandler)(void *, uint32_t);
 
 typedef enum { Coprocessor0 = 0, Coprocessor1, Coprocessor2, Coprocessor3 } Coprocessor;
@@ -108,11 +109,22 @@ typedef struct __BusDevice {
   Write32 write32;
   Write16 write16;
   Write8 write8;
+  // Devices that are plain memory (RAM, BIOS, scratchpad) can hand the bus their
+  // backing store so that accesses skip the handlers. offset & hostMask indexes
+  // it; writes still go to the handlers when hostReadOnly is set. hostWritten,
+  // if set, is told the offset and size of every write the bus makes to host.
+  uint8_t *_Nullable host;
+  uint32_t hostMask;
+  bool hostReadOnly;
+  HostWritten _Nullable hostWritten;
 } BusDevice;
 
 struct __Bus;
 typedef struct __Bus Bus;
 
+struct __BusFastPage;
+typedef struct __BusFastPage BusFastPage;
+
 typedef struct __AddressRange {
   Address start;
   Address end;
@@ -126,9 +138,18 @@ typedef struct __ClockDeviceHandle {
   size_t index;
 } ClockDeviceHandle;
 
+// Where the host stood in real time at the last sync. It belongs to the
+// process rather than to the emulated machine, so loading a state keeps it.
+typedef struct __ClockRealtime {
+  double realTimePerTick;
+  uint64_t realLastSync;
+} ClockRealtime;
+
+// clockRate is in device cycles per second; update is passed the device cycles
+// that elapsed since its previous call.
 typedef struct __ClockDevice {
   void *context;
-  double nanoSecsPerCycle;
+  uint32_t clockRate;
   UpdateHandler update;
 } ClockDevice;
 
@@ -153,6 +174,20 @@ typedef struct __DmaChannelPort DmaChannelPort;
 struct __Gpu;
 typedef struct __Gpu Gpu;
 
+struct __InterruptControl;
+typedef struct __InterruptControl InterruptControl;
+
+struct __Rewind;
+typedef struct __Rewind Rewind;
+
+// How far a snapshot of the arena moved when it was restored: arena is added
+// to pointers into the arena, image to pointers into the emulator's code
+// (device handlers) and static data.
+typedef struct __SystemRelocation {
+  intptr_t arena;
+  intptr_t image;
+} SystemRelocation;
+
 typedef uint32_t GpuPacket;
 
 typedef struct __GpuScreen {
@@ -212,11 +247,18 @@ static inline int32_t RangeCompare(AddressRange r1, AddressRange r2) {
 }
 
 static inline ClockDevice NewClockDevice(void *context, UpdateHandler updateHandler, uint32_t clockRate) {
-  ClockDevice result = {
-      .context = context, .nanoSecsPerCycle = 1000000000.0 / (double)clockRate, .update = updateHandler};
+  ClockDevice result = {.context = context, .clockRate = clockRate, .update = updateHandler};
   return result;
 }
 
+static inline void *_Nullable RelocateArenaPointer(const SystemRelocation *relocation, const void *_Nullable pointer) {
+  return pointer == NULL ? NULL : (void *)((uintptr_t)pointer + relocation->arena);
+}
+
+static inline void *_Nullable RelocateImagePointer(const SystemRelocation *relocation, const void *_Nullable pointer) {
+  return pointer == NULL ? NULL : (void *)((uintptr_t)pointer + relocation->image);
+}
+
 PCFStringRef MemorySegmentName(MemorySegment segment);
 
 ASSUME_NONNULL_END
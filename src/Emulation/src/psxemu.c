@@ -1,4 +1,5 @@
 ﻿// Using SDL and standard IO
+#include "Rewind.h"
 #include "System.h"
 #include <PsxCoreFoundation/String.h>
 #include <SDL.h>
@@ -7,6 +8,8 @@
 #include <locale.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <wchar.h>
 
 // Screen dimension constants
@@ -14,20 +17,50 @@ const int kScreenWidth = 640;
 const int kScreenHeight = 480;
 const char *kBiosPath = "..\\..\\..\\..\\..\\SCPH1001.BIN";
 const char *kWindowTitle = "PsxEmu";
+const char *kOrganizationName = "PsxEmu";
+// Roughly ten minutes of history for typical games.
+const size_t kRewindCapacity = 64 * 1024 * 1024;
 
 void LogSDLError(const char *format);
 bool Init(PCFStringRef _Nonnull biosPath);
+void Present();
+void RunAhead();
 void Loop();
 void Close();
 
 SDL_Window *window = NULL;
 SDL_Surface *screenSurface = NULL;
 System *psxSystem = NULL;
+Rewind *rewindBuffer = NULL;
+// Frames emulated past the one the game has just been given input for, set
+// with --run-ahead. The screen shows the last of them, so input shows up that
+// many frames sooner.
+int runAheadFrames = 0;
+void *runAheadState = NULL;
+size_t runAheadCapacity = 0;
 
 int main(int argc, char *args[]) {
   setlocale(LC_ALL, "C.UTF-8");
   PCFStringRef biosPath = PCFCSTR(kBiosPath);
   if (Init(biosPath)) {
+    // Restores the state at the end of the BIOS boot from the previous run.
+    char *prefPath = SDL_GetPrefPath(kOrganizationName, kWindowTitle);
+    PCFStringRef _Nullable cacheDirectory = prefPath != NULL ? PCFStringNewFromCString(prefPath) : NULL;
+    SDL_free(prefPath);
+    PCFResultOrPanic(SystemBoot(psxSystem, cacheDirectory));
+    if (cacheDirectory != NULL) {
+      PCFRelease(cacheDirectory);
+    }
+    int i;
+    for (i = 1; i + 1 < argc; i += 2) {
+      if (strcmp(args[i], "--exe") == 0) {
+        PCFStringRef exePath = PCFStringNewFromCString(args[i + 1]);
+        PCFResultOrPanic(SystemLoadExecutable(psxSystem, exePath));
+        PCFRelease(exePath);
+      } else if (strcmp(args[i], "--run-ahead") == 0) {
+        runAheadFrames = atoi(args[i + 1]);
+      }
+    }
     Loop();
   }
   Close();
@@ -54,6 +87,7 @@ bool Init(PCFStringRef _Nonnull biosPath) {
       LogSDLError("Window could not be created! SDL_Error: %s");
     } else {
       psxSystem = SystemNew(biosPath, NULL, NULL);
+      rewindBuffer = RewindNew(kRewindCapacity);
       screenSurface = SDL_GetWindowSurface(window);
       PCFStringRef pixelName = PCFStringNewFromCString(SDL_GetPixelFormatName(screenSurface->format->format));
       PCFDEBUG("Pixel format is %s. Num of bytes per pixel is %d. R = 0x%08x, "
@@ -67,6 +101,29 @@ bool Init(PCFStringRef _Nonnull biosPath) {
   return false;
 }
 
+void Present() {
+  SystemUpdateScreen(psxSystem, NewGpuScreen(screenSurface->w, screenSurface->h, screenSurface->pixels));
+}
+
+// Runs the speculative frames after the current one and presents only the last
+// of them, then restores the current frame. The emulator has no audio output
+// yet, so presenting is all there is to hold back.
+void RunAhead() {
+  size_t size = SystemStateSize(psxSystem);
+  if (size > runAheadCapacity) {
+    free(runAheadState);
+    runAheadState = PCFMalloc(size);
+    runAheadCapacity = size;
+  }
+  PCFResultOrPanic(SystemSaveState(psxSystem, runAheadState, size));
+  int frame;
+  for (frame = 0; frame < runAheadFrames; frame++) {
+    SystemRun(psxSystem);
+  }
+  Present();
+  PCFResultOrPanic(SystemLoadState(psxSystem, runAheadState, size));
+}
+
 void Loop() {
   bool quit = false;
   SDL_Event e;
@@ -77,8 +134,18 @@ void Loop() {
       }
     }
     screenSurface = SDL_GetWindowSurface(window);
-    SystemRun(psxSystem);
-    SystemUpdateSurface(psxSystem, screenSurface);
+    // Holding backspace plays the captured frames backwards.
+    const Uint8 *keys = SDL_GetKeyboardState(NULL);
+    bool rewinding = keys[SDL_SCANCODE_BACKSPACE] && RewindPop(rewindBuffer, psxSystem);
+    if (!rewinding) {
+      SystemRun(psxSystem);
+      RewindCapture(rewindBuffer, psxSystem);
+    }
+    if (!rewinding && runAheadFrames > 0) {
+      RunAhead();
+    } else {
+      Present();
+    }
     SDL_UpdateWindowSurface(window);
     SystemSync(psxSystem);
   }
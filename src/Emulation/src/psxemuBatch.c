@@ -0,0 +1,442 @@
+// Runs a manifest of jobs on a pool of worker threads, one System per job, for
+// regression and compatibility sweeps. Each line of the manifest is one job
+// made of key=value fields separated by whitespace:
+//
+//   name=boot bios=SCPH1001.BIN exe=test.exe frames=600 hash=0123456789abcdef
+//
+// bios and frames are required, and hash is the frame hash psxemu-headless
+// --dump-frame-hash prints for the last frame. There is no CD-ROM drive yet, so
+// jobs with a disc are rejected. Blank lines and lines starting with # are
+// skipped.
+//
+// Every worker owns a queue of jobs and takes from its back, and a worker
+// that runs dry steals from the front of the others. One JSON object is
+// printed per finished job, followed by a summary once all are done.
+#include "Bios.h"
+#include "Gpu.h"
+#include "Host.h"
+#include "System.h"
+#include <PsxCoreFoundation/String.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define kScreenWidth 640
+#define kScreenHeight 480
+#define kMaxManifestLine 4096
+
+typedef enum __JobStatus { JobStatusDone, JobStatusPassed, JobStatusFailed, JobStatusError } JobStatus;
+
+static const char *const kJobStatusNames[] = {"done", "passed", "failed", "error"};
+
+typedef struct __Job {
+  char *name;
+  char *biosPath;
+  char *_Nullable exePath;
+  uint32_t frames;
+  bool hasExpectedHash;
+  uint64_t expectedHash;
+} Job;
+
+typedef struct __WorkQueue {
+  HostMutex *lock;
+  uint32_t *jobs;
+  size_t head;
+  size_t tail;
+} WorkQueue;
+
+typedef struct __Batch Batch;
+
+typedef struct __Worker {
+  Batch *batch;
+  uint32_t index;
+  HostThread *_Nullable thread;
+  uint32_t *pixels;
+} Worker;
+
+struct __Batch {
+  Job *jobs;
+  uint32_t numJobs;
+  WorkQueue *queues;
+  Worker *workers;
+  uint32_t numWorkers;
+  const char *_Nullable bootCache;
+  HostMutex *outputLock;
+  uint32_t counts[4];
+  uint64_t frames;
+};
+
+static void PrintUsage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [--threads N] [--boot-cache DIR] MANIFEST\n"
+          "  --threads N         number of worker threads (default: one per core)\n"
+          "  --boot-cache DIR    cache the booted System of each BIOS in DIR\n"
+          "  MANIFEST            job manifest, or - to read it from stdin\n",
+          program);
+}
+
+static char *CopyString(const char *str, size_t length) {
+  char *copy = (char *)PCFMalloc(length + 1);
+  memcpy(copy, str, length);
+  copy[length] = '\0';
+  return copy;
+}
+
+static void JobFree(Job *job) {
+  free(job->name);
+  free(job->biosPath);
+  free(job->exePath);
+}
+
+// Parses one manifest line into job, returns false with a message in error if
+// it is malformed.
+static bool ParseJob(char *line, uint32_t lineNumber, Job *job, const char **error) {
+  memset(job, 0, sizeof(Job));
+  bool hasFrames = false;
+  char *cursor = line;
+  while (true) {
+    while (isspace((unsigned char)*cursor)) {
+      cursor++;
+    }
+    if (*cursor == '\0') {
+      break;
+    }
+    char *field = cursor;
+    while (*cursor != '\0' && !isspace((unsigned char)*cursor)) {
+      cursor++;
+    }
+    size_t fieldLength = (size_t)(cursor - field);
+    char *separator = (char *)memchr(field, '=', fieldLength);
+    if (separator == NULL || separator == field) {
+      *error = "expected key=value";
+      return false;
+    }
+    size_t keyLength = (size_t)(separator - field);
+    const char *value = separator + 1;
+    size_t valueLength = fieldLength - keyLength - 1;
+    char buffer[32];
+    char *end;
+    if (keyLength == 4 && strncmp(field, "name", 4) == 0) {
+      free(job->name);
+      job->name = CopyString(value, valueLength);
+    } else if (keyLength == 4 && strncmp(field, "bios", 4) == 0) {
+      free(job->biosPath);
+      job->biosPath = CopyString(value, valueLength);
+    } else if (keyLength == 3 && strncmp(field, "exe", 3) == 0) {
+      free(job->exePath);
+      job->exePath = CopyString(value, valueLength);
+    } else if (keyLength == 4 && strncmp(field, "disc", 4) == 0) {
+      *error = "disc is not supported, the emulator has no CD-ROM drive yet";
+      return false;
+    } else if (keyLength == 6 && strncmp(field, "frames", 6) == 0) {
+      if (valueLength == 0 || valueLength >= sizeof(buffer)) {
+        *error = "frames is not a number";
+        return false;
+      }
+      memcpy(buffer, value, valueLength);
+      buffer[valueLength] = '\0';
+      unsigned long frames = strtoul(buffer, &end, 10);
+      if (*end != '\0' || frames == 0 || frames > UINT32_MAX) {
+        *error = "frames is not a number";
+        return false;
+      }
+      job->frames = (uint32_t)frames;
+      hasFrames = true;
+    } else if (keyLength == 4 && strncmp(field, "hash", 4) == 0) {
+      if (valueLength == 0 || valueLength > 16) {
+        *error = "hash is not a 64-bit hexadecimal number";
+        return false;
+      }
+      memcpy(buffer, value, valueLength);
+      buffer[valueLength] = '\0';
+      job->expectedHash = strtoull(buffer, &end, 16);
+      if (*end != '\0') {
+        *error = "hash is not a 64-bit hexadecimal number";
+        return false;
+      }
+      job->hasExpectedHash = true;
+    } else {
+      *error = "unknown key";
+      return false;
+    }
+  }
+  if (job->biosPath == NULL || !hasFrames) {
+    *error = "bios and frames are required";
+    return false;
+  }
+  if (job->name == NULL) {
+    char name[32];
+    snprintf(name, sizeof(name), "job%u", lineNumber);
+    job->name = CopyString(name, strlen(name));
+  }
+  return true;
+}
+
+static bool LoadManifest(const char *path, Batch *batch) {
+  FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open manifest %s\n", path);
+    return false;
+  }
+  uint32_t capacity = 64;
+  batch->jobs = (Job *)PCFMalloc(capacity * sizeof(Job));
+  batch->numJobs = 0;
+  char line[kMaxManifestLine];
+  uint32_t lineNumber = 0;
+  bool successful = true;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    lineNumber++;
+    char *start = line;
+    while (isspace((unsigned char)*start)) {
+      start++;
+    }
+    if (*start == '\0' || *start == '#') {
+      continue;
+    }
+    if (batch->numJobs == capacity) {
+      capacity *= 2;
+      batch->jobs = (Job *)realloc(batch->jobs, capacity * sizeof(Job));
+    }
+    const char *error = NULL;
+    if (!ParseJob(start, lineNumber, &batch->jobs[batch->numJobs], &error)) {
+      fprintf(stderr, "%s:%u: %s\n", path, lineNumber, error);
+      JobFree(&batch->jobs[batch->numJobs]);
+      successful = false;
+      continue;
+    }
+    batch->numJobs++;
+  }
+  if (file != stdin) {
+    fclose(file);
+  }
+  return successful;
+}
+
+// Hands out the jobs round-robin, so that every queue starts with a similar mix.
+static void FillQueues(Batch *batch) {
+  uint32_t perQueue = (batch->numJobs + batch->numWorkers - 1) / batch->numWorkers;
+  uint32_t i;
+  for (i = 0; i < batch->numWorkers; i++) {
+    WorkQueue *queue = &batch->queues[i];
+    queue->lock = HostMutexNew();
+    queue->jobs = (uint32_t *)PCFMalloc((perQueue > 0 ? perQueue : 1) * sizeof(uint32_t));
+    queue->head = 0;
+    queue->tail = 0;
+  }
+  for (i = 0; i < batch->numJobs; i++) {
+    WorkQueue *queue = &batch->queues[i % batch->numWorkers];
+    queue->jobs[queue->tail++] = i;
+  }
+}
+
+static bool WorkQueuePopBack(WorkQueue *queue, uint32_t *job) {
+  HostMutexLock(queue->lock);
+  bool found = queue->head < queue->tail;
+  if (found) {
+    *job = queue->jobs[--queue->tail];
+  }
+  HostMutexUnlock(queue->lock);
+  return found;
+}
+
+static bool WorkQueuePopFront(WorkQueue *queue, uint32_t *job) {
+  HostMutexLock(queue->lock);
+  bool found = queue->head < queue->tail;
+  if (found) {
+    *job = queue->jobs[queue->head++];
+  }
+  HostMutexUnlock(queue->lock);
+  return found;
+}
+
+// No job is added once the workers have started, so a worker that finds every
+// queue empty is done.
+static bool NextJob(Worker *worker, uint32_t *job, bool *stolen) {
+  Batch *batch = worker->batch;
+  *stolen = false;
+  if (WorkQueuePopBack(&batch->queues[worker->index], job)) {
+    return true;
+  }
+  uint32_t i;
+  for (i = 1; i < batch->numWorkers; i++) {
+    if (WorkQueuePopFront(&batch->queues[(worker->index + i) % batch->numWorkers], job)) {
+      *stolen = true;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void PrintJsonString(FILE *file, const char *str) {
+  fputc('"', file);
+  for (; *str != '\0'; str++) {
+    unsigned char c = (unsigned char)*str;
+    if (c == '"' || c == '\\') {
+      fprintf(file, "\\%c", c);
+    } else if (c < 0x20) {
+      fprintf(file, "\\u%04x", c);
+    } else {
+      fputc(c, file);
+    }
+  }
+  fputc('"', file);
+}
+
+// Runs a job to its last frame and hashes that frame. Returns the failure as
+// an error instead of panicking, so that one bad job does not end the batch.
+static PCFResult RunJob(Worker *worker, const Job *job, uint64_t *hash) {
+  PCFStringRef biosPath = PCFStringNewFromCString(job->biosPath);
+  PCFResult check = BiosCheck(biosPath);
+  if (!check.successful) {
+    PCFRelease(biosPath);
+    return check;
+  }
+  System *sys = SystemNew(biosPath, NULL, NULL);
+  PCFRelease(biosPath);
+  PCFStringRef _Nullable bootCache =
+      worker->batch->bootCache != NULL ? PCFStringNewFromCString(worker->batch->bootCache) : NULL;
+  PCFResult result = SystemBoot(sys, bootCache);
+  if (bootCache != NULL) {
+    PCFRelease(bootCache);
+  }
+  if (result.successful && job->exePath != NULL) {
+    PCFStringRef exePath = PCFStringNewFromCString(job->exePath);
+    result = SystemLoadExecutable(sys, exePath);
+    PCFRelease(exePath);
+  }
+  if (result.successful) {
+    uint32_t frame;
+    for (frame = 0; frame < job->frames; frame++) {
+      SystemRun(sys);
+    }
+    GpuScreen screen = NewGpuScreen(kScreenWidth, kScreenHeight, worker->pixels);
+    SystemUpdateScreen(sys, screen);
+    *hash = GpuScreenHash(screen);
+  }
+  SystemFree(sys);
+  return result;
+}
+
+static void ReportJob(Worker *worker, uint32_t index, bool stolen, JobStatus status, uint64_t hash,
+                      PCFStringRef _Nullable error, double seconds) {
+  Batch *batch = worker->batch;
+  const Job *job = &batch->jobs[index];
+  HostMutexLock(batch->outputLock);
+  batch->counts[status]++;
+  printf("{\"job\":%u,\"name\":", index);
+  PrintJsonString(stdout, job->name);
+  printf(",\"status\":\"%s\",\"worker\":%u,\"stolen\":%s", kJobStatusNames[status], worker->index,
+         stolen ? "true" : "false");
+  if (status == JobStatusError) {
+    // The message is borrowed from error, which WorkerMain releases.
+    printf(",\"error\":");
+    PrintJsonString(stdout, PCFStringToCString(error));
+  } else {
+    batch->frames += job->frames;
+    printf(",\"frames\":%u,\"hash\":\"%016llx\"", job->frames, (unsigned long long)hash);
+    if (job->hasExpectedHash) {
+      printf(",\"expected\":\"%016llx\"", (unsigned long long)job->expectedHash);
+    }
+    printf(",\"frames_per_second\":%.1f", seconds > 0 ? job->frames / seconds : 0.0);
+  }
+  printf(",\"seconds\":%.3f}\n", seconds);
+  fflush(stdout);
+  HostMutexUnlock(batch->outputLock);
+}
+
+static void WorkerMain(void *argument) {
+  Worker *worker = (Worker *)argument;
+  uint32_t index;
+  bool stolen;
+  while (NextJob(worker, &index, &stolen)) {
+    const Job *job = &worker->batch->jobs[index];
+    uint64_t hash = 0;
+    uint64_t start = HostTicks();
+    PCFResult result = RunJob(worker, job, &hash);
+    double seconds = (double)(HostTicks() - start) / (double)HostTicksPerSecond();
+    JobStatus status = JobStatusError;
+    if (result.successful) {
+      status = !job->hasExpectedHash ? JobStatusDone
+               : hash == job->expectedHash ? JobStatusPassed
+                                           : JobStatusFailed;
+    }
+    ReportJob(worker, index, stolen, status, hash, result.error, seconds);
+    if (!result.successful) {
+      PCFResultReleaseError(result);
+    }
+  }
+}
+
+int main(int argc, char *args[]) {
+  Batch batch;
+  memset(&batch, 0, sizeof(batch));
+  batch.numWorkers = HostNumCores();
+  const char *_Nullable manifestPath = NULL;
+  int i;
+  for (i = 1; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if (strcmp(args[i], "--threads") == 0 && hasValue) {
+      char *end;
+      unsigned long threads = strtoul(args[++i], &end, 10);
+      if (*end != '\0' || threads == 0 || threads > 4096) {
+        PrintUsage(args[0]);
+        return 2;
+      }
+      batch.numWorkers = (uint32_t)threads;
+    } else if (strcmp(args[i], "--boot-cache") == 0 && hasValue) {
+      batch.bootCache = args[++i];
+    } else if (manifestPath == NULL && (args[i][0] != '-' || strcmp(args[i], "-") == 0)) {
+      manifestPath = args[i];
+    } else {
+      PrintUsage(args[0]);
+      return 2;
+    }
+  }
+  if (manifestPath == NULL) {
+    PrintUsage(args[0]);
+    return 2;
+  }
+  if (!LoadManifest(manifestPath, &batch)) {
+    return 2;
+  }
+  if (batch.numWorkers > batch.numJobs && batch.numJobs > 0) {
+    batch.numWorkers = batch.numJobs;
+  }
+
+  batch.outputLock = HostMutexNew();
+  batch.queues = (WorkQueue *)PCFMalloc(batch.numWorkers * sizeof(WorkQueue));
+  batch.workers = (Worker *)PCFMalloc(batch.numWorkers * sizeof(Worker));
+  FillQueues(&batch);
+  uint64_t start = HostTicks();
+  uint32_t w;
+  for (w = 0; w < batch.numWorkers; w++) {
+    Worker *worker = &batch.workers[w];
+    worker->batch = &batch;
+    worker->index = w;
+    worker->pixels = (uint32_t *)PCFMalloc(kScreenWidth * kScreenHeight * sizeof(uint32_t));
+    worker->thread = HostThreadStart(WorkerMain, worker);
+  }
+  for (w = 0; w < batch.numWorkers; w++) {
+    HostThreadJoin(batch.workers[w].thread);
+    free(batch.workers[w].pixels);
+    HostMutexFree(batch.queues[w].lock);
+    free(batch.queues[w].jobs);
+  }
+  double wall = (double)(HostTicks() - start) / (double)HostTicksPerSecond();
+  double framesPerSecond = wall > 0 ? (double)batch.frames / wall : 0.0;
+  printf("{\"summary\":true,\"jobs\":%u,\"done\":%u,\"passed\":%u,\"failed\":%u,\"errors\":%u,\"workers\":%u,"
+         "\"frames\":%llu,\"seconds\":%.3f,\"frames_per_second\":%.1f,\"frames_per_second_per_core\":%.1f}\n",
+         batch.numJobs, batch.counts[JobStatusDone], batch.counts[JobStatusPassed], batch.counts[JobStatusFailed],
+         batch.counts[JobStatusError], batch.numWorkers, (unsigned long long)batch.frames, wall, framesPerSecond,
+         framesPerSecond / batch.numWorkers);
+
+  for (i = 0; i < (int)batch.numJobs; i++) {
+    JobFree(&batch.jobs[i]);
+  }
+  free(batch.jobs);
+  free(batch.queues);
+  free(batch.workers);
+  HostMutexFree(batch.outputLock);
+  return batch.counts[JobStatusFailed] + batch.counts[JobStatusError] > 0 ? 1 : 0;
+}
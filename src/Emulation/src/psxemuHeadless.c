@@ -0,0 +1,183 @@
+// Runs the emulator without a window or SDL, for benchmarks and batch runs on
+// machines without a display. Frame hashes go to stdout and timing statistics
+// to stderr, so that the hashes of two runs can be compared as they are.
+#include "Clock.h"
+#include "Gpu.h"
+#include "Host.h"
+#include "System.h"
+#include <PsxCoreFoundation/String.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define kScreenWidth 640
+#define kScreenHeight 480
+
+const char *kDefaultBiosPath = "SCPH1001.BIN";
+const uint32_t kDefaultFrames = 600;
+
+typedef struct __HeadlessOptions {
+  const char *biosPath;
+  const char *_Nullable exePath;
+  uint32_t frames;
+  bool unthrottled;
+  bool dumpFrameHash;
+  bool stats;
+} HeadlessOptions;
+
+static void PrintUsage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [--bios PATH] [--exe PATH] [--frames N] [--unthrottled] [--dump-frame-hash] [--stats]\n"
+          "  --bios PATH        BIOS image to boot (default %s)\n"
+          "  --exe PATH         PS-X EXE to run once the BIOS has booted\n"
+          "  --frames N         number of frames to emulate (default %u)\n"
+          "  --unthrottled      run as fast as possible instead of in real time\n"
+          "  --dump-frame-hash  print a hash of the screen after every frame\n"
+          "  --stats            print the SystemGetStats counters as JSON (builds with SYSTEM_STATS)\n",
+          program, kDefaultBiosPath, kDefaultFrames);
+}
+
+static bool ParseOptions(int argc, char *args[], HeadlessOptions *options) {
+  options->biosPath = kDefaultBiosPath;
+  options->exePath = NULL;
+  options->frames = kDefaultFrames;
+  options->unthrottled = false;
+  options->dumpFrameHash = false;
+  options->stats = false;
+  int i;
+  for (i = 1; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if (strcmp(args[i], "--bios") == 0 && hasValue) {
+      options->biosPath = args[++i];
+    } else if (strcmp(args[i], "--exe") == 0 && hasValue) {
+      options->exePath = args[++i];
+    } else if (strcmp(args[i], "--frames") == 0 && hasValue) {
+      char *end;
+      unsigned long frames = strtoul(args[++i], &end, 10);
+      if (*end != '\0' || frames == 0 || frames > UINT32_MAX) {
+        return false;
+      }
+      options->frames = (uint32_t)frames;
+    } else if (strcmp(args[i], "--unthrottled") == 0) {
+      options->unthrottled = true;
+    } else if (strcmp(args[i], "--dump-frame-hash") == 0) {
+      options->dumpFrameHash = true;
+    } else if (strcmp(args[i], "--stats") == 0) {
+      options->stats = true;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Prints the counters that are not zero as one JSON object.
+static void PrintStats(const SystemStats *stats) {
+  size_t i;
+  const char *separator = "";
+  fprintf(stderr, "{\"opcodes\":{");
+  for (i = 0; i < 64; i++) {
+    if (stats->cpu.opcodes[i] != 0) {
+      fprintf(stderr, "%s\"0x%02zx\":%llu", separator, i, (unsigned long long)stats->cpu.opcodes[i]);
+      separator = ",";
+    }
+  }
+  separator = "";
+  fprintf(stderr, "},\"register_functs\":{");
+  for (i = 0; i < 64; i++) {
+    if (stats->cpu.registerFuncts[i] != 0) {
+      fprintf(stderr, "%s\"0x%02zx\":%llu", separator, i, (unsigned long long)stats->cpu.registerFuncts[i]);
+      separator = ",";
+    }
+  }
+  fprintf(stderr, "},\"icache_hits\":%llu,\"icache_misses\":%llu,\"bus\":[",
+          (unsigned long long)stats->cpu.iCacheHits, (unsigned long long)stats->cpu.iCacheMisses);
+  for (i = 0; i < stats->numBusDevices; i++) {
+    const BusDeviceStats *device = &stats->busDevices[i];
+    fprintf(stderr, "%s{\"start\":\"0x%08x\",\"reads\":%llu,\"writes\":%llu,\"cycles\":%llu}", i > 0 ? "," : "",
+            device->addressRange.start, (unsigned long long)device->reads, (unsigned long long)device->writes,
+            (unsigned long long)device->cycles);
+  }
+  fprintf(stderr, "],\"dma_words\":[");
+  for (i = 0; i < kStatsNumDmaChannels; i++) {
+    fprintf(stderr, "%s%llu", i > 0 ? "," : "", (unsigned long long)stats->dmaWords[i]);
+  }
+  separator = "";
+  fprintf(stderr, "],\"gpu\":{");
+  for (i = 0; i < kStatsNumGpuCommands; i++) {
+    if (stats->gpu.primitives[i] != 0 || stats->gpu.pixels[i] != 0) {
+      fprintf(stderr, "%s\"0x%02zx\":{\"primitives\":%llu,\"pixels\":%llu}", separator, i,
+              (unsigned long long)stats->gpu.primitives[i], (unsigned long long)stats->gpu.pixels[i]);
+      separator = ",";
+    }
+  }
+  fprintf(stderr, "},\"clock\":[");
+  for (i = 0; i < stats->numClockDevices; i++) {
+    fprintf(stderr, "%s{\"rate\":%u,\"updates\":%llu}", i > 0 ? "," : "", stats->clockDevices[i].clockRate,
+            (unsigned long long)stats->clockDevices[i].updates);
+  }
+  fprintf(stderr, "]}\n");
+}
+
+static double TicksToMilliseconds(uint64_t ticks) { return (double)ticks * 1000.0 / (double)HostTicksPerSecond(); }
+
+int main(int argc, char *args[]) {
+  HeadlessOptions options;
+  if (!ParseOptions(argc, args, &options)) {
+    PrintUsage(args[0]);
+    return 1;
+  }
+  PCFStringRef biosPath = PCFStringNewFromCString(options.biosPath);
+  System *sys = SystemNew(biosPath, NULL, NULL);
+  PCFRelease(biosPath);
+  PCFResultOrPanic(SystemBoot(sys, NULL));
+  if (options.exePath != NULL) {
+    PCFStringRef exePath = PCFStringNewFromCString(options.exePath);
+    PCFResultOrPanic(SystemLoadExecutable(sys, exePath));
+    PCFRelease(exePath);
+  }
+
+  uint32_t *_Nullable pixels =
+      options.dumpFrameHash ? (uint32_t *)PCFMalloc(kScreenWidth * kScreenHeight * sizeof(uint32_t)) : NULL;
+  uint64_t minFrame = UINT64_MAX;
+  uint64_t maxFrame = 0;
+  uint64_t emulated = 0;
+  uint64_t systemTime = ClockSystemTime(SystemClock(sys));
+  uint64_t start = HostTicks();
+  uint32_t frame;
+  for (frame = 0; frame < options.frames; frame++) {
+    uint64_t frameStart = HostTicks();
+    SystemRun(sys);
+    uint64_t frameTicks = HostTicks() - frameStart;
+    emulated += frameTicks;
+    minFrame = frameTicks < minFrame ? frameTicks : minFrame;
+    maxFrame = frameTicks > maxFrame ? frameTicks : maxFrame;
+    if (pixels != NULL) {
+      GpuScreen screen = NewGpuScreen(kScreenWidth, kScreenHeight, pixels);
+      SystemUpdateScreen(sys, screen);
+      printf("%u %016llx\n", frame, (unsigned long long)GpuScreenHash(screen));
+    }
+    if (!options.unthrottled) {
+      SystemSync(sys);
+    }
+  }
+  double wall = TicksToMilliseconds(HostTicks() - start) / 1000.0;
+  double emulatedSeconds = (double)(ClockSystemTime(SystemClock(sys)) - systemTime) / kMasterClockRate;
+  free(pixels);
+
+  fprintf(stderr, "frames:        %u\n", options.frames);
+  fprintf(stderr, "wall time:     %.3f s (%.1f frames/s)\n", wall, options.frames / wall);
+  fprintf(stderr, "emulated time: %.3f s (%.2fx real time)\n", emulatedSeconds, emulatedSeconds / wall);
+  fprintf(stderr, "frame time:    min %.3f ms, avg %.3f ms, max %.3f ms\n", TicksToMilliseconds(minFrame),
+          TicksToMilliseconds(emulated) / options.frames, TicksToMilliseconds(maxFrame));
+  if (options.stats) {
+    SystemStats stats = SystemGetStats(sys);
+    if (stats.enabled) {
+      PrintStats(&stats);
+    } else {
+      fprintf(stderr, "stats:         not counted, build with SYSTEM_STATS\n");
+    }
+  }
+  SystemFree(sys);
+  return 0;
+}
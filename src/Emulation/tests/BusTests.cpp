@@ -0,0 +1,216 @@
+#include "catch.hpp"
+#include <vector>
+extern "C" {
+
+#include "TestSystem.hpp"
+}
+
+static uint32_t BusTestRead32(Bus *bus, Address address, bool *ok) {
+  uint32_t value = 0;
+  uint32_t cycles = 0;
+  SystemException exception;
+  *ok = BusRead32(bus, address, &value, &exception, &cycles);
+  return value;
+}
+
+TEST_CASE("BusPageTableTests", "[Bus]") {
+  auto sys = TestSystemNew();
+  System *system = (System *)sys.get();
+  Bus *bus = BusNew(system, 8);
+  // Registered out of order, two of them sharing the first I/O page and two
+  // overlapping in the last BIOS page but visible in different segments.
+  Memory *io2 = MemoryNewCustom(system, bus, 0x10, NewAddressRange(0x1F801010, 0x1F801020, kMainSegments), 0);
+  Memory *io1 = MemoryNewCustom(system, bus, 0x10, NewAddressRange(0x1F801000, 0x1F801010, kMainSegments), 0);
+  Memory *scratchpad =
+      MemoryNewCustom(system, bus, 0x400, NewAddressRange(0x1F800000, 0x1F800400, UserSegment | KernelSegment0), 0);
+  Memory *rom = MemoryNewCustom(system, bus, 0x1000, NewAddressRange(0x1FFFF000, 0x20000000, kMainSegments), 0);
+  Memory *port = MemoryNewCustom(system, bus, 0x4, NewAddressRange(0xFFFFF010, 0xFFFFF014, KernelSegment2), 0);
+  MemoryWrite32(io1, UserSegment, 4, 0x11111111);
+  MemoryWrite32(io2, UserSegment, 4, 0x22222222);
+  MemoryWrite32(scratchpad, UserSegment, 0x3FC, 0x33333333);
+  MemoryWrite32(rom, UserSegment, 0x10, 0x44444444);
+  MemoryWrite32(port, UserSegment, 0, 0x55555555);
+  bool ok;
+
+  SECTION("Addresses resolve to the device containing them") {
+    REQUIRE(BusTestRead32(bus, 0x1F801004, &ok) == 0x11111111);
+    REQUIRE(ok);
+    REQUIRE(BusTestRead32(bus, 0xBF801014, &ok) == 0x22222222);
+    REQUIRE(ok);
+    REQUIRE(BusTestRead32(bus, 0x9F8003FC, &ok) == 0x33333333);
+    REQUIRE(ok);
+    REQUIRE(BusTestRead32(bus, 0xBFFFF010, &ok) == 0x44444444);
+    REQUIRE(ok);
+    REQUIRE(BusTestRead32(bus, 0xFFFFF010, &ok) == 0x55555555);
+    REQUIRE(ok);
+  }
+
+  SECTION("Unmapped parts of a page and other segments raise bus errors") {
+    BusTestRead32(bus, 0x1F800400, &ok);
+    REQUIRE(!ok);
+    BusTestRead32(bus, 0xBF800000, &ok);
+    REQUIRE(!ok);
+    BusTestRead32(bus, 0x1F801020, &ok);
+    REQUIRE(!ok);
+    BusTestRead32(bus, 0xFFFFF014, &ok);
+    REQUIRE(!ok);
+    BusTestRead32(bus, 0x00000000, &ok);
+    REQUIRE(!ok);
+  }
+
+  SECTION("Writes go to the backing memory") {
+    uint32_t cycles;
+    SystemException exception;
+    REQUIRE(BusWrite16(bus, 0x1F80100A, 0xBEEF, &exception, &cycles));
+    REQUIRE(MemoryRead16(io1, UserSegment, 0xA) == 0xBEEF);
+  }
+
+  SECTION("Duplicate ranges are rejected") {
+    BusDevice device = {};
+    PCFResult result = BusRegisterDevice(bus, &device, NewAddressRange(0x1F801000, 0x1F801004, kMainSegments));
+    REQUIRE(!result.successful);
+    PCFResultReleaseError(result);
+  }
+}
+
+TEST_CASE("BusFastPageTests", "[Bus]") {
+  auto sys = TestSystemNew();
+  System *system = (System *)sys.get();
+  Bus *bus = BusNew(system, 8);
+  Memory *ram = MemoryNew(system, bus);
+  MemoryNewCustom(system, bus, 0x400, NewAddressRange(0x1F800000, 0x1F800400, UserSegment | KernelSegment0), 0);
+  const BusFastPage *pages = BusFastPages(bus);
+
+  SECTION("RAM and its mirrors are fast in every main segment") {
+    const BusFastPage *page = BusFastPageForAddress(pages, 0x80010000);
+    REQUIRE(page != NULL);
+    REQUIRE(page->host == MemoryData(ram) + 0x10000);
+    REQUIRE(page->cycles == kMemoryCpuCycles);
+    REQUIRE(!page->readOnly);
+    MemoryData(ram)[0x10000] = 0x5A;
+    MemoryData(ram)[0x1F0000] = 0xA5;
+    REQUIRE(BusFastPageForAddress(pages, 0x00610000)->host[0] == 0x5A);
+    REQUIRE(BusFastPageForAddress(pages, 0xA07F0000)->host[0] == 0xA5);
+  }
+
+  SECTION("Other segments and partially covered pages go through the bus") {
+    REQUIRE(BusFastPageForAddress(pages, 0xE0000000) == NULL);
+    REQUIRE(BusFastPageForAddress(pages, 0x1F800000) == NULL);
+    REQUIRE(BusFastPageForAddress(pages, 0x00800000) == NULL);
+  }
+  MemoryFree(ram);
+}
+
+TEST_CASE("BusBlockTests", "[Bus]") {
+  auto sys = TestSystemNew();
+  System *system = (System *)sys.get();
+  Bus *bus = BusNew(system, 8);
+  Memory *ram = MemoryNew(system, bus);
+  Memory *io1 = MemoryNewCustom(system, bus, 0x10, NewAddressRange(0x1F801000, 0x1F801010, kMainSegments), 1);
+  Memory *io2 = MemoryNewCustom(system, bus, 0x10, NewAddressRange(0x1F801010, 0x1F801020, kMainSegments), 2);
+  uint32_t values[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+  uint32_t result[8] = {};
+  uint32_t cycles;
+  SystemException exception;
+
+  SECTION("Blocks are split between the devices they cross") {
+    REQUIRE(BusWriteBlock(bus, 0x1F801008, values, 4, &exception, &cycles));
+    REQUIRE(cycles == 2 * 1 + 2 * 2);
+    REQUIRE(MemoryRead32(io1, UserSegment, 0xC) == 2);
+    REQUIRE(MemoryRead32(io2, UserSegment, 0x4) == 4);
+    REQUIRE(BusReadBlock(bus, 0xBF801008, result, 4, &exception, &cycles));
+    REQUIRE(memcmp(result, values, 4 * sizeof(uint32_t)) == 0);
+  }
+
+  SECTION("Blocks wrap from the end of a RAM mirror into the next one") {
+    REQUIRE(BusWriteBlock(bus, 0x801FFFF8, values, 4, &exception, &cycles));
+    REQUIRE(cycles == 4 * kMemoryCpuCycles);
+    REQUIRE(MemoryRead32(ram, UserSegment, 0x1FFFFC) == 2);
+    REQUIRE(MemoryRead32(ram, UserSegment, 0x0) == 3);
+    REQUIRE(BusReadBlock(bus, 0x005FFFF8, result, 4, &exception, &cycles));
+    REQUIRE(memcmp(result, values, 4 * sizeof(uint32_t)) == 0);
+  }
+
+  SECTION("The words before a fault are transferred") {
+    REQUIRE(!BusWriteBlock(bus, 0x1F801018, values, 4, &exception, &cycles));
+    REQUIRE(exception.code == kExceptionBusErrorFetch);
+    REQUIRE(MemoryRead32(io2, UserSegment, 0xC) == 2);
+    REQUIRE(!BusReadBlock(bus, 0x1F801002, result, 1, &exception, &cycles));
+    REQUIRE(exception.code == kExceptionAddressErrorFetch);
+  }
+  MemoryFree(ram);
+}
+
+static void RecordCodeWrite(void *context, Address page) { ((std::vector<Address> *)context)->push_back(page); }
+
+TEST_CASE("MemorySpanTests", "[Memory]") {
+  auto sys = TestSystemNew();
+  System *system = (System *)sys.get();
+  Bus *bus = BusNew(system, 8);
+  Memory *ram = MemoryNew(system, bus);
+  uint32_t values[4] = {1, 2, 3, 4};
+  uint32_t result[4] = {};
+
+  SECTION("Forward spans wrap at the end of RAM") {
+    MemoryWriteSpan(ram, 0x1FFFF8, false, values, 4);
+    REQUIRE(MemoryRead32(ram, UserSegment, 0x1FFFF8) == 1);
+    REQUIRE(MemoryRead32(ram, UserSegment, 0x4) == 4);
+    MemoryReadSpan(ram, 0x1FFFF8, false, result, 4);
+    REQUIRE(memcmp(result, values, sizeof(values)) == 0);
+  }
+
+  SECTION("Backward spans wrap at the start of RAM") {
+    MemoryWriteSpan(ram, 0x4, true, values, 4);
+    REQUIRE(MemoryRead32(ram, UserSegment, 0x4) == 1);
+    REQUIRE(MemoryRead32(ram, UserSegment, 0x0) == 2);
+    REQUIRE(MemoryRead32(ram, UserSegment, 0x1FFFFC) == 3);
+    REQUIRE(MemoryRead32(ram, UserSegment, 0x1FFFF8) == 4);
+    MemoryReadSpan(ram, 0x4, true, result, 4);
+    REQUIRE(memcmp(result, values, sizeof(values)) == 0);
+  }
+
+  SECTION("Direct accesses wrap like the bus does") {
+    MemoryWrite32(ram, UserSegment, 0x7FFFFC, 0x12345678);
+    REQUIRE(MemoryRead32(ram, UserSegment, 0x1FFFFC) == 0x12345678);
+    MemoryWrite16(ram, UserSegment, 0x800004, 0xBEEF);
+    REQUIRE(MemoryRead16(ram, UserSegment, 0x4) == 0xBEEF);
+    REQUIRE(MemoryRead8(ram, UserSegment, 0xFFFFFFFC) == 0x78);
+  }
+
+  SECTION("Writes through one mirror are seen through the others") {
+    uint32_t cycles;
+    SystemException exception;
+    REQUIRE(BusWrite32(bus, 0x807FFFFC, 0x12345678, &exception, &cycles));
+    REQUIRE(MemoryRead32(ram, UserSegment, 0x1FFFFC) == 0x12345678);
+    REQUIRE(BusWriteBlock(bus, 0x003FFFF8, values, 4, &exception, &cycles));
+    REQUIRE(MemoryRead32(ram, UserSegment, 0x4) == 4);
+    REQUIRE(BusReadBlock(bus, 0xA01FFFF8, result, 4, &exception, &cycles));
+    REQUIRE(memcmp(result, values, sizeof(values)) == 0);
+  }
+
+  SECTION("Writes to code pages are reported once per page") {
+    uint32_t cycles;
+    SystemException exception;
+    std::vector<Address> pages;
+    MemorySetCodeWriteHandler(ram, RecordCodeWrite, &pages);
+    MemoryMarkCode(ram, 0x80001004);
+    MemoryMarkCode(ram, 0xA0003000);
+    MemoryMarkCode(ram, 0x80005000);
+    MemoryMarkCode(ram, 0x00007FFC);
+    MemoryMarkCode(ram, 0x1FC00000);
+    REQUIRE(MemoryCodePages(ram)[1]);
+    REQUIRE(!MemoryCodePages(ram)[0]);
+    REQUIRE(BusWrite32(bus, 0x80002000, 0, &exception, &cycles));
+    REQUIRE(pages.empty());
+    REQUIRE(BusWrite8(bus, 0x00605FFF, 0, &exception, &cycles));
+    REQUIRE(pages == std::vector<Address>{0x5000});
+    REQUIRE(BusWriteBlock(bus, 0x80006FFC, values, 2, &exception, &cycles));
+    REQUIRE(pages == std::vector<Address>{0x5000, 0x7000});
+    MemoryNotifyWrite(ram, 0x80001000);
+    MemoryWriteSpan(ram, 0x2FFC, false, values, 4);
+    REQUIRE(pages == std::vector<Address>{0x5000, 0x7000, 0x1000, 0x3000});
+    REQUIRE(!MemoryCodePages(ram)[1]);
+    REQUIRE(!MemoryCodePages(ram)[3]);
+  }
+  MemoryFree(ram);
+}
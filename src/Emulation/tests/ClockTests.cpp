@@ -0,0 +1,147 @@
+#include "catch.hpp"
+#include <vector>
+extern "C" {
+
+#include "TestSystem.hpp"
+}
+
+static void ClockTestUpdate(void *context, uint32_t cycles) { (*(uint32_t *)context)++; }
+
+static void ClockTestCountCycles(void *context, uint32_t cycles) { *(uint64_t *)context += cycles; }
+
+typedef struct __ClockTestEvent {
+  Clock *clock;
+  uint64_t firedAt;
+  uint32_t updates;
+} ClockTestEvent;
+
+static void ClockTestRecordEvent(void *context, uint32_t cycles) {
+  ClockTestEvent *event = (ClockTestEvent *)context;
+  event->firedAt = ClockSystemTime(event->clock);
+  event->updates++;
+}
+
+TEST_CASE("ClockSliceTests", "[Clock]") {
+  auto sys = TestSystemNew();
+  Clock *clock = sys->clock;
+  uint32_t updates = 0;
+  ClockDevice device = NewClockDevice(&updates, ClockTestUpdate, 33868800);
+  ClockDeviceHandle handle = ClockAddDevice(clock, &device);
+  ClockDeviceSetDefaultUpdateFrequency(handle, 1000);
+
+  SECTION("A slice ends exactly at the next device update") {
+    uint32_t slice = ClockStartSlice(clock, 0xFFFFFFFF);
+    REQUIRE(slice > 0);
+    REQUIRE(slice <= 1001);
+    ClockTick(clock, slice - 1);
+    REQUIRE(updates == 0);
+    ClockTick(clock, 1);
+    REQUIRE(updates == 1);
+  }
+
+  SECTION("Slices are capped by the cycles the caller wants to run") {
+    REQUIRE(ClockStartSlice(clock, 10) == 10);
+    REQUIRE(*ClockSliceCycles(clock) == 10);
+  }
+
+  SECTION("Moving an update earlier ends the current slice") {
+    ClockStartSlice(clock, 0xFFFFFFFF);
+    REQUIRE(*ClockSliceCycles(clock) != 0);
+    ClockDeviceSetDefaultUpdateFrequency(handle, 10);
+    REQUIRE(*ClockSliceCycles(clock) == 0);
+    REQUIRE(ClockStartSlice(clock, 0xFFFFFFFF) <= 11);
+  }
+}
+
+TEST_CASE("ClockSchedulingTests", "[Clock]") {
+  auto sys = TestSystemNew();
+  Clock *clock = sys->clock;
+
+  SECTION("Device cycles are converted without drift") {
+    uint64_t gpuCycles = 0;
+    ClockDevice device = NewClockDevice(&gpuCycles, ClockTestCountCycles, 53690000);
+    ClockDeviceHandle handle = ClockAddDevice(clock, &device);
+    ClockDeviceSetDefaultUpdateFrequency(handle, 3413);
+    uint32_t i;
+    for (i = 0; i < 33868800 / 997; i++) {
+      ClockTick(clock, 997);
+    }
+    ClockTick(clock, 33868800 % 997);
+    REQUIRE(ClockSystemTime(clock) == 33868800);
+    ClockDeviceRequestUpdate(handle, 0);
+    ClockTick(clock, 0);
+    REQUIRE(gpuCycles == 53690000);
+  }
+
+  SECTION("Updates can be rescheduled and cancelled") {
+    uint32_t updates = 0;
+    ClockDevice device = NewClockDevice(&updates, ClockTestUpdate, 33868800);
+    ClockDeviceHandle handle = ClockAddDevice(clock, &device);
+    ClockDeviceReschedule(handle, 100);
+    REQUIRE(ClockDeviceCyclesToNextUpdate(handle) == 100);
+    ClockDeviceReschedule(handle, 200);
+    REQUIRE(ClockDeviceCyclesToNextUpdate(handle) == 200);
+    ClockTick(clock, 199);
+    REQUIRE(updates == 0);
+    ClockDeviceCancel(handle);
+    ClockTick(clock, 1000000);
+    REQUIRE(updates == 0);
+    ClockDeviceRequestUpdate(handle, 5);
+    ClockTick(clock, 5);
+    REQUIRE(updates == 1);
+  }
+}
+
+TEST_CASE("ClockHeapTests", "[Clock]") {
+  auto sys = TestSystemNew();
+  Clock *clock = sys->clock;
+  const uint32_t numEvents = 300;
+  std::vector<ClockTestEvent> events(numEvents);
+  std::vector<ClockDeviceHandle> handles;
+  uint32_t i;
+  for (i = 0; i < numEvents; i++) {
+    events[i] = {clock, 0, 0};
+    ClockDevice device = NewClockDevice(&events[i], ClockTestRecordEvent, 33868800);
+    handles.push_back(ClockAddDevice(clock, &device));
+    ClockDeviceSetDefaultUpdateFrequency(handles[i], 100000);
+  }
+  for (i = 0; i < numEvents; i++) {
+    ClockDeviceReschedule(handles[i], 1 + (i * 7919) % 1000);
+  }
+  for (i = 0; i < numEvents; i += 3) {
+    ClockDeviceCancel(handles[i]);
+  }
+  for (i = 0; i < 1000; i++) {
+    ClockTick(clock, 1);
+  }
+  for (i = 0; i < numEvents; i++) {
+    INFO("Event " << i);
+    if (i % 3 == 0) {
+      REQUIRE(events[i].updates == 0);
+    } else {
+      REQUIRE(events[i].updates == 1);
+      REQUIRE(events[i].firedAt == 1 + (i * 7919) % 1000);
+    }
+  }
+}
+
+TEST_CASE("ClockRescheduleBenchmark", "[Clock][.benchmark]") {
+  auto sys = TestSystemNew();
+  Clock *clock = sys->clock;
+  const uint32_t numEvents = 500;
+  std::vector<uint32_t> updates(numEvents);
+  std::vector<ClockDeviceHandle> handles;
+  uint32_t i;
+  for (i = 0; i < numEvents; i++) {
+    ClockDevice device = NewClockDevice(&updates[i], ClockTestUpdate, 33868800);
+    handles.push_back(ClockAddDevice(clock, &device));
+  }
+  uint32_t seed = 1;
+  BENCHMARK("Reschedule with 500 pending events") {
+    for (i = 0; i < numEvents; i++) {
+      seed = seed * 1103515245 + 12345;
+      ClockDeviceReschedule(handles[seed % numEvents], 1 + (seed >> 16) % 100000);
+    }
+    return seed;
+  };
+}
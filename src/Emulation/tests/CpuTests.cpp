@@ -52,3 +52,475 @@ TEST_CASE("CpuTests", "[Types]") {
     REQUIRE(cop0.sr.parsed.cop3Enable);
   }
 }
+
+static Cpu *RunTestProgram(TestSystemUniquePtr &sys, CpuExecutionMode mode, uint32_t *program, size_t size,
+                           uint32_t cycles) {
+  TestProgram testProgram = {.cyclesToRun = cycles, .size = size, .program = (uint8_t *)program};
+  LoadTestProgram(sys, testProgram);
+  CpuSetExecutionMode(sys->cpu, mode);
+  CpuRun(sys->cpu, testProgram.cyclesToRun);
+  return sys->cpu;
+}
+
+TEST_CASE("CpuBlockCacheTests", "[Cpu]") {
+  CpuExecutionMode mode = GENERATE(CpuModeInterpreter, CpuModeCachedInterpreter, CpuModeRecompiler);
+  auto sys = TestSystemNew();
+
+  SECTION("Loops compute the same result") {
+    uint32_t program[] = {
+        0x24010000, // addiu $1, $0, 0
+        0x2402000A, // addiu $2, $0, 10
+        0x00220821, // addu $1, $1, $2
+        0x2442FFFF, // addiu $2, $2, -1
+        0x1440FFFD, // bne $2, $0, -3
+        0x00000000, // nop
+        0x3C038000, // lui $3, 0x8000
+        0xAC610100, // sw $1, 0x100($3)
+        0x8C640100, // lw $4, 0x100($3)
+        0x00000000, // nop
+        0x0BF0000A, // j 0xBFC00028
+        0x00000000, // nop
+    };
+    Cpu *cpu = RunTestProgram(sys, mode, program, sizeof(program), 2000);
+    REQUIRE(cpu->reg[1] == 55);
+    REQUIRE(cpu->reg[2] == 0);
+    REQUIRE(cpu->reg[4] == 55);
+  }
+
+  SECTION("Stores to RAM invalidate cached code") {
+    uint32_t program[] = {
+        0x3C038000, // lui $3, 0x8000
+        0x3C0A8000, // lui $10, 0x8000
+        0x354A0100, // ori $10, $10, 0x100
+        0x3C052406, // lui $5, 0x2406
+        0x34A50001, // ori $5, $5, 1 -> addiu $6, $0, 1
+        0xAC650100, // sw $5, 0x100($3)
+        0x3C0703E0, // lui $7, 0x03E0
+        0x34E70008, // ori $7, $7, 8 -> jr $31
+        0xAC670104, // sw $7, 0x104($3)
+        0xAC600108, // sw $0, 0x108($3)
+        0x0140F809, // jalr $31, $10
+        0x00000000, // nop
+        0x00C04021, // addu $8, $6, $0
+        0x24A50001, // addiu $5, $5, 1 -> addiu $6, $0, 2
+        0xAC650100, // sw $5, 0x100($3)
+        0x0140F809, // jalr $31, $10
+        0x00000000, // nop
+        0x00C04821, // addu $9, $6, $0
+        0x0BF00012, // j 0xBFC00048
+        0x00000000, // nop
+    };
+    Cpu *cpu = RunTestProgram(sys, mode, program, sizeof(program), 4000);
+    REQUIRE(cpu->reg[8] == 1);
+    REQUIRE(cpu->reg[9] == 2);
+  }
+
+  SECTION("Block writes to RAM, as DMA does them, invalidate cached code") {
+    uint32_t routine[] = {
+        0x24060001, // addiu $6, $0, 1
+        0x03E00008, // jr $31
+        0x00000000, // nop
+    };
+    uint32_t program[] = {
+        0x3C0A8000, // lui $10, 0x8000
+        0x354A0100, // ori $10, $10, 0x100
+        0x0140F809, // jalr $31, $10
+        0x00000000, // nop
+        0x00C04021, // addu $8, $6, $0
+        0x0BF00002, // j 0xBFC00008
+        0x00000000, // nop
+    };
+    memcpy(MemoryData(sys->memory) + 0x100, routine, sizeof(routine));
+    Cpu *cpu = RunTestProgram(sys, mode, program, sizeof(program), 2000);
+    REQUIRE(cpu->reg[8] == 1);
+    uint32_t patched = 0x24060002; // addiu $6, $0, 2
+    MemoryWriteSpan(sys->memory, 0x100, false, &patched, 1);
+    CpuRun(cpu, 2000);
+    REQUIRE(cpu->reg[8] == 2);
+  }
+
+  SECTION("Writes to the page a block ends on invalidate it") {
+    uint32_t routine[] = {
+        0x24060001, // addiu $6, $0, 1
+        0x00000000, // nop
+        0x24070001, // addiu $7, $0, 1
+        0x03E00008, // jr $31
+        0x00000000, // nop
+    };
+    uint32_t program[] = {
+        0x3C0A8000, // lui $10, 0x8000
+        0x354A0FF8, // ori $10, $10, 0x0FF8
+        0x0140F809, // jalr $31, $10
+        0x00000000, // nop
+        0x00E04021, // addu $8, $7, $0
+        0x0BF00002, // j 0xBFC00008
+        0x00000000, // nop
+    };
+    memcpy(MemoryData(sys->memory) + 0xFF8, routine, sizeof(routine));
+    Cpu *cpu = RunTestProgram(sys, mode, program, sizeof(program), 2000);
+    REQUIRE(cpu->reg[8] == 1);
+    uint32_t patched = 0x24070002; // addiu $7, $0, 2
+    MemoryWriteSpan(sys->memory, 0x1000, false, &patched, 1);
+    CpuRun(cpu, 2000);
+    REQUIRE(cpu->reg[8] == 2);
+  }
+}
+
+TEST_CASE("CpuScratchpadTests", "[Cpu]") {
+  CpuExecutionMode mode = GENERATE(CpuModeInterpreter, CpuModeCachedInterpreter, CpuModeRecompiler);
+  auto sys = TestSystemNew();
+
+  SECTION("KUSEG and KSEG0 share the scratchpad") {
+    uint32_t program[] = {
+        0x3C031F80, // lui $3, 0x1F80
+        0x24011234, // addiu $1, $0, 0x1234
+        0xAC610010, // sw $1, 0x10($3)
+        0x3C049F80, // lui $4, 0x9F80
+        0x8C820010, // lw $2, 0x10($4)
+        0x00000000, // nop
+        0xA0610013, // sb $1, 0x13($3)
+        0x8C850010, // lw $5, 0x10($4)
+        0x00000000, // nop
+        0x0BF00009, // j 0xBFC00024
+        0x00000000, // nop
+    };
+    Cpu *cpu = RunTestProgram(sys, mode, program, sizeof(program), 200);
+    REQUIRE(cpu->reg[2] == 0x1234);
+    REQUIRE(cpu->reg[5] == 0x34001234);
+  }
+
+  SECTION("KSEG1 has no view of it") {
+    uint32_t value;
+    uint32_t cycles;
+    SystemException exception;
+    REQUIRE(BusRead32(sys->bus, 0x9F800010, &value, &exception, &cycles));
+    REQUIRE(cycles == 0);
+    REQUIRE(!BusRead32(sys->bus, 0xBF800010, &value, &exception, &cycles));
+  }
+}
+
+// Runs program on sys in mode and on reference in the interpreter, and
+// requires both to end in the same state.
+static void RequireSameAsInterpreter(TestSystemUniquePtr &sys, TestSystemUniquePtr &reference, CpuExecutionMode mode,
+                                     uint32_t *program, size_t size) {
+  Cpu *expected = RunTestProgram(reference, CpuModeInterpreter, program, size, 20000);
+  Cpu *cpu = RunTestProgram(sys, mode, program, size, 20000);
+  int i;
+  for (i = 0; i < 32; i++) {
+    INFO("Register " << i);
+    REQUIRE(cpu->reg[i] == expected->reg[i]);
+  }
+  REQUIRE(cpu->hilo.combined == expected->hilo.combined);
+  REQUIRE(cpu->loadReg == expected->loadReg);
+  REQUIRE(memcmp(MemoryData(sys->memory), MemoryData(reference->memory), 0x400) == 0);
+}
+
+TEST_CASE("CpuRecompilerTests", "[Cpu]") {
+  CpuExecutionMode mode = GENERATE(CpuModeCachedInterpreter, CpuModeRecompiler);
+  auto reference = TestSystemNew();
+  auto sys = TestSystemNew();
+
+  SECTION("Every instruction class matches the interpreter") {
+    // Runs a loop touching every translated instruction class (and a few that
+    // fall back to the interpreter) often enough to get it recompiled.
+    uint32_t program[] = {
+        0x3C038000, // lui $3, 0x8000
+        0x2414000C, // addiu $20, $0, 12
+        0x24011234, // addiu $1, $0, 0x1234
+        0x3C02FFFF, // lui $2, 0xFFFF
+        0x34428000, // ori $2, $2, 0x8000
+        0x24100000, // addiu $16, $0, 0
+        0x00222021, // addu $4, $1, $2
+        0x00812823, // subu $5, $4, $1
+        0x00823024, // and $6, $4, $2
+        0x00C13825, // or $7, $6, $1
+        0x00E44026, // xor $8, $7, $4
+        0x01004827, // nor $9, $8, $0
+        0x0041502A, // slt $10, $2, $1
+        0x0041582B, // sltu $11, $2, $1
+        0x000160C0, // sll $12, $1, 3
+        0x00026903, // sra $13, $2, 4
+        0x00027102, // srl $14, $2, 4
+        0x02817804, // sllv $15, $1, $20
+        0x02828807, // srav $17, $2, $20
+        0x00220018, // mult $1, $2
+        0x00009012, // mflo $18
+        0x00009810, // mfhi $19
+        0x00410019, // multu $2, $1
+        0x0000A810, // mfhi $21
+        0x2856FFF0, // slti $22, $2, -16
+        0x2C37FFF0, // sltiu $23, $1, -16
+        0x3058F0F0, // andi $24, $2, 0xF0F0
+        0x38395A5A, // xori $25, $1, 0x5A5A
+        0x002A0820, // add $1, $1, $10
+        0x20420007, // addi $2, $2, 7
+        0xAC640200, // sw $4, 0x200($3)
+        0xA4610204, // sh $1, 0x204($3)
+        0xA0620207, // sb $2, 0x207($3)
+        0x8C7A0200, // lw $26, 0x200($3)
+        0x0340D821, // addu $27, $26, $0 (load delay: old $26)
+        0x807A0207, // lb $26, 0x207($3)
+        0x907C0207, // lbu $28, 0x207($3)
+        0x847D0204, // lh $29, 0x204($3)
+        0x947E0204, // lhu $30, 0x204($3)
+        0x021D8021, // addu $16, $16, $29
+        0x88700205, // lwl $16, 0x205($3)
+        0x98700202, // lwr $16, 0x202($3)
+        0x0034001B, // divu $1, $20
+        0x00002812, // mflo $5
+        0x0054001A, // div $2, $20
+        0x00003010, // mfhi $6
+        0x00800013, // mtlo $4
+        0x01000011, // mthi $8
+        0x0FF0003E, // jal sub
+        0x24E70001, // addiu $7, $7, 1
+        0x05010003, // bgez $8, +3
+        0x25290003, // addiu $9, $9, 3
+        0x25290005, // addiu $9, $9, 5
+        0x254A0007, // addiu $10, $10, 7
+        0x19200002, // blez $9, +2
+        0x04400001, // bltz $2, +1 (delay slot branch)
+        0x256B0001, // addiu $11, $11, 1
+        0x2694FFFF, // addiu $20, $20, -1
+        0x1E80FFCB, // bgtz $20, loop
+        0x00000000, // nop
+        0x0BF0003C, // j end
+        0x00000000, // nop
+        0x3C0C1111, // lui $12, 0x1111
+        0x03E00008, // jr $31
+        0x8C6D0200, // lw $13, 0x200($3)
+    };
+    RequireSameAsInterpreter(sys, reference, mode, program, sizeof(program));
+    REQUIRE(sys->cpu->reg[20] == 0);
+  }
+
+  SECTION("mfc2 and cfc2 results survive the interpreter fallback") {
+    uint32_t program[] = {
+        0x2414000C, // addiu $20, $0, 12
+        0x24100000, // addiu $16, $0, 0
+        0x24110000, // addiu $17, $0, 0
+        0x48940000, // loop: mtc2 $20, $0
+        0x48020000, // mfc2 $2, $0
+        0x00000000, // nop
+        0x02028021, // addu $16, $16, $2
+        0x48D4C000, // ctc2 $20, $24
+        0x4843C000, // cfc2 $3, $24
+        0x00602021, // addu $4, $3, $0 (load delay: old $3)
+        0x02238821, // addu $17, $17, $3
+        0x2694FFFF, // addiu $20, $20, -1
+        0x1E80FFF6, // bgtz $20, loop
+        0x00000000, // nop
+        0x0BF0000E, // j 0xBFC00038
+        0x00000000, // nop
+    };
+    RequireSameAsInterpreter(sys, reference, mode, program, sizeof(program));
+    REQUIRE(sys->cpu->reg[16] == 78);
+    REQUIRE(sys->cpu->reg[17] == 78);
+    REQUIRE(sys->cpu->reg[4] == 2);
+  }
+  SECTION("Stores through a RAM mirror are seen by loads from the first copy") {
+    uint32_t program[] = {
+        0x2414000C, // addiu $20, $0, 12
+        0x24100000, // addiu $16, $0, 0
+        0x3C088060, // lui $8, 0x8060
+        0xAD140100, // loop: sw $20, 0x100($8)
+        0x8C050100, // lw $5, 0x100($0)
+        0x00000000, // nop
+        0x02058021, // addu $16, $16, $5
+        0x2694FFFF, // addiu $20, $20, -1
+        0x1E80FFFA, // bgtz $20, loop
+        0x00000000, // nop
+        0x0BF0000A, // j 0xBFC00028
+        0x00000000, // nop
+    };
+    RequireSameAsInterpreter(sys, reference, mode, program, sizeof(program));
+    REQUIRE(sys->cpu->reg[16] == 78);
+  }
+}
+
+TEST_CASE("CpuRecompilerSelfModifyingTests", "[Cpu]") {
+  // Calls a subroutine in RAM often enough to get it recompiled, then patches
+  // it from the caller; the patched instruction must take effect immediately.
+  uint32_t program[] = {
+        0x3C038000, // lui $3, 0x8000
+        0x346A0100, // ori $10, $3, 0x100
+        0x3C0524C6, // lui $5, 0x24C6
+        0x34A50001, // ori $5, $5, 1 -> addiu $6, $6, 1
+        0xAC650100, // sw $5, 0x100($3)
+        0x3C0703E0, // lui $7, 0x03E0
+        0x34E70008, // ori $7, $7, 8 -> jr $31
+        0xAC670104, // sw $7, 0x104($3)
+        0xAC600108, // sw $0, 0x108($3)
+        0x24060000, // addiu $6, $0, 0
+        0x2414000A, // addiu $20, $0, 10
+        0x0140F809, // jalr $31, $10
+        0x00000000, // nop
+        0x2694FFFF, // addiu $20, $20, -1
+        0x1E80FFFC, // bgtz $20, -4
+        0x00000000, // nop
+        0x24A50063, // addiu $5, $5, 99 -> addiu $6, $6, 100
+        0x24140008, // addiu $20, $0, 8
+        0xAC650100, // sw $5, 0x100($3)
+        0x0140F809, // jalr $31, $10
+        0x00000000, // nop
+        0x2694FFFF, // addiu $20, $20, -1
+        0x1E80FFFB, // bgtz $20, -5
+        0x24A50001, // addiu $5, $5, 1
+        0x0BF00018, // j 0xBFC00060
+        0x00000000, // nop
+  };
+  CpuExecutionMode mode = GENERATE(CpuModeInterpreter, CpuModeCachedInterpreter, CpuModeRecompiler);
+  auto sys = TestSystemNew();
+  Cpu *cpu = RunTestProgram(sys, mode, program, sizeof(program), 20000);
+
+  REQUIRE(cpu->reg[20] == 0);
+  REQUIRE(cpu->reg[6] == 10 + 100 + 101 + 102 + 103 + 104 + 105 + 106 + 107);
+}
+
+TEST_CASE("CpuIdleLoopTests", "[Cpu]") {
+  CpuExecutionMode mode = GENERATE(CpuModeCachedInterpreter, CpuModeRecompiler);
+  auto sys = TestSystemNew();
+  size_t count;
+
+  SECTION("Polling loops are skipped to the end of the slice") {
+    uint32_t program[] = {
+        0x3C038000, // lui $3, 0x8000
+        0x24050000, // addiu $5, $0, 0
+        0x8C640100, // lw $4, 0x100($3)
+        0x00000000, // nop
+        0x1480FFFD, // bne $4, $0, -3
+        0x00000000, // nop
+    };
+    Cpu *cpu = RunTestProgram(sys, mode, program, sizeof(program), 100000);
+    const CpuIdleLoopStats *stats = CpuGetIdleLoopStats(cpu, &count);
+    REQUIRE(count == 1);
+    REQUIRE(stats[0].address == 0xBFC00008);
+    REQUIRE(stats[0].hits == 1);
+    REQUIRE(stats[0].skippedCycles > 90000);
+    REQUIRE(cpu->reg[4] == 0xAAAAAAAA);
+  }
+
+  SECTION("Loops that change registers are not idle") {
+    uint32_t program[] = {
+        0x3C038000, // lui $3, 0x8000
+        0x24050000, // addiu $5, $0, 0
+        0x8C640100, // lw $4, 0x100($3)
+        0x24A50001, // addiu $5, $5, 1
+        0x1480FFFD, // bne $4, $0, -3
+        0x00000000, // nop
+    };
+    Cpu *cpu = RunTestProgram(sys, mode, program, sizeof(program), 100000);
+    CpuGetIdleLoopStats(cpu, &count);
+    REQUIRE(count == 0);
+    REQUIRE(cpu->reg[5] > 1000);
+  }
+}
+
+TEST_CASE("CpuInterruptTests", "[Cpu]") {
+  CpuExecutionMode mode = GENERATE(CpuModeInterpreter, CpuModeCachedInterpreter, CpuModeRecompiler);
+  auto sys = TestSystemNew();
+  System *system = (System *)sys.get();
+  uint32_t program[] = {
+      0x3C048000, // lui $4, 0x8000
+      0x3C052409, // lui $5, 0x2409
+      0x34A50001, // ori $5, $5, 0x0001
+      0xAC850080, // sw $5, 0x80($4)
+      0x3C051000, // lui $5, 0x1000
+      0x34A5FFFF, // ori $5, $5, 0xFFFF
+      0xAC850084, // sw $5, 0x84($4)
+      0xAC800088, // sw $0, 0x88($4)
+      0x3C011F80, // lui $1, 0x1F80
+      0x34020001, // ori $2, $0, 0x0001
+      0xAC221074, // sw $2, 0x1074($1)
+      0x34030401, // ori $3, $0, 0x0401
+      0x40836000, // mtc0 $3, $12
+      0x1000FFFF, // beq $0, $0, -1
+      0x00000000, // nop
+  };
+  Cpu *cpu = RunTestProgram(sys, mode, program, sizeof(program), 1000);
+  cpu->reg[9] = 0;
+
+  SECTION("Masked interrupts are latched but not taken") {
+    SystemInterrupt(system, kInterruptGpu);
+    CpuRun(cpu, 1000);
+    REQUIRE(cpu->reg[9] == 0);
+    REQUIRE(InterruptControlRead32(sys->interruptControl, UserSegment, 0) == 0x2);
+  }
+
+  SECTION("Enabled interrupts enter the exception handler") {
+    SystemInterrupt(system, kInterruptVBlank);
+    CpuRun(cpu, 1000);
+    REQUIRE(cpu->reg[9] == 1);
+    REQUIRE(cpu->cop0.epc == 0xBFC00034);
+    REQUIRE(cpu->cop0.cause.parsed.exceptionCode == kExceptionExternalInterrupt);
+    REQUIRE(cpu->cop0.cause.parsed.interruptPending == 0x04);
+    REQUIRE(cpu->cop0.sr.parsed.currentInteruptEnable == 0);
+    InterruptControlWrite32(sys->interruptControl, UserSegment, 0, 0);
+    REQUIRE(cpu->cop0.cause.parsed.interruptPending == 0);
+  }
+
+  SECTION("Narrow writes only change their own byte lanes") {
+    SystemInterrupt(system, kInterruptGpu);
+    SystemInterrupt(system, kInterruptSpu);
+    REQUIRE(InterruptControlRead32(sys->interruptControl, UserSegment, 0) == 0x202);
+    InterruptControlWrite8(sys->interruptControl, UserSegment, 1, 0x00);
+    REQUIRE(InterruptControlRead32(sys->interruptControl, UserSegment, 0) == 0x002);
+    InterruptControlWrite8(sys->interruptControl, UserSegment, 5, 0x02);
+    REQUIRE(InterruptControlRead32(sys->interruptControl, UserSegment, 4) == 0x201);
+    InterruptControlWrite16(sys->interruptControl, UserSegment, 4, 0x0000);
+    REQUIRE(InterruptControlRead32(sys->interruptControl, UserSegment, 4) == 0x000);
+  }
+}
+
+TEST_CASE("CpuGteTests", "[Cpu]") {
+  CpuExecutionMode mode = GENERATE(CpuModeInterpreter, CpuModeCachedInterpreter, CpuModeRecompiler);
+  auto sys = TestSystemNew();
+  uint32_t program[] = {
+      0x24010100, // addiu $1, $0, 0x100
+      0x48814800, // mtc2 $1, $9
+      0x24020080, // addiu $2, $0, 0x80
+      0x48825000, // mtc2 $2, $10
+      0x34031000, // ori $3, $0, 0x1000
+      0x48834000, // mtc2 $3, $8
+      0x4A08003D, // gpf sf=1
+      0x4804C800, // mfc2 $4, $25
+      0x00000000, // nop
+      0x3C058000, // lui $5, 0x8000
+      0xE8A90000, // swc2 $9, 0($5)
+      0xC8AB0000, // lwc2 $11, 0($5)
+      0x4846F800, // cfc2 $6, $31
+      0x48075800, // mfc2 $7, $11
+      0x00000000, // nop
+      0x1000FFFF, // beq $0, $0, -1
+      0x00000000, // nop
+  };
+  Cpu *cpu = RunTestProgram(sys, mode, program, sizeof(program), 1000);
+  REQUIRE(cpu->reg[4] == 0x100);
+  REQUIRE(cpu->reg[6] == 0);
+  REQUIRE(cpu->reg[7] == 0x100);
+}
+
+TEST_CASE("CpuRunUntilTests", "[Cpu]") {
+  auto sys = TestSystemNew();
+  uint32_t program[] = {
+      0x24010001, // addiu $1, $0, 1
+      0x24210001, // addiu $1, $1, 1
+      0x24210001, // addiu $1, $1, 1
+      0x24210001, // addiu $1, $1, 1
+      0x1000FFFF, // beq $0, $0, -1
+      0x00000000, // nop
+  };
+  TestProgram testProgram = {.cyclesToRun = 0, .size = sizeof(program), .program = (uint8_t *)program};
+  LoadTestProgram(sys, testProgram);
+  Cpu *cpu = sys->cpu;
+  REQUIRE(CpuRunUntil(cpu, 0xBFC0000C, 1000));
+  REQUIRE(cpu->reg[1] == 3);
+  REQUIRE_FALSE(CpuRunUntil(cpu, 0xBFC00100, 1000));
+
+  CpuStartExecutable(cpu, 0xBFC00004, 0x1234, 0x801FFF00);
+  REQUIRE(cpu->reg[28] == 0x1234);
+  REQUIRE(cpu->reg[29] == 0x801FFF00);
+  REQUIRE(cpu->reg[30] == 0x801FFF00);
+  REQUIRE(CpuRunUntil(cpu, 0xBFC00010, 1000));
+  REQUIRE(cpu->reg[1] == 7);
+}
@@ -0,0 +1,141 @@
+#include "catch.hpp"
+extern "C" {
+
+#include "../src/Cpu/Gte.h"
+}
+
+static const uint32_t kGteRtps = 0x00080001;
+static const uint32_t kGteRtpt = 0x00080030;
+
+static void GteTestSetIdentity(Gte *gte) {
+  GteWriteControl(gte, 0, 0x00001000);
+  GteWriteControl(gte, 1, 0);
+  GteWriteControl(gte, 2, 0x00001000);
+  GteWriteControl(gte, 3, 0);
+  GteWriteControl(gte, 4, 0x1000);
+}
+
+TEST_CASE("GteRegisterTests", "[Gte]") {
+  Gte gte;
+  GteReset(&gte);
+
+  SECTION("IRGB expands to IR1-3 and reads back as ORGB") {
+    GteWriteData(&gte, 28, 0x7FFF);
+    REQUIRE(GteReadData(&gte, 9) == 0xF80);
+    REQUIRE(GteReadData(&gte, 11) == 0xF80);
+    REQUIRE(GteReadData(&gte, 29) == 0x7FFF);
+  }
+
+  SECTION("LZCR counts the leading sign bits of LZCS") {
+    GteWriteData(&gte, 30, 0x00010000);
+    REQUIRE(GteReadData(&gte, 31) == 15);
+    GteWriteData(&gte, 30, 0xFFFF0000);
+    REQUIRE(GteReadData(&gte, 31) == 16);
+    GteWriteData(&gte, 30, 0);
+    REQUIRE(GteReadData(&gte, 31) == 32);
+  }
+
+  SECTION("Writes to SXYP push the screen FIFO") {
+    GteWriteData(&gte, 15, 0x00010001);
+    GteWriteData(&gte, 15, 0x00020002);
+    GteWriteData(&gte, 15, 0x00030003);
+    REQUIRE(GteReadData(&gte, 12) == 0x00010001);
+    REQUIRE(GteReadData(&gte, 14) == 0x00030003);
+    REQUIRE(GteReadData(&gte, 15) == 0x00030003);
+  }
+
+  SECTION("Halfword registers are sign extended") {
+    GteWriteData(&gte, 1, 0x0000FFFF);
+    GteWriteControl(&gte, 26, 0x8000);
+    GteWriteControl(&gte, 4, 0xFFFF8000);
+    REQUIRE(GteReadData(&gte, 1) == 0xFFFFFFFF);
+    REQUIRE(GteReadControl(&gte, 26) == 0xFFFF8000);
+    REQUIRE(GteReadControl(&gte, 4) == 0xFFFF8000);
+  }
+
+  SECTION("FLAG sets the error bit from the error flags") {
+    GteWriteControl(&gte, 31, 0x00001000);
+    REQUIRE(GteReadControl(&gte, 31) == 0x00001000);
+    GteWriteControl(&gte, 31, 0xFFFFFFFF);
+    REQUIRE(GteReadControl(&gte, 31) == 0xFFFFF000);
+  }
+}
+
+TEST_CASE("GteCommandTests", "[Gte]") {
+  Gte gte;
+  GteReset(&gte);
+  GteTestSetIdentity(&gte);
+  GteWriteControl(&gte, 26, 0x200);
+  GteWriteControl(&gte, 27, 0x100);
+
+  SECTION("RTPS projects V0") {
+    GteWriteData(&gte, 0, 0x00800100);
+    GteWriteData(&gte, 1, 0x400);
+    REQUIRE(GteExecute(&gte, kGteRtps) == 15);
+    REQUIRE(GteReadData(&gte, 9) == 0x100);
+    REQUIRE(GteReadData(&gte, 10) == 0x80);
+    REQUIRE(GteReadData(&gte, 19) == 0x400);
+    REQUIRE(GteReadData(&gte, 14) == 0x00400080);
+    REQUIRE(GteReadData(&gte, 8) == 0x800);
+    REQUIRE(GteReadControl(&gte, 31) == 0);
+  }
+
+  SECTION("RTPS flags a division overflow") {
+    GteWriteData(&gte, 0, 0x00800100);
+    GteWriteData(&gte, 1, 0x10);
+    GteExecute(&gte, kGteRtps);
+    REQUIRE(GteReadData(&gte, 14) == 0x00FF01FF);
+    REQUIRE(GteReadControl(&gte, 31) == 0x80021000);
+  }
+
+  SECTION("RTPT matches three RTPS") {
+    uint32_t vertices[3][2] = {{0x01230456, 0x0789}, {0xFE00F100, 0x0300}, {0x7FFF8000, 0x7FFF}};
+    GteWriteControl(&gte, 0, 0x0FFF1234);
+    GteWriteControl(&gte, 2, 0x7FFFE000);
+    GteWriteControl(&gte, 5, 0x7FFFFFFF);
+    GteWriteControl(&gte, 7, 0x1000);
+    GteWriteControl(&gte, 24, 0x01000000);
+    Gte single = gte;
+    uint32_t flags = 0;
+    int i;
+    for (i = 0; i < 3; i++) {
+      GteWriteData(&gte, i * 2, vertices[i][0]);
+      GteWriteData(&gte, i * 2 + 1, vertices[i][1]);
+      GteWriteData(&single, 0, vertices[i][0]);
+      GteWriteData(&single, 1, vertices[i][1]);
+      GteExecute(&single, kGteRtps);
+      flags |= GteReadControl(&single, 31);
+    }
+    GteExecute(&gte, kGteRtpt);
+    for (i = 8; i < 28; i++) {
+      REQUIRE(GteReadData(&gte, i) == GteReadData(&single, i));
+    }
+    REQUIRE(GteReadControl(&gte, 31) == flags);
+    REQUIRE(flags != 0);
+  }
+
+  SECTION("MVMVA saturates IR and sets the error flag") {
+    GteWriteControl(&gte, 0, 0x7FFF7FFF);
+    GteWriteControl(&gte, 1, 0x00007FFF);
+    GteWriteData(&gte, 0, 0x7FFF7FFF);
+    GteWriteData(&gte, 1, 0x7FFF);
+    GteExecute(&gte, 0x00086012);
+    REQUIRE(GteReadData(&gte, 25) == 0x000BFFD0);
+    REQUIRE(GteReadData(&gte, 9) == 0x7FFF);
+    REQUIRE(GteReadControl(&gte, 31) == 0x81000000);
+  }
+
+  SECTION("NCLIP and AVSZ3") {
+    GteWriteData(&gte, 12, 0);
+    GteWriteData(&gte, 13, 10);
+    GteWriteData(&gte, 14, 10 << 16);
+    GteExecute(&gte, 0x06);
+    REQUIRE(GteReadData(&gte, 24) == 100);
+    GteWriteControl(&gte, 29, 0x555);
+    GteWriteData(&gte, 17, 0x100);
+    GteWriteData(&gte, 18, 0x200);
+    GteWriteData(&gte, 19, 0x300);
+    GteExecute(&gte, 0x2D);
+    REQUIRE(GteReadData(&gte, 7) == 0x1FF);
+  }
+}
@@ -0,0 +1,145 @@
+#include "catch.hpp"
+#include <vector>
+extern "C" {
+
+#include "../src/Lz.h"
+#include "../src/Rewind.h"
+#include "TestSystem.hpp"
+}
+
+static std::vector<uint8_t> LzRoundTrip(const std::vector<uint8_t> &input) {
+  std::vector<uint8_t> compressed(LZ_MAX_COMPRESSED_SIZE(input.size()));
+  size_t compressedSize = LzCompress(input.data(), input.size(), compressed.data(), compressed.size());
+  REQUIRE(compressedSize > 0);
+  std::vector<uint8_t> output(input.size());
+  REQUIRE(LzDecompress(compressed.data(), compressedSize, output.data(), output.size()) == input.size());
+  compressed.resize(compressedSize);
+  REQUIRE(output == input);
+  return compressed;
+}
+
+TEST_CASE("LzTests", "[Rewind]") {
+  SECTION("Runs of zeros compress to a few bytes") {
+    std::vector<uint8_t> input(4096, 0);
+    REQUIRE(LzRoundTrip(input).size() < 32);
+  }
+
+  SECTION("Sparse changes compress well") {
+    std::vector<uint8_t> input(4096, 0);
+    input[17] = 0x12;
+    input[1000] = 0x34;
+    input[1001] = 0x56;
+    input[4095] = 0x78;
+    REQUIRE(LzRoundTrip(input).size() < 64);
+  }
+
+  SECTION("Incompressible data round trips") {
+    std::vector<uint8_t> input(5000);
+    uint32_t seed = 1;
+    for (auto &byte : input) {
+      seed = seed * 1103515245 + 12345;
+      byte = (uint8_t)(seed >> 16);
+    }
+    REQUIRE(LzRoundTrip(input).size() <= LZ_MAX_COMPRESSED_SIZE(input.size()));
+  }
+
+  SECTION("Long repeated patterns and literal runs round trip") {
+    std::vector<uint8_t> input;
+    uint32_t i;
+    for (i = 0; i < 300; i++) {
+      input.push_back((uint8_t)i);
+    }
+    for (i = 0; i < 3000; i++) {
+      input.push_back((uint8_t)(i % 7));
+    }
+    LzRoundTrip(input);
+  }
+
+  SECTION("Buffers that are too small are reported") {
+    std::vector<uint8_t> input(4096, 0);
+    std::vector<uint8_t> compressed(LZ_MAX_COMPRESSED_SIZE(input.size()));
+    REQUIRE(LzCompress(input.data(), input.size(), compressed.data(), 2) == 0);
+    size_t compressedSize = LzCompress(input.data(), input.size(), compressed.data(), compressed.size());
+    std::vector<uint8_t> output(100);
+    REQUIRE(LzDecompress(compressed.data(), compressedSize, output.data(), output.size()) == 0);
+  }
+}
+
+static uint32_t kRewindLoop[] = {
+    0x3C038000, // lui $3, 0x8000
+    0x24010000, // addiu $1, $0, 0
+    0x24210001, // addiu $1, $1, 1
+    0xAC610100, // sw $1, 0x100($3)
+    0x1000FFFD, // beq $0, $0, -3
+    0x00000000, // nop
+};
+
+TEST_CASE("RewindTests", "[Rewind]") {
+  auto sys = TestSystemNew();
+  TestProgram program = {.cyclesToRun = 1000, .size = sizeof(kRewindLoop), .program = (uint8_t *)kRewindLoop};
+  LoadTestProgram(sys, program);
+  std::vector<uint32_t> counters;
+
+  SECTION("Popping walks back through every captured frame") {
+    Rewind *rewind = RewindNew(1024 * 1024);
+    uint32_t i;
+    for (i = 0; i < 50; i++) {
+      CpuRun(sys->cpu, program.cyclesToRun);
+      RewindCapture(rewind, (System *)sys.get());
+      counters.push_back(sys->cpu->reg[1]);
+    }
+    REQUIRE(RewindNumSnapshots(rewind) == 50);
+    // Only a handful of pages change per frame.
+    REQUIRE(RewindUsedBytes(rewind) < 49 * 2048);
+    for (i = 50; i > 0; i--) {
+      CpuRun(sys->cpu, program.cyclesToRun);
+      REQUIRE(RewindPop(rewind, (System *)sys.get()));
+      REQUIRE(sys->cpu->reg[1] == counters[i - 1]);
+      REQUIRE(*(uint32_t *)(MemoryData(sys->memory) + 0x100) == counters[i - 1]);
+    }
+    REQUIRE(!RewindPop(rewind, (System *)sys.get()));
+    REQUIRE(RewindNumSnapshots(rewind) == 0);
+    RewindFree(rewind);
+  }
+
+  SECTION("Running on after a pop continues the history from there") {
+    Rewind *rewind = RewindNew(1024 * 1024);
+    uint32_t i;
+    for (i = 0; i < 10; i++) {
+      CpuRun(sys->cpu, program.cyclesToRun);
+      RewindCapture(rewind, (System *)sys.get());
+      counters.push_back(sys->cpu->reg[1]);
+    }
+    REQUIRE(RewindPop(rewind, (System *)sys.get()));
+    REQUIRE(RewindPop(rewind, (System *)sys.get()));
+    REQUIRE(sys->cpu->reg[1] == counters[8]);
+    CpuRun(sys->cpu, program.cyclesToRun);
+    RewindCapture(rewind, (System *)sys.get());
+    REQUIRE(RewindNumSnapshots(rewind) == 9);
+    REQUIRE(RewindPop(rewind, (System *)sys.get()));
+    REQUIRE(sys->cpu->reg[1] == counters[9]);
+    REQUIRE(RewindPop(rewind, (System *)sys.get()));
+    REQUIRE(sys->cpu->reg[1] == counters[7]);
+    RewindFree(rewind);
+  }
+
+  SECTION("The oldest frames are dropped when the history is full") {
+    Rewind *rewind = RewindNew(4096);
+    uint32_t i;
+    for (i = 0; i < 200; i++) {
+      CpuRun(sys->cpu, program.cyclesToRun);
+      RewindCapture(rewind, (System *)sys.get());
+      counters.push_back(sys->cpu->reg[1]);
+    }
+    size_t numSnapshots = RewindNumSnapshots(rewind);
+    REQUIRE(numSnapshots > 2);
+    REQUIRE(numSnapshots < 200);
+    REQUIRE(RewindUsedBytes(rewind) <= 4096);
+    for (i = 200; i > 200 - numSnapshots; i--) {
+      REQUIRE(RewindPop(rewind, (System *)sys.get()));
+      REQUIRE(sys->cpu->reg[1] == counters[i - 1]);
+    }
+    REQUIRE(!RewindPop(rewind, (System *)sys.get()));
+    RewindFree(rewind);
+  }
+}
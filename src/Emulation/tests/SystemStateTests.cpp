@@ -0,0 +1,127 @@
+#include "catch.hpp"
+#include <vector>
+extern "C" {
+
+#include "../src/Cpu/BlockCache.h"
+#include "TestSystem.hpp"
+}
+
+static uint32_t kCountingLoop[] = {
+    0x3C038000, // lui $3, 0x8000
+    0x24010000, // addiu $1, $0, 0
+    0x24210001, // addiu $1, $1, 1
+    0xAC610100, // sw $1, 0x100($3)
+    0x1000FFFD, // beq $0, $0, -3
+    0x00000000, // nop
+};
+
+static uint32_t kJumpToRam[] = {
+    0x3C028000, // lui $2, 0x8000
+    0x34421000, // ori $2, $2, 0x1000
+    0x00400008, // jr $2
+    0x00000000, // nop
+};
+
+static uint32_t kRamLoop[] = {
+    0x24210001, // addiu $1, $1, 1
+    0xAC010100, // sw $1, 0x100($0)
+    0x1000FFFD, // beq $0, $0, -3
+    0x00000000, // nop
+};
+
+static std::vector<uint8_t> SaveState(TestSystemUniquePtr &sys) {
+  std::vector<uint8_t> state(SystemStateSize((System *)sys.get()));
+  PCFResultOrPanic(SystemSaveState((System *)sys.get(), state.data(), state.size()));
+  return state;
+}
+
+static uint32_t RamWord(TestSystemUniquePtr &sys, Address address) {
+  return *(uint32_t *)(MemoryData(sys->memory) + address);
+}
+
+TEST_CASE("SystemStateTests", "[System]") {
+  CpuExecutionMode mode = GENERATE(CpuModeInterpreter, CpuModeCachedInterpreter, CpuModeRecompiler);
+  auto sys = TestSystemNew();
+  TestProgram program = {.cyclesToRun = 5000, .size = sizeof(kCountingLoop), .program = (uint8_t *)kCountingLoop};
+  LoadTestProgram(sys, program);
+  CpuSetExecutionMode(sys->cpu, mode);
+  CpuRun(sys->cpu, program.cyclesToRun);
+  std::vector<uint8_t> state = SaveState(sys);
+
+  SECTION("A state loaded into another system continues where it was saved") {
+    CpuRun(sys->cpu, program.cyclesToRun);
+    auto other = TestSystemNew();
+    REQUIRE(SystemLoadState((System *)other.get(), state.data(), state.size()).successful);
+    REQUIRE(other->cpu->sys == (System *)other.get());
+    REQUIRE(other->cpu->bus == other->bus);
+    CpuRun(other->cpu, program.cyclesToRun);
+    REQUIRE(other->cpu->reg[1] == sys->cpu->reg[1]);
+    REQUIRE(other->cpu->pc == sys->cpu->pc);
+    REQUIRE(RamWord(other, 0x100) == RamWord(sys, 0x100));
+    REQUIRE(ClockSystemTime(other->clock) == ClockSystemTime(sys->clock));
+  }
+
+  SECTION("Loading a state rewinds the system it was saved from") {
+    uint32_t counter = sys->cpu->reg[1];
+    CpuRun(sys->cpu, program.cyclesToRun);
+    REQUIRE(sys->cpu->reg[1] != counter);
+    REQUIRE(SystemLoadState((System *)sys.get(), state.data(), state.size()).successful);
+    REQUIRE(sys->cpu->reg[1] == counter);
+    REQUIRE(RamWord(sys, 0x100) == counter);
+  }
+
+  SECTION("Damaged states are rejected and leave the system untouched") {
+    auto other = TestSystemNew();
+    REQUIRE(!SystemSaveState((System *)sys.get(), state.data(), state.size() - 1).successful);
+    REQUIRE(!SystemLoadState((System *)other.get(), state.data(), state.size() - 1).successful);
+    state[4]++;
+    REQUIRE(!SystemLoadState((System *)other.get(), state.data(), state.size()).successful);
+    state[0]++;
+    REQUIRE(!SystemLoadState((System *)other.get(), state.data(), state.size()).successful);
+    REQUIRE(other->cpu->sys == (System *)other.get());
+    REQUIRE(other->cpu->pc == 0xBFC00000);
+  }
+}
+
+TEST_CASE("SystemStateCodeTests", "[System]") {
+  CpuExecutionMode mode = GENERATE(CpuModeCachedInterpreter, CpuModeRecompiler);
+  auto sys = TestSystemNew();
+  TestProgram program = {.cyclesToRun = 5000, .size = sizeof(kJumpToRam), .program = (uint8_t *)kJumpToRam};
+  LoadTestProgram(sys, program);
+  CpuSetExecutionMode(sys->cpu, mode);
+  memcpy(MemoryData(sys->memory) + 0x1000, kRamLoop, sizeof(kRamLoop));
+  CpuRun(sys->cpu, program.cyclesToRun);
+  std::vector<uint8_t> state = SaveState(sys);
+  uint32_t generation = BlockCacheGeneration(sys->cpu->blockCache);
+
+  SECTION("Loading into the same system keeps the code the state does not change") {
+    CpuRun(sys->cpu, program.cyclesToRun);
+    REQUIRE(SystemLoadState((System *)sys.get(), state.data(), state.size()).successful);
+    CpuRun(sys->cpu, program.cyclesToRun);
+    REQUIRE(BlockCacheGeneration(sys->cpu->blockCache) == generation);
+  }
+
+  SECTION("Loading into the same system drops the code the state changes") {
+    uint32_t increment = 0x24210002; // addiu $1, $1, 2
+    memcpy(MemoryData(sys->memory) + 0x1000, &increment, sizeof(increment));
+    MemoryNotifyWrite(sys->memory, 0x80001000);
+    CpuRun(sys->cpu, program.cyclesToRun);
+    REQUIRE(SystemLoadState((System *)sys.get(), state.data(), state.size()).successful);
+    CpuRun(sys->cpu, program.cyclesToRun);
+    auto other = TestSystemNew();
+    REQUIRE(SystemLoadState((System *)other.get(), state.data(), state.size()).successful);
+    CpuRun(other->cpu, program.cyclesToRun);
+    REQUIRE(sys->cpu->reg[1] == other->cpu->reg[1]);
+    REQUIRE(RamWord(sys, 0x100) == RamWord(other, 0x100));
+  }
+}
+
+TEST_CASE("SystemStateBenchmark", "[System][.benchmark]") {
+  auto sys = TestSystemNew();
+  TestProgram program = {.cyclesToRun = 5000, .size = sizeof(kCountingLoop), .program = (uint8_t *)kCountingLoop};
+  LoadTestProgram(sys, program);
+  CpuRun(sys->cpu, program.cyclesToRun);
+  std::vector<uint8_t> state = SaveState(sys);
+  BENCHMARK("Save state") { return SystemSaveState((System *)sys.get(), state.data(), state.size()).successful; };
+  BENCHMARK("Load state") { return SystemLoadState((System *)sys.get(), state.data(), state.size()).successful; };
+}
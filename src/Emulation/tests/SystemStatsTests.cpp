@@ -0,0 +1,49 @@
+#include "catch.hpp"
+extern "C" {
+
+#include "TestSystem.hpp"
+}
+
+// SystemGetStats needs a whole System, so the CPU and bus counters are read
+// from the test system directly.
+TEST_CASE("SystemStatsTests", "[System]") {
+  CpuExecutionMode mode = GENERATE(CpuModeInterpreter, CpuModeCachedInterpreter);
+  auto sys = TestSystemNew();
+  uint32_t program[] = {
+      0x24010000, // addiu $1, $0, 0
+      0x2402000A, // addiu $2, $0, 10
+      0x00220821, // addu $1, $1, $2
+      0x2442FFFF, // addiu $2, $2, -1
+      0x1440FFFD, // bne $2, $0, -3
+      0x00000000, // nop
+      0x3C038000, // lui $3, 0x8000
+      0xAC610100, // sw $1, 0x100($3)
+      0x1000FFFF, // beq $0, $0, -1
+      0x00000000, // nop
+  };
+  TestProgram testProgram = {.cyclesToRun = 2000, .size = sizeof(program), .program = (uint8_t *)program};
+  LoadTestProgram(sys, testProgram);
+  CpuSetExecutionMode(sys->cpu, mode);
+  CpuRun(sys->cpu, testProgram.cyclesToRun);
+
+#if SYSTEM_STATS
+  SystemStats stats;
+  memset(&stats, 0, sizeof(stats));
+  CpuGetStats(sys->cpu, &stats);
+  BusGetStats(sys->bus, &stats);
+  REQUIRE(stats.cpu.registerFuncts[0x21] == 10);
+  REQUIRE(stats.cpu.opcodes[0x05] == 10);
+  REQUIRE(stats.cpu.opcodes[0x2B] == 1);
+  REQUIRE(stats.cpu.opcodes[0x04] > 1);
+  size_t i;
+  uint64_t ramWrites = 0;
+  for (i = 0; i < stats.numBusDevices; i++) {
+    if (stats.busDevices[i].addressRange.start == 0) {
+      ramWrites = stats.busDevices[i].writes;
+    }
+  }
+  REQUIRE(ramWrites == 1);
+#else
+  REQUIRE_FALSE(SystemGetStats((System *)sys.get()).enabled);
+#endif
+}
@@ -0,0 +1,76 @@
+#include "catch.hpp"
+#include <thread>
+#include <vector>
+extern "C" {
+
+#include "TestSystem.hpp"
+#include <PsxCoreFoundation/String.h>
+}
+
+static uint32_t kCountingLoop[] = {
+    0x3C038000, // lui $3, 0x8000
+    0x24010000, // addiu $1, $0, 0
+    0x24210001, // addiu $1, $1, 1
+    0xAC610100, // sw $1, 0x100($3)
+    0x1000FFFD, // beq $0, $0, -3
+    0x00000000, // nop
+};
+
+typedef struct __SystemRunResult {
+  uint32_t counter;
+  Address pc;
+  uint64_t systemTime;
+  bool stateLoaded;
+} SystemRunResult;
+
+// Everything a console in a test farm does on its thread: run, go through the
+// PCF runtime and save and restore its state.
+static SystemRunResult RunSystem(CpuExecutionMode mode) {
+  auto sys = TestSystemNew();
+  TestProgram program = {.cyclesToRun = 20000, .size = sizeof(kCountingLoop), .program = (uint8_t *)kCountingLoop};
+  LoadTestProgram(sys, program);
+  CpuSetExecutionMode(sys->cpu, mode);
+  std::vector<uint8_t> state(SystemStateSize((System *)sys.get()));
+  bool stateLoaded = true;
+  int i;
+  for (i = 0; i < 50; i++) {
+    CpuRun(sys->cpu, program.cyclesToRun);
+    PCFResultOrPanic(SystemSaveState((System *)sys.get(), state.data(), state.size()));
+    PCFRelease(PCFStringNewFromFormat(PCFCSTR("Slice %d of a system in mode %d"), i, (int)mode));
+    CpuRun(sys->cpu, program.cyclesToRun);
+    stateLoaded &= SystemLoadState((System *)sys.get(), state.data(), state.size()).successful;
+  }
+  SystemRunResult result = {.counter = sys->cpu->reg[1],
+                            .pc = sys->cpu->pc,
+                            .systemTime = ClockSystemTime(sys->clock),
+                            .stateLoaded = stateLoaded};
+  return result;
+}
+
+TEST_CASE("SystemThreadTests", "[System]") {
+  const CpuExecutionMode modes[] = {CpuModeInterpreter, CpuModeCachedInterpreter, CpuModeRecompiler};
+  const size_t numModes = sizeof(modes) / sizeof(modes[0]);
+  std::vector<SystemRunResult> expected;
+  for (CpuExecutionMode mode : modes) {
+    expected.push_back(RunSystem(mode));
+  }
+
+  SECTION("Systems on different threads run as if they were alone") {
+    const size_t numThreads = 12;
+    std::vector<SystemRunResult> results(numThreads);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < numThreads; i++) {
+      threads.emplace_back([&results, &modes, i]() { results[i] = RunSystem(modes[i % numModes]); });
+    }
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+    for (size_t i = 0; i < numThreads; i++) {
+      const SystemRunResult &reference = expected[i % numModes];
+      REQUIRE(results[i].stateLoaded);
+      REQUIRE(results[i].counter == reference.counter);
+      REQUIRE(results[i].pc == reference.pc);
+      REQUIRE(results[i].systemTime == reference.systemTime);
+    }
+  }
+}
@@ -4,6 +4,8 @@ extern "C" {
 #include "../src/Bus.h"
 #include "../src/Clock.h"
 #include "../src/Cpu/Cpu.h"
+#include "../src/Dma.h"
+#include "../src/InterruptControl.h"
 #include "../src/Memory.h"
 #include "../src/System.h"
 #include "../src/Types.h"
@@ -15,12 +17,15 @@ extern "C" {
 // system function, but it should suffice for testing the CPU.
 typedef struct __TestSystem {
   size_t arenaPosition;
+  size_t transientPosition;
   Clock *clock;
   Cpu *cpu;
   Bus *bus;
   Gpu *gpu;
   Memory *memory;
   Bios *bios;
+  Dma *dma;
+  InterruptControl *interruptControl;
 } TestSystem;
 
 typedef struct __TestProgram {
@@ -29,23 +34,35 @@ typedef struct __TestProgram {
   uint8_t *program;
 } TestProgram;
 
-typedef std::unique_ptr<TestSystem, decltype(std::free) *> TestSystemUniquePtr;
+static void TestSystemFree(TestSystem *testSys) {
+  CpuFree(testSys->cpu);
+  MemoryFree(testSys->memory);
+  free(testSys);
+}
+
+typedef std::unique_ptr<TestSystem, decltype(&TestSystemFree)> TestSystemUniquePtr;
 
 static void LoadTestProgram(TestSystemUniquePtr &sys, TestProgram program) {
-  void *mem = MemoryNewCustom((System *)sys.get(), sys->bus, program.size + 4,
+  Memory *mem = MemoryNewCustom((System *)sys.get(), sys->bus, program.size + 4,
                               NewAddressRange(0x1FC00000, 0x1FC00000 + program.size + 4, kMainSegments), 0);
-  memcpy(mem, program.program, program.size);
+  memcpy(MemoryData(mem), program.program, program.size);
 }
 
 static TestSystemUniquePtr TestSystemNew() {
-  void *arena = PCFMalloc(10 * 1024 * 1024);
+  const size_t arenaSize = 10 * 1024 * 1024;
+  void *arena = PCFMalloc(arenaSize);
   TestSystem *testSys = (TestSystem *)arena;
   System *sys = (System *)testSys;
   testSys->arenaPosition = sizeof(*testSys);
+  testSys->transientPosition = arenaSize;
   testSys->clock = ClockNew((System *)sys);
-  testSys->bus = BusNew((System *)sys, 3);
+  testSys->bus = BusNew((System *)sys, 6);
   testSys->memory = MemoryNew(sys, testSys->bus);
+  testSys->dma = DmaNew(sys, testSys->bus);
   testSys->cpu = CpuNew(sys, testSys->bus, testSys->clock);
-  TestSystemUniquePtr result{testSys, std::free};
+  CpuSetMemory(testSys->cpu, testSys->memory);
+  CpuSetScratchpad(testSys->cpu, MemoryData(DataCacheNew(sys, testSys->bus)));
+  testSys->interruptControl = InterruptControlNew(sys, testSys->bus, testSys->cpu);
+  TestSystemUniquePtr result{testSys, TestSystemFree};
   return result;
 }
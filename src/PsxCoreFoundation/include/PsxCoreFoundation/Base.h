@@ -7,6 +7,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
 
 #if defined(__clang__)
 #define ASSUME_NONNULL_BEGIN _Pragma("clang assume_nonnull begin")
@@ -17,8 +20,6 @@
 #define _Nonnull
 #define _Nullable
 #define _Null_unspecified
-#define __nullable
-#define __nonnull
 #endif
 
 typedef void *PCFObject;
@@ -54,6 +55,29 @@ void PCFBaseConstructorWithOverrides(PCFObject ref, PCFBaseVTable *vtable,
                                      uint32_t typeId);
 void PCFBaseMarkObjectImmortal(PCFObject ref);
 
+// Locks for the few tables that all threads share. While one is held, only the
+// ones listed after it may be taken.
+typedef enum __PCFLockId {
+  PCFLockInternedStrings = 0,
+  PCFLockLog,
+  kPCFNumLocks
+} PCFLockId;
+
+void PCFLock(PCFLockId lock);
+void PCFUnlock(PCFLockId lock);
+
+// State for PCFRunOnce, which runs init exactly once per PCFOnce. Threads that
+// arrive while it runs wait for it, the ones after it take no lock.
+#if defined(_WIN32)
+typedef void *PCFOnce; // Laid out like INIT_ONCE.
+#define PCF_ONCE_INIT NULL
+#else
+typedef pthread_once_t PCFOnce;
+#define PCF_ONCE_INIT PTHREAD_ONCE_INIT
+#endif
+
+void PCFRunOnce(PCFOnce *once, void (*init)(void));
+
 PCFObject PCFRetain(PCFObject ref);
 void PCFRelease(PCFObject _Nullable ref);
 void PCFPanic(const char *message);
@@ -1,4 +1,5 @@
 #pragma once
+#include "Macros.h"
 #include <setjmp.h>
 
 #ifdef __cplusplus
@@ -72,8 +73,9 @@ typedef struct {
   CEXCEPTION_T volatile Exception;
 } CEXCEPTION_FRAME_T;
 
-// actual root frame storage (only one if single-tasking)
-extern volatile CEXCEPTION_FRAME_T CExceptionFrames[];
+// actual root frame storage (only one if single-tasking), kept per thread so
+// that Try and Throw can be used on any of them
+extern PCF_THREAD_LOCAL volatile CEXCEPTION_FRAME_T CExceptionFrames[];
 
 // Try (see C file for explanation)
 #define Try                                                                    \
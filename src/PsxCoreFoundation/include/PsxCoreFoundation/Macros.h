@@ -15,6 +15,15 @@
     _69, _70, count, ...)                                                      \
   count
 
+// Storage that every thread has its own copy of.
+#if defined(__cplusplus)
+#define PCF_THREAD_LOCAL thread_local
+#elif defined(_MSC_VER) && !defined(__clang__)
+#define PCF_THREAD_LOCAL __declspec(thread)
+#else
+#define PCF_THREAD_LOCAL _Thread_local
+#endif
+
 #define EXPAND(...) __VA_ARGS__
 #define GLUE2(a, b) a##b
 #define GLUE3(a, b, c) a##b##c
@@ -36,70 +45,37 @@
     PCFPanic(result2);                                                         \
   } while (0)
 
-#define PCF_VTABLE9(name, o1k, o1v, o2k, o2v, o3k, o3v, o4k, o4v)              \
-  PCFBaseVTable *name##VTable() {                                              \
-    static PCFBaseVTable k##name##VTable = {};                                 \
-    if (k##name##VTable.destructor == NULL) {                                  \
-      k##name##VTable = kPCFObjectVTable;                                      \
-      k##name##VTable.o1k = o1v;                                               \
-      k##name##VTable.o2k = o2v;                                               \
-      k##name##VTable.o3k = o3v;                                               \
-      k##name##VTable.o4k = o4v;                                               \
-    }                                                                          \
-    return &k##name##VTable;                                                   \
+// Defines name##VTable(). The table is filled in by the first call from any
+// thread, through PCFRunOnce, so the calls after it take no lock.
+#define PCF_VTABLE_ONCE(name, overrides)                                       \
+  static PCFBaseVTable GLUE3(k, name, VTable);                                 \
+  static void GLUE3(Init, name, VTable)(void) {                                \
+    PCFBaseVTable table = kPCFObjectVTable;                                    \
+    overrides                                                                  \
+    GLUE3(k, name, VTable) = table;                                            \
+  }                                                                            \
+  PCFBaseVTable *GLUE2(name, VTable)() {                                       \
+    static PCFOnce once = PCF_ONCE_INIT;                                       \
+    PCFRunOnce(&once, GLUE3(Init, name, VTable));                              \
+    return &GLUE3(k, name, VTable);                                            \
   }
 
+#define PCF_VTABLE9(name, o1k, o1v, o2k, o2v, o3k, o3v, o4k, o4v)              \
+  PCF_VTABLE_ONCE(name, table.o1k = o1v; table.o2k = o2v; table.o3k = o3v;     \
+                  table.o4k = o4v;)
+
 #define PCF_VTABLE7(name, o1k, o1v, o2k, o2v, o3k, o3v)                        \
-  PCFBaseVTable *name##VTable() {                                              \
-    static PCFBaseVTable k##name##VTable = {};                                 \
-    if (k##name##VTable.destructor == NULL) {                                  \
-      k##name##VTable = kPCFObjectVTable;                                      \
-      k##name##VTable.o1k = o1v;                                               \
-      k##name##VTable.o2k = o2v;                                               \
-      k##name##VTable.o3k = o3v;                                               \
-    }                                                                          \
-    return &k##name##VTable;                                                   \
-  }
+  PCF_VTABLE_ONCE(name, table.o1k = o1v; table.o2k = o2v; table.o3k = o3v;)
 
 #define PCF_VTABLE5(name, o1k, o1v, o2k, o2v)                                  \
-  PCFBaseVTable *name##VTable() {                                              \
-    static PCFBaseVTable k##name##VTable = {};                                 \
-    if (k##name##VTable.destructor == NULL) {                                  \
-      k##name##VTable = kPCFObjectVTable;                                      \
-      k##name##VTable.o1k = o1v;                                               \
-      k##name##VTable.o2k = o2v;                                               \
-    }                                                                          \
-    return &k##name##VTable;                                                   \
-  }
+  PCF_VTABLE_ONCE(name, table.o1k = o1v; table.o2k = o2v;)
 
 #define PCF_VTABLE3(name, o1k, o1v)                                            \
-  PCFBaseVTable *GLUE2(name, VTable)() {                                       \
-    static PCFBaseVTable GLUE3(k, name, VTable) = {};                          \
-    if (GLUE3(k, name, VTable).destructor == NULL) {                           \
-      GLUE3(k, name, VTable) = kPCFObjectVTable;                               \
-      GLUE3(k, name, VTable).o1k = o1v;                                        \
-    }                                                                          \
-    return &GLUE3(k, name, VTable);                                            \
-  }
+  PCF_VTABLE_ONCE(name, table.o1k = o1v;)
 
-#define PCF_VTABLE1(name)                                                      \
-  PCFBaseVTable *GLUE2(name, VTable)() {                                       \
-    static PCFBaseVTable GLUE3(k, name, VTable) = {};                          \
-    if (GLUE3(k, name, VTable).destructor == NULL) {                           \
-      GLUE3(k, name, VTable) = kPCFObjectVTable;                               \
-    }                                                                          \
-    return &GLUE3(k, name, VTable);                                            \
-  }
+#define PCF_VTABLE1(name) PCF_VTABLE_ONCE(name, )
 
-#define PCF_VTABLE(name, overrides)                                            \
-  PCFBaseVTable *name##VTable() {                                              \
-    static PCFBaseVTable table = {};                                           \
-    if (table.destructor == NULL) {                                            \
-      table = kPCFObjectVTable;                                                \
-      overrides                                                                \
-    }                                                                          \
-    return &table;                                                             \
-  }
+#define PCF_VTABLE(name, overrides) PCF_VTABLE_ONCE(name, overrides)
 
 #define RESULT_TYPE(name, type)                                                \
   typedef struct __##name##Result {                                            \
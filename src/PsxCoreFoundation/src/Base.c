@@ -1,6 +1,11 @@
 #include "Internal.h"
 #include "PsxCoreFoundation/String.h"
 #include <string.h>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
 
 ASSUME_NONNULL_BEGIN
 
@@ -21,12 +26,43 @@ PCFBaseVTable kPCFObjectVTable = {
     .hash = PCFBaseHash,
 };
 
+#if defined(_WIN32)
+static SRWLOCK PCFLocks[kPCFNumLocks] = {SRWLOCK_INIT, SRWLOCK_INIT};
+
+void PCFLock(PCFLockId lock) { AcquireSRWLockExclusive(&PCFLocks[lock]); }
+
+void PCFUnlock(PCFLockId lock) { ReleaseSRWLockExclusive(&PCFLocks[lock]); }
+
+static BOOL CALLBACK PCFRunOnceCallback(PINIT_ONCE once, PVOID init,
+                                       PVOID *context) {
+  ((void (*)(void))init)();
+  return TRUE;
+}
+
+void PCFRunOnce(PCFOnce *once, void (*init)(void)) {
+  InitOnceExecuteOnce((PINIT_ONCE)once, PCFRunOnceCallback, (PVOID)init, NULL);
+}
+#else
+static pthread_mutex_t PCFLocks[kPCFNumLocks] = {PTHREAD_MUTEX_INITIALIZER,
+                                                 PTHREAD_MUTEX_INITIALIZER};
+
+void PCFLock(PCFLockId lock) { pthread_mutex_lock(&PCFLocks[lock]); }
+
+void PCFUnlock(PCFLockId lock) { pthread_mutex_unlock(&PCFLocks[lock]); }
+
+void PCFRunOnce(PCFOnce *once, void (*init)(void)) { pthread_once(once, init); }
+#endif
+
+// Interned once, so that printing NULL objects does not go through the
+// interned strings lock every time.
+static PCFStringRef _Nullable PCFNullStringValue = NULL;
+static PCFOnce PCFNullStringOnce = PCF_ONCE_INIT;
+
+static void PCFNullStringInit(void) { PCFNullStringValue = PCFCSTR("NULL"); }
+
 static PCFStringRef PCFNullString() {
-  static PCFStringRef nullString = NULL;
-  if (nullString == NULL) {
-    nullString = PCFCSTR("NULL");
-  }
-  return nullString;
+  PCFRunOnce(&PCFNullStringOnce, PCFNullStringInit);
+  return (PCFStringRef)PCFNullStringValue;
 }
 
 void PCFBaseConstructor(PCFObject ref, uint32_t typeId) {
@@ -1,6 +1,6 @@
 #include "PsxCoreFoundation/Exception.h"
 
-volatile CEXCEPTION_FRAME_T CExceptionFrames[CEXCEPTION_NUM_ID] = { { 0 } };
+PCF_THREAD_LOCAL volatile CEXCEPTION_FRAME_T CExceptionFrames[CEXCEPTION_NUM_ID] = { { 0 } };
 
 //------------------------------------------------------------------------------------------
 //  Throw
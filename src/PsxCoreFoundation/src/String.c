@@ -5,6 +5,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <windows.h>
+#else
+#include <stdatomic.h>
+#endif
 
 ASSUME_NONNULL_BEGIN
 
@@ -37,7 +42,28 @@ typedef struct __PCFInternStringEntry {
 const size_t PCFInternedBuckets = 1009;
 static PCFInternStringEntry PCFInternedStrings[PCFInternedBuckets] = {};
 
-static PCFLogLevel PCFCurrentLogLevel = PCFLogDebug;
+// Read by every PCFLog call, so it is atomic rather than behind the log lock.
+#if defined(_MSC_VER) && !defined(__clang__)
+static volatile LONG PCFCurrentLogLevel = PCFLogDebug;
+
+static PCFLogLevel PCFGetLogLevel(void) {
+  return (PCFLogLevel)InterlockedCompareExchange(&PCFCurrentLogLevel, 0, 0);
+}
+
+static void PCFStoreLogLevel(PCFLogLevel level) {
+  InterlockedExchange(&PCFCurrentLogLevel, (LONG)level);
+}
+#else
+static _Atomic PCFLogLevel PCFCurrentLogLevel = PCFLogDebug;
+
+static PCFLogLevel PCFGetLogLevel(void) {
+  return atomic_load_explicit(&PCFCurrentLogLevel, memory_order_relaxed);
+}
+
+static void PCFStoreLogLevel(PCFLogLevel level) {
+  atomic_store_explicit(&PCFCurrentLogLevel, level, memory_order_relaxed);
+}
+#endif
 
 static PCFStringRef PCFStringToString(PCFObject ref) {
   return (PCFStringRef)ref;
@@ -192,7 +218,7 @@ static PCFStringRef PCFStringInternWithEntry(PCFInternStringEntry *entry,
   return PCFStringInternWithEntry(entry->next, str);
 }
 
-PCFStringRef PCFStringIntern(const char *str) {
+static PCFStringRef PCFStringInternLocked(const char *str) {
   uint32_t hash = kPCFDefaultHash((void *)str);
   size_t bucket = hash % PCFInternedBuckets;
   PCFInternStringEntry *entry = &PCFInternedStrings[bucket];
@@ -206,6 +232,13 @@ PCFStringRef PCFStringIntern(const char *str) {
   return PCFStringInternWithEntry(entry, str);
 }
 
+PCFStringRef PCFStringIntern(const char *str) {
+  PCFLock(PCFLockInternedStrings);
+  PCFStringRef result = PCFStringInternLocked(str);
+  PCFUnlock(PCFLockInternedStrings);
+  return result;
+}
+
 PCFStringRef PCFLogLevelName(PCFLogLevel name) {
   switch (name) {
   case PCFLogDebug:
@@ -219,19 +252,23 @@ PCFStringRef PCFLogLevelName(PCFLogLevel name) {
   }
 }
 
+// Lines logged from different threads are printed whole, one after another.
 void PCFLog(PCFLogLevel level, PCFStringRef format, ...) {
-  if (PCFCurrentLogLevel > level) {
+  if (PCFGetLogLevel() > level) {
     return;
   }
-  printf("[%s] ", PCFStringToCString(PCFLogLevelName(level)));
+  PCFStringRef levelName = PCFLogLevelName(level);
   va_list argp;
   va_start(argp, format);
   PCFStringRef formatted = PCFStringNewFromFormatVarargs(format, argp);
   va_end(argp);
-  printf("%s\n", PCFStringToCString(formatted));
+  PCFLock(PCFLockLog);
+  printf("[%s] %s\n", PCFStringToCString(levelName),
+         PCFStringToCString(formatted));
+  PCFUnlock(PCFLockLog);
   PCFRelease(formatted);
 }
 
-void PCFSetLogLevel(PCFLogLevel level) { PCFCurrentLogLevel = level; }
+void PCFSetLogLevel(PCFLogLevel level) { PCFStoreLogLevel(level); }
 
 ASSUME_NONNULL_END